@@ -41,6 +41,7 @@
  */
 
 #include "MainAppWindow.h"
+#include "SequencerHarness.h"
 
 
 //==============================================================================
@@ -94,12 +95,21 @@ class AppClass : public JUCEApplication
 			// So far, it just exists in memory as an empty pocket of potential waiting
 			// to burst into life as a program. Nothing yet exists to act or be displayed.
 			
+			// If we've been asked to test the sequencer (e.g. on a build machine), do that
+			// instead, without any windows, and quit with the result.
+			if (commandLine.contains (T("--headless-test")))
+			{
+				setApplicationReturnValue (SequencerHarness::run (commandLine));
+				quit();
+				return;
+			}
+			
 			// All we want to do here is create the main window. This instantiates an object
 			// of 'MainAppWindow' - which we have defined in MainAppWindow(.h/.cpp). The app's
 			// behaviour comes from that, so all we need is to bring it to life...
 			theMainWindow = new MainAppWindow();
 			// ... and plonk it onto the display...
-			theMainWindow->centreWithSize (300, 350);   // [*] (see below for a tip on this)
+			theMainWindow->centreWithSize (300, 650);   // [*] (see below for a tip on this)
 			// ... (of course making sure that it is visible!)
 			theMainWindow->setVisible (true);
 			
@@ -0,0 +1,295 @@
+/*
+ *  DrumSampler.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _DRUMSAMPLER_H_
+#define _DRUMSAMPLER_H_
+
+#include <juce/juce.h>
+
+/**
+ Plays one-shot drum samples from a fixed set of voices.
+
+ Each sound is read into memory up front and mapped to a MIDI note. Sounds can
+ be put in a choke group, and starting any sound in a group quickly fades out
+ everything else playing in that group, e.g. so a closed hi-hat cuts off an
+ open one.
+
+ noteOn() starts a sound straight away, so the caller decides which sample it
+ lands on by splitting its render() calls (see SequencerAudio). If all the
+ voices are busy the oldest one is stolen. Nothing here allocates or locks once
+ the sounds are loaded.
+ */
+class DrumSampler
+	{
+	public:
+		/** Construct a sampler with a fixed number of voices.
+		 */
+		DrumSampler (const int maxVoices_ = 32)
+			:	maxVoices (maxVoices_),
+				outputSampleRate (44100.0),
+				voiceCounter (0)
+		{
+			voices = new Voice [maxVoices];
+
+			for (int i = 0; i < maxVoices; i++)
+				voices[i].sound = -1;
+
+			for (int i = 0; i < 128; i++)
+				soundForNote[i] = -1;
+		}
+
+		~DrumSampler()
+		{
+			delete[] voices;
+		}
+
+		//==============================================================================
+		/** Load a sound file into memory and map it to a note, returning its index or -1 if it couldn't be read.
+
+		 Sounds with the same (non-zero) choke group cut each other off. This must be
+		 done before the sampler starts playing.
+		 */
+		int addSound (const File& file, const int note, const int chokeGroup = 0)
+		{
+			AudioFormatManager formatManager;
+			formatManager.registerBasicFormats();
+
+			AudioFormatReader* reader = formatManager.createReaderFor (file);
+
+			if (reader == 0)
+				return -1;
+
+			const int numSamples = (int) reader->lengthInSamples;
+			AudioSampleBuffer* buffer = new AudioSampleBuffer (2, numSamples);
+			buffer->readFromAudioReader (reader, 0, numSamples, 0, true, true);
+
+			Sound s;
+			s.sampleRate = reader->sampleRate;
+			s.chokeGroup = chokeGroup;
+
+			sounds.add (buffer);
+			soundInfo.add (s);
+			soundForNote [note & 127] = sounds.size() - 1;
+
+			delete reader;
+
+			return sounds.size() - 1;
+		}
+
+		/** Load the audio files in a directory for a set of notes, by name, returning the number that were loaded.
+
+		 Each note has a name, e.g. "kick" or "closed hat", and is given the file
+		 whose name (without its extension, and ignoring case) is that name, or
+		 failing that the first one, alphabetically, that has the name in it (so
+		 "808 Kick.wav" would do for "kick"). So adding or renaming a file only ever
+		 changes the sound it's for. A note with no file for it stays silent.
+		 chokeGroups has one entry for each note (or pass 0 for none).
+		 */
+		int loadDirectory (const File& directory, const char* const* names, const int* notes,
+						   const int* chokeGroups, const int numNotes)
+		{
+			OwnedArray<File> files;
+			directory.findChildFiles (files, File::findFiles, false, T("*.wav"));
+			directory.findChildFiles (files, File::findFiles, false, T("*.aif*"));
+
+			StringArray paths;
+
+			for (int i = 0; i < files.size(); i++)
+				paths.add (files[i]->getFullPathName());
+
+			paths.sort (true);
+
+			int numLoaded = 0;
+
+			for (int n = 0; n < numNotes; n++)
+			{
+				const String name (String (names[n]).toLowerCase());
+				int match = -1;
+
+				for (int i = 0; i < paths.size(); i++)
+				{
+					const String fileName (File (paths[i]).getFileNameWithoutExtension().toLowerCase());
+
+					if (fileName == name)
+					{
+						match = i;
+						break;
+					}
+
+					if (match < 0 && fileName.contains (name))
+						match = i;
+				}
+
+				if (match >= 0 && addSound (File (paths [match]), notes[n], chokeGroups != 0 ? chokeGroups[n] : 0) >= 0)
+					numLoaded++;
+			}
+
+			return numLoaded;
+		}
+
+		int getNumSounds() const throw()						{ return sounds.size(); }
+
+		/** Must be called before playing, when nothing else is using the sampler.
+		 */
+		void setSampleRate (const double newSampleRate)
+		{
+			outputSampleRate = newSampleRate;
+			allNotesOff();
+		}
+
+		//==============================================================================
+		/** Start the sound mapped to a note, if there is one (the audio thread only).
+		 */
+		void noteOn (const int note, const float velocity) throw()
+		{
+			const int sound = soundForNote [note & 127];
+
+			if (sound < 0)
+				return;
+
+			const int chokeGroup = soundInfo.getUnchecked (sound).chokeGroup;
+
+			if (chokeGroup != 0)
+			{
+				for (int i = 0; i < maxVoices; i++)
+				{
+					Voice& v = voices[i];
+
+					if (v.sound >= 0 && soundInfo.getUnchecked (v.sound).chokeGroup == chokeGroup && v.fadeStep == 0)
+						v.fadeStep = 1.0f / (float) jmax (1, roundDoubleToInt (outputSampleRate * chokeFadeMilliseconds / 1000.0));
+				}
+			}
+
+			Voice& v = voices [findVoiceToUse()];
+			v.sound = sound;
+			v.position = 0.0;
+			v.increment = soundInfo.getUnchecked (sound).sampleRate / outputSampleRate;
+			v.gain = velocity;
+			v.fade = 1.0f;
+			v.fadeStep = 0.0f;
+			v.startedAt = voiceCounter++;
+		}
+
+		/** Stop everything straight away.
+		 */
+		void allNotesOff() throw()
+		{
+			for (int i = 0; i < maxVoices; i++)
+				voices[i].sound = -1;
+		}
+
+		/** Add the next numSamples of every playing voice to the outputs, starting at startSample.
+		 */
+		void render (float** outputs, const int numOutputs, const int startSample, const int numSamples) throw()
+		{
+			if (numSamples <= 0)
+				return;
+
+			const int numChannels = jmin (2, numOutputs);
+
+			for (int v = 0; v < maxVoices; v++)
+			{
+				if (voices[v].sound >= 0)
+					renderVoice (voices[v], outputs, numChannels, startSample, numSamples);
+			}
+		}
+
+	private:
+		//==============================================================================
+		// how long a choked sound takes to fade out, which stops it clicking
+		enum { chokeFadeMilliseconds = 5 };
+
+		struct Sound
+		{
+			double sampleRate;
+			int chokeGroup;
+		};
+
+		struct Voice
+		{
+			int sound;			// -1 when the voice is free
+			double position;
+			double increment;
+			float gain;
+			float fade;			// 1 unless it's been choked, when it ramps down to 0..
+			float fadeStep;		// ..by this much each sample
+			int startedAt;
+		};
+
+		const int maxVoices;
+		Voice* voices;
+		OwnedArray<AudioSampleBuffer> sounds;
+		Array<Sound> soundInfo;
+		int soundForNote [128];
+		double outputSampleRate;
+		int voiceCounter;
+
+		int findVoiceToUse() const throw()
+		{
+			// use a free voice, or steal the one that's been playing longest
+			int best = 0;
+
+			for (int i = 0; i < maxVoices; i++)
+			{
+				if (voices[i].sound < 0)
+					return i;
+
+				if (voices[i].startedAt - voices[best].startedAt < 0)
+					best = i;
+			}
+
+			return best;
+		}
+
+		void renderVoice (Voice& v, float** outputs, const int numChannels,
+						  const int startSample, const int numSamples) throw()
+		{
+			const AudioSampleBuffer& sound = *sounds.getUnchecked (v.sound);
+			const int soundLength = sound.getNumSamples();
+			int numDone = numSamples;
+
+			for (int chan = 0; chan < numChannels; chan++)
+			{
+				if (outputs [chan] == 0)
+					continue;
+
+				const float* const src = sound.getSampleData (chan);
+				float* const dest = outputs [chan] + startSample;
+				double pos = v.position;
+				float fade = v.fade;
+
+				for (int i = 0; i < numSamples; i++)
+				{
+					const int index = (int) pos;
+
+					if (index >= soundLength - 1 || fade <= 0.0f)
+					{
+						numDone = i;
+						break;
+					}
+
+					// linear interpolation to cope with differing sample rates
+					const float alpha = (float) (pos - index);
+					dest[i] += v.gain * fade * (src[index] + alpha * (src[index + 1] - src[index]));
+					pos += v.increment;
+					fade -= v.fadeStep;
+				}
+			}
+
+			v.position += v.increment * numDone;
+			v.fade -= v.fadeStep * numDone;
+
+			if (numDone < numSamples || v.position >= soundLength - 1 || v.fade <= 0.0f)
+				v.sound = -1;
+		}
+
+		DrumSampler (const DrumSampler&);
+		const DrumSampler& operator= (const DrumSampler&);
+	};
+
+#endif//_DRUMSAMPLER_H_
@@ -0,0 +1,107 @@
+/*
+ *  EventTimeline.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _EVENTTIMELINE_H_
+#define _EVENTTIMELINE_H_
+
+#include <juce/juce.h>
+
+/**
+ One message in an EventTimeline.
+ */
+struct TimelineEvent
+{
+	int step;			// counting from the start of the song
+	uint8 data[3];
+	uint8 size;
+	uint8 output;		// which of the sequencer's outputs it goes to
+	uint16 delay;		// how long after the step it goes (for swing), in 65536ths of the step
+};
+
+/**
+ A whole song worked out in advance, as one sorted array of messages.
+
+ A SongCompiler builds these in the background, and the Sequencer plays them by
+ moving a cursor along the array, so each step costs nothing more than reading
+ the next few events. There's also an index of where each bar starts, so the
+ sequencer can jump into a new timeline at any bar without searching, and a
+ table of when each step happens (from the song's TempoMap), so it never has to
+ work out a tempo while it's playing.
+
+ Once it's been built a timeline never changes; an edit makes a new one, which
+ the sequencer swaps in at the next bar line.
+ */
+class EventTimeline
+	{
+	public:
+		enum { stepsPerBar = 16 };
+
+		/** Create an empty timeline with room for a number of events.
+		 */
+		EventTimeline (const int numBars_, const int numEvents_)
+			:	numBars (numBars_),
+				numEvents (numEvents_)
+		{
+			events = new TimelineEvent [jmax (1, numEvents)];
+			barStarts = new int [numBars + 1];
+			zeromem (barStarts, (numBars + 1) * sizeof (int));
+			stepTimes = new int64 [getNumSteps() + 1];
+			zeromem (stepTimes, (getNumSteps() + 1) * sizeof (int64));
+		}
+
+		~EventTimeline()
+		{
+			delete[] events;
+			delete[] barStarts;
+			delete[] stepTimes;
+		}
+
+		//==============================================================================
+		int getNumBars() const throw()								{ return numBars; }
+		int getNumSteps() const throw()								{ return numBars * stepsPerBar; }
+		int getNumEvents() const throw()							{ return numEvents; }
+
+		/** The events, in the order they're played.
+
+		 The note-offs at the very end of the song have step == getNumSteps(), and
+		 go out with the first step when it loops round.
+		 */
+		const TimelineEvent* getEvents() const throw()				{ return events; }
+
+		/** The index of the first event on a bar (or numEvents, if there aren't any after it).
+		 */
+		int getBarStart (const int bar) const throw()				{ return barStarts [bar]; }
+
+		/** When a step happens, in nanoseconds from the start of the song.
+
+		 This goes up to getNumSteps(), which is when the song ends.
+		 */
+		int64 getStepTime (const int step) const throw()			{ return stepTimes [step]; }
+
+		/** How long a step lasts, in nanoseconds.
+		 */
+		int64 getStepLength (const int step) const throw()			{ return stepTimes [step + 1] - stepTimes [step]; }
+
+		//==============================================================================
+		/** For the SongCompiler to fill in.
+		 */
+		TimelineEvent* getEventsForWriting() throw()				{ return events; }
+		void setBarStart (const int bar, const int eventIndex) throw()	{ barStarts [bar] = eventIndex; }
+		int64* getStepTimesForWriting() throw()						{ return stepTimes; }
+
+	private:
+		const int numBars, numEvents;
+		TimelineEvent* events;
+		int* barStarts;
+		int64* stepTimes;
+
+		EventTimeline (const EventTimeline&);
+		const EventTimeline& operator= (const EventTimeline&);
+	};
+
+#endif//_EVENTTIMELINE_H_
@@ -0,0 +1,99 @@
+/*
+ *  Float4.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _FLOAT4_H_
+#define _FLOAT4_H_
+
+#include <juce/juce.h>
+
+// SSE is used for the synth's voices wherever the compiler supports it
+#if (defined (__SSE__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 1)) && ! defined (SEQUENCER_NO_SSE)
+ #include <xmmintrin.h>
+ #define SEQUENCER_USE_SSE 1
+#endif
+
+/**
+ Four floats which are worked on together, with SSE if it's available.
+
+ This lets the DSP code be written once, as if for one value, and still do four
+ at a time. Comparisons give a mask (all bits set where true) for select().
+
+ Anything holding these must be 16-byte aligned, which new[] doesn't promise on
+ every platform, so allocate a little extra and round the pointer up.
+ */
+struct Float4
+{
+#if SEQUENCER_USE_SSE
+	__m128 v;
+
+	static const Float4 make (const __m128 v_) throw()						{ Float4 f; f.v = v_; return f; }
+	static const Float4 broadcast (const float x) throw()					{ return make (_mm_set1_ps (x)); }
+
+	const Float4 operator+ (const Float4& other) const throw()				{ return make (_mm_add_ps (v, other.v)); }
+	const Float4 operator- (const Float4& other) const throw()				{ return make (_mm_sub_ps (v, other.v)); }
+	const Float4 operator* (const Float4& other) const throw()				{ return make (_mm_mul_ps (v, other.v)); }
+
+	const Float4 isLessThan (const Float4& other) const throw()				{ return make (_mm_cmplt_ps (v, other.v)); }
+	const Float4 isGreaterOrEqual (const Float4& other) const throw()		{ return make (_mm_cmpge_ps (v, other.v)); }
+
+	/** Where mask is set this takes a, otherwise b. */
+	static const Float4 select (const Float4& mask, const Float4& a, const Float4& b) throw()
+	{
+		return make (_mm_or_ps (_mm_and_ps (mask.v, a.v), _mm_andnot_ps (mask.v, b.v)));
+	}
+
+	/** Where mask is set this takes a, otherwise zero. */
+	static const Float4 selectOrZero (const Float4& mask, const Float4& a) throw()
+	{
+		return make (_mm_and_ps (mask.v, a.v));
+	}
+
+	float& operator[] (const int lane) throw()								{ return ((float*) &v) [lane]; }
+	float operator[] (const int lane) const throw()							{ return ((const float*) &v) [lane]; }
+#else
+	float v[4];
+
+	static const Float4 broadcast (const float x) throw()					{ Float4 f; f.v[0] = f.v[1] = f.v[2] = f.v[3] = x; return f; }
+
+	const Float4 operator+ (const Float4& other) const throw()				{ Float4 f; for (int i = 0; i < 4; i++) f.v[i] = v[i] + other.v[i]; return f; }
+	const Float4 operator- (const Float4& other) const throw()				{ Float4 f; for (int i = 0; i < 4; i++) f.v[i] = v[i] - other.v[i]; return f; }
+	const Float4 operator* (const Float4& other) const throw()				{ Float4 f; for (int i = 0; i < 4; i++) f.v[i] = v[i] * other.v[i]; return f; }
+
+	// (the masks are just 0 or 1 here, which select() treats the same way)
+	const Float4 isLessThan (const Float4& other) const throw()				{ Float4 f; for (int i = 0; i < 4; i++) f.v[i] = v[i] < other.v[i] ? 1.0f : 0.0f; return f; }
+	const Float4 isGreaterOrEqual (const Float4& other) const throw()		{ Float4 f; for (int i = 0; i < 4; i++) f.v[i] = v[i] >= other.v[i] ? 1.0f : 0.0f; return f; }
+
+	static const Float4 select (const Float4& mask, const Float4& a, const Float4& b) throw()
+	{
+		Float4 f;
+		for (int i = 0; i < 4; i++)
+			f.v[i] = mask.v[i] != 0 ? a.v[i] : b.v[i];
+		return f;
+	}
+
+	static const Float4 selectOrZero (const Float4& mask, const Float4& a) throw()
+	{
+		Float4 f;
+		for (int i = 0; i < 4; i++)
+			f.v[i] = mask.v[i] != 0 ? a.v[i] : 0.0f;
+		return f;
+	}
+
+	float& operator[] (const int lane) throw()								{ return v [lane]; }
+	float operator[] (const int lane) const throw()							{ return v [lane]; }
+#endif
+
+	/** The four lanes added together. */
+	float sum() const throw()
+	{
+		const Float4& f = *this;
+		return (f[0] + f[1]) + (f[2] + f[3]);
+	}
+};
+
+#endif//_FLOAT4_H_
@@ -0,0 +1,99 @@
+/*
+ *  LockFreeSnapshot.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _LOCKFREESNAPSHOT_H_
+#define _LOCKFREESNAPSHOT_H_
+
+#include <juce/juce.h>
+
+#if JUCE_WIN32
+ #include <intrin.h>
+ #pragma intrinsic (_InterlockedExchange, _ReadWriteBarrier)
+ #define lockFreeExchange(variable, newValue)	((int) _InterlockedExchange ((volatile long*) &(variable), (long) (newValue)))
+ #ifdef _WIN64
+  #pragma intrinsic (_InterlockedExchangePointer)
+  #define lockFreeExchangePointer(variable, newValue)	_InterlockedExchangePointer ((void* volatile*) &(variable), (void*) (newValue))
+ #else
+  #define lockFreeExchangePointer(variable, newValue)	((void*) _InterlockedExchange ((volatile long*) &(variable), (long) (newValue)))
+ #endif
+ #ifndef lockFreeMemoryBarrier
+  #define lockFreeMemoryBarrier()				_ReadWriteBarrier()
+ #endif
+#else
+ #define lockFreeExchange(variable, newValue)	__sync_lock_test_and_set (&(variable), (newValue))
+ #define lockFreeExchangePointer(variable, newValue)	((void*) __sync_lock_test_and_set (&(variable), (newValue)))
+ #ifndef lockFreeMemoryBarrier
+  #define lockFreeMemoryBarrier()				__sync_synchronize()
+ #endif
+#endif
+
+/**
+ Passes the latest copy of a small value type from one thread to another
+ without locking.
+
+ This is a triple buffer: the writer fills a spare copy and swaps it into the
+ middle, and the reader swaps the middle out whenever there's something new
+ there. Neither side ever waits for the other or sees a half-written value, and
+ the reader just gets the newest value, skipping any it didn't get round to.
+
+ There must only be one thread publishing and one thread reading.
+ */
+template <class ValueType>
+class LockFreeSnapshot
+	{
+	public:
+		/** Create a snapshot holding an initial value.
+		 */
+		LockFreeSnapshot (const ValueType& initialValue = ValueType())
+			:	writeIndex (0),
+				middleIndex (1),
+				readIndex (2)
+		{
+			for (int i = 0; i < 3; i++)
+				values[i] = initialValue;
+		}
+
+		/** Make a new value available to the reader (writer thread only).
+		 */
+		void publish (const ValueType& newValue) throw()
+		{
+			values [writeIndex] = newValue;
+
+			// make sure the copy is finished before the reader can get at it
+			lockFreeMemoryBarrier();
+			writeIndex = lockFreeExchange (middleIndex, writeIndex | newValueFlag) & indexMask;
+		}
+
+		/** Get the most recently published value (reader thread only).
+
+		 The reference stays valid, and the value won't change, until the next call.
+		 */
+		const ValueType& read() throw()
+		{
+			if ((middleIndex & newValueFlag) != 0)
+			{
+				readIndex = lockFreeExchange (middleIndex, readIndex) & indexMask;
+				lockFreeMemoryBarrier();
+			}
+
+			return values [readIndex];
+		}
+
+	private:
+		enum { indexMask = 3, newValueFlag = 4 };
+
+		ValueType values[3];
+		int writeIndex;
+		volatile int middleIndex;
+		int readIndex;
+
+		LockFreeSnapshot (const LockFreeSnapshot&);
+		const LockFreeSnapshot& operator= (const LockFreeSnapshot&);
+	};
+
+#endif//_LOCKFREESNAPSHOT_H_
@@ -0,0 +1,95 @@
+/*
+ *  LoopbackMidiDestination.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _LOOPBACKMIDIDESTINATION_H_
+#define _LOOPBACKMIDIDESTINATION_H_
+
+#include <juce/juce.h>
+#include "MidiDestination.h"
+#include "SequencerClock.h"
+
+/**
+ A stand-in for a MIDI device which records everything sent to it.
+
+ Each message is stamped with the SequencerClock time it arrived and the time it
+ was due, so the sequencer can be tested without any MIDI hardware. There's room
+ for a fixed number of messages, allocated up front; any more than that are only
+ counted.
+
+ The messages can be read once the sender has been stopped.
+ */
+class LoopbackMidiDestination : public MidiDestination
+	{
+	public:
+		/** One message, as it was received.
+		 */
+		struct ReceivedMessage
+		{
+			int64 dueTime;
+			int64 receivedTime;
+			uint8 data[4];
+			int size;
+		};
+
+		LoopbackMidiDestination (const int maxMessages_)
+			:	maxMessages (maxMessages_),
+				numReceived (0)
+		{
+			messages = new ReceivedMessage [maxMessages];
+		}
+
+		~LoopbackMidiDestination()
+		{
+			delete[] messages;
+		}
+
+		//==============================================================================
+		void sendMessageNow (const MidiMessage& message, const int64 dueTime)
+		{
+			const int64 now = SequencerClock::getNanoseconds();
+
+			if (numReceived < maxMessages)
+			{
+				ReceivedMessage& m = messages [numReceived];
+				m.dueTime = dueTime;
+				m.receivedTime = now;
+				m.size = jmin ((int) sizeof (m.data), message.getRawDataSize());
+				memcpy (m.data, message.getRawData(), m.size);
+			}
+
+			numReceived++;
+		}
+
+		/** Forget everything received so far (only while nothing is sending).
+		 */
+		void clear() throw()								{ numReceived = 0; }
+
+		/** The number of messages received, including any that there wasn't room to keep.
+		 */
+		int getNumReceived() const throw()					{ return numReceived; }
+
+		/** The number of messages that were kept.
+		 */
+		int getNumMessages() const throw()					{ return jmin (numReceived, maxMessages); }
+
+		const ReceivedMessage& getMessage (const int index) const throw()
+		{
+			jassert (index >= 0 && index < getNumMessages());
+			return messages [index];
+		}
+
+	private:
+		ReceivedMessage* messages;
+		const int maxMessages;
+		volatile int numReceived;
+
+		LoopbackMidiDestination (const LoopbackMidiDestination&);
+		const LoopbackMidiDestination& operator= (const LoopbackMidiDestination&);
+	};
+
+#endif//_LOOPBACKMIDIDESTINATION_H_
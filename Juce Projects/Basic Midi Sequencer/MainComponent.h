@@ -2,22 +2,37 @@
 #define _MAINCOMPONENT_H_
 
 #include <juce/juce.h>
-#include "MyRadioButtons.h"
+#include "StepGridComponent.h"
+#include "SequencerClock.h"
+#include "SequencerPattern.h"
+#include "Sequencer.h"
+#include "SequencerAudio.h"
+#include "OfflineRenderer.h"
+#include "SequencerSong.h"
+#include "SongCompiler.h"
+#include "MidiClockFollower.h"
+#include "PatternBank.h"
 
 // uint32 seems to be defined in multiple places, this is a hack for now..
 #define uint32 JUCE_NAMESPACE::uint32
 
+// where the built-in drums' samples are, relative to the app; each row's is the file
+// named after it ("kick.wav", "snare.wav", "closed hat.wav" and "open hat.wav")
+#define DRUMS_DIRECTORY "../../../drums/"
+
 class MainComponent  :	public Component,
 						public ButtonListener,
+						public StepGridListener,
 						public ComboBoxListener,
 						public SliderListener,
 						public LabelListener,
-						public Thread
+						public Timer
 	{
 	private:
 		StringArray midiDevices;
-		MidiOutput* midiOutput;
-		ComboBox* midiOutputSelector;
+		ComboBox* drumsOutputSelector;
+		ComboBox* synthOutputSelector;
+		Label* outputStatus;
 		TextButton* play;
 		TextButton* stop;
 		Array<Label*> noteVals;
@@ -27,14 +42,95 @@ class MainComponent  :	public Component,
 		Slider* rateSlider;
 		Slider* synthVol;
 		Slider* stepVol;
+		Slider* stepSwing;
+		Slider* synthSwing;
+		Label* swingLabel;
+		Slider* stepGate;
+		Slider* synthGate;
+		Label* gateLabel;
 		Label* text;
 		Label* volumeLabel;
-		Array<int> noteSeq;
-		int	index;
+		Label* timingLabel;
+		TextButton* exportTiming;
+		TextButton* exportMidi;
+		ToggleButton* internalSynth;
+		ToggleButton* internalDrums;
+		ComboBox* patternSelector;
+		Label* songChain;
+		ToggleButton* songMode;
+		ToggleButton* sendClock;
+		ToggleButton* followClock;
+		StringArray midiInputDevices;
+		MidiInput* midiInput;
+		ComboBox* midiInputSelector;
+		ToggleButton* record;
+		Slider* quantiseStrength;
+		Label* quantiseLabel;
+		TextButton* loadBank;
+		TextButton* saveBank;
+		TextButton* exportXml;
+		Label* bankLabel;
+		Slider* bankSlider;
+		ToggleButton* realtime;
+		Label* schedulingLabel;
 		int rate;
 		int i;
 		
-		Array<MyRadioButtons*> stepSequencer;
+		StepGridComponent* stepGrid;
+		
+		// the size of the grid of steps, and the drum sounds for its rows: kick, snare, closed hat, open hat
+		enum { numDrumRows = 4, numGridSteps = 16 };
+		
+		// the drums play on the sequencer's first output, and the synth on its second (unless it's
+		// chosen the same device as the drums, when it shares theirs); each has its own sender
+		// thread, so a slow device only holds itself up
+		enum { drumsOutput = 0, synthOutput = 1, numOutputs = 2 };
+		MidiOutput* midiOutputs[numOutputs];
+		int outputDevices[numOutputs];
+		
+		// the MIDI channels the drums and the synth play on (and are recorded from)
+		enum { drumsChannel = 1, synthChannel = 2 };
+
+		int drumNotes[numDrumRows];
+		
+		// the built-in synth and drums, which the sequencer plays as well as the MIDI output
+		AudioDeviceManager audioDeviceManager;
+		SequencerAudio sequencerAudio;
+		
+		// the sequencer runs on its own thread, and the GUI gives it a new pattern whenever
+		// anything changes; the timer follows it to move the playhead on the display
+		Sequencer sequencer;
+		int displayedStep;
+		
+		// the grid shows one of the song's patterns, and the song is built into a timeline
+		// in the background whenever it changes, for the sequencer to play in song mode
+		SequencerSong song;
+		SongCompiler songCompiler;
+		int currentPattern;
+		String songText;
+		
+		// a pattern for building a new one in before it's handed on (see SequencerSong for why it's on the heap)
+		SequencerPattern* scratchPattern;
+		
+		// the pattern bank that's open (if any), which the sequencer plays the bank slider's pattern
+		// straight out of, and the ones it's replaced, which it may still be playing until it stops
+		PatternBank* bank;
+		Array<PatternBank*> retiredBanks;
+		
+		// the clock coming in from the MIDI input, which the sequencer can follow instead of its own tempo
+		MidiClockFollower clockFollower;
+		
+		// the notes coming in from the MIDI input, which can be recorded into the grid (the clock
+		// messages are passed on to the follower), and how far after its step each note of the
+		// grid goes if it was recorded late, in 256ths of a step
+		MidiRecorder recorder;
+		uint8 stepDelays[numDrumRows + 1][numGridSteps];
+		
+		// each drum step's ratchets and chance (see SequencerPattern), set from its menu, and each
+		// step's nudge, set from the menu or by recording a note early (the synth's too)
+		uint8 stepRatchets[numDrumRows][numGridSteps];
+		uint8 stepChances[numDrumRows][numGridSteps];
+		int8 stepNudges[numDrumRows + 1][numGridSteps];
 		
 		
 	public:
@@ -44,10 +140,14 @@ class MainComponent  :	public Component,
 		/** Create our main component which does all of the app's work.
 		 */
 		MainComponent () 
-			:	Thread(T("Sequencer")),
-				midiOutput(0),
-				index(0),
-				rate(125)
+			:	midiInput(0),
+				rate(125),
+				displayedStep(-1),
+				songCompiler(sequencer),
+				currentPattern(0),
+				songText(T("1x4")),
+				scratchPattern(new SequencerPattern()),
+				bank(0)
 		{		
 			
 			// simple sequencing example,  using a thread
@@ -55,19 +155,32 @@ class MainComponent  :	public Component,
 			// get a list of our MIDI output devices
 			midiDevices = MidiOutput::getDevices();
 			
-			// create a combo box (menu) component
-			addAndMakeVisible(midiOutputSelector = new ComboBox("MIDI Output Selector"));
-			midiOutputSelector->setBounds(10, 10, 270, 20);
-			midiOutputSelector->addListener(this);
+			// create a combo box (menu) component for the drums' output, and one for the synth's
+			addAndMakeVisible(drumsOutputSelector = new ComboBox("Drums MIDI Output Selector"));
+			drumsOutputSelector->setBounds(10, 10, 135, 20);
+			drumsOutputSelector->addListener(this);
 			
-			// populate the menu with our MIDI device names
+			addAndMakeVisible(synthOutputSelector = new ComboBox("Synth MIDI Output Selector"));
+			synthOutputSelector->setBounds(145, 10, 135, 20);
+			synthOutputSelector->addListener(this);
+			
+			// populate the menus with our MIDI device names
 			for(i = 0; i < midiDevices.size(); i++)
 			{
-				midiOutputSelector->addItem(midiDevices[i], i+1);
+				drumsOutputSelector->addItem(midiDevices[i], i+1);
+				synthOutputSelector->addItem(midiDevices[i], i+1);
 			}
 			
-			// choose the first item 1 (note that the first item is not 0 in this case for combo boxes)
-			midiOutputSelector->setSelectedId(1, false);
+			// choose the first item 1 (note that the first item is not 0 in this case for combo boxes),
+			// and open it once everything's been set up, further down
+			drumsOutputSelector->setSelectedId(1, true);
+			synthOutputSelector->setSelectedId(1, true);
+			
+			for(i = 0; i < numOutputs; i++)
+			{
+				midiOutputs[i] = 0;
+				outputDevices[i] = -1;
+			}
 			
 			// play button
 			addAndMakeVisible(play = new TextButton(T("Play")));
@@ -130,6 +243,7 @@ class MainComponent  :	public Component,
 			synthVol->setRange(0, 1, 0.001);
 			synthVol->setSkewFactor(0.9);
 			synthVol->setValue(1);
+			synthVol->addListener(this);
 			
 			addAndMakeVisible(stepVol = new Slider(T("Step Sequencer Volume")));
 			stepVol->setBounds(145, 270, 135, 10);
@@ -137,6 +251,7 @@ class MainComponent  :	public Component,
 			stepVol->setRange(0, 1, 0.001);
 			stepVol->setSkewFactor(0.9);
 			stepVol->setValue(1);
+			stepVol->addListener(this);
 			
 			// Rate slider
 			addAndMakeVisible(rateSlider = new Slider(T("Rate Slider")));
@@ -144,68 +259,260 @@ class MainComponent  :	public Component,
 			rateSlider->setRange(60, 180, 1);
 			rateSlider->setTextBoxStyle(Slider::TextBoxLeft, false, 30, 20);
 			rateSlider->setValue(180);
+			rateSlider->addListener(this);
 			
 			// some text for our status
 			addAndMakeVisible(text = new Label(T("Text"),T("Ready...")));
-			text->setBounds(10, 100, 270, 20);
+			text->setBounds(10, 100, 80, 20);
+			
+			// how late the messages are going out, and a button to save the figures
+			addAndMakeVisible(timingLabel = new Label(T("Timing"), String::empty));
+			timingLabel->setBounds(90, 100, 190, 20);
+			timingLabel->setFont(Font(11.0f));
+			
+			addAndMakeVisible(exportTiming = new TextButton(T("Export Timing...")));
+			exportTiming->setBounds(10, 320, 135, 20);
+			exportTiming->setConnectedEdges(2);
+			exportTiming->addButtonListener(this);
+			
+			// and one to write the pattern out as a MIDI file
+			addAndMakeVisible(exportMidi = new TextButton(T("Export MIDI...")));
+			exportMidi->setBounds(145, 320, 135, 20);
+			exportMidi->setConnectedEdges(1);
+			exportMidi->addButtonListener(this);
+			
+			// the melody can be played by the built-in synth as well as (or instead of) the MIDI output
+			addAndMakeVisible(internalSynth = new ToggleButton(T("Play the synth through the audio device")));
+			internalSynth->setBounds(10, 345, 270, 20);
+			internalSynth->setToggleState(true, false);
+			internalSynth->addButtonListener(this);
+			
+			// ..and the same for the drums
+			addAndMakeVisible(internalDrums = new ToggleButton(T("Play the drums through the audio device")));
+			internalDrums->setBounds(10, 370, 270, 20);
+			internalDrums->setToggleState(true, false);
+			internalDrums->addButtonListener(this);
+			
+			// swing for the drums and the synth, which pushes back every other step
+			addAndMakeVisible(swingLabel = new Label(T("Swing"), T("Swing:")));
+			swingLabel->setBounds(10, 420, 50, 20);
+			
+			addAndMakeVisible(stepSwing = new Slider(T("Step Sequencer Swing")));
+			stepSwing->setBounds(60, 425, 105, 10);
+			stepSwing->setTextBoxStyle(Slider::NoTextBox, false, 0, 0);
+			stepSwing->setRange(0, SequencerTrack::maxSwingPercent / 100.0, 0.01);
+			stepSwing->setValue(0);
+			stepSwing->addListener(this);
+			
+			addAndMakeVisible(synthSwing = new Slider(T("Synthesizer Swing")));
+			synthSwing->setBounds(175, 425, 105, 10);
+			synthSwing->setTextBoxStyle(Slider::NoTextBox, false, 0, 0);
+			synthSwing->setRange(0, SequencerTrack::maxSwingPercent / 100.0, 0.01);
+			synthSwing->setValue(0);
+			synthSwing->addListener(this);
+			
+			// which of the song's patterns is on the grid, the order they're played in, and
+			// whether to play the song or just the grid
+			addAndMakeVisible(patternSelector = new ComboBox(T("Pattern Selector")));
+			patternSelector->setBounds(10, 395, 90, 20);
+			
+			for(i = 0; i < SequencerSong::maxPatterns; i++)
+				patternSelector->addItem(T("Pattern ") + String(i + 1), i + 1);
+			
+			patternSelector->setSelectedId(1, true);
+			patternSelector->addListener(this);
+			
+			addAndMakeVisible(songChain = new Label(T("Song"), songText));
+			songChain->setBounds(105, 395, 115, 20);
+			songChain->setEditable(true);
+			songChain->setColour(Label::backgroundColourId, Colours::white);
+			songChain->addListener(this);
+			
+			addAndMakeVisible(songMode = new ToggleButton(T("Song")));
+			songMode->setBounds(225, 395, 55, 20);
+			songMode->addButtonListener(this);
+			
+			// MIDI clock: sending ours to the output, or following one from an input
+			addAndMakeVisible(sendClock = new ToggleButton(T("Send MIDI clock")));
+			sendClock->setBounds(10, 445, 135, 20);
+			sendClock->addButtonListener(this);
+			
+			addAndMakeVisible(followClock = new ToggleButton(T("Follow MIDI clock")));
+			followClock->setBounds(145, 445, 135, 20);
+			followClock->addButtonListener(this);
+			
+			addAndMakeVisible(midiInputSelector = new ComboBox(T("MIDI Input Selector")));
+			midiInputSelector->setBounds(10, 470, 270, 20);
+			midiInputSelector->addListener(this);
+			
+			midiInputDevices = MidiInput::getDevices();
+			recorder.setForwardTo(&clockFollower);
+			zeromem(stepDelays, sizeof(stepDelays));
+			zeromem(stepRatchets, sizeof(stepRatchets));
+			zeromem(stepChances, sizeof(stepChances));
+			zeromem(stepNudges, sizeof(stepNudges));
+			
+			for(i = 0; i < midiInputDevices.size(); i++)
+				midiInputSelector->addItem(midiInputDevices[i], i+1);
+			
+			midiInputSelector->setSelectedId(1, false);
+			
+			// how long the drums' and the synth's notes last, in steps (the synth plays every other
+			// step, so 2 is legato for it, and more ties its notes over)
+			addAndMakeVisible(gateLabel = new Label(T("Gate"), T("Gate:")));
+			gateLabel->setBounds(10, 490, 50, 20);
+			
+			addAndMakeVisible(stepGate = new Slider(T("Step Sequencer Gate")));
+			stepGate->setBounds(60, 495, 105, 10);
+			stepGate->setTextBoxStyle(Slider::NoTextBox, false, 0, 0);
+			stepGate->setRange(0.1, 4.0, 0.05);
+			stepGate->setValue(1.0);
+			stepGate->addListener(this);
+			
+			addAndMakeVisible(synthGate = new Slider(T("Synthesizer Gate")));
+			synthGate->setBounds(175, 495, 105, 10);
+			synthGate->setTextBoxStyle(Slider::NoTextBox, false, 0, 0);
+			synthGate->setRange(0.1, 4.0, 0.05);
+			synthGate->setValue(1.0);
+			synthGate->addListener(this);
+			
+			// how each output's queue is doing
+			addAndMakeVisible(outputStatus = new Label(T("Output Status"), String::empty));
+			outputStatus->setBounds(10, 520, 270, 20);
+			
+			// recording from the MIDI input, and how hard the notes are pulled onto the steps
+			addAndMakeVisible(record = new ToggleButton(T("Record")));
+			record->setBounds(10, 545, 80, 20);
+			record->addButtonListener(this);
+			
+			addAndMakeVisible(quantiseLabel = new Label(T("Quantise"), T("Quantise:")));
+			quantiseLabel->setBounds(95, 545, 65, 20);
+			
+			addAndMakeVisible(quantiseStrength = new Slider(T("Quantise Strength")));
+			quantiseStrength->setBounds(160, 550, 120, 10);
+			quantiseStrength->setTextBoxStyle(Slider::NoTextBox, false, 0, 0);
+			quantiseStrength->setRange(0, 1, 0.01);
+			quantiseStrength->setValue(1);
+			
+			// saving and loading the song's patterns, and picking one from a bank to play from the next bar
+			addAndMakeVisible(loadBank = new TextButton(T("Load Bank...")));
+			loadBank->setBounds(10, 570, 90, 20);
+			loadBank->setConnectedEdges(2);
+			loadBank->addButtonListener(this);
+			
+			addAndMakeVisible(saveBank = new TextButton(T("Save Bank...")));
+			saveBank->setBounds(100, 570, 90, 20);
+			saveBank->setConnectedEdges(3);
+			saveBank->addButtonListener(this);
+			
+			addAndMakeVisible(exportXml = new TextButton(T("Export XML...")));
+			exportXml->setBounds(190, 570, 90, 20);
+			exportXml->setConnectedEdges(1);
+			exportXml->addButtonListener(this);
+			
+			addAndMakeVisible(bankLabel = new Label(T("Bank"), T("Bank:")));
+			bankLabel->setBounds(10, 595, 50, 20);
+			
+			addAndMakeVisible(bankSlider = new Slider(T("Bank Pattern")));
+			bankSlider->setBounds(60, 595, 220, 20);
+			bankSlider->setSliderStyle(Slider::IncDecButtons);
+			bankSlider->setTextBoxStyle(Slider::TextBoxLeft, false, 60, 20);
+			bankSlider->setRange(1, 1, 1);
+			bankSlider->setEnabled(false);
+			bankSlider->addListener(this);
+			
+			// real-time scheduling for the timing threads, and what they actually got
+			addAndMakeVisible(realtime = new ToggleButton(T("Real-time")));
+			realtime->setBounds(10, 620, 100, 20);
+			realtime->addButtonListener(this);
+			
+			addAndMakeVisible(schedulingLabel = new Label(T("Scheduling"), String::empty));
+			schedulingLabel->setBounds(110, 620, 170, 20);
+			schedulingLabel->setFont(Font(11.0f));
 			
 			// Step Sequencer buttons
-			for(i = 0; i < 4; i++)
+			drumNotes[0] = 35;
+			drumNotes[1] = 38;
+			drumNotes[2] = 42;
+			drumNotes[3] = 46;
+			
+			// the hats are in the same choke group, so a closed hat cuts off an open one
+			const char* const drumNames[numDrumRows] = { "kick", "snare", "closed hat", "open hat" };
+			const int chokeGroups[numDrumRows] = { 0, 0, 1, 1 };
+			File appDirectory = File::getSpecialLocation(File::currentApplicationFile).getParentDirectory();
+			File drumsDirectory = appDirectory.getChildFile(T(DRUMS_DIRECTORY));
+			
+			DBG_PRINTF(( String("Drums Directory: ") << drumsDirectory.getFullPathName() ));
+			
+			if(sequencerAudio.getDrums().loadDirectory(drumsDirectory, drumNames, drumNotes, chokeGroups, numDrumRows) == 0)
 			{
-				stepSequencer.add(new MyRadioButtons(16));
-				addAndMakeVisible(stepSequencer[i]);
+				internalDrums->setToggleState(false, false);
+				internalDrums->setEnabled(false);
+				sequencerAudio.setDrumsEnabled(false);
 			}
+			
+			addAndMakeVisible(stepGrid = new StepGridComponent(numDrumRows, numGridSteps));
+			
+			// we need to know when the steps change so we can update the pattern
+			stepGrid->addListener(this);
 		
 			
-			// add some notes to the sequence, noteSeq is an Array<int>
+			// Fill sliders with note values, the synth plays one on every other step
 			// Note sequence is: 60, 62, 64, 65, 67, 65, 64, 62
-//			noteSeq.add(60);
-//			noteSeq.add(62);
-//			noteSeq.add(64);
-//			noteSeq.add(65);
-//			noteSeq.add(67);
-//			noteSeq.add(65);
-//			noteSeq.add(64);
-//			noteSeq.add(62);
-//			noteSeq.add(60);
-//			noteSeq.add(62);
-//			noteSeq.add(64);
-//			noteSeq.add(65);
-//			noteSeq.add(67);
-//			noteSeq.add(65);
-//			noteSeq.add(64);
-//			noteSeq.add(62);
-			
-			// This is a bit of a hack as only every odd note gets played
-			// This means that the drum sequencer has twice the resolution of the 
-			// synth
-			
-			noteSeq.add(60);
-			noteSeq.add(0);
-			noteSeq.add(62);
-			noteSeq.add(0);
-			noteSeq.add(64);
-			noteSeq.add(0);
-			noteSeq.add(65);
-			noteSeq.add(0);
-			noteSeq.add(67);
-			noteSeq.add(0);
-			noteSeq.add(65);
-			noteSeq.add(0);
-			noteSeq.add(64);
-			noteSeq.add(0);
-			noteSeq.add(62);
-			
-			
-			// Fill sliders with note values
+			const int initialNotes[8] = { 60, 62, 64, 65, 67, 65, 64, 62 };
+			
 			for(i = 0; i < 8; i++)
 			{
-				notes[i]->setValue(noteSeq[(i*2)]);
+				notes[i]->setValue(initialNotes[i]);
+			}
+			
+			// all the song's patterns start off the same as the grid
+			fillPattern(*scratchPattern);
+			
+			for(i = 0; i < SequencerSong::maxPatterns; i++)
+				song.setPattern(i, *scratchPattern);
+			
+			song.setEntriesFromText(songText);
+			song.setTempo(rateSlider->getValue());
+			updateOutputs();
+			
+			publishPattern();
+			
+			// start the audio device for the built-in synth and drums, which the sequencer gives its
+			// messages to ahead of time so they can be played at exactly the right sample
+			sequencer.addScheduledDestination(&sequencerAudio);
+			
+			const String error(audioDeviceManager.initialise(0, 2, 0, true));
+			
+			if(error.isEmpty())
+			{
+				audioDeviceManager.setAudioCallback(&sequencerAudio);
+			}
+			else
+			{
+				internalSynth->setToggleState(false, false);
+				internalSynth->setEnabled(false);
+				sequencerAudio.setSynthEnabled(false);
+				internalDrums->setToggleState(false, false);
+				internalDrums->setEnabled(false);
+				sequencerAudio.setDrumsEnabled(false);
 			}
 		}
 		
 		~MainComponent ()
 		{
+			// the sequencer needs to be stopped before the things it uses are deleted
+			sequencer.stop();
+			audioDeviceManager.setAudioCallback(0);
+			deleteAndZero(midiInput);
+			
+			for(i = 0; i < numOutputs; i++)
+				delete midiOutputs[i];
+			
+			delete bank;
+			deleteRetiredBanks();
+			delete scratchPattern;
+			
 			deleteAllChildren();
 		}
 		
@@ -213,10 +520,7 @@ class MainComponent  :	public Component,
 		
 		void resized ()
 		{			
-			for(i = 0; i < stepSequencer.size(); i++)
-			{
-				stepSequencer[i]->setBounds(10, (text->getY()+30) + 20*i, getWidth()-20, 20);
-			}
+			stepGrid->setBounds(10, text->getY()+30, getWidth()-20, 20*numDrumRows);
 		}
 		
 		void buttonClicked(Button* button)
@@ -225,49 +529,227 @@ class MainComponent  :	public Component,
 			{
 				text->setText(T("Playing"), false);
 				
-				// startThread starts our thread which ultimately causes our run() method to be called
-				// 10 = highest priority
-				startThread(10); 
+				if(! sequencer.isPlaying())
+					timingLabel->setText(String::empty, false);
+				
+				// this starts the sequencer's thread, which does all the playing
+				sequencer.start();
+				
+				// and start checking where the playhead is, at about the display's frame rate
+				startTimer(20);
 			}
 			else if(button == stop)
 			{
-				text->setText(T("Stopped"), false);
-				index = 0;		// Reset index so sequence starts from the beggining
+				// the first press pauses, so Play carries on from there, and the second goes back to the start
+				if(sequencer.isPlaying())
+				{
+					text->setText(T("Paused"), false);
+					sequencer.pause();
+				}
+				else
+				{
+					text->setText(T("Stopped"), false);
+					sequencer.stop();
+				}
+				
+				// (now nothing's using the banks that have been replaced, and they can go)
+				deleteRetiredBanks();
 				
-				// stop (and timeout after 3 secs, if this fails and then force if necessary)
-				stopThread(3000); 
+				// clear the playhead from the display
+				stopTimer();
+				recordNotes();
+				recorder.clearPlayheadPositions();
+				timingLabel->setText(sequencer.getTimingMonitor().getSummary(), false);
+				stepGrid->setPlayheadColumn(-1);
+				displayedStep = -1;
 			}
 			else if(button == synthSelection)
 			{
 				if(synthSelection->getToggleState())
 					synthSelection->setButtonText(T("Synthsizer On"));
-				if(! synthSelection->getToggleState()){
+				if(! synthSelection->getToggleState())
 					synthSelection->setButtonText(T("Synthsizer Off"));
-					midiOutput->sendMessageNow(MidiMessage::allNotesOff(2));}
+				
+				// (the notes that are playing still get their note-offs when they're due)
+				muteSongTracks();
 			}
 			else if(button == stepSelection)
 			{
 				if(stepSelection->getToggleState())
 					stepSelection->setButtonText(T("Step Sequencer On"));
-				if(! stepSelection->getToggleState()){
+				if(! stepSelection->getToggleState())
 					stepSelection->setButtonText(T("Step Sequencer Off"));
-					midiOutput->sendMessageNow(MidiMessage::allNotesOff(1));}
+				
+				muteSongTracks();
+			}
+			
+			else if(button == exportTiming)
+			{
+				FileChooser chooser(T("Save the timing measurements"),
+									File::getSpecialLocation(File::userDocumentsDirectory).getChildFile(T("sequencer timing.csv")),
+									T("*.csv"));
+				
+				if(chooser.browseForFileToSave(true) && ! sequencer.getTimingMonitor().exportToCsv(chooser.getResult()))
+					AlertWindow::showMessageBox(AlertWindow::WarningIcon, T("Export Timing"), T("Couldn't write the file"));
+				
+				return;
+			}
+			else if(button == exportMidi)
+			{
+				exportMidiFile();
+				return;
+			}
+			else if(button == loadBank)
+			{
+				loadPatternBank();
+				return;
+			}
+			else if(button == saveBank)
+			{
+				FileChooser chooser(T("Save the song's patterns as a bank"),
+									File::getSpecialLocation(File::userDocumentsDirectory).getChildFile(T("patterns.seqbank")),
+									T("*.seqbank"));
+				
+				if(chooser.browseForFileToSave(true) && ! PatternBank::writeFile(chooser.getResult(), getSongPatterns()))
+					AlertWindow::showMessageBox(AlertWindow::WarningIcon, T("Save Bank"), T("Couldn't write the file"));
+				
+				return;
+			}
+			else if(button == exportXml)
+			{
+				FileChooser chooser(T("Export the song's patterns as XML"),
+									File::getSpecialLocation(File::userDocumentsDirectory).getChildFile(T("patterns.xml")),
+									T("*.xml"));
+				
+				if(! chooser.browseForFileToSave(true))
+					return;
+				
+				XmlElement* const xml = PatternBank::createXml(getSongPatterns());
+				
+				if(! xml->writeToFile(chooser.getResult(), String::empty))
+					AlertWindow::showMessageBox(AlertWindow::WarningIcon, T("Export XML"), T("Couldn't write the file"));
+				
+				delete xml;
+				return;
 			}
+			else if(button == internalSynth)
+			{
+				sequencerAudio.setSynthEnabled(internalSynth->getToggleState());
+				return;
+			}
+			else if(button == internalDrums)
+			{
+				sequencerAudio.setDrumsEnabled(internalDrums->getToggleState());
+				return;
+			}
+			else if(button == songMode)
+			{
+				// (this happens at the next bar line)
+				sequencer.setSongMode(songMode->getToggleState());
+				return;
+			}
+			else if(button == record)
+			{
+				recorder.setRecording(record->getToggleState());
+				return;
+			}
+			else if(button == realtime)
+			{
+				// (this happens the next time it starts)
+				sequencer.setRealtime(realtime->getToggleState());
+				schedulingLabel->setText(T("(from the next Play)"), false);
+				return;
+			}
+			else if(button == sendClock)
+			{
+				// (this happens the next time it starts)
+				sequencer.setSendsClock(sendClock->getToggleState());
+				return;
+			}
+			else if(button == followClock)
+			{
+				// the sequencer has to be stopped to change this, and then waits for the clock to start
+				// (pausing first means the stop button goes all the way back to the start)
+				sequencer.pause();
+				buttonClicked(stop);
 				
+				sequencer.setClockFollower(followClock->getToggleState() ? &clockFollower : 0);
+				text->setText(followClock->getToggleState() ? T("Press Play, then start the clock") : T("Ready..."), false);
+				return;
+			}
+			
+			publishPattern();
+		}
+		
+		void stepGridCellChanged(StepGridComponent* grid, int row, int column)
+		{
+			// a step that's been clicked goes back on the beat, if it had been recorded off it
+			stepDelays[row][column] = 0;
+			publishPattern();
+		}
+		
+		/** Show a menu of a drum step's ratchets, chance and nudge, and publish whatever's picked.
+		 */
+		void stepGridCellMenuRequested(StepGridComponent* grid, int row, int column)
+		{
+			// the ids are the ratchets, 100 + the chance, and 300 + the nudge's index
+			static const int ratchets[] = { 1, 2, 3, 4, 6, 8 };
+			static const int chances[] = { 100, 75, 50, 25 };
+			static const int nudges[] = { -96, -64, -32, 0, 32, 64, 96 };
+			static const char* const nudgeNames[] = { "3/8 early", "1/4 early", "1/8 early", "On the step", "1/8 late", "1/4 late", "3/8 late" };
+			
+			PopupMenu ratchetMenu, chanceMenu, nudgeMenu;
+			
+			for(i = 0; i < int(sizeof(ratchets) / sizeof(ratchets[0])); i++)
+				ratchetMenu.addItem(ratchets[i], ratchets[i] == 1 ? String(T("Once")) : String(ratchets[i]) + T(" times"),
+									true, ratchets[i] == jmax(1, int(stepRatchets[row][column])));
+			
+			for(i = 0; i < int(sizeof(chances) / sizeof(chances[0])); i++)
+				chanceMenu.addItem(100 + chances[i], String(chances[i]) + T("%"),
+								   true, chances[i] == (stepChances[row][column] == 0 ? 100 : stepChances[row][column]));
+			
+			for(i = 0; i < int(sizeof(nudges) / sizeof(nudges[0])); i++)
+				nudgeMenu.addItem(300 + i, nudgeNames[i], true, nudges[i] == stepNudges[row][column]);
+			
+			PopupMenu menu;
+			menu.addSubMenu(T("Ratchet"), ratchetMenu);
+			menu.addSubMenu(T("Chance"), chanceMenu);
+			menu.addSubMenu(T("Nudge"), nudgeMenu);
+			
+			const int result = menu.show();
+			
+			if(result <= 0)
+				return;
+			else if(result < 100)
+				stepRatchets[row][column] = uint8(result);
+			else if(result <= 200)
+				stepChances[row][column] = uint8(result == 200 ? 0 : result - 100);
+			else
+				stepNudges[row][column] = int8(nudges[result - 300]);
+			
+			stepGrid->setCellDivisions(row, column, jmax(1, int(stepRatchets[row][column])));
+			publishPattern();
 		}
 		
 		void sliderValueChanged (Slider* slider)
 		{
-			if(slider = rateSlider)
-				rate = ((30/rateSlider->getValue())*1000);
+			// (picking a bank pattern cues it rather than publishing the grid, which would take over from it)
+			if(slider == bankSlider)
+			{
+				cueBankPattern();
+				return;
+			}
 			
-			// Update note sequence with values from inc/dec sliders
-			for(i = 0; i < 8; i++)
+			if(slider == rateSlider)
 			{
-				noteSeq.set((i*2), int(notes[i]->getValue()));
+				rate = ((30/rateSlider->getValue())*1000);
 				
+				// (the song's tempo changes are made relative to this, in the song's text)
+				song.setTempo(rateSlider->getValue());
+				songCompiler.songChanged(song);
 			}
-			midiOutput->sendMessageNow(MidiMessage::allNotesOff(2));
+			
+			publishPattern();
 
 			//****************************************************************<<DR>>
 			// I'm not sure why this wouldn't work, I thought I could compare the
@@ -296,6 +778,22 @@ class MainComponent  :	public Component,
 		
 		void labelTextChanged (Label* changedLabel)
 		{
+			if(changedLabel == songChain)
+			{
+				// if the song can't be read, put back the one that's playing
+				if(song.setEntriesFromText(songChain->getText()))
+				{
+					songText = songChain->getText();
+					songCompiler.songChanged(song);
+				}
+				else
+				{
+					songChain->setText(songText, false);
+				}
+				
+				return;
+			}
+			
 //			if(changedLabel == noteVals[0])
 //				noteSeq.set(0, noteVals[0]->getText().getIntValue());
 //			if(changedLabel == noteVals[1])
@@ -317,119 +815,469 @@ class MainComponent  :	public Component,
 		
 		void comboBoxChanged(ComboBox* comboBox)
 		{
-			if(comboBox == midiOutputSelector)
+			if(comboBox == drumsOutputSelector || comboBox == synthOutputSelector)
+			{
+				// open the midi outputs selected via the menus, and send the tracks to them
+				updateOutputs();
+				publishPattern();
+			}
+			else if(comboBox == midiInputSelector)
 			{
-				// open the midi output selected via the menu
-				midiOutput = MidiOutput::openDevice(midiOutputSelector->getSelectedItemIndex());
+				// (the old input has to stop before the new one can start giving the recorder its notes)
+				deleteAndZero(midiInput);
+				midiInput = MidiInput::openDevice(midiInputSelector->getSelectedItemIndex(), &recorder);
 				
-				// this would be called near the start of the program since we do..
-				//  midiOutputSelector->setSelectedId(1, false);
-				// ..shortly after populating our combo box menu in the constructor
+				if(midiInput != 0)
+					midiInput->start();
+			}
+			else if(comboBox == patternSelector)
+			{
+				// put the pattern on the grid, and play it if we're not in song mode
+				currentPattern = patternSelector->getSelectedId() - 1;
+				showPattern(song.getPattern(currentPattern));
+				publishPattern();
 			}
 		}
 		
 		
-		void run()
+		/** Moves the playhead (the transport hint) on the step grid.
+		 
+			This runs on the message thread, so the sequencer thread never has to repaint
+			anything. If the playhead hasn't moved since last time nothing is done, and if
+			it's moved more than one step (at a fast tempo) the steps in between are skipped.
+			It also keeps the timing figures up to date.
+		 */
+		void timerCallback()
 		{
-			// this is where our Thread runs after startThread() is called when the play button is clicked
+			// show the latest figures, which change once a second
+			TimingMonitor& timing = sequencer.getTimingMonitor();
 			
-			while( ! threadShouldExit() )
+			if(timing.update())
 			{
-				// get the current time in ms, do this first so it is as accurate as possible
-				const uint32 now = Time::getMillisecondCounter();
+				timingLabel->setText(timing.getSummary(), false);
+				
+				String status;
 				
-				// .. even bfeore checking our midi output is valid (i.e., not 0)
-				if(midiOutput != 0)
+				for(i = 0; i < numOutputs; i++)
 				{
-					// the '%' is the modulo operator, it gives the remainder after a division
-					// so although index keeps getting larger.. doing index % noteSeq.size() always keeps
-					// the index into the array betwen 0 and (noteSeq.size()-1)
-					// e.g. if noteSeq.size() is 16 the return of index % noteSeq.size()
-					// will always be between 0...15
-					// Therefor (index - 1) % noteSeq.size() should get the previous note in the sequence
-					
-					// Set up current and previous notes
-					int previousNoteIndex = (index - 1) % stepSequencer[0]->radioGroup.size();
-					int currentNoteIndex = index % stepSequencer[0]->radioGroup.size();
-					int previousSynthNoteIndex = (index - 2) % stepSequencer[0]->radioGroup.size();
-					
+					const MidiSender& sender = sequencer.getSender(i);
 					
-					//********************************************<<DR>>
-					// I think it is this that is causing a few problems
-					// The last button doesn't get repainted after being 
-					// turned white initially
-					//********************************************<<DR>>
-					
-					// Move the transport hint
-					for(i = 0; i < 4; i++)
-					{
-						stepSequencer[i]->radioGroup[currentNoteIndex]->setColour(TextButton::buttonColourId, Colours::white);
-						if(currentNoteIndex > 0)
-							stepSequencer[i]->radioGroup[previousNoteIndex]->setColour(TextButton::buttonColourId, Colours::lightblue);
-						else if (currentNoteIndex = 0)
-							stepSequencer[i]->radioGroup[15]->setColour(TextButton::buttonColourId, Colours::lightblue);
-					}
-
-					
-					
-					// If the synth selection button is on play the synth
-					if(synthSelection->getToggleState() && (currentNoteIndex % 2 == 0))
-					{
-						// note off for the previous note..
-						midiOutput->sendMessageNow(MidiMessage::noteOff(2, noteSeq[previousSynthNoteIndex]));
-						// note on for new note..
-						midiOutput->sendMessageNow(MidiMessage::noteOn(2, noteSeq[currentNoteIndex], float(synthVol->getValue())));
-					}
-					
-					float stepVolume = float(stepVol->getValue());
-					
-					if(stepSelection->getToggleState())
-					{
-						// Step sequencer section
-						if (stepSequencer[0]->radioGroup[currentNoteIndex]->getToggleState())		//Kick drum
-						{
-							midiOutput->sendMessageNow(MidiMessage::noteOff(1, 35));
-							midiOutput->sendMessageNow(MidiMessage::noteOn(1, 35, stepVolume));
-						}
-						if (stepSequencer[1]->radioGroup[currentNoteIndex]->getToggleState())		//Snare Drum
-						{
-							midiOutput->sendMessageNow(MidiMessage::noteOff(1, 38));
-							midiOutput->sendMessageNow(MidiMessage::noteOn(1, 38, stepVolume));
-						}
-						if (stepSequencer[2]->radioGroup[currentNoteIndex]->getToggleState())		//Closed hat
-						{
-							midiOutput->sendMessageNow(MidiMessage::noteOff(1, 42));
-							midiOutput->sendMessageNow(MidiMessage::noteOn(1, 42, stepVolume));
-						}
-						if (stepSequencer[3]->radioGroup[currentNoteIndex]->getToggleState())		//Open Hat
-						{
-							midiOutput->sendMessageNow(MidiMessage::noteOff(1, 46));
-							midiOutput->sendMessageNow(MidiMessage::noteOn(1, 46, stepVolume));
-						}
-					}					
+					if(midiOutputs[i] != 0)
+						status << (i == drumsOutput ? "Drums: " : "  Synth: ") << sender.getNumQueued() << " queued, "
+							   << sender.getNumDropped() << " dropped";
+				}
+				
+				outputStatus->setText(status, false);
+				schedulingLabel->setText(sequencer.getSchedulingDescription(), false);
+			}
+			
+			int64 position;
+			const bool hasMoved = sequencer.getPlayhead(SequencerClock::getNanoseconds(), position, &recorder);
+			
+			// anything that's been played on the input goes into the pattern as it plays
+			recordNotes();
+			
+			if(! hasMoved)
+				return;
+			
+			const int step = int(position % numGridSteps);
+			
+			if(step != displayedStep)
+			{
+				stepGrid->setPlayheadColumn(step);
+				displayedStep = step;
+			}
+		}
+		
+		/** Copy the state of all the controls into a new pattern for the sequencer thread.
+		 
+			This must only be called from the message thread.
+		 */
+		void publishPattern()
+		{
+			SequencerPattern& p = *scratchPattern;
+			fillPattern(p);
+			
+			sequencer.setPattern(p);
+			
+			// the grid is also one of the song's patterns
+			if(song.setPattern(currentPattern, p))
+				songCompiler.songChanged(song);
+		}
+		
+		/** Set the step grid and note sliders from one of the song's patterns, without
+			publishing anything.
+		 */
+		void showPattern(const SequencerPattern& p)
+		{
+			for(int drum = 0; drum < numDrumRows; drum++)
+				for(int step = 0; step < numGridSteps; step++)
+					stepGrid->setCellOn(drum, step, p.tracks[drum].isStepOn(step));
+			
+			for(int i = 0; i < notes.size(); i++)
+				notes[i]->setValue(p.getNote(numDrumRows, i * 2), false);
+			
+			stepSwing->setValue(p.tracks[0].swing, false);
+			synthSwing->setValue(p.tracks[numDrumRows].swing, false);
+			stepGate->setValue(p.tracks[0].gate, false);
+			synthGate->setValue(p.tracks[numDrumRows].gate, false);
+			
+			for(int row = 0; row <= numDrumRows; row++)
+			{
+				for(int step = 0; step < numGridSteps; step++)
+				{
+					stepDelays[row][step] = p.stepDelays[row][step];
+					stepNudges[row][step] = p.stepNudges[row][step];
+				}
+			}
+			
+			for(int drum = 0; drum < numDrumRows; drum++)
+			{
+				for(int step = 0; step < numGridSteps; step++)
+				{
+					stepRatchets[drum][step] = p.stepRatchets[drum][step];
+					stepChances[drum][step] = p.stepChances[drum][step];
+					stepGrid->setCellDivisions(drum, step, p.getRatchets(drum, step));
+				}
+			}
+		}
+		
+		/** Put the notes that have been played on the MIDI input since last time into the grid,
+			and publish the pattern if there were any.
+		 
+			Each note is placed between the steps the playhead passed as it was played, and pulled
+			towards the nearest step as strongly as the quantise slider says. It goes on the step
+			it's nearest to, and whatever's left over becomes the step's delay if it's late, or its
+			nudge if it's early (as far as a nudge can go, which is about half a step).
+		 
+			The notes are sorted by channel, as they're played: one on the drums' channel turns on
+			the step of the row with its note (any other note there is ignored), one on the synth's
+			channel is quantised to the synth's steps (every other one), and notes on any other
+			channel are ignored.
+		 */
+		void recordNotes()
+		{
+			MidiRecorder::RecordedNote note;
+			bool hasRecorded = false;
+			
+			while(recorder.popNote(note))
+			{
+				double position;
+				
+				// (a note played before the playhead got going has nowhere to go)
+				if(! recorder.getStepPosition(note.time, (15.0 / rateSlider->getValue()) * 1.0e9, position))
+					continue;
+				
+				int row = -1;
+				
+				if(note.channel == drumsChannel)
+				{
+					for(int drum = 0; drum < numDrumRows; drum++)
+						if(drumNotes[drum] == note.note)
+							row = drum;
+				}
+				else if(note.channel == synthChannel)
+				{
+					row = numDrumRows;
+				}
+				
+				if(row < 0)
+					continue;
+				
+				const double gridSize = row < numDrumRows ? 1.0 : 2.0;
+				const double quantised = MidiRecorder::quantise(position / gridSize, quantiseStrength->getValue()) * gridSize;
+				const double nearest = floor(quantised / gridSize + 0.5) * gridSize;
+				const int step = (int(nearest) % numGridSteps + numGridSteps) % numGridSteps;
+				const int offset = roundDoubleToInt((quantised - nearest) * 256.0);
+				
+				// (a step's delay can't take its note past the next step, or a nudge more than half a step early)
+				stepDelays[row][step] = uint8(jlimit(0, 255, offset));
+				stepNudges[row][step] = int8(jlimit(-(int) SequencerPattern::maxNudge, 0, offset));
+				
+				if(row < numDrumRows)
+					stepGrid->setCellOn(row, step, true);
+				else
+					notes[step / 2]->setValue(note.note, false);
+				
+				hasRecorded = true;
+			}
+			
+			if(hasRecorded)
+				publishPattern();
+		}
+		
+		/** Open the devices chosen for the drums and the synth, and give them to the sequencer's outputs.
+		 
+			If both have chosen the same device it's only opened once, on the drums' output. A device
+			that's not needed any more is closed straight away, as once it's been taken off its output
+			the sequencer's finished with it; the tracks need publishing again afterwards to be routed
+			to the right output.
+		 */
+		void updateOutputs()
+		{
+			int wantedDevices[numOutputs];
+			wantedDevices[drumsOutput] = drumsOutputSelector->getSelectedItemIndex();
+			wantedDevices[synthOutput] = synthOutputSelector->getSelectedItemIndex();
+			
+			if(wantedDevices[synthOutput] == wantedDevices[drumsOutput])
+				wantedDevices[synthOutput] = -1;
+			
+			// keep any device that's already open, even if it's moved to the other output..
+			MidiOutput* newOutputs[numOutputs];
+			
+			for(i = 0; i < numOutputs; i++)
+			{
+				newOutputs[i] = 0;
+				
+				for(int j = 0; j < numOutputs; j++)
+					if(wantedDevices[i] >= 0 && outputDevices[j] == wantedDevices[i])
+						newOutputs[i] = midiOutputs[j];
+			}
+			
+			// ..and close the rest, once they've been taken off the outputs (which turns off
+			// whatever they had playing, and waits for the outputs to finish with them)
+			for(i = 0; i < numOutputs; i++)
+				sequencer.setOutput(i, 0);
+			
+			for(i = 0; i < numOutputs; i++)
+			{
+				bool isStillUsed = false;
+				
+				for(int j = 0; j < numOutputs; j++)
+					if(newOutputs[j] == midiOutputs[i])
+						isStillUsed = true;
+				
+				if(! isStillUsed)
+					delete midiOutputs[i];
+			}
+			
+			for(i = 0; i < numOutputs; i++)
+			{
+				if(newOutputs[i] == 0 && wantedDevices[i] >= 0)
+					newOutputs[i] = MidiOutput::openDevice(wantedDevices[i]);
+				
+				midiOutputs[i] = newOutputs[i];
+				outputDevices[i] = newOutputs[i] != 0 ? wantedDevices[i] : -1;
+				sequencer.setOutput(i, midiOutputs[i]);
+			}
+			
+			// the song's patterns need to know where their tracks go too
+			muteSongTracks();
+		}
+		
+		/** Open a pattern bank (or an XML export, which is made into a bank next to it first) in place
+			of the one that's open.
+		 
+			If there's a bank with the XML's name next to it already, it asks before replacing it, and
+			if not the new bank gets a name of its own.
+		 */
+		void loadPatternBank()
+		{
+			FileChooser chooser(T("Open a pattern bank"),
+								File::getSpecialLocation(File::userDocumentsDirectory),
+								T("*.seqbank;*.xml"));
+			
+			if(! chooser.browseForFileToOpen())
+				return;
+			
+			File file(chooser.getResult());
+			
+			if(file.hasFileExtension(T("xml")))
+			{
+				XmlDocument document(file);
+				XmlElement* const xml = document.getDocumentElement();
+				OwnedArray<SequencerPattern> patterns;
+				const bool isBank = xml != 0 && PatternBank::loadFromXml(*xml, patterns) && patterns.size() > 0;
+				delete xml;
+				
+				Array<const SequencerPattern*> patternsToWrite;
+				
+				for(int i = 0; i < patterns.size(); i++)
+					patternsToWrite.add(patterns[i]);
+				
+				// (a bank that's already there, which might be the open one, is only replaced if it's ok to)
+				file = file.withFileExtension(T("seqbank"));
+				
+				if(file.exists()
+				   && ! AlertWindow::showOkCancelBox(AlertWindow::QuestionIcon, T("Load Bank"),
+													 file.getFileName() + T(" already exists. Replace it with these patterns?"),
+													 T("Replace"), T("Keep Both")))
+					file = file.getNonexistentSibling();
+				
+				if(! isBank || ! PatternBank::writeFile(file, patternsToWrite))
+				{
+					AlertWindow::showMessageBox(AlertWindow::WarningIcon, T("Load Bank"), T("Couldn't read the patterns"));
+					return;
 				}
+			}
+			
+			PatternBank* const newBank = PatternBank::openFile(file);
+			
+			if(newBank == 0)
+			{
+				AlertWindow::showMessageBox(AlertWindow::WarningIcon, T("Load Bank"), T("That isn't a pattern bank this version can read"));
+				return;
+			}
+			
+			// the sequencer may be playing one of the old bank's patterns, so the grid takes over from
+			// it, and the bank waits until the sequencer's stopped before it goes
+			if(bank != 0)
+			{
+				retiredBanks.add(bank);
+				publishPattern();
+				
+				if(! sequencer.isPlaying())
+					deleteRetiredBanks();
+			}
+			
+			bank = newBank;
+			bankSlider->setRange(1, bank->getNumPatterns(), 1);
+			bankSlider->setValue(1, false);
+			bankSlider->setEnabled(true);
+		}
+		
+		/** Put the bank slider's pattern on the grid, and cue it to play from the next bar.
+		 
+			It isn't published: the sequencer plays it straight out of the bank, so switching
+			patterns never copies anything, until the grid's next changed. It does replace the
+			grid's pattern in the song.
+		 */
+		void cueBankPattern()
+		{
+			if(bank == 0)
+				return;
+			
+			const SequencerPattern& p = bank->getPattern(int(bankSlider->getValue()) - 1);
+			showPattern(p);
+			sequencer.cuePattern(&p);
+			
+			if(song.setPattern(currentPattern, p))
+				songCompiler.songChanged(song);
+		}
+		
+		void deleteRetiredBanks()
+		{
+			for(i = 0; i < retiredBanks.size(); i++)
+				delete retiredBanks[i];
+			
+			retiredBanks.clear();
+		}
+		
+		/** All the song's patterns, e.g. to save them.
+		 */
+		const Array<const SequencerPattern*> getSongPatterns() const
+		{
+			Array<const SequencerPattern*> patterns;
 			
-				index++;
+			for(int i = 0; i < SequencerSong::maxPatterns; i++)
+				patterns.add(&song.getPattern(i));
+			
+			return patterns;
+		}
+		
+		/** The sequencer output the synth's tracks play on.
+		 */
+		int getSynthOutput() const
+		{
+			return outputDevices[synthOutput] >= 0 ? (int) synthOutput : (int) drumsOutput;
+		}
+		
+		/** Apply the on/off buttons and the outputs to all the song's patterns, not just the one on the grid.
+		 */
+		void muteSongTracks()
+		{
+			SequencerPattern& p = *scratchPattern;
+			
+			for(int i = 0; i < SequencerSong::maxPatterns; i++)
+			{
+				p = song.getPattern(i);
 				
+				for(int drum = 0; drum < numDrumRows; drum++)
+				{
+					p.tracks[drum].enabled = stepSelection->getToggleState();
+					p.tracks[drum].output = uint8(drumsOutput);
+				}
 				
-				//***********************************************************************<<DR>>
-				// I am accessing the rate slider here to get the BPM of the transport
-				// I did try updating the 'rate' variable in the sliderValueChanged callback
-				// but got some horrible results
-				//***********************************************************************<<DR>>
+				p.tracks[numDrumRows].enabled = synthSelection->getToggleState();
+				p.tracks[numDrumRows].output = uint8(getSynthOutput());
+				song.setPattern(i, p);
+			}
+			
+			songCompiler.songChanged(song);
+		}
+		
+		/** Copy the state of all the controls into a pattern, replacing whatever was in it.
+		 */
+		void fillPattern(SequencerPattern& p)
+		{
+			p.clear();
+			
+			// a track for each row of drums..
+			for(int drum = 0; drum < numDrumRows; drum++)
+			{
+				const int t = p.addTrack(numGridSteps, drumNotes[drum], drumsChannel, float(stepVol->getValue()));
+				p.tracks[t].enabled = stepSelection->getToggleState();
+				p.tracks[t].swing = float(stepSwing->getValue());
+				p.tracks[t].gate = float(stepGate->getValue());
+				p.tracks[t].output = uint8(drumsOutput);
 				
-				// pause until the next event is due i.e. the time it was at the top of the loop
-				// plus 'rate' which is the time we want between events (defaulted to 125ms)
-				Time::waitForMillisecondCounter(now + ((15/rateSlider->getValue())*1000));
+				for(int step = 0; step < numGridSteps; step++)
+				{
+					p.tracks[t].setStepOn(step, stepGrid->isCellOn(drum, step));
+					p.stepDelays[t][step] = stepDelays[drum][step];
+					p.stepRatchets[t][step] = stepRatchets[drum][step];
+					p.stepChances[t][step] = stepChances[drum][step];
+					p.stepNudges[t][step] = stepNudges[drum][step];
+				}
 			}
 			
-			// we break out of the while loop when the Thread is told to stop via stopThread()
-			// here we send an all notes off message to prevent hangin notes (which haven't had a real note off)
-			if(midiOutput != 0) 
+			// ..and one for the synth, which plays a note from the sliders on every other step
+			const int synth = p.addTrack(numGridSteps, 60, synthChannel, float(synthVol->getValue()));
+			p.tracks[synth].enabled = synthSelection->getToggleState();
+			p.tracks[synth].swing = float(synthSwing->getValue());
+			p.tracks[synth].gate = float(synthGate->getValue());
+			p.tracks[synth].output = uint8(getSynthOutput());
+			
+			for(int i = 0; i < notes.size(); i++)
 			{
-				midiOutput->sendMessageNow(MidiMessage::allNotesOff(1));
-				midiOutput->sendMessageNow(MidiMessage::allNotesOff(2));
+				p.tracks[synth].setStepOn(i * 2, true);
+				p.stepNotes[synth][i * 2] = uint8(notes[i]->getValue());
+				p.stepDelays[synth][i * 2] = stepDelays[numDrumRows][i * 2];
+				p.stepNudges[synth][i * 2] = stepNudges[numDrumRows][i * 2];
 			}
+			
+			p.tempo = rateSlider->getValue();
+		}
+		
+		/** Ask how many bars to render, and where to, then write the pattern as a MIDI file.
+		 
+			This doesn't go anywhere near the sequencer thread, so it works whether or not
+			we're playing.
+		 */
+		void exportMidiFile()
+		{
+			AlertWindow barsWindow(T("Export MIDI"), T("How many bars should be written?"), AlertWindow::QuestionIcon);
+			barsWindow.addTextEditor(T("bars"), T("16"), T("Bars:"));
+			barsWindow.addButton(T("OK"), 1, KeyPress(KeyPress::returnKey));
+			barsWindow.addButton(T("Cancel"), 0, KeyPress(KeyPress::escapeKey));
+			
+			if(barsWindow.runModalLoop() == 0)
+				return;
+			
+			const int numBars = jlimit(1, 100000, barsWindow.getTextEditorContents(T("bars")).getIntValue());
+			
+			FileChooser chooser(T("Save the pattern as a MIDI file"),
+								File::getSpecialLocation(File::userDocumentsDirectory).getChildFile(T("sequence.mid")),
+								T("*.mid"));
+			
+			if(! chooser.browseForFileToSave(true))
+				return;
+			
+			fillPattern(*scratchPattern);
+			
+			// (with the song's tempo changes and ramps, as it would play in song mode)
+			if(! OfflineRenderer::renderToFile(*scratchPattern, numBars, song.getTempoMap(), chooser.getResult()))
+				AlertWindow::showMessageBox(AlertWindow::WarningIcon, T("Export MIDI"), T("Couldn't write the file"));
 		}
 		
 	};
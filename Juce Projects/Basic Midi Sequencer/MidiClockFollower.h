@@ -0,0 +1,229 @@
+/*
+ *  MidiClockFollower.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _MIDICLOCKFOLLOWER_H_
+#define _MIDICLOCKFOLLOWER_H_
+
+#include <juce/juce.h>
+#include "SequencerClock.h"
+#include "LockFreeSnapshot.h"
+
+/**
+ Follows the MIDI clock coming in from another device, so the sequencer can play in time with it.
+
+ MIDI clock is 24 ticks per beat (6 per step), but the ticks never arrive quite
+ when they were sent: the other device, the cable, the driver and the thread
+ that hands them over all add a millisecond or so of jitter. Using the raw
+ arrival times would make the sequencer's timing that bad too, so instead they
+ go through a phase-locked loop: each tick is compared with where the loop
+ expected it, and the difference nudges the loop's idea of the current tick's
+ time (its phase) and of the time between ticks (its period). The loop's
+ bandwidth sets how quickly it follows; it starts wide, so it locks on within a
+ couple of beats, then narrows so the jitter is smoothed out. What comes out is a
+ steady tempo and a tick time that's much closer to the truth than any one
+ arrival, which the sequencer can schedule ahead from.
+
+ Start, Continue and Stop (and the Song Position Pointer, which says where a
+ Continue carries on from) are followed too. A Stop remembers the step it
+ stopped in, so a Continue without a Song Position Pointer carries on from
+ there.
+
+ The messages come in on one thread (normally the MidiInput's), and the state
+ is passed to the sequencer thread through a LockFreeSnapshot, so only one
+ other thread can call getState().
+ */
+class MidiClockFollower : public MidiInputCallback
+	{
+	public:
+		enum { ticksPerStep = 6 };
+
+		/** Where the clock has got to.
+		 */
+		struct State
+		{
+			bool isLocked;			// true once the loop has settled onto the clock
+			bool isRunning;			// between a Start or Continue and a Stop
+			int generation;			// goes up with every Start or Continue
+			int startStep;			// the step it started (or continued) from
+			int64 tickTime;			// the loop's time for the latest tick (a SequencerClock time)..
+			int64 tick;				// ..and which tick of the song that was
+			double tickLength;		// the loop's time between ticks, in nanoseconds
+
+			/** When a tick of the song happens (or happened) by the loop's reckoning.
+			 */
+			int64 getTimeOfTick (const int64 songTick) const throw()
+			{
+				return tickTime + (int64) ((songTick - tick) * tickLength);
+			}
+
+			int64 getTimeOfStep (const int64 step) const throw()		{ return getTimeOfTick (step * ticksPerStep); }
+
+			double getTempo() const throw()								{ return tickLength > 0 ? 60.0e9 / (24.0 * tickLength) : 0.0; }
+		};
+
+		//==============================================================================
+		MidiClockFollower()
+		{
+			reset();
+		}
+
+		~MidiClockFollower()
+		{
+		}
+
+		//==============================================================================
+		/** Forget the clock, and wait to lock on again (input thread only).
+		 */
+		void reset()
+		{
+			numTicks = 0;
+			lastArrival = 0;
+			tickTime = 0;
+			tickLength = 0.0;
+			songPosition = 0;
+
+			state.isLocked = false;
+			state.isRunning = false;
+			state.generation = 0;
+			state.startStep = 0;
+			state.tickTime = 0;
+			state.tick = 0;
+			state.tickLength = 0.0;
+			states.publish (state);
+		}
+
+		/** Handle a message that arrived at a SequencerClock time (input thread only).
+
+		 Anything other than clock and transport messages is ignored.
+		 */
+		void handleMessage (const MidiMessage& message, const int64 arrivalTime)
+		{
+			const uint8* const data = message.getRawData();
+
+			switch (data[0])
+			{
+				case 0xf8:	handleTick (arrivalTime); break;
+				case 0xfa:	startFrom (0); break;
+				case 0xfb:	startFrom (songPosition); break;
+				case 0xfc:	stop(); break;
+
+				case 0xf2:
+					// (the position is in 16th notes, which are our steps)
+					if (message.getRawDataSize() >= 3)
+						songPosition = (data[1] & 0x7f) | ((data[2] & 0x7f) << 7);
+					break;
+
+				default:	return;
+			}
+
+			states.publish (state);
+		}
+
+		/** Get the latest state (one other thread only, normally the sequencer's).
+		 */
+		const State& getState() throw()								{ return states.read(); }
+
+		//==============================================================================
+		void handleIncomingMidiMessage (MidiInput*, const MidiMessage& message)
+		{
+			// (the message's own time stamp is on a different, coarser clock)
+			handleMessage (message, SequencerClock::getNanoseconds());
+		}
+
+	private:
+		//==============================================================================
+		// how many ticks it takes to lock on, and the loop's bandwidth once it has
+		enum { ticksToLock = 48 };
+		static double getBandwidthHz() throw()						{ return 0.1; }
+
+		/** The loop's gain for the next tick (its bandwidth, in radians per tick).
+
+		 This starts wide, so the loop can find the clock from a couple of ticks,
+		 and narrows gradually to the bandwidth, with the loop always settled
+		 enough for where it's got to. (While it's narrowing this is much like
+		 fitting a straight line through all the ticks so far.)
+		 */
+		double getLoopGain() const throw()
+		{
+			return jmax (2.0 * double_Pi * getBandwidthHz() * tickLength * 1.0e-9, 2.0 / numTicks);
+		}
+
+		// the loop (only used by the input thread)
+		int numTicks;
+		int64 lastArrival;
+		int64 tickTime;
+		double tickLength;
+		int songPosition;
+
+		State state;
+		LockFreeSnapshot<State> states;
+
+		void startFrom (const int step)
+		{
+			// the next tick is the first step's
+			state.isRunning = true;
+			state.startStep = step;
+			state.tick = step * (int64) ticksPerStep - 1;
+			++state.generation;
+			songPosition = step;
+		}
+
+		void stop()
+		{
+			// (Continue carries on from the start of the step the next tick would have been in)
+			if (state.isRunning)
+				songPosition = (int) ((state.tick + 1) / ticksPerStep);
+
+			state.isRunning = false;
+		}
+
+		void handleTick (const int64 arrivalTime)
+		{
+			// if the ticks stopped for a while (or came far too fast) the old tempo's no use
+			if (numTicks > 1 && (arrivalTime - lastArrival > tickLength * 4.0 || arrivalTime - lastArrival < tickLength / 4.0))
+				numTicks = 0;
+
+			if (numTicks == 0)
+			{
+				tickTime = arrivalTime;
+			}
+			else if (numTicks == 1)
+			{
+				tickLength = (double) (arrivalTime - tickTime);
+				tickTime = arrivalTime;
+			}
+			else
+			{
+				// a second-order loop: the error moves the phase straight away and the
+				// period a little, with the gains chosen (from the bandwidth, as a
+				// proportion of the tick rate) to be critically damped
+				const double w = getLoopGain();
+				const double predicted = tickTime + tickLength;
+				const double error = jlimit (-tickLength / 2, tickLength / 2, arrivalTime - predicted);
+
+				tickTime = (int64) (predicted + 1.4142135623730951 * w * error);
+				tickLength += w * w * error;
+			}
+
+			lastArrival = arrivalTime;
+			++numTicks;
+
+			if (state.isRunning)
+				++state.tick;
+
+			// (while it's stopped the song doesn't move, but the loop keeps following the clock)
+			state.isLocked = numTicks >= ticksToLock;
+			state.tickTime = tickTime;
+			state.tickLength = tickLength;
+		}
+
+		MidiClockFollower (const MidiClockFollower&);
+		const MidiClockFollower& operator= (const MidiClockFollower&);
+	};
+
+#endif//_MIDICLOCKFOLLOWER_H_
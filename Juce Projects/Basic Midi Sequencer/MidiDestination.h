@@ -0,0 +1,68 @@
+/*
+ *  MidiDestination.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _MIDIDESTINATION_H_
+#define _MIDIDESTINATION_H_
+
+#include <juce/juce.h>
+
+/**
+ Somewhere other than a MidiOutput device that a MidiSender can send to.
+
+ MidiOutput can't be subclassed, so anything that wants to receive the
+ sequencer's messages in-process (a built-in synth, or a loopback for testing)
+ implements this instead and is given to MidiSender::setDestination().
+
+ sendMessageNow() is called on the sender thread, so it must be quick and mustn't
+ allocate or lock.
+ */
+class MidiDestination
+	{
+	public:
+		virtual ~MidiDestination() {}
+
+		/** Called when a message is sent.
+
+		 dueTime is the SequencerClock time the message was meant to go at, which
+		 will usually be a moment before now.
+		 */
+		virtual void sendMessageNow (const MidiMessage& message, const int64 dueTime) = 0;
+	};
+
+//==============================================================================
+/**
+ Something that takes the sequencer's messages ahead of time, rather than at the
+ moment they're due.
+
+ The Sequencer hands these the same blocks it gives the MidiSender, as soon as
+ they're worked out (see Sequencer::addScheduledDestination()). It's for things
+ like the built-in synth, which render audio in blocks and so need to know about
+ a message before its time comes, to put it at exactly the right sample.
+ */
+class ScheduledMidiDestination
+	{
+	public:
+		virtual ~ScheduledMidiDestination() {}
+
+		/** Called on the sequencer thread with each block of messages.
+
+		 As with MidiSender::sendBlock(), each message's position in the buffer is
+		 the number of microseconds after blockStartTime (a SequencerClock time)
+		 that it's due. This mustn't allocate or lock.
+		 */
+		virtual void sendBlock (const MidiBuffer& buffer, const int64 blockStartTime) = 0;
+
+		/** Called when the sequencer stops, after its thread has finished.
+
+		 Anything that hasn't been played yet should be thrown away, and any notes
+		 that are playing stopped.
+		 */
+		virtual void reset() = 0;
+	};
+
+#endif//_MIDIDESTINATION_H_
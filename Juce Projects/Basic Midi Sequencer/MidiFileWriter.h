@@ -0,0 +1,159 @@
+/*
+ *  MidiFileWriter.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _MIDIFILEWRITER_H_
+#define _MIDIFILEWRITER_H_
+
+#include <juce/juce.h>
+
+/**
+ Writes a type 1 Standard MIDI File straight to a stream.
+
+ Unlike MidiFile, nothing is kept in memory: the tracks are written one after
+ the other as the events arrive, and each track's length is filled in when it
+ ends. That means the stream must be able to go back (e.g. a FileOutputStream),
+ and the events in a track must be added in time order.
+
+ @code
+ MidiFileWriter writer (stream, 2, 960);
+ writer.startTrack();
+ writer.addTempo (0, 120.0);
+ writer.endTrack (0);
+ writer.startTrack();
+ writer.addEvent (0, MidiMessage::noteOn (1, 60, 1.0f));
+ ...
+ writer.endTrack (endTime);
+ @endcode
+ */
+class MidiFileWriter
+	{
+	public:
+		/** Start a file, writing its header.
+		 */
+		MidiFileWriter (OutputStream& out_, const int numTracks, const int ticksPerQuarterNote)
+			:	out (out_),
+				trackStart (-1),
+				lastTime (0)
+		{
+			out.write ("MThd", 4);
+			out.writeIntBigEndian (6);
+			out.writeShortBigEndian (1);
+			out.writeShortBigEndian ((short) numTracks);
+			out.writeShortBigEndian ((short) ticksPerQuarterNote);
+		}
+
+		//==============================================================================
+		/** Begin the next track.
+		 */
+		void startTrack()
+		{
+			jassert (trackStart < 0); // the last track wasn't ended
+
+			out.write ("MTrk", 4);
+			trackStart = out.getPosition();
+			out.writeIntBigEndian (0);	// the length, which is filled in by endTrack()
+			lastTime = 0;
+		}
+
+		/** Add a message at a time in ticks (which mustn't be before the last one).
+		 */
+		void addEvent (const int64 time, const uint8* const data, const int size)
+		{
+			writeDeltaTime (time);
+			out.write (data, size);
+		}
+
+		void addEvent (const int64 time, const MidiMessage& message)
+		{
+			addEvent (time, message.getRawData(), message.getRawDataSize());
+		}
+
+		/** Add a meta event (e.g. 0x51 for a tempo change).
+		 */
+		void addMetaEvent (const int64 time, const int type, const uint8* const data, const int size)
+		{
+			writeDeltaTime (time);
+			out.writeByte ((char) 0xff);
+			out.writeByte ((char) type);
+			writeVariableLength (size);
+			out.write (data, size);
+		}
+
+		/** Add a tempo change, in bpm.
+		 */
+		void addTempo (const int64 time, const double bpm)
+		{
+			const int microsecondsPerQuarterNote = (int) (60000000.0 / bpm + 0.5);
+			const uint8 data[3] = { (uint8) (microsecondsPerQuarterNote >> 16),
+									(uint8) (microsecondsPerQuarterNote >> 8),
+									(uint8) microsecondsPerQuarterNote };
+
+			addMetaEvent (time, 0x51, data, 3);
+		}
+
+		/** Add a time signature, e.g. 4, 4 for 4/4.
+		 */
+		void addTimeSignature (const int64 time, const int numerator, const int denominator)
+		{
+			int powerOfTwo = 0;
+			while ((1 << powerOfTwo) < denominator)
+				powerOfTwo++;
+
+			const uint8 data[4] = { (uint8) numerator, (uint8) powerOfTwo, 24, 8 };
+			addMetaEvent (time, 0x58, data, 4);
+		}
+
+		/** Finish the current track at the given time.
+		 */
+		void endTrack (const int64 time)
+		{
+			jassert (trackStart >= 0); // there's no track to end
+
+			addMetaEvent (jmax (time, lastTime), 0x2f, 0, 0);
+
+			// go back and fill in the length
+			const int64 trackEnd = out.getPosition();
+			out.setPosition (trackStart);
+			out.writeIntBigEndian ((int) (trackEnd - trackStart - 4));
+			out.setPosition (trackEnd);
+
+			trackStart = -1;
+		}
+
+	private:
+		OutputStream& out;
+		int64 trackStart;
+		int64 lastTime;
+
+		void writeDeltaTime (const int64 time)
+		{
+			jassert (time >= lastTime); // events must be added in order
+
+			writeVariableLength ((int) (time - lastTime));
+			lastTime = time;
+		}
+
+		void writeVariableLength (int value)
+		{
+			uint8 bytes[5];
+			int numBytes = 0;
+
+			bytes [numBytes++] = (uint8) (value & 0x7f);
+
+			while ((value >>= 7) != 0)
+				bytes [numBytes++] = (uint8) ((value & 0x7f) | 0x80);
+
+			while (--numBytes >= 0)
+				out.writeByte ((char) bytes [numBytes]);
+		}
+
+		MidiFileWriter (const MidiFileWriter&);
+		const MidiFileWriter& operator= (const MidiFileWriter&);
+	};
+
+#endif//_MIDIFILEWRITER_H_
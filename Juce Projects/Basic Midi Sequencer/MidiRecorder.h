@@ -0,0 +1,202 @@
+/*
+ *  MidiRecorder.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _MIDIRECORDER_H_
+#define _MIDIRECORDER_H_
+
+#include <juce/juce.h>
+#include "SequencerClock.h"
+#include "LockFreeFifo.h"
+
+/**
+ Records the notes played on a MIDI input, so they can be put into the pattern.
+
+ The input's callback does as little as it can: it stamps each note-on with the
+ SequencerClock time it arrived and pushes it onto a lock-free queue, so it never
+ waits for anything or allocates, however fast the notes come in (if the queue
+ does fill up, the extra notes are dropped and counted). Anything that isn't a
+ note-on is passed on to another callback, e.g. a MidiClockFollower, so one input
+ can do both.
+
+ The message thread takes the notes off the queue with popNote() and works out
+ where they were in the song from the sequencer's playhead (which it passes on
+ with addPlayheadPosition()), and quantise() pulls them towards the nearest step.
+ Then they go into the pattern, which is published like any other edit, so the
+ sequencer thread just picks them up with the next pattern and never knows
+ anything's being recorded.
+ */
+class MidiRecorder : public MidiInputCallback
+	{
+	public:
+		/** A note-on, and when it arrived.
+		 */
+		struct RecordedNote
+		{
+			int64 time;				// a SequencerClock time
+			uint8 channel;			// 1 to 16
+			uint8 note;
+			uint8 velocity;
+		};
+
+		//==============================================================================
+		MidiRecorder()
+			:	isRecordingNow (false),
+				forwardTo (0),
+				notes (1024),
+				numDropped (0),
+				numPositions (0),
+				nextPosition (0)
+		{
+		}
+
+		~MidiRecorder()
+		{
+		}
+
+		//==============================================================================
+		/** Start or stop recording; while it's not recording the notes are ignored.
+		 */
+		void setRecording (const bool shouldRecord) throw()						{ isRecordingNow = shouldRecord; }
+		bool isRecording() const throw()										{ return isRecordingNow; }
+
+		/** Pass everything other than the note-ons to another callback, or 0 for none (it isn't
+			deleted by this object).
+
+		 Only change this while the input's stopped.
+		 */
+		void setForwardTo (MidiInputCallback* const callback) throw()			{ forwardTo = callback; }
+
+		/** The number of notes that were dropped because the queue was full.
+		 */
+		int getNumDropped() const throw()										{ return numDropped; }
+
+		//==============================================================================
+		/** Take the oldest note off the queue, returning false if there aren't any (one thread only).
+		 */
+		bool popNote (RecordedNote& note) throw()								{ return notes.pop (note); }
+
+		/** Tell the recorder that a step of the song (counting from when it started) happens at a time.
+
+		 These must come in order, from the same thread that calls popNote().
+		 */
+		void addPlayheadPosition (const int64 step, const int64 time) throw()
+		{
+			positions [nextPosition].step = step;
+			positions [nextPosition].time = time;
+			nextPosition = (nextPosition + 1) % maxPositions;
+			numPositions = jmin (numPositions + 1, (int) maxPositions);
+		}
+
+		/** Forget where the playhead has been, e.g. when it stops.
+		 */
+		void clearPlayheadPositions() throw()
+		{
+			numPositions = 0;
+			nextPosition = 0;
+		}
+
+		/** Work out where a time was in the song, in steps, returning false if the playhead
+			hadn't got there yet.
+
+		 It's found between the steps the playhead has passed, or after the last one
+		 by guessing that the step lasts as long as the one before (or stepLength
+		 nanoseconds, if there's only been one).
+		 */
+		bool getStepPosition (const int64 time, const double stepLength, double& position) const throw()
+		{
+			// (going back from the latest position)
+			for (int i = 1; i <= numPositions; i++)
+			{
+				const Position& p = getPosition (i);
+
+				if (p.time > time)
+					continue;
+
+				double length = stepLength;
+
+				if (i > 1)
+					length = (double) (getPosition (i - 1).time - p.time);
+				else if (numPositions > 1)
+					length = (double) (p.time - getPosition (2).time);
+
+				position = p.step + (length > 0 ? (time - p.time) / length : 0.0);
+				return true;
+			}
+
+			return false;
+		}
+
+		/** Pull a position towards the nearest whole step: a strength of 1 puts it right on
+			the step, and 0 leaves it where it is.
+		 */
+		static double quantise (const double position, const double strength) throw()
+		{
+			const double nearest = floor (position + 0.5);
+			return position + (nearest - position) * jlimit (0.0, 1.0, strength);
+		}
+
+		//==============================================================================
+		void handleIncomingMidiMessage (MidiInput* source, const MidiMessage& message)
+		{
+			// (the message's own time stamp is on a different, coarser clock)
+			const int64 time = SequencerClock::getNanoseconds();
+
+			if (! message.isNoteOn())
+			{
+				if (forwardTo != 0)
+					forwardTo->handleIncomingMidiMessage (source, message);
+
+				return;
+			}
+
+			if (! isRecordingNow)
+				return;
+
+			RecordedNote note;
+			note.time = time;
+			note.channel = (uint8) message.getChannel();
+			note.note = (uint8) message.getNoteNumber();
+			note.velocity = message.getVelocity();
+
+			if (! notes.push (note))
+				numDropped++;
+		}
+
+	private:
+		//==============================================================================
+		enum { maxPositions = 8 };
+
+		struct Position
+		{
+			int64 step;
+			int64 time;
+		};
+
+		volatile bool isRecordingNow;
+		MidiInputCallback* forwardTo;
+
+		// the input's thread pushes the notes, and the message thread pops them
+		LockFreeFifo<RecordedNote> notes;
+		volatile int numDropped;
+
+		// the last few steps the playhead passed (message thread only)
+		Position positions [maxPositions];
+		int numPositions, nextPosition;
+
+		/** The position n steps back from the latest (1 is the latest).
+		 */
+		const Position& getPosition (const int n) const throw()
+		{
+			return positions [(nextPosition - n + maxPositions) % maxPositions];
+		}
+
+		MidiRecorder (const MidiRecorder&);
+		const MidiRecorder& operator= (const MidiRecorder&);
+	};
+
+#endif//_MIDIRECORDER_H_
@@ -0,0 +1,358 @@
+/*
+ *  MidiSender.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _MIDISENDER_H_
+#define _MIDISENDER_H_
+
+#include <juce/juce.h>
+#include "LockFreeFifo.h"
+#include "SequencerClock.h"
+#include "TimingMonitor.h"
+#include "MidiDestination.h"
+#include "RealtimeScheduling.h"
+
+/**
+ A thread which sends timestamped MIDI messages at the right moment.
+
+ The sequencer works a little way ahead and hands over a block of messages at
+ a time with sendBlock(), where each one's position in the MidiBuffer is its
+ time in microseconds after the start of the block. This thread waits for each
+ one on the SequencerClock and sends it, so the timing depends on the
+ timestamps and not on when the sequencer happened to wake up.
+
+ (MidiOutput::sendBlockOfMessages() does the same sort of thing, but only to
+ the nearest millisecond.)
+
+ The messages can go to a MidiOutput device or to a MidiDestination (or both).
+ Each device should have its own sender, so that one that's slow (or stuck)
+ only holds up its own messages: the queue is lock-free, so the thread handing
+ the messages over never waits, and if the queue fills up the extra messages
+ are dropped and counted.
+
+ Only short messages (up to 4 bytes) can be sent this way; anything longer is
+ dropped.
+
+ It keeps track of which notes it's turned on and not yet off, so when it's
+ stopped sendNotesOff() can turn off just the ones that are left hanging, rather
+ than sending All Notes Off, and when its output's changed to another device
+ the old one gets the same treatment.
+
+ A device is only ever used by the thread while it holds a lock, which
+ setOutput() takes to swap the device over, so once setOutput() has returned
+ the old device is finished with and can be given to another sender, or closed.
+
+ With setRealtime() the thread asks the OS for real-time scheduling when it
+ starts (see RealtimeScheduling), so a busy machine can't keep it waiting.
+ */
+class MidiSender : public Thread
+	{
+	public:
+		MidiSender()
+			:	Thread (T("MIDI Sender")),
+				output (0),
+				destination (0),
+				timingMonitor (0),
+				messages (4096),
+				numDropped (0),
+				realtimeWanted (false),
+				realtimeCpu (-1),
+				schedulingMode (RealtimeScheduling::normal),
+				pinnedCpu (-1)
+		{
+			zeromem (soundingNotes, sizeof (soundingNotes));
+		}
+
+		~MidiSender()
+		{
+			stop();
+		}
+
+		//==============================================================================
+		/** Change the output the messages go to (it isn't deleted by this object).
+
+		 The notes left playing on the old one are turned off, and once this returns
+		 the sender won't use it again. If the thread's in the middle of sending, this
+		 waits for it.
+		 */
+		void setOutput (MidiOutput* const newOutput)
+		{
+			const ScopedLock sl (outputLock);
+
+			if (newOutput != output)
+			{
+				releaseNotes (output);
+				output = newOutput;
+			}
+		}
+
+		MidiOutput* getOutput() const throw()							{ return output; }
+
+		/** Change the in-process destination the messages go to, or 0 for none (it isn't deleted by this object).
+		 */
+		void setDestination (MidiDestination* const newDestination) throw()	{ destination = newDestination; }
+
+		/** True if there's a device or a destination for the messages to go to.
+		 */
+		bool hasSomewhereToSend() const throw()							{ return output != 0 || destination != 0; }
+
+		/** Set a monitor to record how late each message goes out (or 0 for none).
+
+		 Only change this when the thread isn't running.
+		 */
+		void setTimingMonitor (TimingMonitor* const newMonitor) throw()	{ timingMonitor = newMonitor; }
+
+		/** Run the thread with real-time scheduling if the OS allows it, kept on one CPU
+			(or -1 for any).
+
+		 This takes effect the next time it starts.
+		 */
+		void setRealtime (const bool shouldBeRealtime, const int cpu = -1) throw()
+		{
+			realtimeWanted = shouldBeRealtime;
+			realtimeCpu = cpu;
+		}
+
+		/** The scheduling the thread got when it last started.
+		 */
+		RealtimeScheduling::Mode getSchedulingMode() const throw()		{ return (RealtimeScheduling::Mode) schedulingMode; }
+
+		/** The CPU the thread was kept on when it last started, or -1 if it wasn't.
+		 */
+		int getPinnedCpu() const throw()								{ return pinnedCpu; }
+
+		/** Start sending, throwing away anything left over from last time.
+		 */
+		void start()
+		{
+			if (! isThreadRunning())
+			{
+				messages.reset();
+				numDropped = 0;
+				schedulingMode = RealtimeScheduling::normal;
+				pinnedCpu = -1;
+				startThread (10);
+			}
+		}
+
+		/** Stop sending, throwing away anything that hasn't been sent yet.
+
+		 Any notes it's left playing are still playing; see sendNotesOff().
+		 */
+		void stop()
+		{
+			stopThread (1000);
+			messages.reset();
+		}
+
+		/** Send a message straight away, e.g. to tell the output something once it's been
+			stopped (only call this while the thread isn't running).
+		 */
+		void sendMessageNow (const MidiMessage& message)
+		{
+			jassert (! isThreadRunning());
+
+			if (output != 0)
+				output->sendMessageNow (message);
+
+			if (destination != 0)
+				destination->sendMessageNow (message, SequencerClock::getNanoseconds());
+		}
+
+		/** Send note-offs for the notes that were turned on and never turned off (only
+			call this while the thread isn't running).
+		 */
+		void sendNotesOff()
+		{
+			jassert (! isThreadRunning());
+
+			for (int channel = 0; channel < 16; channel++)
+				for (int note = 0; note < 128; note++)
+					if (isNoteSounding (channel, note))
+						sendMessageNow (MidiMessage::noteOff (channel + 1, note));
+
+			zeromem (soundingNotes, sizeof (soundingNotes));
+		}
+
+		/** Queue up a block of messages (this must only be called from one thread).
+
+		 Each message's position in the buffer is the number of microseconds after
+		 blockStartTime (a SequencerClock time) that it should be sent. Blocks must
+		 be sent in time order. Returns the number of messages that were dropped,
+		 because they were too long or the queue was full. If there's nowhere for
+		 them to go, they aren't queued at all.
+		 */
+		int sendBlock (const MidiBuffer& buffer, const int64 blockStartTime)
+		{
+			if (output == 0 && destination == 0)
+				return 0;
+
+			MidiBuffer::Iterator i (buffer);
+			const uint8* data;
+			int size, position;
+			int numDroppedNow = 0;
+
+			while (i.getNextEvent (data, size, position))
+			{
+				TimedMessage m;
+				m.time = blockStartTime + position * (int64) 1000;
+				m.size = size;
+
+				if (size > maxMessageSize)
+				{
+					numDroppedNow++;
+					continue;
+				}
+
+				memcpy (m.data, data, size);
+
+				if (! messages.push (m))
+					numDroppedNow++;
+			}
+
+			notify();
+			numDropped += numDroppedNow;
+			return numDroppedNow;
+		}
+
+		//==============================================================================
+		/** The number of messages waiting to be sent.
+		 */
+		int getNumQueued() const throw()								{ return messages.getNumReady(); }
+
+		/** The number of messages dropped since it started.
+		 */
+		int getNumDropped() const throw()								{ return numDropped; }
+
+		//==============================================================================
+		void run()
+		{
+			// (a thread can only change its own scheduling)
+			if (realtimeWanted)
+			{
+				schedulingMode = RealtimeScheduling::makeCurrentThreadRealtime (realtimePriority);
+
+				if (realtimeCpu >= 0 && RealtimeScheduling::pinCurrentThread (realtimeCpu))
+					pinnedCpu = realtimeCpu;
+
+				RealtimeScheduling::prefaultStack();
+			}
+
+			TimedMessage m;
+
+			while (! threadShouldExit())
+			{
+				if (! messages.peek (m))
+				{
+					wait (100);
+					continue;
+				}
+
+				// if the next message is a long way off, have a nap and check again
+				// (so that we can still be stopped in good time)
+				if (m.time - SequencerClock::getNanoseconds() > 100000000)
+				{
+					wait (50);
+					continue;
+				}
+
+				SequencerClock::waitUntil (m.time);
+				messages.pop (m);
+
+				// (this is only held up if the device is being changed)
+				const ScopedLock sl (outputLock);
+
+				MidiOutput* const out = output;
+				MidiDestination* const dest = destination;
+
+				if (out != 0 || dest != 0)
+				{
+					const MidiMessage message (m.data, m.size);
+
+					if (out != 0)
+						out->sendMessageNow (message);
+
+					if (dest != 0)
+						dest->sendMessageNow (message, m.time);
+
+					// (timed once it's gone, so how long the device takes to send it counts too)
+					if (timingMonitor != 0)
+						timingMonitor->addEvent (m.time, SequencerClock::getNanoseconds());
+
+					updateSoundingNotes (m.data);
+				}
+			}
+		}
+
+	private:
+		// (the senders do the accurately timed part, so they go above the sequencer's thread)
+		enum { maxMessageSize = 4, realtimePriority = 80 };
+
+		struct TimedMessage
+		{
+			int64 time;
+			uint8 data [maxMessageSize];
+			int size;
+		};
+
+		MidiOutput* volatile output;
+		MidiDestination* volatile destination;
+		TimingMonitor* timingMonitor;
+		LockFreeFifo<TimedMessage> messages;
+		volatile int numDropped;
+		bool realtimeWanted;
+		int realtimeCpu;
+		volatile int schedulingMode;
+		volatile int pinnedCpu;
+
+		// the notes that have been turned on and not off (a bit for each note on each channel); while
+		// the thread's running, it's only used with the lock held
+		uint64 soundingNotes [16][2];
+		CriticalSection outputLock;
+
+		void updateSoundingNotes (const uint8* const data) throw()
+		{
+			const int type = data[0] & 0xf0;
+
+			if (type != 0x80 && type != 0x90)
+				return;
+
+			const uint64 bit = (uint64) 1 << (data[1] & 63);
+			uint64& notes = soundingNotes [data[0] & 0x0f][(data[1] >> 6) & 1];
+
+			if (type == 0x90 && data[2] != 0)
+				notes |= bit;
+			else
+				notes &= ~bit;
+		}
+
+		bool isNoteSounding (const int channel, const int note) const throw()
+		{
+			return (soundingNotes [channel][note >> 6] & ((uint64) 1 << (note & 63))) != 0;
+		}
+
+		/** Turn off the notes that are playing on a device that's no longer being used.
+
+		 They're still counted as playing, as the new device gets their note-offs too
+		 when they come, which does no harm.
+		 */
+		void releaseNotes (MidiOutput* const oldOutput)
+		{
+			if (oldOutput == 0)
+				return;
+
+			for (int channel = 0; channel < 16; channel++)
+				for (int note = 0; note < 128; note++)
+					if (isNoteSounding (channel, note))
+						oldOutput->sendMessageNow (MidiMessage::noteOff (channel + 1, note));
+		}
+
+		MidiSender (const MidiSender&);
+		const MidiSender& operator= (const MidiSender&);
+	};
+
+#endif//_MIDISENDER_H_
@@ -0,0 +1,285 @@
+/*
+ *  NoteOffWheel.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _NOTEOFFWHEEL_H_
+#define _NOTEOFFWHEEL_H_
+
+#include <juce/juce.h>
+#include "SequencerPattern.h"
+
+/**
+ The note-offs that are waiting to be played, in a hierarchical timing wheel.
+
+ Time is counted in ticks (whatever the owner likes; a PatternEngine has 64 to
+ a step). The near wheel has a slot for each of the next 256 ticks, and the far
+ wheel a slot for each of the 63 blocks of 256 ticks after that. Each slot is a
+ linked list, so adding a note-off is just putting it on the list for its tick
+ (or its block, if it's further off), and when the time gets to the start of a
+ block, that block's list is shared out between the near slots. Adding,
+ cancelling and taking out a note-off that's due are all constant time,
+ however many are waiting.
+
+ There can only be one note-off waiting for each note on each channel of each
+ output (a note that's played again before it's finished has to be turned off
+ first), so they can be looked up by note, e.g. to cancel one.
+
+ All the memory is allocated in the constructor, so it can be used on the
+ sequencer thread.
+ */
+class NoteOffWheel
+	{
+	public:
+		enum { nearSlots = 256, farSlots = 64, maxTicksAhead = nearSlots * (farSlots - 1) };
+
+		struct NoteOff
+		{
+			int64 tick;
+			int track;				// the track that played it, so a track's notes can be turned off together
+			uint8 output;
+			uint8 channel;			// 1 to 16
+			uint8 note;
+		};
+
+		//==============================================================================
+		/** Create a wheel with room for a number of note-offs.
+		 */
+		NoteOffWheel (const int capacity_)
+			:	capacity (capacity_)
+		{
+			entries = new Entry [capacity];
+			noteIndex = new int [numKeys];
+			clear();
+		}
+
+		~NoteOffWheel()
+		{
+			delete[] entries;
+			delete[] noteIndex;
+		}
+
+		//==============================================================================
+		/** Forget all the note-offs, without playing them.
+		 */
+		void clear() throw()
+		{
+			for (int i = 0; i < nearSlots; i++)
+				nearWheel[i] = -1;
+
+			for (int i = 0; i < farSlots; i++)
+				farWheel[i] = -1;
+
+			for (int i = 0; i < numKeys; i++)
+				noteIndex[i] = -1;
+
+			// (all the entries go on the free list)
+			for (int i = 0; i < capacity; i++)
+			{
+				entries[i].isWaiting = false;
+				entries[i].next = i + 1 < capacity ? i + 1 : -1;
+			}
+
+			firstFree = capacity > 0 ? 0 : -1;
+			numWaiting = 0;
+			currentTick = 0;
+		}
+
+		/** Add a note-off, returning false if there's no room for it.
+
+		 There mustn't be one for the same note already (see find()). If its tick has
+		 already gone, it's played with the next ones that are due; if it's more than
+		 maxTicksAhead away it's brought forward to then.
+		 */
+		bool add (const int64 tick, const int track, const int output, const int channel, const int note) throw()
+		{
+			const int key = getKey (output, channel, note);
+			jassert (noteIndex [key] < 0);
+
+			if (firstFree < 0 || noteIndex [key] >= 0)
+				return false;
+
+			const int index = firstFree;
+			Entry& e = entries [index];
+			firstFree = e.next;
+
+			e.noteOff.tick = jlimit (currentTick, currentTick + maxTicksAhead, tick);
+			e.noteOff.track = track;
+			e.noteOff.output = (uint8) output;
+			e.noteOff.channel = (uint8) channel;
+			e.noteOff.note = (uint8) note;
+			e.isWaiting = true;
+
+			link (index);
+			noteIndex [key] = index;
+			numWaiting++;
+			return true;
+		}
+
+		/** Find the note-off waiting for a note, returning its index or -1 if there isn't one.
+		 */
+		int find (const int output, const int channel, const int note) const throw()
+		{
+			return noteIndex [getKey (output, channel, note)];
+		}
+
+		/** Take a note-off out without playing it.
+		 */
+		void remove (const int index) throw()
+		{
+			Entry& e = entries [index];
+			jassert (e.isWaiting);
+
+			unlink (index);
+			noteIndex [getKey (e.noteOff.output, e.noteOff.channel, e.noteOff.note)] = -1;
+			e.isWaiting = false;
+			e.next = firstFree;
+			firstFree = index;
+			numWaiting--;
+		}
+
+		/** Take out the next note-off that's due before a tick, returning false once there
+			aren't any more.
+
+		 The time moves on to endTick as they're taken out, e.g.
+
+		 @code
+		 NoteOffWheel::NoteOff noteOff;
+
+		 while (wheel.popNextDue (endTick, noteOff))
+			 ...play it...
+		 @endcode
+
+		 If there aren't any waiting the time can go anywhere, backwards included.
+		 */
+		bool popNextDue (const int64 endTick, NoteOff& noteOff) throw()
+		{
+			while (numWaiting > 0 && currentTick < endTick)
+			{
+				const int index = nearWheel [(int) (currentTick & nearMask)];
+
+				if (index >= 0)
+				{
+					noteOff = entries [index].noteOff;
+					remove (index);
+					return true;
+				}
+
+				// at the start of each block its note-offs come down from the far wheel
+				if ((++currentTick & nearMask) == 0)
+					cascade();
+			}
+
+			if (numWaiting == 0)
+				currentTick = endTick;
+
+			return false;
+		}
+
+		//==============================================================================
+		int getNumWaiting() const throw()									{ return numWaiting; }
+		int getCapacity() const throw()										{ return capacity; }
+
+		/** The time it's got to: nothing before this is still waiting.
+		 */
+		int64 getCurrentTick() const throw()								{ return currentTick; }
+
+		/** The note-off at an index, or 0 if there isn't one there.
+
+		 This is for going through all of them, e.g. to turn everything off.
+		 */
+		const NoteOff* getNoteOff (const int index) const throw()
+		{
+			return entries [index].isWaiting ? &(entries [index].noteOff) : 0;
+		}
+
+	private:
+		//==============================================================================
+		enum { nearMask = nearSlots - 1, blockShift = 8, numKeys = SequencerPattern::maxOutputs * 16 * 128 };
+
+		struct Entry
+		{
+			NoteOff noteOff;
+			int previous, next;
+			int slot;				// 0 to nearSlots - 1 on the near wheel, above that on the far one
+			bool isWaiting;
+		};
+
+		const int capacity;
+		Entry* entries;
+		int* noteIndex;				// the entry for each note, or -1
+		int nearWheel [nearSlots];
+		int farWheel [farSlots];
+		int firstFree, numWaiting;
+		int64 currentTick;
+
+		static int getKey (const int output, const int channel, const int note) throw()
+		{
+			return ((output * 16) + ((channel - 1) & 15)) * 128 + (note & 127);
+		}
+
+		int& getSlotHead (const int slot) throw()
+		{
+			return slot < nearSlots ? nearWheel [slot] : farWheel [slot - nearSlots];
+		}
+
+		/** Put an entry on the list for its tick, or its block if that's not in the near wheel's range.
+		 */
+		void link (const int index) throw()
+		{
+			Entry& e = entries [index];
+
+			// (anything less than a whole turn of the near wheel away can go straight on it, as
+			// its slot won't come round before then)
+			if (e.noteOff.tick - currentTick < nearSlots)
+				e.slot = (int) (e.noteOff.tick & nearMask);
+			else
+				e.slot = nearSlots + (int) ((e.noteOff.tick >> blockShift) & (farSlots - 1));
+
+			int& head = getSlotHead (e.slot);
+			e.previous = -1;
+			e.next = head;
+
+			if (head >= 0)
+				entries [head].previous = index;
+
+			head = index;
+		}
+
+		void unlink (const int index) throw()
+		{
+			Entry& e = entries [index];
+
+			if (e.previous >= 0)
+				entries [e.previous].next = e.next;
+			else
+				getSlotHead (e.slot) = e.next;
+
+			if (e.next >= 0)
+				entries [e.next].previous = e.previous;
+		}
+
+		/** Move the note-offs for the block that's just started onto the near wheel.
+		 */
+		void cascade() throw()
+		{
+			int& head = farWheel [(int) ((currentTick >> blockShift) & (farSlots - 1))];
+			int index = head;
+			head = -1;
+
+			while (index >= 0)
+			{
+				const int next = entries [index].next;
+				link (index);
+				index = next;
+			}
+		}
+
+		NoteOffWheel (const NoteOffWheel&);
+		const NoteOffWheel& operator= (const NoteOffWheel&);
+	};
+
+#endif//_NOTEOFFWHEEL_H_
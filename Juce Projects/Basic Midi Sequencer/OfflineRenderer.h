@@ -0,0 +1,189 @@
+/*
+ *  OfflineRenderer.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _OFFLINERENDERER_H_
+#define _OFFLINERENDERER_H_
+
+#include <juce/juce.h>
+#include "SequencerPattern.h"
+#include "PatternEngine.h"
+#include "MidiFileWriter.h"
+#include "TempoMap.h"
+
+/**
+ Renders a pattern to a Standard MIDI File as fast as it can.
+
+ This goes through the same PatternEngine as the live sequencer, but instead of
+ waiting for each step it just works out its time in ticks, so hours of music
+ take a moment. The file is type 1: the first track has the time signature and
+ the tempo map, then there's one track for each track of the pattern that's
+ switched on. Each track is written in a separate pass through the song, so
+ nothing has to be held in memory however long it is.
+
+ A MIDI file can only change tempo suddenly, so a ramp in the tempo map is
+ written as a change on every step of it, each making that step last just as
+ long as it does in the map.
+ */
+class OfflineRenderer
+	{
+	public:
+		enum { stepsPerBar = 16, ticksPerQuarterNote = 960, ticksPerStep = ticksPerQuarterNote / 4 };
+
+		/** Render a number of bars of the pattern to a stream, at the tempo (or tempos) in the map.
+		 */
+		static void render (const SequencerPattern& pattern,
+							const int numBars,
+							const TempoMap& tempoMap,
+							OutputStream& out)
+		{
+			const int64 numSteps = (int64) numBars * stepsPerBar;
+			const int64 endTime = numSteps * ticksPerStep;
+
+			PatternEngine* const engine = new PatternEngine();
+			engine->compile (pattern);
+			engine->setEndStep (numSteps);
+
+			int numTracksToWrite = 0;
+
+			for (int t = 0; t < pattern.numTracks; t++)
+				if (pattern.tracks[t].enabled)
+					numTracksToWrite++;
+
+			MidiFileWriter writer (out, numTracksToWrite + 1, ticksPerQuarterNote);
+
+			// the tempo track
+			writer.startTrack();
+			writer.addTimeSignature (0, 4, 4);
+
+			writeTempoMap (writer, tempoMap, (int) numSteps);
+			writer.endTrack (endTime);
+
+			// then one pass through the song for each track
+			for (int t = 0; t < pattern.numTracks; t++)
+			{
+				if (! pattern.tracks[t].enabled)
+					continue;
+
+				const uint64 trackMask = (uint64) 1 << t;
+				FileNoteSink sink (writer);
+
+				writer.startTrack();
+				engine->resetNotes();
+
+				for (int64 step = 0; step < numSteps; step++)
+				{
+					sink.time = step * ticksPerStep;
+					engine->renderStep (pattern, step, sink, trackMask);
+				}
+
+				sink.time = endTime;
+				engine->renderNotesOff (sink, trackMask);
+				writer.endTrack (endTime);
+			}
+
+			delete engine;
+		}
+
+		/** Render to a file, returning false if it couldn't be written.
+		 */
+		static bool renderToFile (const SequencerPattern& pattern,
+								  const int numBars,
+								  const TempoMap& tempoMap,
+								  const File& file)
+		{
+			file.deleteFile();
+			FileOutputStream* const out = file.createOutputStream();
+
+			if (out == 0)
+				return false;
+
+			render (pattern, numBars, tempoMap, *out);
+			delete out;
+
+			return true;
+		}
+
+	private:
+		/** Write the tempo of each segment that starts before the end, and of each step of a ramp.
+		 */
+		static void writeTempoMap (MidiFileWriter& writer, const TempoMap& tempoMap, const int numSteps)
+		{
+			for (int i = 0; i < tempoMap.getNumSegments(); i++)
+			{
+				const TempoMap::Segment segment (tempoMap.getSegment (i));
+
+				if (segment.startStep >= numSteps)
+					break;
+
+				if (segment.curve == TempoMap::constant || i + 1 == tempoMap.getNumSegments())
+				{
+					writer.addTempo ((int64) segment.startStep * ticksPerStep, segment.tempo);
+					continue;
+				}
+
+				const int endStep = jmin (numSteps, tempoMap.getSegment (i + 1).startStep);
+
+				for (int step = segment.startStep; step < endStep; step++)
+				{
+					// a step is a 16th note, so one lasting t seconds is at 15 / t bpm
+					const int64 length = tempoMap.getTimeOfStep (step + 1) - tempoMap.getTimeOfStep (step);
+					writer.addTempo ((int64) step * ticksPerStep, 15.0e9 / (double) length);
+				}
+			}
+		}
+
+		/** Sends the engine's notes to the file at the current time.
+		 */
+		class FileNoteSink
+			{
+			public:
+				FileNoteSink (MidiFileWriter& writer_)
+					:	time (0),
+						writer (writer_),
+						delay (0)
+				{
+				}
+
+				void setDelay (const float proportionOfStep)
+				{
+					delay = roundFloatToInt (proportionOfStep * ticksPerStep);
+				}
+
+				// (a file has all the tracks, whichever output they're on)
+				void setOutput (const int)
+				{
+				}
+
+				void noteOn (const int channel, const int note, const float velocity)
+				{
+					// (the same rounding as MidiMessage::noteOn)
+					const uint8 data[3] = { (uint8) (0x90 | (channel - 1)), (uint8) note,
+											(uint8) jlimit (0, 127, roundFloatToInt (velocity * 127.0f)) };
+					writer.addEvent (time + delay, data, 3);
+				}
+
+				void noteOff (const int channel, const int note)
+				{
+					const uint8 data[3] = { (uint8) (0x80 | (channel - 1)), (uint8) note, 0 };
+					writer.addEvent (time + delay, data, 3);
+				}
+
+				int64 time;
+
+			private:
+				MidiFileWriter& writer;
+				int delay;
+
+				const FileNoteSink& operator= (const FileNoteSink&);
+			};
+
+		OfflineRenderer();
+		OfflineRenderer (const OfflineRenderer&);
+	};
+
+#endif//_OFFLINERENDERER_H_
@@ -0,0 +1,406 @@
+/*
+ *  PatternBank.cpp
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#include "PatternBank.h"
+
+#if JUCE_WIN32
+ #define WIN32_LEAN_AND_MEAN
+ #define NOGDI
+ #define NOMINMAX
+ #include <windows.h>
+#else
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+#endif
+
+//==============================================================================
+/** Map a whole file read-only, returning 0 if it can't be, or it's empty or bigger than maxSize.
+ */
+static void* mapFile (const File& file, const int64 maxSize, int64& size, void*& mappingHandle)
+{
+	void* data = 0;
+	mappingHandle = 0;
+
+#if JUCE_WIN32
+	const String path (file.getFullPathName());
+	const HANDLE h = CreateFileW ((const WCHAR*) (const tchar*) path, GENERIC_READ, FILE_SHARE_READ, 0,
+								  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+
+	if (h == INVALID_HANDLE_VALUE)
+		return 0;
+
+	LARGE_INTEGER fileSize;
+
+	if (GetFileSizeEx (h, &fileSize) && fileSize.QuadPart > 0 && fileSize.QuadPart <= maxSize)
+	{
+		const HANDLE mapping = CreateFileMapping (h, 0, PAGE_READONLY, 0, 0, 0);
+
+		if (mapping != 0)
+		{
+			data = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+
+			if (data != 0)
+			{
+				size = fileSize.QuadPart;
+				mappingHandle = mapping;
+			}
+			else
+			{
+				CloseHandle (mapping);
+			}
+		}
+	}
+
+	// (the mapping keeps the file open for as long as it needs it)
+	CloseHandle (h);
+#else
+	const int fd = open (file.getFullPathName().toUTF8(), O_RDONLY);
+
+	if (fd < 0)
+		return 0;
+
+	struct stat info;
+
+	if (fstat (fd, &info) == 0 && info.st_size > 0 && info.st_size <= maxSize)
+	{
+		data = mmap (0, (size_t) info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+		if (data != MAP_FAILED)
+			size = info.st_size;
+		else
+			data = 0;
+	}
+
+	close (fd);
+#endif
+
+	return data;
+}
+
+void PatternBank::unmap (void* data, const int64 size, void* mappingHandle)
+{
+#if JUCE_WIN32
+	UnmapViewOfFile (data);
+	CloseHandle ((HANDLE) mappingHandle);
+#else
+	munmap (data, (size_t) size);
+#endif
+}
+
+//==============================================================================
+PatternBank::PatternBank (const File& file_, void* mappedData_, const int64 mappedSize_, void* mappingHandle_)
+	:	file (file_),
+		mappedData (mappedData_),
+		mappedSize (mappedSize_),
+		mappingHandle (mappingHandle_),
+		patterns ((const SequencerPattern*) (((const char*) mappedData_) + headerSize)),
+		numPatterns ((int) ((const Header*) mappedData_)->numPatterns)
+{
+}
+
+PatternBank::~PatternBank()
+{
+	unmap (mappedData, mappedSize, mappingHandle);
+}
+
+PatternBank* PatternBank::openFile (const File& file)
+{
+	int64 size = 0;
+	void* mappingHandle = 0;
+	void* const data = mapFile (file, headerSize + (int64) maxPatterns * sizeof (SequencerPattern), size, mappingHandle);
+
+	if (data == 0)
+		return 0;
+
+	// the patterns have to be laid out just as this build lays them out
+	const Header& header = *(const Header*) data;
+
+	if (size < headerSize
+		 || memcmp (header.magic, "SEQBANK", 8) != 0
+		 || header.byteOrder != 0x01020304
+		 || header.formatVersion != formatVersion
+		 || header.headerSize != headerSize
+		 || header.patternSize != sizeof (SequencerPattern)
+		 || header.maxTracks != SequencerPattern::maxTracks
+		 || header.maxSteps != SequencerPattern::maxSteps
+		 || header.numPatterns > maxPatterns
+		 || size < headerSize + (int64) header.numPatterns * (int64) sizeof (SequencerPattern))
+	{
+		unmap (data, size, mappingHandle);
+		return 0;
+	}
+
+	PatternBank* const bank = new PatternBank (file, data, size, mappingHandle);
+
+	// (a pattern that's out of range could make the sequencer read past the end of something,
+	// or work out nonsense times for its notes)
+	for (int i = 0; i < bank->numPatterns; i++)
+	{
+		if (! isValidPattern (bank->patterns[i]))
+		{
+			delete bank;
+			return 0;
+		}
+	}
+
+	return bank;
+}
+
+//==============================================================================
+bool PatternBank::writeFile (const File& file, const Array<const SequencerPattern*>& patternsToWrite)
+{
+	if (patternsToWrite.size() > maxPatterns)
+		return false;
+
+	// it's written to another file and moved over the old one at the end, so a bank that's
+	// open on the old file (maybe with the sequencer playing from it) isn't changed under it
+	const File tempFile (file.getSiblingFile (file.getFileName() + T(".tmp")));
+	tempFile.deleteFile();
+
+	FileOutputStream* const out = tempFile.createOutputStream();
+
+	if (out == 0)
+		return false;
+
+	uint32 headerData [headerSize / sizeof (uint32)];
+	zeromem (headerData, sizeof (headerData));
+
+	Header& header = *(Header*) headerData;
+	memcpy (header.magic, "SEQBANK", 8);
+	header.byteOrder = 0x01020304;
+	header.formatVersion = formatVersion;
+	header.headerSize = headerSize;
+	header.patternSize = sizeof (SequencerPattern);
+	header.maxTracks = SequencerPattern::maxTracks;
+	header.maxSteps = SequencerPattern::maxSteps;
+	header.numPatterns = patternsToWrite.size();
+
+	bool ok = out->write (headerData, headerSize);
+
+	for (int i = 0; ok && i < patternsToWrite.size(); i++)
+		ok = out->write (patternsToWrite.getUnchecked (i), sizeof (SequencerPattern));
+
+	delete out;
+
+	if (ok)
+		ok = tempFile.moveFileTo (file);
+
+	if (! ok)
+		tempFile.deleteFile();
+
+	return ok;
+}
+
+//==============================================================================
+XmlElement* PatternBank::createXml (const Array<const SequencerPattern*>& patternsToWrite)
+{
+	XmlElement* const bankXml = new XmlElement (T("PATTERNBANK"));
+	bankXml->setAttribute (T("version"), (int) xmlVersion);
+
+	for (int i = 0; i < patternsToWrite.size(); i++)
+	{
+		const SequencerPattern& p = *patternsToWrite.getUnchecked (i);
+		XmlElement* const patternXml = new XmlElement (T("PATTERN"));
+		patternXml->setAttribute (T("tempo"), p.tempo);
+		patternXml->setAttribute (T("seed"), (int) p.randomSeed);
+
+		for (int t = 0; t < p.numTracks; t++)
+		{
+			const SequencerTrack& track = p.tracks[t];
+			XmlElement* const trackXml = new XmlElement (T("TRACK"));
+			trackXml->setAttribute (T("length"), track.length);
+			trackXml->setAttribute (T("note"), track.note);
+			trackXml->setAttribute (T("channel"), track.channel);
+			trackXml->setAttribute (T("output"), track.output);
+			trackXml->setAttribute (T("velocity"), track.velocity);
+			trackXml->setAttribute (T("swing"), track.swing);
+			trackXml->setAttribute (T("gate"), track.gate);
+			trackXml->setAttribute (T("enabled"), track.enabled ? 1 : 0);
+
+			// the steps are a string of x's and dots, and the notes, delays and so on (if there
+			// are any) a number for each step, with a dash for a step that plays the track's note
+			String steps, notes, delays, ratchets, chances, nudges;
+			bool hasNotes = false, hasDelays = false, hasRatchets = false, hasChances = false, hasNudges = false;
+
+			for (int step = 0; step < track.length; step++)
+			{
+				const String space (step > 0 ? T(" ") : T(""));
+
+				steps << (track.isStepOn (step) ? T("x") : T("."));
+
+				if (p.stepNotes[t][step] == SequencerPattern::useTrackNote)
+					notes << space << T("-");
+				else
+					notes << space << (int) p.stepNotes[t][step];
+
+				delays << space << (int) p.stepDelays[t][step];
+				ratchets << space << (int) p.stepRatchets[t][step];
+				chances << space << (int) p.stepChances[t][step];
+				nudges << space << (int) p.stepNudges[t][step];
+				hasNotes = hasNotes || p.stepNotes[t][step] != SequencerPattern::useTrackNote;
+				hasDelays = hasDelays || p.stepDelays[t][step] != 0;
+				hasRatchets = hasRatchets || p.stepRatchets[t][step] != 0;
+				hasChances = hasChances || p.stepChances[t][step] != 0;
+				hasNudges = hasNudges || p.stepNudges[t][step] != 0;
+			}
+
+			trackXml->setAttribute (T("steps"), steps);
+
+			if (hasNotes)
+				trackXml->setAttribute (T("notes"), notes);
+
+			if (hasDelays)
+				trackXml->setAttribute (T("delays"), delays);
+
+			if (hasRatchets)
+				trackXml->setAttribute (T("ratchets"), ratchets);
+
+			if (hasChances)
+				trackXml->setAttribute (T("chances"), chances);
+
+			if (hasNudges)
+				trackXml->setAttribute (T("nudges"), nudges);
+
+			patternXml->addChildElement (trackXml);
+		}
+
+		bankXml->addChildElement (patternXml);
+	}
+
+	return bankXml;
+}
+
+// (the same range TempoMap keeps its tempos to)
+static const double minTempo = 1.0, maxTempo = 10000.0;
+
+/** True if a value read from a file is a number between the limits (which a NaN never is).
+ */
+static bool isInRange (const double value, const double minimum, const double maximum) throw()
+{
+	return value >= minimum && value <= maximum;
+}
+
+/** Keep a value read from a file between the limits, using the default if it isn't a number at all.
+ */
+static double limitAttribute (const double value, const double minimum, const double maximum, const double defaultValue) throw()
+{
+	if (value != value)
+		return defaultValue;
+
+	return jlimit (minimum, maximum, value);
+}
+
+bool PatternBank::loadFromXml (const XmlElement& xml, OwnedArray<SequencerPattern>& patternsRead)
+{
+	if (! xml.hasTagName (T("PATTERNBANK")))
+		return false;
+
+	// (before version 2 there was no dash, and a 0 meant the track's note)
+	const bool zeroIsTrackNote = xml.getIntAttribute (T("version"), 1) < 2;
+
+	for (const XmlElement* patternXml = xml.getFirstChildElement(); patternXml != 0; patternXml = patternXml->getNextElement())
+	{
+		if (! patternXml->hasTagName (T("PATTERN")))
+			return false;
+
+		SequencerPattern* const p = new SequencerPattern();
+		p->tempo = limitAttribute (patternXml->getDoubleAttribute (T("tempo"), 120.0), minTempo, maxTempo, 120.0);
+		p->randomSeed = (uint32) patternXml->getIntAttribute (T("seed"), 0);
+
+		for (const XmlElement* trackXml = patternXml->getFirstChildElement(); trackXml != 0; trackXml = trackXml->getNextElement())
+		{
+			// (addTrack() keeps everything in range)
+			const int t = p->addTrack (trackXml->getIntAttribute (T("length"), 16),
+									   trackXml->getIntAttribute (T("note"), 60),
+									   trackXml->getIntAttribute (T("channel"), 1),
+									   (float) limitAttribute (trackXml->getDoubleAttribute (T("velocity"), 1.0), 0.0, 1.0, 1.0));
+
+			if (t < 0)
+				break;
+
+			SequencerTrack& track = p->tracks[t];
+			track.output = (uint8) jlimit (0, (int) SequencerPattern::maxOutputs - 1, trackXml->getIntAttribute (T("output"), 0));
+			track.swing = (float) limitAttribute (trackXml->getDoubleAttribute (T("swing"), 0.0),
+												  0.0, SequencerTrack::maxSwingPercent / 100.0, 0.0);
+			track.gate = (float) limitAttribute (trackXml->getDoubleAttribute (T("gate"), 1.0),
+												 0.0, (double) SequencerTrack::maxGateSteps, 1.0);
+			track.enabled = trackXml->getIntAttribute (T("enabled"), 1) != 0;
+
+			const String steps (trackXml->getStringAttribute (T("steps")));
+
+			for (int step = 0; step < track.length && step < steps.length(); step++)
+				track.setStepOn (step, steps[step] == T('x'));
+
+			StringArray notes, delays, ratchets, chances, nudges;
+			notes.addTokens (trackXml->getStringAttribute (T("notes")), T(" "), String::empty);
+			delays.addTokens (trackXml->getStringAttribute (T("delays")), T(" "), String::empty);
+			ratchets.addTokens (trackXml->getStringAttribute (T("ratchets")), T(" "), String::empty);
+			chances.addTokens (trackXml->getStringAttribute (T("chances")), T(" "), String::empty);
+			nudges.addTokens (trackXml->getStringAttribute (T("nudges")), T(" "), String::empty);
+
+			for (int step = 0; step < track.length && step < notes.size(); step++)
+			{
+				const int note = notes[step].getIntValue();
+
+				if (notes[step] == T("-") || (zeroIsTrackNote && note == 0))
+					p->stepNotes[t][step] = SequencerPattern::useTrackNote;
+				else
+					p->stepNotes[t][step] = (uint8) jlimit (0, 127, note);
+			}
+
+			for (int step = 0; step < track.length && step < delays.size(); step++)
+				p->stepDelays[t][step] = (uint8) jlimit (0, 255, delays[step].getIntValue());
+
+			for (int step = 0; step < track.length && step < ratchets.size(); step++)
+				p->stepRatchets[t][step] = (uint8) jlimit (0, (int) SequencerPattern::maxRatchets, ratchets[step].getIntValue());
+
+			for (int step = 0; step < track.length && step < chances.size(); step++)
+				p->stepChances[t][step] = (uint8) jlimit (0, 100, chances[step].getIntValue());
+
+			for (int step = 0; step < track.length && step < nudges.size(); step++)
+				p->stepNudges[t][step] = (int8) jlimit (-(int) SequencerPattern::maxNudge, (int) SequencerPattern::maxNudge,
+														nudges[step].getIntValue());
+		}
+
+		patternsRead.add (p);
+	}
+
+	return true;
+}
+
+//==============================================================================
+bool PatternBank::isValidPattern (const SequencerPattern& pattern) throw()
+{
+	if (pattern.numTracks < 0 || pattern.numTracks > SequencerPattern::maxTracks
+		 || ! isInRange (pattern.tempo, minTempo, maxTempo))
+		return false;
+
+	for (int t = 0; t < pattern.numTracks; t++)
+	{
+		const SequencerTrack& track = pattern.tracks[t];
+
+		if (track.length < 1 || track.length > SequencerPattern::maxSteps
+			 || track.note > 127 || track.channel < 1 || track.channel > 16
+			 || track.output >= SequencerPattern::maxOutputs
+			 || ! isInRange (track.velocity, 0.0, 1.0)
+			 || ! isInRange (track.swing, 0.0, SequencerTrack::maxSwingPercent / 100.0)
+			 || ! isInRange (track.gate, 0.0, (double) SequencerTrack::maxGateSteps))
+			return false;
+
+		for (int step = 0; step < SequencerPattern::maxSteps; step++)
+			if ((pattern.stepNotes[t][step] > 127 && pattern.stepNotes[t][step] != SequencerPattern::useTrackNote)
+				 || pattern.stepRatchets[t][step] > SequencerPattern::maxRatchets
+				 || pattern.stepChances[t][step] > 100
+				 || pattern.stepNudges[t][step] < -SequencerPattern::maxNudge)
+				return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,108 @@
+/*
+ *  PatternBank.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _PATTERNBANK_H_
+#define _PATTERNBANK_H_
+
+#include <juce/juce.h>
+#include "SequencerPattern.h"
+
+/**
+ A file of patterns, memory-mapped so they can be played straight from it.
+
+ The file is a small header followed by the patterns one after another, each
+ exactly as a SequencerPattern is laid out in memory. So opening a bank is just
+ mapping the file and checking it, however many patterns it has, and a pattern
+ is just a pointer into the mapping, which can be handed to
+ Sequencer::cuePattern() without copying, parsing or allocating anything.
+
+ Because the patterns are stored as they are in memory, a bank can only be read
+ by a build of the app with the same pattern layout (the header says what it
+ was written with, and openFile() refuses anything different). For swapping
+ patterns with anything else there's an XML version: see createXml().
+
+ The patterns are checked when the bank's opened (which also brings the whole
+ file into memory, so switching to one later shouldn't have to wait for the
+ disk). The mapping is read-only, and stays until the bank is deleted.
+ */
+class PatternBank
+	{
+	public:
+		enum { maxPatterns = 16384 };
+
+		/** Map a bank file, returning 0 if it couldn't be opened or isn't a bank this build can read.
+		 */
+		static PatternBank* openFile (const File& file);
+
+		~PatternBank();
+
+		//==============================================================================
+		int getNumPatterns() const throw()										{ return numPatterns; }
+
+		/** One of the patterns, which stays where it is until the bank is deleted.
+		 */
+		const SequencerPattern& getPattern (const int index) const throw()
+		{
+			jassert (index >= 0 && index < numPatterns);
+			return patterns [index];
+		}
+
+		const File& getFile() const throw()										{ return file; }
+
+		//==============================================================================
+		/** Write some patterns out as a bank file, returning false if it couldn't be written.
+		 */
+		static bool writeFile (const File& file, const Array<const SequencerPattern*>& patternsToWrite);
+
+		/** Describe some patterns as XML, for other programs to read (the caller deletes it).
+		 */
+		static XmlElement* createXml (const Array<const SequencerPattern*>& patternsToWrite);
+
+		/** Read the patterns back from XML made by createXml(), returning false if it isn't
+			that kind of XML (the patterns that have been read are still added).
+		 */
+		static bool loadFromXml (const XmlElement& xml, OwnedArray<SequencerPattern>& patternsRead);
+
+		/** Check that a pattern's in range, so it's safe to play.
+		 */
+		static bool isValidPattern (const SequencerPattern& pattern) throw();
+
+	private:
+		//==============================================================================
+		/** The start of the file: the patterns start headerSize bytes in.
+		 */
+		struct Header
+		{
+			char magic [8];				// "SEQBANK" and a 0
+			uint32 byteOrder;			// 0x01020304, as the machine that wrote it stores it
+			uint32 formatVersion;
+			uint32 headerSize;
+			uint32 patternSize;			// sizeof (SequencerPattern)
+			uint32 maxTracks;
+			uint32 maxSteps;
+			uint32 numPatterns;
+		};
+
+		enum { formatVersion = 3, headerSize = 64, xmlVersion = 2 };
+
+		const File file;
+		void* mappedData;
+		int64 mappedSize;
+		void* mappingHandle;				// (only used on Windows)
+		const SequencerPattern* patterns;
+		int numPatterns;
+
+		PatternBank (const File& file, void* mappedData, const int64 mappedSize, void* mappingHandle);
+
+		static void unmap (void* data, const int64 size, void* mappingHandle);
+
+		PatternBank (const PatternBank&);
+		const PatternBank& operator= (const PatternBank&);
+	};
+
+#endif//_PATTERNBANK_H_
@@ -0,0 +1,622 @@
+/*
+ *  PatternEngine.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _PATTERNENGINE_H_
+#define _PATTERNENGINE_H_
+
+#include <juce/juce.h>
+#include "SequencerPattern.h"
+#include "NoteOffWheel.h"
+
+/**
+ Works out which tracks of a pattern hit on each step, quickly.
+
+ When a new pattern arrives, compile() turns the tracks' step bitsets round the
+ other way: the tracks are grouped by length, and each group gets a 64-bit mask
+ for each of its steps with a bit set for every track that hits there. Finding
+ the hits for a step is then one mask lookup per distinct track length, ORed
+ together, however many tracks and steps there are. Muted tracks are left out
+ of the masks, so they cost nothing at all.
+
+ renderStep() turns a step into notes. It sends them to a 'sink', which can be
+ anything with these methods:
+
+ @code
+ void setDelay (float proportionOfStep);
+ void setOutput (int output);
+ void noteOn (int channel, int note, float velocity);
+ void noteOff (int channel, int note);
+ @endcode
+
+ so the same code plays the pattern live (see MidiBufferNoteSink) and writes it
+ to a file. setDelay() is called before each track's notes, with how far after
+ the step they should go (because of the track's swing and the step's own
+ delay, which never add up to a whole step); the sink works out what that
+ means in time, as only it knows how long the step is. setOutput() is called
+ before each note, with the output its track is routed to.
+
+ Each note lasts for its track's gate length, so when it's played its note-off
+ goes into a NoteOffWheel, and comes out again on whichever step it's due (with
+ a delay to put it in the right place within the step). A step's messages are
+ only the notes starting and ending there, and muting a track doesn't leave
+ anything hanging, as the note-offs that are waiting still get played.
+
+ A step can also be ratcheted (played several times, evenly spaced across the
+ step), left to chance, or nudged off the grid, either way. These are all just
+ more notes at different delays, so they go out with the step's other messages,
+ timestamped like the rest, and cost the sequencer thread no extra wake-ups.
+ A ratchet's later hits can fall into the next step, and a note nudged early
+ into the step before, so renderStep() looks at the steps either side as well
+ as its own, and plays whatever falls inside the step it's rendering. Only the
+ tracks that have any ratchets or early nudges are looked at on the neighbouring
+ steps (and only those with any chances have their dice thrown), so a pattern
+ without them costs hardly any more than it did. The notes are
+ sorted by the tick they fall in (with a list for each tick of the step), so
+ each one goes after the note-offs that are due before it.
+
+ Whether a step left to chance plays is decided by hashing the pattern's seed
+ with the track and the step, rather than by a generator that moves on each
+ time. It's as quick, and it means a step always makes the same choice however
+ many times it's looked at, so a note that's rendered from a neighbouring step
+ is never played (or skipped) twice, and a file plays back the same as the
+ pattern did with the same seed.
+
+ If a step's early notes weren't played on the step before (it's just started,
+ or jumped, or the pattern's changed in between so they weren't the same notes)
+ they go on the step instead, as it's too late for them. The engine remembers
+ which tracks' early notes it did play, and only leaves those out.
+
+ All the memory is allocated in the constructor, so compile() can be called on
+ the sequencer thread.
+ */
+class PatternEngine
+	{
+	public:
+		// (there's a bit of a 64-bit mask for each tick of a step, when sorting the notes)
+		enum { ticksPerStep = 64 };
+
+		/** The furthest after its step a note can go, so it's always before the next step.
+		 */
+		static float getMaxDelay() throw()										{ return 255.0f / 256.0f; }
+
+		PatternEngine()
+			:	numGroups (0),
+				compiledVersion (0),
+				hasCompiled (false),
+				ratchetTracks (0),
+				earlyTracks (0),
+				chanceTracks (0),
+				endStep (-1),
+				earlyPlayed (0),
+				noteOffs (SequencerPattern::maxTracks * (SequencerTrack::maxGateSteps + SequencerPattern::maxRatchets + 2))
+		{
+			masks = new uint64 [SequencerPattern::maxTracks * SequencerPattern::maxSteps];
+			hits = new Hit [maxHitsPerStep];
+			resetNotes();
+		}
+
+		~PatternEngine()
+		{
+			delete[] masks;
+			delete[] hits;
+		}
+
+		//==============================================================================
+		/** Rebuild the masks if the pattern has changed since last time.
+		 */
+		void compile (const SequencerPattern& pattern) throw()
+		{
+			if (hasCompiled && pattern.version == compiledVersion)
+				return;
+
+			hasCompiled = true;
+			compiledVersion = pattern.version;
+			numGroups = 0;
+			ratchetTracks = 0;
+			earlyTracks = 0;
+			chanceTracks = 0;
+			int numMasksUsed = 0;
+
+			for (int t = 0; t < pattern.numTracks; t++)
+			{
+				const SequencerTrack& track = pattern.tracks[t];
+
+				if (! track.enabled)
+					continue;
+
+				Group* group = findGroup (track.length);
+
+				if (group == 0)
+				{
+					group = groups + numGroups++;
+					group->length = track.length;
+					group->masks = masks + numMasksUsed;
+					numMasksUsed += track.length;
+
+					zeromem (group->masks, track.length * sizeof (uint64));
+				}
+
+				const uint64 trackBit = (uint64) 1 << t;
+
+				for (int step = 0; step < track.length; step++)
+				{
+					if (track.isStepOn (step))
+					{
+						group->masks [step] |= trackBit;
+
+						// (these are the tracks that can have notes on the steps either side)
+						if (pattern.getRatchets (t, step) > 1)
+							ratchetTracks |= trackBit;
+
+						if (pattern.stepNudges [t][step] < 0)
+							earlyTracks |= trackBit;
+
+						if (pattern.getChance (t, step) < 100)
+							chanceTracks |= trackBit;
+					}
+				}
+			}
+		}
+
+		/** Make the next compile() rebuild the masks, whatever the pattern's version.
+
+		 This is for going between patterns that weren't published by the same
+		 Sequencer, whose versions can't be compared. The notes the old pattern
+		 nudged early into the step before aren't the new one's, so the new one's
+		 early notes go on their step.
+		 */
+		void invalidate() throw()
+		{
+			hasCompiled = false;
+			earlyPlayed = 0;
+		}
+
+		/** Stop at a step (counting from the start of the song), so nothing is nudged early out of it
+			or any step after it, e.g. at the end of a block of a song whose next block plays
+			something else, or before a bar line where another pattern's been cued. -1 is for no end.
+		 */
+		void setEndStep (const int64 step) throw()
+		{
+			endStep = step;
+		}
+
+		/** A mask of the tracks which hit on a step, counting from the start of the song.
+		 */
+		uint64 getHits (const int64 step) const throw()
+		{
+			uint64 hits = 0;
+
+			for (int i = 0; i < numGroups; i++)
+				hits |= groups[i].masks [(int) (step % groups[i].length)];
+
+			return hits;
+		}
+
+		/** Add the notes for a step (counting from the start of the song) to a sink, and
+			the note-offs that are due during it.
+
+		 Only the tracks in trackMask are played. The pattern must be the one last
+		 passed to compile(). If the step is before the last one (e.g. it's jumped
+		 back), everything that's still playing is turned off first.
+		 */
+		template <class NoteSink>
+		void renderStep (const SequencerPattern& pattern, const int64 step, NoteSink& sink,
+						 const uint64 trackMask = ~(uint64) 0) throw()
+		{
+			const int64 stepTick = step * ticksPerStep;
+
+			if (stepTick < noteOffs.getCurrentTick())
+				renderNotesOff (sink);
+
+			const bool followsLast = (step == nextStep);
+			const uint64 playedEarly = followsLast ? earlyPlayed : 0;
+			nextStep = step + 1;
+			earlyPlayed = 0;
+
+			// find the notes that fall inside this step: this step's own, then (only for the tracks
+			// that have any) the later hits of the last step's ratchets, if that was played, and
+			// the next step's notes that are nudged early into this one
+			numHits = 0;
+			usedTicks = 0;
+
+			addHits (pattern, step, step, getHits (step) & trackMask, playedEarly);
+
+			if (followsLast && step > 0 && (ratchetTracks & trackMask) != 0)
+				addHits (pattern, step - 1, step, getHits (step - 1) & ratchetTracks & trackMask, 0);
+
+			if ((earlyTracks & trackMask) != 0 && (endStep < 0 || step + 1 < endStep))
+				addHits (pattern, step + 1, step, getHits (step + 1) & earlyTracks & trackMask, 0);
+
+			// the note-offs that are due right on the step go before its notes, so a note can
+			// finish and start again..
+			renderNoteOffsDue (sink, stepTick, stepTick + 1);
+
+			// ..then the notes go in order, each after the note-offs due before it..
+			while (usedTicks != 0)
+			{
+				const int tick = findLowestBit (usedTicks);
+				usedTicks &= usedTicks - 1;
+
+				renderNoteOffsDue (sink, stepTick, stepTick + tick + 1);
+
+				for (int i = firstHits [tick]; i >= 0; i = hits[i].next)
+					renderHit (pattern, hits[i], stepTick, sink);
+			}
+
+			// ..and the rest of the note-offs that are due before the next step, including any
+			// of this step's that are shorter than a step
+			renderNoteOffsDue (sink, stepTick, stepTick + ticksPerStep);
+		}
+
+		/** Send note offs straight away for all the notes that are still playing on the tracks in trackMask.
+		 */
+		template <class NoteSink>
+		void renderNotesOff (NoteSink& sink, const uint64 trackMask = ~(uint64) 0) throw()
+		{
+			sink.setDelay (0.0f);
+
+			for (int i = 0; i < noteOffs.getCapacity(); i++)
+			{
+				const NoteOffWheel::NoteOff* const noteOff = noteOffs.getNoteOff (i);
+
+				if (noteOff != 0 && (trackMask & ((uint64) 1 << noteOff->track)) != 0)
+				{
+					sink.setOutput (noteOff->output);
+					sink.noteOff (noteOff->channel, noteOff->note);
+					noteOffs.remove (i);
+				}
+			}
+		}
+
+		/** Forget which notes are playing, without turning them off, e.g. when starting again.
+		 */
+		void resetNotes() throw()
+		{
+			noteOffs.clear();
+			nextStep = -1;
+			earlyPlayed = 0;
+		}
+
+		/** The number of notes that are still playing.
+		 */
+		int getNumNotesPlaying() const throw()
+		{
+			return noteOffs.getNumWaiting();
+		}
+
+		/** How long a track's notes last, in ticks (at least one).
+		 */
+		static int getGateTicks (const SequencerTrack& track) throw()
+		{
+			return jlimit (1, (int) SequencerTrack::maxGateSteps * ticksPerStep, roundFloatToInt (track.gate * ticksPerStep));
+		}
+
+		/** The position of a track within its own length on a step, counting from the start of the song.
+		 */
+		static int getTrackStep (const SequencerTrack& track, const int64 step) throw()
+		{
+			return (int) (step % track.length);
+		}
+
+		/** How far after a step a track's notes go, as a proportion of the step.
+
+		 Swing pushes back every other step (the off-beat 16ths).
+		 */
+		static float getSwingDelay (const SequencerTrack& track, const int64 step) throw()
+		{
+			return (step & 1) != 0 ? jlimit (0.0f, SequencerTrack::maxSwingPercent / 100.0f, track.swing) : 0.0f;
+		}
+
+		/** Where a track's (first) note on a step goes, as a proportion of the step from it: its
+			swing, delay and nudge together, which are never a whole step either way.
+		 */
+		static float getStepOffset (const SequencerPattern& pattern, const int track, const int64 step) throw()
+		{
+			const SequencerTrack& t = pattern.tracks [track];
+			const int trackStep = getTrackStep (t, step);
+
+			return jlimit (-getMaxDelay(), getMaxDelay(),
+						   getSwingDelay (t, step) + pattern.getStepDelay (track, trackStep) + pattern.getStepNudge (track, trackStep));
+		}
+
+		/** Whether a track plays on a step that's left to chance (counting from the start of the song).
+
+		 This is a hash of the pattern's seed, the track and the step, so it's always the
+		 same for the same step.
+		 */
+		static bool isChosen (const SequencerPattern& pattern, const int track, const int64 step) throw()
+		{
+			const int chance = pattern.getChance (track, getTrackStep (pattern.tracks [track], step));
+
+			if (chance >= 100)
+				return true;
+
+			// (MurmurHash3's finishing mix, which spreads every bit of the input over the output)
+			uint32 x = pattern.randomSeed ^ ((uint32) track * 0x9e3779b9) ^ ((uint32) step * 0x85ebca6b)
+						^ ((uint32) (step >> 32) * 0xc2b2ae35);
+			x ^= x >> 16;
+			x *= 0x85ebca6b;
+			x ^= x >> 13;
+			x *= 0xc2b2ae35;
+			x ^= x >> 16;
+
+			return (int) (x % 100) < chance;
+		}
+
+		/** Find the lowest set bit in a mask of hits, e.g.
+
+			@code
+			while (hits != 0)
+			{
+				const int track = PatternEngine::findLowestBit (hits);
+				hits &= hits - 1;
+				...
+			}
+			@endcode
+		 */
+		static int findLowestBit (const uint64 mask) throw()
+		{
+			// (a de Bruijn sequence, which works the same on any compiler)
+			static const int positions[64] =
+			{
+				 0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+				62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+				63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+				46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6
+			};
+
+			const uint64 debruijn = ((uint64) 0x03f79d71 << 32) | (uint64) 0xb4cb0a89;
+			return positions [((mask & (0 - mask)) * debruijn) >> 58];
+		}
+
+	private:
+		struct Group
+		{
+			int length;
+			uint64* masks;
+		};
+
+		Group groups [SequencerPattern::maxTracks];
+		int numGroups;
+		uint64* masks;
+		uint32 compiledVersion;
+		bool hasCompiled;
+
+		// the tracks with any ratcheted steps, with any nudged early, and with any left to chance
+		uint64 ratchetTracks, earlyTracks, chanceTracks;
+		int64 endStep, nextStep;
+
+		// the tracks whose notes on nextStep were nudged early and played on the step before
+		uint64 earlyPlayed;
+
+		// the notes that fall inside the step being rendered, with a list for each tick (kept
+		// in order of delay, with its first and last), and a bit set in usedTicks for each one that has any; a track
+		// can only have notes from three steps inside one step, and each step's ratchets
+		// can only put maxRatchets of them there
+		struct Hit
+		{
+			float delay;
+			int track, note, gateTicks;
+			int next;
+		};
+
+		enum { maxHitsPerStep = SequencerPattern::maxTracks * 3 * SequencerPattern::maxRatchets };
+
+		Hit* hits;
+		int numHits;
+		int firstHits [ticksPerStep], lastHits [ticksPerStep];
+		uint64 usedTicks;
+
+		// the notes that are playing, waiting for their note-offs
+		NoteOffWheel noteOffs;
+
+		/** Add the hits a track's notes on a step make inside the step being rendered (which
+			is the same step, or the one before or after it). For the step's own notes,
+			playedEarly says which tracks had theirs nudged early played on the step before.
+		 */
+		void addHits (const SequencerPattern& pattern, const int64 sourceStep, const int64 step,
+					  uint64 trackMask, const uint64 playedEarly) throw()
+		{
+			while (trackMask != 0)
+			{
+				const int t = findLowestBit (trackMask);
+				const uint64 trackBit = (uint64) 1 << t;
+				trackMask &= trackMask - 1;
+
+				if ((chanceTracks & trackBit) != 0 && ! isChosen (pattern, t, sourceStep))
+					continue;
+
+				const SequencerTrack& track = pattern.tracks[t];
+				const int trackStep = getTrackStep (track, sourceStep);
+				const int numRatchets = pattern.getRatchets (t, trackStep);
+				float offset = getStepOffset (pattern, t, sourceStep);
+
+				// (if the step before didn't play this track's early notes, they go on the step instead)
+				if (offset < 0.0f && sourceStep == step && (playedEarly & trackBit) == 0)
+					offset = 0.0f;
+
+				// a ratchet's notes are each cut short before the next one
+				const int gateTicks = numRatchets > 1 ? jmin (getGateTicks (track), (int) ticksPerStep / numRatchets)
+													  : getGateTicks (track);
+
+				const int stepsAfterSource = (int) (step - sourceStep);
+
+				for (int i = 0; i < numRatchets; i++)
+				{
+					// (which step a hit's in is worked out from its position relative to its own
+					// step, so it's the same whichever step it's looked at from)
+					const float position = offset + i / (float) numRatchets;
+
+					if (position >= stepsAfterSource && position < stepsAfterSource + 1)
+					{
+						addHit (t, pattern.getNote (t, trackStep), position - stepsAfterSource, gateTicks);
+
+						if (sourceStep > step)
+							earlyPlayed |= trackBit;
+					}
+				}
+			}
+		}
+
+		void addHit (const int track, const int note, const float delay, const int gateTicks) throw()
+		{
+			if (numHits >= maxHitsPerStep)
+				return;
+
+			Hit& hit = hits [numHits];
+			hit.delay = delay;
+			hit.track = track;
+			hit.note = note;
+			hit.gateTicks = gateTicks;
+
+			// it goes in the list for the tick it starts in, after any with a smaller delay (which
+			// is nearly always on the end, as most of a tick's notes have the same delay)
+			const int tick = jlimit (0, (int) ticksPerStep - 1, (int) (delay * ticksPerStep));
+			const int index = numHits++;
+
+			if ((usedTicks & ((uint64) 1 << tick)) == 0)
+			{
+				hit.next = -1;
+				firstHits [tick] = lastHits [tick] = index;
+				usedTicks |= (uint64) 1 << tick;
+			}
+			else if (hits [lastHits [tick]].delay <= delay)
+			{
+				hit.next = -1;
+				hits [lastHits [tick]].next = index;
+				lastHits [tick] = index;
+			}
+			else
+			{
+				int* link = firstHits + tick;
+
+				while (hits [*link].delay <= delay)
+					link = &(hits [*link].next);
+
+				hit.next = *link;
+				*link = index;
+			}
+		}
+
+		template <class NoteSink>
+		void renderHit (const SequencerPattern& pattern, const Hit& hit, const int64 stepTick, NoteSink& sink) throw()
+		{
+			const SequencerTrack& track = pattern.tracks [hit.track];
+
+			sink.setDelay (hit.delay);
+			sink.setOutput (track.output);
+
+			// if the note's still playing from before (because it's tied over), it has to stop first
+			const int waiting = noteOffs.find (track.output, track.channel, hit.note);
+
+			if (waiting >= 0)
+			{
+				noteOffs.remove (waiting);
+				sink.noteOff (track.channel, hit.note);
+			}
+
+			sink.noteOn (track.channel, hit.note, track.velocity);
+
+			// (there's always room, as no track can have more than maxGateSteps + maxRatchets + 1 notes playing at once)
+			const int64 onTick = stepTick + roundFloatToInt (hit.delay * ticksPerStep);
+
+			if (! noteOffs.add (onTick + hit.gateTicks, hit.track, track.output, track.channel, hit.note))
+				sink.noteOff (track.channel, hit.note);
+		}
+
+		/** Add the note-offs from the wheel that are due before a tick, placed within the step they're in.
+		 */
+		template <class NoteSink>
+		void renderNoteOffsDue (NoteSink& sink, const int64 stepTick, const int64 endTick) throw()
+		{
+			NoteOffWheel::NoteOff noteOff;
+
+			while (noteOffs.popNextDue (endTick, noteOff))
+			{
+				// (one that's overdue, because steps were skipped, goes straight away)
+				sink.setDelay (jmax (0, (int) (noteOff.tick - stepTick)) / (float) ticksPerStep);
+				sink.setOutput (noteOff.output);
+				sink.noteOff (noteOff.channel, noteOff.note);
+			}
+		}
+
+		Group* findGroup (const int length) throw()
+		{
+			for (int i = 0; i < numGroups; i++)
+				if (groups[i].length == length)
+					return groups + i;
+
+			return 0;
+		}
+
+		PatternEngine (const PatternEngine&);
+		const PatternEngine& operator= (const PatternEngine&);
+	};
+
+//==============================================================================
+/**
+ A PatternEngine note sink which adds the notes to a MidiBuffer for a step.
+
+ The time is the step's position in the buffer, and any swing delay is worked
+ out from the length of the step (both in the buffer's units).
+
+ If there's an array of buffers for the outputs (SequencerPattern::maxOutputs of
+ them), each note is also added to the one for its output.
+ */
+class MidiBufferNoteSink
+	{
+	public:
+		MidiBufferNoteSink (MidiBuffer& buffer_, const int stepTime_, const int stepLength_ = 0,
+							MidiBuffer* const outputBuffers_ = 0)
+			:	buffer (buffer_),
+				outputBuffers (outputBuffers_),
+				stepTime (stepTime_),
+				stepLength (stepLength_),
+				time (stepTime_),
+				output (0)
+		{
+		}
+
+		void setDelay (const float proportionOfStep)
+		{
+			time = stepTime + roundFloatToInt (proportionOfStep * stepLength);
+		}
+
+		void setOutput (const int newOutput)
+		{
+			output = jlimit (0, (int) SequencerPattern::maxOutputs - 1, newOutput);
+		}
+
+		void noteOn (const int channel, const int note, const float velocity)
+		{
+			add (MidiMessage::noteOn (channel, note, velocity));
+		}
+
+		void noteOff (const int channel, const int note)
+		{
+			add (MidiMessage::noteOff (channel, note));
+		}
+
+	private:
+		MidiBuffer& buffer;
+		MidiBuffer* const outputBuffers;
+		const int stepTime, stepLength;
+		int time, output;
+
+		void add (const MidiMessage& message)
+		{
+			buffer.addEvent (message, time);
+
+			if (outputBuffers != 0)
+				outputBuffers [output].addEvent (message, time);
+		}
+
+		const MidiBufferNoteSink& operator= (const MidiBufferNoteSink&);
+	};
+
+#endif//_PATTERNENGINE_H_
@@ -0,0 +1,452 @@
+/*
+ *  PolySynth.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _POLYSYNTH_H_
+#define _POLYSYNTH_H_
+
+#include <juce/juce.h>
+#include "Float4.h"
+#include "LockFreeSnapshot.h"
+
+/**
+ A simple polyphonic synth for playing the sequencer's melody without a MIDI device.
+
+ Each voice is a band-limited sawtooth (a PolyBLEP oscillator, which takes the
+ corners off the jumps so there's very little aliasing), through a resonant
+ lowpass filter (a state variable filter) with an ADSR envelope on both the level
+ and the cutoff.
+
+ The voices are stored in groups of four, one per Float4 lane, and each group is
+ rendered in one go, so 64 voices is just 16 times round the inner loop. Groups
+ with nothing playing are skipped. The envelope stages and filter coefficients
+ are updated every controlBlockSize samples rather than every sample.
+
+ Everything is allocated in the constructor; noteOn(), noteOff() and render()
+ are for the audio thread and never allocate or lock.
+ */
+class PolySynth
+	{
+	public:
+		/** The sound, which can be changed from the message thread while it's playing.
+		 */
+		struct Parameters
+		{
+			float attack, decay, sustain, release;	// times in seconds, sustain 0 to 1
+			float cutoff;							// in Hz
+			float resonance;						// 0 to 1
+			float envelopeAmount;					// how many times the cutoff the envelope adds
+			float gain;
+
+			Parameters()
+				:	attack (0.005f),
+					decay (0.3f),
+					sustain (0.6f),
+					release (0.2f),
+					cutoff (800.0f),
+					resonance (0.3f),
+					envelopeAmount (4.0f),
+					gain (0.2f)
+			{
+			}
+		};
+
+		enum { controlBlockSize = 32 };
+
+		PolySynth (const int maxVoices = 64)
+			:	parameters (Parameters()),
+				numGroups ((maxVoices + 3) / 4),
+				sampleRate (44100.0),
+				voiceCounter (0)
+		{
+			groupMemory = new char [numGroups * sizeof (VoiceGroup) + 16];
+			groups = (VoiceGroup*) (((size_t) groupMemory + 15) & ~(size_t) 15);
+			zeromem (groups, numGroups * sizeof (VoiceGroup));
+
+			voices = new VoiceInfo [numGroups * 4];
+
+			mixMemory = new char [controlBlockSize * sizeof (Float4) + 16];
+			mix = (Float4*) (((size_t) mixMemory + 15) & ~(size_t) 15);
+
+			allNotesOff (true);
+			updateCoefficients (parameters.read());
+		}
+
+		~PolySynth()
+		{
+			delete[] groupMemory;
+			delete[] voices;
+			delete[] mixMemory;
+		}
+
+		//==============================================================================
+		/** Change the sound (the message thread only).
+		 */
+		void setParameters (const Parameters& newParameters)
+		{
+			parameters.publish (newParameters);
+		}
+
+		/** Must be called before playing, when nothing else is using the synth.
+		 */
+		void setSampleRate (const double newSampleRate)
+		{
+			sampleRate = newSampleRate;
+			allNotesOff (true);
+			updateCoefficients (parameters.read());
+		}
+
+		int getMaxVoices() const throw()				{ return numGroups * 4; }
+
+		/** The number of voices that are making a sound (the audio thread only).
+		 */
+		int getNumActiveVoices() const throw()
+		{
+			int n = 0;
+
+			for (int i = 0; i < numGroups * 4; i++)
+				if (voices[i].stage != idle)
+					n++;
+
+			return n;
+		}
+
+		//==============================================================================
+		void noteOn (const int note, const float velocity) throw()
+		{
+			const int voice = findVoiceToUse();
+			VoiceGroup& g = groups [voice >> 2];
+			VoiceInfo& info = voices [voice];
+			const int lane = voice & 3;
+
+			const double frequency = 440.0 * pow (2.0, (note - 69) / 12.0);
+			const float increment = (float) jmin (0.45, frequency / sampleRate);
+
+			// a stolen voice carries on from where its envelope had got to, to avoid a click
+			if (info.stage == idle)
+			{
+				g.phase[lane] = 0.0f;
+				g.level[lane] = 0.0f;
+				g.ic1[lane] = 0.0f;
+				g.ic2[lane] = 0.0f;
+			}
+
+			g.increment[lane] = increment;
+			g.inverseIncrement[lane] = 1.0f / increment;
+			g.gain[lane] = velocity;
+
+			info.note = note;
+			info.stage = attack;
+			info.startedAt = voiceCounter++;
+
+			setStageCoefficients (g, lane, attack);
+			updateFilter (g, lane);
+		}
+
+		void noteOff (const int note) throw()
+		{
+			for (int i = 0; i < numGroups * 4; i++)
+			{
+				if (voices[i].note == note && (voices[i].stage == attack || voices[i].stage == decay))
+				{
+					voices[i].stage = release;
+					setStageCoefficients (groups [i >> 2], i & 3, release);
+				}
+			}
+		}
+
+		/** Release all the notes, or silence them straight away.
+		 */
+		void allNotesOff (const bool immediately) throw()
+		{
+			for (int i = 0; i < numGroups * 4; i++)
+			{
+				VoiceInfo& info = voices[i];
+
+				if (immediately)
+				{
+					stopVoice (i);
+				}
+				else if (info.stage == attack || info.stage == decay)
+				{
+					info.stage = release;
+					setStageCoefficients (groups [i >> 2], i & 3, release);
+				}
+			}
+		}
+
+		/** Add the next numSamples of output to a buffer (the audio thread only).
+		 */
+		void render (float* output, int numSamples) throw()
+		{
+			const Parameters& p = parameters.read();
+
+			if (memcmp (&p, &currentParameters, sizeof (Parameters)) != 0)
+				updateCoefficients (p);
+
+			while (numSamples > 0)
+			{
+				const int num = jmin ((int) controlBlockSize, numSamples);
+
+				updateStages();
+				renderGroups (num);
+
+				for (int i = 0; i < num; i++)
+					output[i] += mix[i].sum();
+
+				output += num;
+				numSamples -= num;
+			}
+		}
+
+	private:
+		//==============================================================================
+		enum Stage { idle, attack, decay, release };
+
+		/** Everything that's worked on in the inner loop, for four voices.
+		 */
+		struct VoiceGroup
+		{
+			Float4 phase, increment, inverseIncrement;		// the oscillator, in cycles
+			Float4 level, levelCoefficient, levelTarget;		// the envelope, which moves towards the target
+			Float4 ic1, ic2, a1, a2, a3;						// the filter's state and coefficients
+			Float4 gain;
+		};
+
+		/** Everything else about a voice.
+		 */
+		struct VoiceInfo
+		{
+			int note;
+			int stage;
+			int startedAt;
+		};
+
+		LockFreeSnapshot<Parameters> parameters;
+		Parameters currentParameters;
+
+		const int numGroups;
+		char* groupMemory;
+		VoiceGroup* groups;
+		VoiceInfo* voices;
+		char* mixMemory;
+		Float4* mix;
+
+		double sampleRate;
+		int voiceCounter;
+
+		// the envelope coefficients for each stage, worked out from the parameters
+		float attackCoefficient, decayCoefficient, releaseCoefficient;
+		float filterK;
+
+		//==============================================================================
+		/** The coefficient to move a fraction of the way to the target each sample, with a time constant in seconds.
+		 */
+		float getCoefficient (const float timeConstant) const throw()
+		{
+			return (float) exp (-1.0 / jmax (1.0, timeConstant * sampleRate));
+		}
+
+		void updateCoefficients (const Parameters& p) throw()
+		{
+			currentParameters = p;
+
+			// the attack aims past 1 so it doesn't slow right down at the top, and reaches 1 after
+			// about 1.5 time constants; the others reach the target (near enough) after about 5
+			attackCoefficient = getCoefficient (p.attack / 1.5f);
+			decayCoefficient = getCoefficient (p.decay / 5.0f);
+			releaseCoefficient = getCoefficient (p.release / 5.0f);
+			filterK = 2.0f - 1.95f * jlimit (0.0f, 1.0f, p.resonance);
+
+			for (int i = 0; i < numGroups * 4; i++)
+				if (voices[i].stage != idle)
+					setStageCoefficients (groups [i >> 2], i & 3, voices[i].stage);
+		}
+
+		void setStageCoefficients (VoiceGroup& g, const int lane, const int stage) throw()
+		{
+			float coefficient = 1.0f, target = 0.0f;
+
+			switch (stage)
+			{
+				case attack:	coefficient = attackCoefficient;	target = 1.3f; break;
+				case decay:		coefficient = decayCoefficient;		target = currentParameters.sustain; break;
+				case release:	coefficient = releaseCoefficient;	target = 0.0f; break;
+				default:		break;
+			}
+
+			// (level = target + (level - target) * coefficient, rearranged for the inner loop)
+			g.levelCoefficient[lane] = coefficient;
+			g.levelTarget[lane] = target * (1.0f - coefficient);
+		}
+
+		/** Work out the filter's coefficients from where the envelope has got to.
+		 */
+		void updateFilter (VoiceGroup& g, const int lane) throw()
+		{
+			const Parameters& p = currentParameters;
+			const double cutoff = jmin (sampleRate * 0.45, (double) p.cutoff * (1.0 + p.envelopeAmount * g.level[lane]));
+			const float gCoefficient = (float) tan (double_Pi * cutoff / sampleRate);
+
+			g.a1[lane] = 1.0f / (1.0f + gCoefficient * (gCoefficient + filterK));
+			g.a2[lane] = gCoefficient * g.a1[lane];
+			g.a3[lane] = gCoefficient * g.a2[lane];
+		}
+
+		/** Move the voices on through their envelopes, once per control block.
+		 */
+		void updateStages() throw()
+		{
+			for (int i = 0; i < numGroups * 4; i++)
+			{
+				VoiceInfo& info = voices[i];
+
+				if (info.stage == idle)
+					continue;
+
+				VoiceGroup& g = groups [i >> 2];
+				const int lane = i & 3;
+
+				if (info.stage == attack && g.level[lane] >= 1.0f)
+				{
+					g.level[lane] = 1.0f;
+					info.stage = decay;
+					setStageCoefficients (g, lane, decay);
+				}
+				else if (info.stage == release && g.level[lane] < 0.0001f)
+				{
+					stopVoice (i);
+					continue;
+				}
+
+				updateFilter (g, lane);
+			}
+		}
+
+		void stopVoice (const int voice) throw()
+		{
+			VoiceGroup& g = groups [voice >> 2];
+			const int lane = voice & 3;
+
+			voices[voice].note = -1;
+			voices[voice].stage = idle;
+			voices[voice].startedAt = 0;
+
+			g.phase[lane] = g.level[lane] = g.gain[lane] = 0.0f;
+			g.ic1[lane] = g.ic2[lane] = 0.0f;
+			g.increment[lane] = 0.0f;
+			g.inverseIncrement[lane] = 1.0f;
+			g.levelCoefficient[lane] = 1.0f;
+			g.levelTarget[lane] = 0.0f;
+			g.a1[lane] = 1.0f;
+			g.a2[lane] = g.a3[lane] = 0.0f;
+		}
+
+		/** A free voice, or if there aren't any the oldest one that's been released, or failing that the oldest one.
+		 */
+		int findVoiceToUse() const throw()
+		{
+			int oldest = 0, oldestReleased = -1;
+
+			for (int i = 0; i < numGroups * 4; i++)
+			{
+				const VoiceInfo& info = voices[i];
+
+				if (info.stage == idle)
+					return i;
+
+				if (info.startedAt - voices[oldest].startedAt < 0)
+					oldest = i;
+
+				if (info.stage == release
+					 && (oldestReleased < 0 || info.startedAt - voices[oldestReleased].startedAt < 0))
+					oldestReleased = i;
+			}
+
+			return oldestReleased >= 0 ? oldestReleased : oldest;
+		}
+
+		bool isGroupActive (const int group) const throw()
+		{
+			const VoiceInfo* const v = voices + group * 4;
+			return (v[0].stage | v[1].stage | v[2].stage | v[3].stage) != idle;
+		}
+
+		/** Render every group that's playing into the mix, four voices at a time.
+		 */
+		void renderGroups (const int numSamples) throw()
+		{
+			const Float4 zero (Float4::broadcast (0.0f));
+			const Float4 one (Float4::broadcast (1.0f));
+			const Float4 two (Float4::broadcast (2.0f));
+
+			for (int i = 0; i < numSamples; i++)
+				mix[i] = zero;
+
+			for (int group = 0; group < numGroups; group++)
+			{
+				if (! isGroupActive (group))
+					continue;
+
+				VoiceGroup& g = groups [group];
+
+				Float4 phase (g.phase), level (g.level), ic1 (g.ic1), ic2 (g.ic2);
+				const Float4 increment (g.increment), inverseIncrement (g.inverseIncrement);
+				const Float4 levelCoefficient (g.levelCoefficient), levelTarget (g.levelTarget);
+				const Float4 a1 (g.a1), a2 (g.a2), a3 (g.a3), gain (g.gain);
+				const Float4 oneMinusIncrement (one - increment);
+
+				for (int i = 0; i < numSamples; i++)
+				{
+					// a naive sawtooth..
+					Float4 x (phase * two - one);
+
+					// ..with the PolyBLEP residual taken off either side of the jump
+					const Float4 t1 (phase * inverseIncrement);
+					const Float4 t2 ((phase - one) * inverseIncrement);
+
+					x = x - Float4::selectOrZero (phase.isLessThan (increment), t1 + t1 - t1 * t1 - one);
+					x = x - Float4::selectOrZero (oneMinusIncrement.isLessThan (phase), t2 * t2 + t2 + t2 + one);
+
+					phase = phase + increment;
+					phase = phase - Float4::selectOrZero (phase.isGreaterOrEqual (one), one);
+
+					// the filter (a trapezoidal state variable filter, lowpass output)
+					const Float4 v3 (x - ic2);
+					const Float4 v1 (a1 * ic1 + a2 * v3);
+					const Float4 v2 (ic2 + a2 * ic1 + a3 * v3);
+					ic1 = v1 * two - ic1;
+					ic2 = v2 * two - ic2;
+
+					// and the envelope
+					level = level * levelCoefficient + levelTarget;
+
+					mix[i] = mix[i] + v2 * level * gain;
+				}
+
+				g.phase = phase;
+				g.level = level;
+				g.ic1 = ic1;
+				g.ic2 = ic2;
+			}
+
+			const float masterGain = currentParameters.gain;
+
+			if (masterGain != 1.0f)
+			{
+				const Float4 m (Float4::broadcast (masterGain));
+
+				for (int i = 0; i < numSamples; i++)
+					mix[i] = mix[i] * m;
+			}
+		}
+
+		PolySynth (const PolySynth&);
+		const PolySynth& operator= (const PolySynth&);
+	};
+
+#endif//_POLYSYNTH_H_
@@ -0,0 +1,166 @@
+/*
+ *  RealtimeScheduling.cpp
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#include "RealtimeScheduling.h"
+
+#if JUCE_WIN32
+ #define WIN32_LEAN_AND_MEAN
+ #define NOGDI
+ #define NOMINMAX
+ #include <windows.h>
+#elif JUCE_MAC
+ #include <mach/mach.h>
+ #include <mach/mach_time.h>
+ #include <mach/thread_policy.h>
+ #include <sys/mman.h>
+#else
+ #include <pthread.h>
+ #include <sched.h>
+ #include <errno.h>
+ #include <sys/mman.h>
+ #include <sys/resource.h>
+#endif
+
+//==============================================================================
+#if JUCE_WIN32
+
+RealtimeScheduling::Mode RealtimeScheduling::makeCurrentThreadRealtime (const int) throw()
+{
+	return SetThreadPriority (GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) ? timeCritical : normal;
+}
+
+bool RealtimeScheduling::pinCurrentThread (const int cpu) throw()
+{
+	return cpu >= 0 && cpu < 32 && SetThreadAffinityMask (GetCurrentThread(), ((DWORD_PTR) 1) << cpu) != 0;
+}
+
+bool RealtimeScheduling::lockMemory() throw()
+{
+	// (there's no way to lock everything here, only particular blocks)
+	return false;
+}
+
+void RealtimeScheduling::unlockMemory() throw()
+{
+}
+
+//==============================================================================
+#elif JUCE_MAC
+
+RealtimeScheduling::Mode RealtimeScheduling::makeCurrentThreadRealtime (const int) throw()
+{
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info (&timebase);
+	const double ticksPerMs = 1000000.0 * timebase.denom / timebase.numer;
+
+	// the thread wakes about once a millisecond, needs a fraction of that, and has to have
+	// had it within half a millisecond of waking
+	thread_time_constraint_policy_data_t policy;
+	policy.period = (uint32_t) ticksPerMs;
+	policy.computation = (uint32_t) (ticksPerMs * 0.2);
+	policy.constraint = (uint32_t) (ticksPerMs * 0.5);
+	policy.preemptible = 1;
+
+	return thread_policy_set (mach_thread_self(), THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t) &policy,
+							  THREAD_TIME_CONSTRAINT_POLICY_COUNT) == KERN_SUCCESS ? timeCritical : normal;
+}
+
+bool RealtimeScheduling::pinCurrentThread (const int) throw()
+{
+	// (the Mac only takes hints about which threads should share a CPU)
+	return false;
+}
+
+bool RealtimeScheduling::lockMemory() throw()
+{
+	return mlockall (MCL_CURRENT) == 0;
+}
+
+void RealtimeScheduling::unlockMemory() throw()
+{
+	munlockall();
+}
+
+//==============================================================================
+#else
+
+RealtimeScheduling::Mode RealtimeScheduling::makeCurrentThreadRealtime (const int priority) throw()
+{
+	struct sched_param param;
+	zeromem (&param, sizeof (param));
+	param.sched_priority = jlimit (sched_get_priority_min (SCHED_FIFO), sched_get_priority_max (SCHED_FIFO), priority);
+
+	int result = pthread_setschedparam (pthread_self(), SCHED_FIFO, &param);
+
+	// without root, a user can still be allowed real-time priorities up to a limit
+	if (result == EPERM)
+	{
+		struct rlimit limit;
+
+		if (getrlimit (RLIMIT_RTPRIO, &limit) == 0 && limit.rlim_cur > 0
+			 && (int) limit.rlim_cur < param.sched_priority)
+		{
+			param.sched_priority = (int) limit.rlim_cur;
+			result = pthread_setschedparam (pthread_self(), SCHED_FIFO, &param);
+		}
+	}
+
+	return result == 0 ? fifo : normal;
+}
+
+bool RealtimeScheduling::pinCurrentThread (const int cpu) throw()
+{
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		return false;
+
+	cpu_set_t cpus;
+	CPU_ZERO (&cpus);
+	CPU_SET (cpu, &cpus);
+
+	return pthread_setaffinity_np (pthread_self(), sizeof (cpus), &cpus) == 0;
+}
+
+bool RealtimeScheduling::lockMemory() throw()
+{
+	return mlockall (MCL_CURRENT) == 0;
+}
+
+void RealtimeScheduling::unlockMemory() throw()
+{
+	munlockall();
+}
+
+#endif
+
+//==============================================================================
+void RealtimeScheduling::prefaultStack() throw()
+{
+	// (volatile, so writing it can't be optimised away)
+	volatile char stack [64 * 1024];
+
+	for (int i = 0; i < (int) sizeof (stack); i += 1024)
+		stack[i] = 0;
+
+#if ! JUCE_WIN32
+	// (lockMemory() only locked what was there then, which this thread's stack may not have been;
+	// if it isn't allowed, the stack's at least in memory for now)
+	mlock ((const void*) stack, sizeof (stack));
+#endif
+}
+
+const String RealtimeScheduling::getModeName (const Mode mode)
+{
+	switch (mode)
+	{
+		case timeCritical:	return T("real-time (time-critical)");
+		case fifo:			return T("real-time (SCHED_FIFO)");
+		default:			break;
+	}
+
+	return T("normal scheduling");
+}
@@ -0,0 +1,82 @@
+/*
+ *  RealtimeScheduling.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _REALTIMESCHEDULING_H_
+#define _REALTIMESCHEDULING_H_
+
+#include <juce/juce.h>
+
+/**
+ Puts the sequencer's timing threads into the OS's real-time scheduling, where
+ it's allowed.
+
+ Even the highest JUCE thread priority is an ordinary time-shared one on Linux,
+ so on a busy machine the thread can be kept waiting for whole milliseconds.
+ A real-time thread runs ahead of everything ordinary as soon as it wakes up:
+
+ - on Linux it's SCHED_FIFO, at the priority asked for or the highest the user's
+   allowed (RLIMIT_RTPRIO), whichever's lower
+ - on the Mac it's the time-constraint policy that Core Audio's threads use
+ - on Windows it's time-critical priority
+
+ If it isn't allowed (e.g. a Linux user without permission) the thread carries
+ on with ordinary scheduling, and the caller's told which it got so it can say.
+
+ The thread can also be pinned to one CPU (not on the Mac), and the process's
+ memory locked so none of it gets paged out (not on Windows). lockMemory() only
+ locks what's there already, so anything a real-time thread needs should be
+ allocated before it's called: locking everything allocated afterwards too
+ would count every later allocation (like a whole pattern bank) against the
+ user's RLIMIT_MEMLOCK, and make them fail once it's used up. A thread started
+ afterwards locks its own stack in with prefaultStack().
+ */
+class RealtimeScheduling
+	{
+	public:
+		enum Mode
+		{
+			normal = 0,				// ordinary time-shared scheduling
+			timeCritical,			// the Mac's time-constraint policy, or Windows' time-critical priority
+			fifo					// Linux's SCHED_FIFO
+		};
+
+		/** Try to give the calling thread real-time scheduling, returning what it got.
+
+		 The priority is from 1 to 99, and only counts on Linux (where 99 would be
+		 above the kernel's own real-time threads, so it's best kept lower).
+		 */
+		static Mode makeCurrentThreadRealtime (const int priority) throw();
+
+		/** Try to keep the calling thread on one CPU (counting from 0), returning false if it can't.
+		 */
+		static bool pinCurrentThread (const int cpu) throw();
+
+		/** Touch the next part of the calling thread's stack, so it's already in memory
+			before any time-critical work, and lock it there if that's allowed.
+		 */
+		static void prefaultStack() throw();
+
+		//==============================================================================
+		/** Lock all the memory the process has now into RAM (but not what it allocates later),
+			returning false if it isn't allowed or there's more than RLIMIT_MEMLOCK lets it lock.
+		 */
+		static bool lockMemory() throw();
+
+		/** Undo lockMemory().
+		 */
+		static void unlockMemory() throw();
+
+		//==============================================================================
+		static const String getModeName (const Mode mode);
+
+	private:
+		RealtimeScheduling();
+		RealtimeScheduling (const RealtimeScheduling&);
+	};
+
+#endif//_REALTIMESCHEDULING_H_
@@ -0,0 +1,1057 @@
+/*
+ *  Sequencer.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _SEQUENCER_H_
+#define _SEQUENCER_H_
+
+#include <juce/juce.h>
+#include "SequencerClock.h"
+#include "SequencerPattern.h"
+#include "PatternEngine.h"
+#include "EventTimeline.h"
+#include "LockFreeSnapshot.h"
+#include "LockFreeFifo.h"
+#include "MidiSender.h"
+#include "TimingMonitor.h"
+#include "MidiClockFollower.h"
+#include "MidiRecorder.h"
+#include "RealtimeScheduling.h"
+
+// how far ahead of time the sequencer works out what to play
+#define SEQUENCER_LOOKAHEAD_MS 40
+
+// the most ScheduledMidiDestinations a Sequencer can play to
+#define SEQUENCER_MAX_SCHEDULED_DESTINATIONS 4
+
+/**
+ Plays a SequencerPattern, with no GUI.
+
+ This is the sequencer thread: it works out the messages for each step a little
+ way ahead of time and hands them to a MidiSender, which sends them to a
+ MidiOutput and/or a MidiDestination at exactly the right moment. They're also
+ given straight away to any ScheduledMidiDestinations (e.g. the built-in synth),
+ which do their own timing.
+
+ There are several outputs, each with its own MidiSender (and so its own queue
+ and thread), and each track of the pattern says which one it plays on. So a
+ slow device only ever holds up its own messages, never the other outputs' or
+ this thread. Only the outputs that have a device or a destination have their
+ threads started. The scheduled destinations get every track's messages.
+
+ The pattern is changed with setPattern() from one other thread (normally the
+ message thread), and that thread can follow where the sequencer has got to with
+ getPlayhead(). It can also cue a pattern that's kept somewhere else (e.g. in a
+ memory-mapped PatternBank) to start at the next bar line, which only passes a
+ pointer, so switching between any number of patterns never copies anything.
+
+ In song mode it plays an EventTimeline instead, which a SongCompiler builds in
+ the background from a whole arrangement of patterns. New timelines, and going
+ in and out of song mode, are picked up at the start of a bar. The timeline
+ has the time of every step worked out already (from the song's TempoMap, with
+ any ramps), so in song mode the pattern's tempo isn't used.
+
+ It can send MIDI clock (and Start, Stop and Continue) along with the notes, for
+ other devices to follow, or follow another device's clock itself through a
+ MidiClockFollower, in which case the steps happen wherever the clock says and
+ the tempo's the other device's.
+
+ On a busy machine an ordinary thread can be kept waiting for whole
+ milliseconds, so there's a real-time mode (see setRealtime()) which asks the
+ OS for real-time scheduling for this thread and the senders, locks the
+ process's memory, and can keep this thread on one CPU and each sender on one of
+ its own. If the OS won't allow it they carry on as normal, and
+ getSchedulingDescription() says what they got.
+
+ The MainComponent drives one of these from its controls, and the
+ SequencerHarness drives one on its own for testing.
+ */
+class Sequencer : public Thread
+	{
+	public:
+		Sequencer()
+			:	Thread (T("Sequencer")),
+				patternVersion (0),
+				cueNumber (0),
+				cuedPattern (0),
+				cuedVersion (0),
+				lastCueNumber (0),
+				decidedBar (-1),
+				takesCue (false),
+				wantsSong (false),
+				lookaheadMs (SEQUENCER_LOOKAHEAD_MS),
+				index (0),
+				numScheduledDestinations (0),
+				playheadQueue (256),
+				timeline (0),
+				pendingTimeline (0),
+				retiredTimelines (64),
+				songModeWanted (false),
+				songMode (false),
+				songStep (0),
+				timelineCursor (0),
+				startTime (0),
+				stepsSinceStart (0),
+				stepLength (0.0),
+				songStartTime (0),
+				sendsClockWanted (false),
+				sendsClock (false),
+				clockFollower (0),
+				followedGeneration (0),
+				isFollowing (false),
+				transportPosition (-1),
+				realtimeWanted (false),
+				realtimeCpu (-1),
+				schedulingMode (RealtimeScheduling::normal),
+				isPinned (false),
+				isMemoryLocked (false)
+		{
+			// make room for the messages up front, so the sequencer thread doesn't need to allocate
+			// (enough for a step with every track ratcheted, at 16 bytes a message)
+			stepMessages.ensureSize (messageBufferSize);
+			zeromem (&barCue, sizeof (barCue));
+
+			for (int i = 0; i < SequencerPattern::maxOutputs; i++)
+			{
+				outputMessages[i].ensureSize (messageBufferSize);
+				senders[i].setTimingMonitor (&timing[i]);
+			}
+		}
+
+		~Sequencer()
+		{
+			// the threads need to be stopped before the things they use are deleted
+			stop();
+
+			deleteRetiredTimelines();
+			delete (EventTimeline*) pendingTimeline;
+			delete timeline;
+
+			if (isMemoryLocked)
+				RealtimeScheduling::unlockMemory();
+		}
+
+		//==============================================================================
+		/** Change the pattern, which the sequencer picks up at its next step.
+
+		 The pattern's version is set by this. Only call this from one thread.
+		 */
+		void setPattern (SequencerPattern& newPattern)
+		{
+			newPattern.version = ++patternVersion;
+			pattern.publish (newPattern);
+		}
+
+		/** Play a pattern that's kept somewhere else (e.g. in a PatternBank) instead, from
+			the next bar line.
+
+		 Only the pointer is passed, and the sequencer plays the pattern from where it
+		 is, so nothing's copied or allocated however big it is. It carries on until
+		 the next setPattern(), which takes over straight away (and if that comes
+		 before the bar line, the cue is forgotten). The tempo still comes from the
+		 pattern given to setPattern().
+
+		 The pattern mustn't change, and mustn't be deleted until the sequencer has
+		 been stopped and setPattern() called since. Call this from the same thread
+		 as setPattern().
+		 */
+		void cuePattern (const SequencerPattern* const patternToPlay)
+		{
+			jassert (patternToPlay != 0);
+
+			PatternCue cue;
+			cue.pattern = patternToPlay;
+			cue.afterVersion = patternVersion;
+			cue.number = ++cueNumber;
+			cues.publish (cue);
+		}
+
+		/** Change the device one of the outputs sends to, or 0 for none (it isn't deleted by this object).
+
+		 A device can only be on one output, so if it's on another one it's taken off
+		 that first (which waits until that output's finished with it). Once this
+		 returns, the output's old device isn't used any more (unless it's been given
+		 to another output), so it can be closed. The thread that starts and stops
+		 the sequencer must call this.
+		 */
+		void setOutput (const int outputIndex, MidiOutput* const newOutput)
+		{
+			const int index = jlimit (0, (int) SequencerPattern::maxOutputs - 1, outputIndex);
+
+			if (newOutput != 0)
+				for (int i = 0; i < SequencerPattern::maxOutputs; i++)
+					if (i != index && senders[i].getOutput() == newOutput)
+						senders[i].setOutput (0);
+
+			senders[index].setOutput (newOutput);
+
+			if (isPlaying())
+				startSender (index);
+		}
+
+		/** Change the in-process destination one of the outputs sends to, or 0 for none (it isn't
+			deleted by this object). The thread that starts and stops the sequencer must call this.
+		 */
+		void setDestination (const int outputIndex, MidiDestination* const newDestination)
+		{
+			const int index = jlimit (0, (int) SequencerPattern::maxOutputs - 1, outputIndex);
+			senders[index].setDestination (newDestination);
+
+			if (isPlaying())
+				startSender (index);
+		}
+
+		/** The sender for one of the outputs, e.g. to see how many messages it has queued or has dropped.
+		 */
+		const MidiSender& getSender (const int outputIndex) const throw()	{ return senders [outputIndex]; }
+
+		/** Add something to be given the messages ahead of time (it isn't deleted by this object).
+
+		 This must only be called while the sequencer is stopped.
+		 */
+		void addScheduledDestination (ScheduledMidiDestination* const destination)
+		{
+			jassert (! isPlaying());
+
+			if (numScheduledDestinations < SEQUENCER_MAX_SCHEDULED_DESTINATIONS)
+				scheduledDestinations [numScheduledDestinations++] = destination;
+		}
+
+		//==============================================================================
+		/** Give the sequencer a new timeline to play in song mode, which it takes
+			over and deletes when it's finished with it.
+
+		 The sequencer starts playing it at its next bar line, from the same bar. Only
+		 call this from one thread (normally a SongCompiler's).
+		 */
+		void setTimeline (EventTimeline* const newTimeline)
+		{
+			lockFreeMemoryBarrier();
+			EventTimeline* const unused = (EventTimeline*) lockFreeExchangePointer (pendingTimeline, newTimeline);
+
+			// (if the sequencer never got round to the last one, it can go straight away)
+			delete unused;
+		}
+
+		/** Delete the timelines the sequencer has finished with.
+
+		 The sequencer thread never deletes anything itself, so it passes the old ones
+		 back; this must be called now and then by whoever calls setTimeline().
+		 */
+		void deleteRetiredTimelines()
+		{
+			EventTimeline* t;
+
+			while (retiredTimelines.pop (t))
+				delete t;
+		}
+
+		/** Switch between playing the pattern and the song's timeline, at the next bar line.
+		 */
+		void setSongMode (const bool shouldPlaySong) throw()				{ songModeWanted = shouldPlaySong; }
+		bool isSongModeWanted() const throw()								{ return songModeWanted; }
+
+		//==============================================================================
+		/** Send MIDI clock, and Start, Continue and Stop, with the notes.
+
+		 This takes effect the next time it starts.
+		 */
+		void setSendsClock (const bool shouldSendClock) throw()				{ sendsClockWanted = shouldSendClock; }
+		bool isSendingClockWanted() const throw()							{ return sendsClockWanted; }
+
+		/** Follow another device's MIDI clock, or 0 to go by the sequencer's own tempo
+			(it isn't deleted by this object).
+
+		 While following, the sequencer waits for the clock's Start or Continue once
+		 it's been started, and stops playing (but keeps running) on its Stop. This
+		 must only be called while the sequencer is stopped.
+		 */
+		void setClockFollower (MidiClockFollower* const newFollower)
+		{
+			jassert (! isPlaying());
+			clockFollower = newFollower;
+		}
+
+		//==============================================================================
+		/** Run the sequencer's thread and its senders with real-time scheduling, if the OS
+			allows it, with the process's memory locked into RAM, and optionally keep the
+			sequencer's thread on one CPU (counting from 0, or -1 for any).
+
+		 Each sender spins for the last moment before its messages, and one spinning
+		 can't be interrupted by another at the same real-time priority, so they mustn't
+		 share a CPU: output n's sender is kept on CPU cpu + 1 + n, or if the machine
+		 hasn't got that many it's left for the OS to put wherever it likes. Only the
+		 senders with somewhere to send are started at all.
+
+		 This takes effect the next time it starts.
+		 */
+		void setRealtime (const bool shouldBeRealtime, const int cpu = -1)
+		{
+			realtimeWanted = shouldBeRealtime;
+			realtimeCpu = cpu;
+
+			for (int i = 0; i < SequencerPattern::maxOutputs; i++)
+			{
+				const int senderCpu = cpu + 1 + i;
+				senders[i].setRealtime (shouldBeRealtime, cpu >= 0 && senderCpu < SystemStats::getNumCpus() ? senderCpu : -1);
+			}
+		}
+
+		bool isRealtimeWanted() const throw()								{ return realtimeWanted; }
+
+		/** The scheduling the timing threads got when they last started (the least real-time
+			of them, if they didn't all get the same).
+		 */
+		RealtimeScheduling::Mode getSchedulingMode() const throw()
+		{
+			int mode = schedulingMode;
+
+			for (int i = 0; i < SequencerPattern::maxOutputs; i++)
+				if (senders[i].hasSomewhereToSend())
+					mode = jmin (mode, (int) senders[i].getSchedulingMode());
+
+			return (RealtimeScheduling::Mode) mode;
+		}
+
+		/** Describe the scheduling the threads got, e.g. for the display.
+		 */
+		const String getSchedulingDescription() const
+		{
+			String description (RealtimeScheduling::getModeName (getSchedulingMode()));
+
+			if (isPinned)
+				description << T(", CPU ") << realtimeCpu;
+
+			String senderCpus;
+
+			for (int i = 0; i < SequencerPattern::maxOutputs; i++)
+				if (senders[i].isThreadRunning() && senders[i].getPinnedCpu() >= 0)
+					senderCpus << (senderCpus.isEmpty() ? T("") : T(", ")) << senders[i].getPinnedCpu();
+
+			if (senderCpus.isNotEmpty())
+				description << T(" (outputs on ") << senderCpus << T(")");
+
+			if (isMemoryLocked)
+				description << T(", memory locked");
+			else if (realtimeWanted)
+				description << T(", memory not locked");
+
+			return description;
+		}
+
+		//==============================================================================
+		/** How late one output's messages have been going out since playing started.
+
+		 (Pausing or stopping collects the last of them, so the second that was
+		 playing is in there too.)
+		 */
+		TimingMonitor& getTimingMonitor (const int outputIndex = 0) throw()	{ return timing [outputIndex]; }
+
+		//==============================================================================
+		/** Start playing, carrying on from the step it was paused at.
+
+		 If it's not already playing the timing figures are started again.
+		 */
+		void start()
+		{
+			if (isPlaying())
+				return;
+
+			// if there's a clock going out (which there can't be while we're following one), other
+			// devices are told to start from the top, or from where we paused
+			sendsClock = sendsClockWanted && clockFollower == 0;
+			transportPosition = songMode ? songStep : (int) index;
+
+			// locking the memory is for the whole process, so it's done here rather than by the threads
+			// (everything they use has been allocated by now; only the threads' stacks come later)
+			if (realtimeWanted && ! isMemoryLocked)
+			{
+				isMemoryLocked = RealtimeScheduling::lockMemory();
+			}
+			else if (isMemoryLocked && ! realtimeWanted)
+			{
+				RealtimeScheduling::unlockMemory();
+				isMemoryLocked = false;
+			}
+
+			schedulingMode = RealtimeScheduling::normal;
+			isPinned = false;
+
+			// the senders do the accurately timed part, so they go first..
+			for (int i = 0; i < SequencerPattern::maxOutputs; i++)
+				startSender (i);
+
+			// 10 = highest priority
+			startThread (10);
+		}
+
+		/** Stop playing, but stay where it is, so start() carries on from there.
+
+		 Each output turns off the notes it's left playing (just those, not
+		 everything). Only call this from the thread that calls getPlayhead().
+		 */
+		void pause()
+		{
+			// stop (and timeout after 3 secs, if this fails and then force if necessary)
+			stopThread (3000);
+
+			for (int i = 0; i < SequencerPattern::maxOutputs; i++)
+			{
+				senders[i].stop();
+				timing[i].finish();
+			}
+
+			// the steps in the lookahead were worked out but never sent, so go back to the first of them
+			const int64 now = SequencerClock::getNanoseconds();
+			PlayheadPosition position;
+
+			while (playheadQueue.pop (position))
+			{
+				if (position.time > now)
+				{
+					seekStep (position.step, position.songStep);
+					break;
+				}
+			}
+
+			// (the notes that were due to be turned off in the lookahead never were)
+			for (int i = 0; i < SequencerPattern::maxOutputs; i++)
+				senders[i].sendNotesOff();
+
+			if (sendsClock)
+			{
+				for (int i = 0; i < SequencerPattern::maxOutputs; i++)
+					senders[i].sendMessageNow (MidiMessage (0xfc));
+
+				sendsClock = false;
+			}
+
+			for (int i = 0; i < numScheduledDestinations; i++)
+				scheduledDestinations[i]->reset();
+
+			playheadQueue.reset();
+		}
+
+		/** Stop playing, and go back to the start of the pattern.
+		 */
+		void stop()
+		{
+			pause();
+
+			index = 0;
+			songStep = 0;
+			timelineCursor = 0;
+		}
+
+		bool isPlaying() const throw()										{ return isThreadRunning(); }
+
+		/** Find the step that's playing now (the thread calling setPattern() only).
+
+		 Returns false if the playhead hasn't moved since last time, otherwise sets
+		 step to the latest step (counting from when playing started) whose time
+		 has come. If it's moved more than one step the ones in between are skipped.
+		 If there's a MidiRecorder, it's told about every step, skipped or not, so it
+		 can work out where its notes were played.
+		 */
+		bool getPlayhead (const int64 now, int64& step, MidiRecorder* const recorder = 0)
+		{
+			PlayheadPosition position;
+			bool hasMoved = false;
+
+			while (playheadQueue.peek (position) && position.time <= now)
+			{
+				step = position.step;
+				hasMoved = true;
+				playheadQueue.pop (position);
+
+				if (recorder != 0)
+					recorder->addPlayheadPosition (position.step, position.time);
+			}
+
+			return hasMoved;
+		}
+
+		//==============================================================================
+		void run()
+		{
+			// (a thread can only change its own scheduling; the stack's touched so the first steps
+			// don't wait for it to be paged in)
+			if (realtimeWanted)
+			{
+				schedulingMode = RealtimeScheduling::makeCurrentThreadRealtime (realtimePriority);
+				isPinned = realtimeCpu >= 0 && RealtimeScheduling::pinCurrentThread (realtimeCpu);
+				RealtimeScheduling::prefaultStack();
+			}
+
+			// Rather than sending each step's messages the moment it's due, we work a little
+			// way ahead (the lookahead) and hand the messages to the sender with the exact
+			// times they should go out. That means this thread only has to wake up about once
+			// per step (less at fast tempos, where it does several at once), and how promptly
+			// it wakes up doesn't affect the timing at all.
+
+			// every step's time is worked out from the time we started (in nanoseconds), rather than
+			// from when the last step woke up, so however long the loop takes it never drifts
+			const int64 lookahead = (int64) (lookaheadMs * 1000000.0);
+			stepLength = pattern.read().getStepLengthNanoseconds();
+			setStartTime (SequencerClock::getNanoseconds() + lookahead);
+
+			// nothing's playing yet (pause() turned off whatever was left, so the note-offs that
+			// were waiting can be forgotten)
+			engine.resetNotes();
+			zeromem (soundingNotes, sizeof (soundingNotes));
+			isFollowing = false;
+			decidedBar = -1;
+
+			while (! threadShouldExit())
+			{
+				// (when following a clock, there's nothing to do until it's running)
+				if (clockFollower != 0 && ! followClock())
+				{
+					wait (2);
+					continue;
+				}
+
+				const int64 now = SequencerClock::getNanoseconds();
+				int64 stepTime = getNextStepTime();
+
+				// if we've fallen behind (e.g. the machine stalled) carry on from now, rather
+				// than playing all the missed steps at once to catch up (the clock we're following
+				// can't be moved, so then the late steps just go as soon as they can)
+				if (stepTime < now && clockFollower == 0)
+				{
+					setStartTime (now);
+					stepTime = now;
+				}
+
+				// work out all the steps that are due before the end of the lookahead
+				clearStepMessages();
+				const int64 blockStart = stepTime;
+
+				while (stepTime < now + lookahead)
+				{
+					const int time = (int) ((stepTime - blockStart) / 1000);
+
+					if (index % EventTimeline::stepsPerBar == 0)
+						startBar (time, stepTime);
+
+					// everything this step needs comes from the latest pattern that was published
+					// (or the one that's been cued instead), which won't change under us however
+					// much the user is clicking
+					const SequencerPattern& published = pattern.read();
+					const SequencerPattern& p = getPlayingPattern (published);
+
+					// (what happens at the next bar line is decided on the step before it, so this step
+					// knows whether the next bar is still this pattern's)
+					const bool isLastStepOfBar = (index + 1) % EventTimeline::stepsPerBar == 0;
+
+					if (isLastStepOfBar)
+						decideBarChange (index + 1, published.version);
+
+					if (sendsClock)
+						renderClock (time);
+
+					// (where the step is, for the display and for pausing, before rendering moves the song on)
+					PlayheadPosition position;
+					position.time = stepTime;
+					position.step = index;
+					position.songStep = songStep;
+
+					if (songMode)
+					{
+						renderTimelineStep (time);
+					}
+					else
+					{
+						// (the offline renderer uses the same engine, so files sound just like this; if
+						// something else takes over at the bar line, this pattern's notes mustn't be
+						// nudged early into it, and the new one's go on the bar's first step instead)
+						engine.compile (p);
+						engine.setEndStep (isLastStepOfBar && (takesCue || wantsSong != songMode) ? index + 1 : -1);
+						MidiBufferNoteSink sink (stepMessages, time, (int) (stepLength / 1000), outputMessages);
+						engine.renderStep (p, index, sink);
+					}
+
+					// let the display know when we'll get there, it does the rest
+					playheadQueue.push (position);
+
+					index++;
+					stepsSinceStart++;
+
+					// if the tempo has changed, start counting again from the next step so the
+					// steps we've already played keep their times
+					const double newStepLength = published.getStepLengthNanoseconds();
+
+					if (newStepLength != stepLength)
+					{
+						startTime += (int64) (stepsSinceStart * stepLength);
+						stepsSinceStart = 0;
+						stepLength = newStepLength;
+					}
+
+					stepTime = getNextStepTime();
+				}
+
+				sendStepMessages (blockStart);
+
+				// sleep until the next step is half a lookahead away
+				const int64 msToWait = (stepTime - lookahead / 2 - SequencerClock::getNanoseconds()) / 1000000;
+
+				if (msToWait > 0)
+					wait ((int) msToWait);
+			}
+		}
+
+	private:
+		//==============================================================================
+		// whoever changes the pattern publishes it here, and this is all the sequencer thread looks at
+		LockFreeSnapshot<SequencerPattern> pattern;
+		uint32 patternVersion;
+
+		// cuePattern() publishes its cues here, and the sequencer thread takes the newest at a bar
+		// line (unless a pattern's been published since) and plays it until the next one is
+		struct PatternCue
+		{
+			const SequencerPattern* pattern;
+			uint32 afterVersion;			// the version of the published pattern it replaces
+			uint32 number;					// goes up with each cue, 0 for none
+		};
+
+		LockFreeSnapshot<PatternCue> cues;
+		uint32 cueNumber;
+		const SequencerPattern* cuedPattern;
+		uint32 cuedVersion, lastCueNumber;
+
+		// what happens at the next bar line (see decideBarChange()): the step it's for, the newest
+		// cue then and whether it's taken there, and whether it's the song that plays from there
+		int64 decidedBar;
+		bool takesCue, wantsSong;
+		PatternCue barCue;
+
+		// the sequencer thread's quick version of the pattern
+		PatternEngine engine;
+
+		// sends the messages the sequencer thread works out, at the times they're due, with a
+		// sender for each output; stepMessages has every output's messages, for the scheduled destinations
+		MidiSender senders [SequencerPattern::maxOutputs];
+		TimingMonitor timing [SequencerPattern::maxOutputs];
+		double lookaheadMs;
+		enum { messageBufferSize = SequencerPattern::maxTracks * SequencerPattern::maxRatchets * 2 * 16 };
+		MidiBuffer stepMessages;
+		MidiBuffer outputMessages [SequencerPattern::maxOutputs];
+		int64 index;
+		ScheduledMidiDestination* scheduledDestinations [SEQUENCER_MAX_SCHEDULED_DESTINATIONS];
+		int numScheduledDestinations;
+
+		// the sequencer thread posts the time of each step here as it works it out, and
+		// getPlayhead() picks them up as they come round
+		struct PlayheadPosition
+		{
+			int64 time;
+			int64 step;
+			int songStep;
+		};
+
+		LockFreeFifo<PlayheadPosition> playheadQueue;
+
+		// the song: setTimeline() leaves a new timeline in pendingTimeline, the sequencer
+		// thread swaps it for the current one at a bar line, and passes the old one back
+		// through retiredTimelines to be deleted
+		EventTimeline* timeline;
+		EventTimeline* volatile pendingTimeline;
+		LockFreeFifo<EventTimeline*> retiredTimelines;
+		volatile bool songModeWanted;
+		bool songMode;
+		int songStep, timelineCursor;
+
+		// the times of the steps: the pattern's are counted from startTime at its tempo, and
+		// the song's come from the timeline's table, counted from songStartTime
+		int64 startTime, stepsSinceStart;
+		double stepLength;
+		int64 songStartTime;
+
+		// which notes the timeline has turned on (a bit for each note on each channel of each
+		// output), so they can be turned off when it's swapped for another one
+		uint64 soundingNotes [SequencerPattern::maxOutputs][16][2];
+
+		// MIDI clock: whether we're sending it, and the clock we're following (if any), with
+		// what the sequencer thread last saw of it
+		volatile bool sendsClockWanted;
+		bool sendsClock;
+		MidiClockFollower* clockFollower;
+		MidiClockFollower::State clock;
+		int followedGeneration;
+		bool isFollowing;
+
+		// where start() started from, for the Start or Continue that goes with the first clock (or -1
+		// once it's gone)
+		int transportPosition;
+
+		// real-time mode: what's wanted (for the next start), and what this thread got
+		// (below the senders, which do the accurately timed part)
+		enum { realtimePriority = 70 };
+		bool realtimeWanted;
+		int realtimeCpu;
+		volatile int schedulingMode;
+		volatile bool isPinned;
+		bool isMemoryLocked;
+
+		//==============================================================================
+		/** Start an output's sender if it has somewhere to send and isn't already going,
+			starting its timing figures again.
+		 */
+		void startSender (const int outputIndex)
+		{
+			MidiSender& sender = senders [outputIndex];
+
+			if (sender.hasSomewhereToSend() && ! sender.isThreadRunning())
+			{
+				timing [outputIndex].reset();
+				sender.start();
+			}
+		}
+
+		/** When the next step is due (sequencer thread only).
+		 */
+		int64 getNextStepTime() const throw()
+		{
+			if (clockFollower != 0)
+				return clock.getTimeOfStep (index);
+
+			if (songMode && timeline != 0 && timeline->getNumSteps() > 0)
+				return songStartTime + timeline->getStepTime (songStep);
+
+			return startTime + (int64) (stepsSinceStart * stepLength);
+		}
+
+		/** How long the next step lasts (sequencer thread only).
+		 */
+		int64 getNextStepLength() const throw()
+		{
+			if (songMode && timeline != 0 && timeline->getNumSteps() > 0)
+				return timeline->getStepLength (songStep % timeline->getNumSteps());
+
+			return (int64) stepLength;
+		}
+
+		/** Make the next step happen at a particular time, and count the rest from there.
+		 */
+		void setStartTime (const int64 time) throw()
+		{
+			startTime = time;
+			stepsSinceStart = 0;
+
+			if (timeline != 0)
+				songStartTime = time - timeline->getStepTime (jmin (songStep, timeline->getNumSteps()));
+		}
+
+		/** Hand the messages that have been worked out to everything that's playing them.
+		 */
+		void sendStepMessages (const int64 blockStart)
+		{
+			for (int i = 0; i < SequencerPattern::maxOutputs; i++)
+				senders[i].sendBlock (outputMessages[i], blockStart);
+
+			for (int i = 0; i < numScheduledDestinations; i++)
+				scheduledDestinations[i]->sendBlock (stepMessages, blockStart);
+		}
+
+		void clearStepMessages() throw()
+		{
+			stepMessages.clear();
+
+			for (int i = 0; i < SequencerPattern::maxOutputs; i++)
+				outputMessages[i].clear();
+		}
+
+		/** Add the MIDI clock for the next step to every output, 6 ticks spread evenly over
+			it (sequencer thread only).
+
+		 The first tick is on the step, and goes before the step's notes.
+		 */
+		void renderClock (const int time)
+		{
+			const int64 length = getNextStepLength();
+
+			for (int output = 0; output < SequencerPattern::maxOutputs; output++)
+			{
+				MidiBuffer& messages = outputMessages [output];
+
+				if (transportPosition == 0)
+				{
+					const uint8 start = 0xfa;
+					messages.addEvent (&start, 1, time);
+				}
+				else if (transportPosition > 0)
+				{
+					// (the song position is in 16th notes, which are our steps)
+					const uint8 songPosition[] = { 0xf2, (uint8) (transportPosition & 0x7f), (uint8) ((transportPosition >> 7) & 0x7f) };
+					const uint8 resume = 0xfb;
+					messages.addEvent (songPosition, 3, time);
+					messages.addEvent (&resume, 1, time);
+				}
+
+				const uint8 tick = 0xf8;
+
+				for (int i = 0; i < MidiClockFollower::ticksPerStep; i++)
+					messages.addEvent (&tick, 1, time + (int) ((i * length) / (MidiClockFollower::ticksPerStep * 1000)));
+			}
+
+			transportPosition = -1;
+		}
+
+		/** Catch up with the clock we're following, returning false if it's not running (sequencer thread only).
+
+		 When it starts, or starts again, the sequencer jumps to the step it says;
+		 when it stops, or starts again, whatever's playing is turned off.
+		 */
+		bool followClock()
+		{
+			clock = clockFollower->getState();
+			const bool shouldPlay = clock.isRunning && clock.isLocked;
+
+			if (isFollowing && (! shouldPlay || clock.generation != followedGeneration))
+			{
+				clearStepMessages();
+				renderAllNotesOff (0);
+				sendStepMessages (SequencerClock::getNanoseconds());
+				isFollowing = false;
+			}
+
+			if (! shouldPlay)
+				return false;
+
+			if (! isFollowing)
+			{
+				followedGeneration = clock.generation;
+				isFollowing = true;
+				seekStep (clock.startStep, clock.startStep);
+			}
+
+			return true;
+		}
+
+		/** Go to a step, counting from the start of the pattern, and a step of the song.
+		 */
+		void seekStep (const int64 step, int songPosition) throw()
+		{
+			index = step;
+			decidedBar = -1;
+
+			if (timeline != 0 && timeline->getNumSteps() > 0)
+			{
+				songPosition %= timeline->getNumSteps();
+				seekTimeline (songPosition / EventTimeline::stepsPerBar);
+
+				// (anything before the step is skipped, so its notes aren't turned on)
+				const TimelineEvent* const events = timeline->getEvents();
+
+				while (timelineCursor < timeline->getNumEvents() && events [timelineCursor].step < songPosition)
+					timelineCursor++;
+
+				songStep = songPosition;
+			}
+		}
+
+		void renderAllNotesOff (const int time)
+		{
+			if (songMode)
+			{
+				renderSoundingNotesOff (time);
+			}
+			else
+			{
+				MidiBufferNoteSink sink (stepMessages, time, 0, outputMessages);
+				engine.renderNotesOff (sink);
+			}
+		}
+
+		/** Pick up any changes that wait for a bar line (sequencer thread only).
+
+		 This is called before a bar's first step is rendered, with its time.
+		 */
+		void startBar (const int time, const int64 stepTime)
+		{
+			// (it's usually been decided already, on the step before)
+			decideBarChange (index, pattern.read().version);
+
+			// a cued pattern starts here (its notes that are still playing get their note-offs
+			// from the engine as usual)
+			if (takesCue)
+			{
+				cuedPattern = barCue.pattern;
+				cuedVersion = barCue.afterVersion;
+				engine.invalidate();
+			}
+
+			lastCueNumber = barCue.number;
+
+			const bool wantSong = wantsSong;
+			const bool isSwitching = wantSong != songMode;
+			EventTimeline* const newTimeline = (EventTimeline*) lockFreeExchangePointer (pendingTimeline, (EventTimeline*) 0);
+
+			if (newTimeline != 0)
+			{
+				if (songMode)
+					renderSoundingNotesOff (time);
+
+				if (timeline != 0 && ! retiredTimelines.push (timeline))
+					jassertfalse; // (leaking it is better than deleting it here)
+
+				timeline = newTimeline;
+				seekTimeline (songStep / EventTimeline::stepsPerBar);
+			}
+
+			if (isSwitching)
+			{
+				// everything stops, and the other one starts from the top
+				renderAllNotesOff (time);
+
+				songMode = wantSong;
+				seekTimeline (0);
+			}
+
+			// (the step we're on stays where it is, and the new timeline's steps are counted from it)
+			if (newTimeline != 0 || isSwitching)
+				setStartTime (stepTime);
+		}
+
+		/** Decide whether a cued pattern or a switch to or from the song takes over at a bar line
+			(sequencer thread only).
+
+		 A cue is taken unless another pattern's been published since it was cued. This
+		 is done on the step before the bar if that's played, so that step can leave out
+		 the notes it would nudge early into the bar if something else plays there, and
+		 startBar() then does what was decided, even if another cue has come in since
+		 (that one waits for the next bar).
+		 */
+		void decideBarChange (const int64 barStep, const uint32 publishedVersion) throw()
+		{
+			if (barStep == decidedBar)
+				return;
+
+			decidedBar = barStep;
+			wantsSong = songModeWanted;
+			barCue = cues.read();
+			takesCue = barCue.number != lastCueNumber && barCue.afterVersion == publishedVersion;
+		}
+
+		/** The pattern to play: the cued one until a newer one's been published, and then
+			that (sequencer thread only).
+		 */
+		const SequencerPattern& getPlayingPattern (const SequencerPattern& published) throw()
+		{
+			if (cuedPattern != 0 && published.version != cuedVersion)
+			{
+				cuedPattern = 0;
+				engine.invalidate();
+			}
+
+			// (the cued pattern's version is whatever it was saved with, so the engine's
+			// invalidated whenever it's switched to or from)
+			return cuedPattern != 0 ? *cuedPattern : published;
+		}
+
+		/** Move the cursor to the start of a bar of the timeline, or back to the top if it's shorter than that.
+		 */
+		void seekTimeline (int bar) throw()
+		{
+			if (timeline == 0 || bar >= timeline->getNumBars())
+				bar = 0;
+
+			songStep = bar * EventTimeline::stepsPerBar;
+			timelineCursor = timeline != 0 ? timeline->getBarStart (bar) : 0;
+		}
+
+		/** Add the timeline's events for the next step to the messages (sequencer thread only).
+		 */
+		void renderTimelineStep (const int time)
+		{
+			if (timeline == 0 || timeline->getNumSteps() == 0)
+				return;
+
+			const TimelineEvent* const events = timeline->getEvents();
+			const int numEvents = timeline->getNumEvents();
+
+			// at the end, play what's left (the last notes' note-offs) and go round again
+			if (songStep >= timeline->getNumSteps())
+			{
+				while (timelineCursor < numEvents)
+					renderTimelineEvent (events [timelineCursor++], time, 0);
+
+				songStartTime += timeline->getStepTime (songStep);
+				songStep = 0;
+				timelineCursor = 0;
+			}
+
+			const int64 thisStepLength = timeline->getStepLength (songStep);
+
+			while (timelineCursor < numEvents && events [timelineCursor].step <= songStep)
+				renderTimelineEvent (events [timelineCursor++], time, thisStepLength);
+
+			songStep++;
+		}
+
+		void renderTimelineEvent (const TimelineEvent& e, int time, const int64 thisStepLength)
+		{
+			// (swung notes go a little after the step)
+			if (e.delay != 0)
+				time += (int) ((e.delay * thisStepLength) / (65536 * 1000));
+
+			const int output = e.output < SequencerPattern::maxOutputs ? e.output : 0;
+			const int channel = e.data[0] & 0x0f;
+			const int note = e.data[1] & 0x7f;
+			const uint64 bit = (uint64) 1 << (note & 63);
+			uint64& sounding = soundingNotes [output][channel][note >> 6];
+
+			if ((e.data[0] & 0xf0) == 0x90 && e.data[2] != 0)
+			{
+				sounding |= bit;
+			}
+			else if ((e.data[0] & 0xf0) == 0x80 || (e.data[0] & 0xf0) == 0x90)
+			{
+				// after a swap, the new timeline turns off notes that the old one never turned on
+				if ((sounding & bit) == 0)
+					return;
+
+				sounding &= ~bit;
+			}
+
+			stepMessages.addEvent (e.data, e.size, time);
+			outputMessages [output].addEvent (e.data, e.size, time);
+		}
+
+		void renderSoundingNotesOff (const int time)
+		{
+			MidiBufferNoteSink sink (stepMessages, time, 0, outputMessages);
+
+			for (int output = 0; output < SequencerPattern::maxOutputs; output++)
+			{
+				sink.setOutput (output);
+
+				for (int channel = 0; channel < 16; channel++)
+				{
+					for (int word = 0; word < 2; word++)
+					{
+						uint64 notes = soundingNotes [output][channel][word];
+
+						while (notes != 0)
+						{
+							sink.noteOff (channel + 1, word * 64 + PatternEngine::findLowestBit (notes));
+							notes &= notes - 1;
+						}
+
+						soundingNotes [output][channel][word] = 0;
+					}
+				}
+			}
+		}
+
+		Sequencer (const Sequencer&);
+		const Sequencer& operator= (const Sequencer&);
+	};
+
+#endif//_SEQUENCER_H_
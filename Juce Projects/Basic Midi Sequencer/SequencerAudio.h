@@ -0,0 +1,284 @@
+/*
+ *  SequencerAudio.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _SEQUENCERAUDIO_H_
+#define _SEQUENCERAUDIO_H_
+
+#include <juce/juce.h>
+#include "MidiDestination.h"
+#include "LockFreeFifo.h"
+#include "SequencerClock.h"
+#include "PolySynth.h"
+#include "DrumSampler.h"
+
+/**
+ The sequencer's own sound, played through the audio device.
+
+ The Sequencer gives this its messages ahead of time (it's a
+ ScheduledMidiDestination), and they're queued up through a LockFreeFifo with
+ their SequencerClock times. Each audio callback works out the SequencerClock
+ time of its first sample and plays every message that falls inside the block at
+ exactly the right sample, splitting the synth's rendering around it. So the
+ timing doesn't depend on when the callbacks happen to run, only on the lookahead
+ being longer than one audio block.
+
+ The time of each block comes from counting samples, pulled gently towards the
+ time the callback actually ran, so the jitter in the callback times doesn't
+ get into the sound but the two clocks can't drift apart.
+
+ Messages on the synth's channel (2 by default) go to a PolySynth, and those on
+ the drum channel (1 by default) to a DrumSampler.
+ */
+class SequencerAudio : public AudioIODeviceCallback,
+					   public ScheduledMidiDestination
+	{
+	public:
+		SequencerAudio()
+			:	events (8192),
+				synthChannel (2),
+				synthEnabled (true),
+				drumChannel (1),
+				drumsEnabled (true),
+				generation (0),
+				lastGeneration (0),
+				sampleRate (0.0),
+				nextBlockTime (0)
+		{
+		}
+
+		~SequencerAudio()
+		{
+		}
+
+		//==============================================================================
+		PolySynth& getSynth() throw()									{ return synth; }
+
+		/** Change the MIDI channel the synth listens to (only while stopped).
+		 */
+		void setSynthChannel (const int channel) throw()				{ synthChannel = channel; }
+
+		/** Turn the synth on or off; when it's off its messages are ignored.
+		 */
+		void setSynthEnabled (const bool shouldBeEnabled) throw()		{ synthEnabled = shouldBeEnabled; }
+		bool isSynthEnabled() const throw()								{ return synthEnabled; }
+
+		/** The drum sampler, whose sounds must be loaded before the audio starts.
+		 */
+		DrumSampler& getDrums() throw()									{ return drums; }
+
+		/** Change the MIDI channel the drums listen to (only while stopped).
+		 */
+		void setDrumChannel (const int channel) throw()					{ drumChannel = channel; }
+
+		/** Turn the drums on or off; when they're off their messages are ignored.
+		 */
+		void setDrumsEnabled (const bool shouldBeEnabled) throw()		{ drumsEnabled = shouldBeEnabled; }
+		bool areDrumsEnabled() const throw()							{ return drumsEnabled; }
+
+		//==============================================================================
+		void sendBlock (const MidiBuffer& buffer, const int64 blockStartTime)
+		{
+			MidiBuffer::Iterator i (buffer);
+			const uint8* data;
+			int size, position;
+
+			while (i.getNextEvent (data, size, position))
+			{
+				// (only short messages are any use here)
+				if (size > 3)
+					continue;
+
+				TimedEvent e;
+				e.time = blockStartTime + position * (int64) 1000;
+				e.generation = generation;
+				e.size = size;
+				memcpy (e.data, data, size);
+
+				// (if the audio has stopped and the queue's full, this just drops them)
+				events.push (e);
+			}
+		}
+
+		void reset()
+		{
+			// anything still queued belongs to the old generation, so the audio thread will
+			// throw it away, and silence the synth when it sees the change
+			lockFreeMemoryBarrier();
+			++generation;
+		}
+
+		//==============================================================================
+		void audioDeviceIOCallback (const float** inputChannelData,
+									int totalNumInputChannels,
+									float** outputChannelData,
+									int totalNumOutputChannels,
+									int numSamples)
+		{
+			for (int i = 0; i < totalNumOutputChannels; i++)
+				if (outputChannelData[i] != 0)
+					zeromem (outputChannelData[i], numSamples * sizeof (float));
+
+			if (totalNumOutputChannels == 0 || outputChannelData[0] == 0 || sampleRate <= 0)
+				return;
+
+			const int64 blockTime = getBlockTime (numSamples);
+			const double samplesPerNanosecond = sampleRate / 1.0e9;
+
+			const int currentGeneration = generation;
+
+			if (currentGeneration != lastGeneration)
+			{
+				synth.allNotesOff (true);
+				drums.allNotesOff();
+				lastGeneration = currentGeneration;
+			}
+
+			// render a piece at a time, stopping wherever there's a message
+			int position = 0;
+			TimedEvent e;
+
+			while (events.peek (e))
+			{
+				if (e.generation != currentGeneration)
+				{
+					events.pop (e);
+					continue;
+				}
+
+				const int64 offset = (int64) ((e.time - blockTime) * samplesPerNanosecond);
+
+				if (offset >= numSamples)
+					break;
+
+				// (anything late goes as soon as it can)
+				const int eventPosition = (int) jmax ((int64) position, offset);
+
+				renderSection (outputChannelData, totalNumOutputChannels, position, eventPosition - position);
+				position = eventPosition;
+
+				handleEvent (e);
+				events.pop (e);
+			}
+
+			renderSection (outputChannelData, totalNumOutputChannels, position, numSamples - position);
+		}
+
+		void audioDeviceAboutToStart (AudioIODevice* device)
+		{
+			sampleRate = device->getCurrentSampleRate();
+			synth.setSampleRate (sampleRate);
+			drums.setSampleRate (sampleRate);
+			nextBlockTime = 0;
+		}
+
+		void audioDeviceStopped()
+		{
+			sampleRate = 0.0;
+		}
+
+	private:
+		//==============================================================================
+		struct TimedEvent
+		{
+			int64 time;
+			int generation;
+			uint8 data[3];
+			int size;
+		};
+
+		LockFreeFifo<TimedEvent> events;
+		PolySynth synth;
+		int synthChannel;
+		volatile bool synthEnabled;
+		DrumSampler drums;
+		int drumChannel;
+		volatile bool drumsEnabled;
+
+		// changed whenever the sequencer stops, to throw away what's left in the queue
+		volatile int generation;
+		int lastGeneration;
+
+		double sampleRate;
+		int64 nextBlockTime;
+
+		/** The SequencerClock time of the first sample of this block.
+		 */
+		int64 getBlockTime (const int numSamples) throw()
+		{
+			const int64 now = SequencerClock::getNanoseconds();
+			int64 blockTime;
+
+			// follow the callback times slowly, unless they've jumped (e.g. the device glitched),
+			// in which case start counting again from now
+			const int64 error = now - nextBlockTime;
+
+			if (nextBlockTime == 0 || error > 20000000 || error < -20000000)
+				blockTime = now;
+			else
+				blockTime = nextBlockTime + error / 32;
+
+			nextBlockTime = blockTime + (int64) (numSamples * 1.0e9 / sampleRate);
+			return blockTime;
+		}
+
+		/** Render part of the block, between two messages.
+		 */
+		void renderSection (float** outputs, const int numOutputs, const int startSample, const int numSamples) throw()
+		{
+			if (numSamples <= 0)
+				return;
+
+			// the synth is mono, so it goes in the first channel and is copied to the others
+			float* const output = outputs[0] + startSample;
+			synth.render (output, numSamples);
+
+			for (int i = 1; i < numOutputs; i++)
+				if (outputs[i] != 0)
+					memcpy (outputs[i] + startSample, output, numSamples * sizeof (float));
+
+			drums.render (outputs, numOutputs, startSample, numSamples);
+		}
+
+		void handleEvent (const TimedEvent& e) throw()
+		{
+			const MidiMessage message (e.data, e.size);
+
+			if (message.getChannel() == drumChannel)
+			{
+				// (one-shots don't need note-offs)
+				if (! drumsEnabled)
+					drums.allNotesOff();
+				else if (message.isNoteOn())
+					drums.noteOn (message.getNoteNumber(), message.getFloatVelocity());
+
+				return;
+			}
+
+			if (message.getChannel() != synthChannel)
+				return;
+
+			if (! synthEnabled)
+			{
+				// (so that turning it off doesn't leave notes hanging)
+				synth.allNotesOff (false);
+				return;
+			}
+
+			if (message.isNoteOn())
+				synth.noteOn (message.getNoteNumber(), message.getFloatVelocity());
+			else if (message.isNoteOff())
+				synth.noteOff (message.getNoteNumber());
+			else if (message.isAllNotesOff())
+				synth.allNotesOff (false);
+		}
+
+		SequencerAudio (const SequencerAudio&);
+		const SequencerAudio& operator= (const SequencerAudio&);
+	};
+
+#endif//_SEQUENCERAUDIO_H_
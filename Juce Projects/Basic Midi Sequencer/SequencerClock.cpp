@@ -0,0 +1,118 @@
+/*
+ *  SequencerClock.cpp
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#include "SequencerClock.h"
+
+#if JUCE_WIN32
+ #define WIN32_LEAN_AND_MEAN
+ #define NOGDI
+ #define NOMINMAX
+ #include <windows.h>
+#elif JUCE_MAC
+ #include <mach/mach_time.h>
+#else
+ #include <time.h>
+ #include <errno.h>
+#endif
+
+//==============================================================================
+#if JUCE_WIN32
+
+static double getNanosecondsPerTick() throw()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency (&frequency);
+	return 1.0e9 / (double) frequency.QuadPart;
+}
+
+int64 SequencerClock::getNanoseconds() throw()
+{
+	static const double nanosecondsPerTick = getNanosecondsPerTick();
+
+	LARGE_INTEGER ticks;
+	QueryPerformanceCounter (&ticks);
+	return (int64) (ticks.QuadPart * nanosecondsPerTick);
+}
+
+static void sleepUntil (const int64 targetTime) throw()
+{
+	// there's no absolute sleep here, and Sleep() can overshoot by a whole
+	// scheduler tick, so stop sleeping a couple of ms early and spin the rest
+	for (;;)
+	{
+		const int64 msLeft = (targetTime - SequencerClock::getNanoseconds()) / 1000000 - 2;
+
+		if (msLeft <= 0)
+			break;
+
+		Sleep ((DWORD) msLeft);
+	}
+}
+
+//==============================================================================
+#elif JUCE_MAC
+
+static mach_timebase_info_data_t getTimebase() throw()
+{
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info (&timebase);
+	return timebase;
+}
+
+static const mach_timebase_info_data_t& timebase() throw()
+{
+	static const mach_timebase_info_data_t t = getTimebase();
+	return t;
+}
+
+int64 SequencerClock::getNanoseconds() throw()
+{
+	return (int64) (mach_absolute_time() * (double) timebase().numer / timebase().denom);
+}
+
+static void sleepUntil (const int64 targetTime) throw()
+{
+	const int64 nanosecondsLeft = targetTime - SequencerClock::getNanoseconds();
+
+	if (nanosecondsLeft > 0)
+		mach_wait_until (mach_absolute_time()
+						  + (uint64_t) (nanosecondsLeft * (double) timebase().denom / timebase().numer));
+}
+
+//==============================================================================
+#else
+
+int64 SequencerClock::getNanoseconds() throw()
+{
+	struct timespec t;
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec * (int64) 1000000000 + t.tv_nsec;
+}
+
+static void sleepUntil (const int64 targetTime) throw()
+{
+	struct timespec t;
+	t.tv_sec = (time_t) (targetTime / 1000000000);
+	t.tv_nsec = (long) (targetTime % 1000000000);
+
+	// (this is an absolute time, so being interrupted and going round again doesn't add any delay)
+	while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &t, 0) == EINTR)
+	{}
+}
+
+#endif
+
+//==============================================================================
+void SequencerClock::waitUntil (const int64 targetTime, const int64 spinNanoseconds) throw()
+{
+	if (targetTime - getNanoseconds() > spinNanoseconds)
+		sleepUntil (targetTime - spinNanoseconds);
+
+	while (getNanoseconds() < targetTime)
+	{}
+}
@@ -0,0 +1,44 @@
+/*
+ *  SequencerClock.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _SEQUENCERCLOCK_H_
+#define _SEQUENCERCLOCK_H_
+
+#include <juce/juce.h>
+
+/**
+ A nanosecond clock for timing the sequencer.
+
+ Time::waitForMillisecondCounter() only works to the nearest millisecond, and
+ sleeping for a length of time (rather than until a time) lets whatever the
+ thread did before the sleep add up as drift. Instead the sequencer works out
+ when each step is due from the time it started, and waits until then with
+ waitUntil(). That sleeps with the OS's absolute timer until just before the
+ time, then spins for the last moment to take out the scheduler's wake-up jitter.
+ */
+class SequencerClock
+	{
+	public:
+		/** The time in nanoseconds on a monotonic clock (the start point is arbitrary).
+		 */
+		static int64 getNanoseconds() throw();
+
+		/** Block until getNanoseconds() reaches targetTime.
+
+		 The thread sleeps until spinNanoseconds before the target and spins from
+		 there, so a larger value costs more CPU but copes with a busier system.
+		 Returns straight away if the time has already passed.
+		 */
+		static void waitUntil (const int64 targetTime, const int64 spinNanoseconds = 200000) throw();
+
+	private:
+		SequencerClock();
+		SequencerClock (const SequencerClock&);
+	};
+
+#endif//_SEQUENCERCLOCK_H_
@@ -0,0 +1,1050 @@
+/*
+ *  SequencerHarness.cpp
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#include "SequencerHarness.h"
+#include "Sequencer.h"
+#include "SongCompiler.h"
+#include "LoopbackMidiDestination.h"
+#include "MidiClockFollower.h"
+#include "MidiRecorder.h"
+#include "PatternBank.h"
+#include <stdio.h>
+
+//==============================================================================
+struct HarnessOptions
+{
+	int seconds;
+	double tempo;
+	int numTracks;
+	int maxLatenessMicroseconds;
+	bool stress;
+	int songBars;		// 0 to play just the pattern
+	bool sendClock;
+	int numOutputs;
+	bool stall;			// if true, the last output's destination is very slow
+	bool record;		// if true, a drum roll is recorded into the pattern as it plays
+	int bankSize;		// the number of patterns in a bank to switch between, or 0 for none
+	bool realtime;		// if true, the sequencer asks for real-time scheduling
+	int cpu;			// the CPU to keep the sequencer on, or -1 for any
+	int numLoadThreads;	// how many threads keep the CPUs busy while it plays
+	bool ratchets;		// if true, the steps have ratchets, chances and nudges
+};
+
+static int getOption (const StringArray& args, const String& name, const int defaultValue)
+{
+	for (int i = 0; i < args.size(); i++)
+		if (args[i].startsWith (name + T("=")))
+			return args[i].fromFirstOccurrenceOf (T("="), false, false).getIntValue();
+
+	return defaultValue;
+}
+
+static void print (const String& text)
+{
+	printf ("%s\n", (const char*) text);
+	fflush (stdout);
+}
+
+/** A pattern that keeps the sequencer busy: tracks of different lengths (so they
+	drift against each other) with a different note each, so the note-ons and
+	note-offs can be matched up. Some of the tracks are swung, and the gate lengths
+	go from half a step to tied over a couple of steps. With ratchets, some of the
+	steps are rolled, some left to chance, and some nudged off the grid either way.
+ */
+static void fillTestPattern (SequencerPattern& p, const HarnessOptions& options, Random& random)
+{
+	p.numTracks = 0;
+
+	for (int t = 0; t < options.numTracks; t++)
+	{
+		const int track = p.addTrack (16 - (t % 5), 24 + t, (t % 16) + 1, 0.8f);
+		p.tracks[track].swing = (t % 4) == 1 ? 0.33f : 0.0f;
+		p.tracks[track].gate = (t % 3) == 0 ? 0.5f : ((t % 3) == 1 ? 1.0f : 2.5f);
+		p.tracks[track].output = (uint8) (t % options.numOutputs);
+
+		for (int step = 0; step < p.tracks[track].length; step++)
+			p.tracks[track].setStepOn (step, random.nextInt (3) != 0);
+
+		if (options.ratchets)
+		{
+			for (int step = 0; step < p.tracks[track].length; step++)
+			{
+				const int extra = random.nextInt (6);
+				p.stepRatchets[track][step] = (uint8) (extra == 0 ? 2 + random.nextInt (SequencerPattern::maxRatchets - 1) : 0);
+				p.stepChances[track][step] = (uint8) (extra == 1 ? 10 + random.nextInt (81) : 0);
+
+				if (random.nextInt (3) == 0)
+					p.stepNudges[track][step] = (int8) (random.nextInt (2 * SequencerPattern::maxNudge + 1) - SequencerPattern::maxNudge);
+			}
+		}
+	}
+
+	p.tempo = options.tempo;
+
+	if (options.ratchets)
+		p.randomSeed = (uint32) random.nextInt();
+}
+
+//==============================================================================
+/** A PatternEngine note sink which keeps where each track's notes start, in steps.
+ */
+class NotePositionSink
+	{
+	public:
+		NotePositionSink()
+			:	step (0),
+				delay (0.0f)
+		{
+		}
+
+		void setDelay (const float proportionOfStep)			{ delay = proportionOfStep; }
+		void setOutput (const int)								{}
+		void noteOff (const int, const int)						{}
+
+		void noteOn (const int, const int note, const float)
+		{
+			// (each of the test pattern's tracks has its own note)
+			const int track = note - 24;
+
+			if (track >= 0 && track < SequencerPattern::maxTracks)
+				positions [track].add (step + delay);
+		}
+
+		int64 step;
+		Array<double> positions [SequencerPattern::maxTracks];
+
+	private:
+		float delay;
+	};
+
+static void sortPositions (Array<double>& positions)
+{
+	// (they're nearly in order already)
+	for (int i = 1; i < positions.size(); i++)
+	{
+		const double position = positions.getUnchecked (i);
+		int j = i;
+
+		for (; j > 0 && positions.getUnchecked (j - 1) > position; j--)
+			positions.set (j, positions.getUnchecked (j - 1));
+
+		positions.set (j, position);
+	}
+}
+
+/** Render some of a pattern through a PatternEngine, and check that every note it played
+	(ratchets and nudges included) started exactly where it should have, and that about
+	the right number of steps left to chance played. Returns the number of errors.
+ */
+static int checkStepExtras (const SequencerPattern& pattern)
+{
+	const int numSteps = 32 * EventTimeline::stepsPerBar;
+	PatternEngine* const engine = new PatternEngine();
+	NotePositionSink* const sink = new NotePositionSink();
+
+	engine->compile (pattern);
+	engine->setEndStep (numSteps);
+
+	for (int step = 0; step < numSteps; step++)
+	{
+		sink->step = step;
+		engine->renderStep (pattern, step, *sink);
+	}
+
+	int numErrors = 0, numNotes = 0, numLeftToChance = 0, numChosen = 0;
+	double expectedChosen = 0.0;
+
+	for (int t = 0; t < pattern.numTracks; t++)
+	{
+		const SequencerTrack& track = pattern.tracks[t];
+		Array<double> expected;
+
+		for (int step = 0; step < numSteps; step++)
+		{
+			const int trackStep = PatternEngine::getTrackStep (track, step);
+
+			if (! track.isStepOn (trackStep))
+				continue;
+
+			const int chance = pattern.getChance (t, trackStep);
+			const bool isChosen = PatternEngine::isChosen (pattern, t, step);
+
+			if (chance < 100)
+			{
+				numLeftToChance++;
+				expectedChosen += chance / 100.0;
+
+				if (isChosen)
+					numChosen++;
+			}
+
+			if (! isChosen)
+				continue;
+
+			// (the very first step can't go early, so it goes on the step)
+			const float offset = step > 0 ? PatternEngine::getStepOffset (pattern, t, step)
+										  : jmax (0.0f, PatternEngine::getStepOffset (pattern, t, step));
+			const int numRatchets = pattern.getRatchets (t, trackStep);
+
+			for (int i = 0; i < numRatchets; i++)
+			{
+				const double position = step + (double) (offset + i / (float) numRatchets);
+
+				if (position < numSteps)
+					expected.add (position);
+			}
+		}
+
+		Array<double>& played = sink->positions [t];
+		sortPositions (expected);
+		sortPositions (played);
+		numNotes += played.size();
+
+		if (played.size() != expected.size())
+		{
+			print (String ("FAIL: track ") << (t + 1) << " played " << played.size() << " notes rather than " << expected.size());
+			numErrors++;
+			continue;
+		}
+
+		for (int i = 0; i < played.size(); i++)
+		{
+			if (fabs (played.getUnchecked (i) - expected.getUnchecked (i)) > 0.0001)
+			{
+				print (String ("FAIL: track ") << (t + 1) << " played a note at step " << played.getUnchecked (i)
+						<< " rather than " << expected.getUnchecked (i));
+				numErrors++;
+				break;
+			}
+		}
+	}
+
+	// (that's about 4 standard deviations either way)
+	if (fabs (numChosen - expectedChosen) > 2.0 * sqrt ((double) numLeftToChance) + 1.0)
+	{
+		print (String ("FAIL: ") << numChosen << " of the steps left to chance played, rather than about "
+				<< roundDoubleToInt (expectedChosen));
+		numErrors++;
+	}
+
+	print (String ("Checked ") << numNotes << " notes over " << numSteps << " steps; " << numChosen << " of the "
+			<< numLeftToChance << " steps left to chance played (about " << roundDoubleToInt (expectedChosen) << " were expected)");
+
+	delete sink;
+	delete engine;
+	return numErrors;
+}
+
+/** Play a pattern whose downbeat is nudged early, and cue another like it (on another note)
+	during the first bar. The cued one should take over cleanly at the bar line: its downbeat
+	goes right on the bar line (it's too late to nudge it early), the first one's next downbeat
+	isn't played at all, and from then on the cued one's downbeats are nudged early as usual.
+	Returns the number of errors.
+ */
+static int checkCueAtBarLine()
+{
+	const int firstNote = 30, cuedNote = 31;
+	SequencerPattern* const first = new SequencerPattern();
+	SequencerPattern* const cued = new SequencerPattern();
+
+	for (int i = 0; i < 2; i++)
+	{
+		SequencerPattern& p = (i == 0) ? *first : *cued;
+		const int t = p.addTrack (EventTimeline::stepsPerBar, i == 0 ? firstNote : cuedNote, 1, 0.8f);
+		p.tracks[t].gate = 0.5f;
+		p.tracks[t].setStepOn (0, true);
+		p.stepNudges[t][0] = (int8) -SequencerPattern::maxNudge;
+		p.tempo = 240.0;
+	}
+
+	LoopbackMidiDestination* const loopback = new LoopbackMidiDestination (256);
+	Sequencer* const sequencer = new Sequencer();
+	sequencer->setDestination (0, loopback);
+	sequencer->setPattern (*first);
+	sequencer->start();
+
+	// (a bar lasts a second, so this is well inside the first one, and it stops just
+	// after the third bar line)
+	Thread::sleep (300);
+	sequencer->cuePattern (cued);
+	Thread::sleep (1900);
+	sequencer->stop();
+
+	Array<double> firstTimes, cuedTimes;
+
+	for (int i = 0; i < loopback->getNumMessages(); i++)
+	{
+		const LoopbackMidiDestination::ReceivedMessage& m = loopback->getMessage (i);
+
+		if (m.size == 3 && (m.data[0] & 0xf0) == 0x90 && m.data[2] > 0)
+			(m.data[1] == firstNote ? firstTimes : cuedTimes).add ((double) m.dueTime);
+	}
+
+	// (the times are in steps from the first pattern's first downbeat, which isn't nudged as it's the very first step)
+	const double stepLength = first->getStepLengthNanoseconds();
+	const double nudge = SequencerPattern::maxNudge / 256.0;
+	int numErrors = 0;
+
+	if (firstTimes.size() != 1)
+	{
+		print (String ("FAIL: the first pattern played ") << firstTimes.size() << " downbeats rather than 1");
+		numErrors++;
+	}
+
+	if (cuedTimes.size() != 2)
+	{
+		print (String ("FAIL: the cued pattern played ") << cuedTimes.size() << " downbeats rather than 2");
+		numErrors++;
+	}
+
+	if (numErrors == 0)
+	{
+		const double expected[] = { EventTimeline::stepsPerBar, 2 * EventTimeline::stepsPerBar - nudge };
+
+		for (int i = 0; i < 2; i++)
+		{
+			const double position = (cuedTimes.getUnchecked (i) - firstTimes.getUnchecked (0)) / stepLength;
+
+			if (fabs (position - expected[i]) > 0.01)
+			{
+				print (String ("FAIL: the cued pattern's downbeat ") << (i + 1) << " played at step " << position
+						<< " rather than " << expected[i]);
+				numErrors++;
+			}
+		}
+	}
+
+	if (numErrors == 0)
+		print ("Cued a pattern with its downbeat nudged early at a bar line: it took over on the bar");
+
+	delete sequencer;
+	delete loopback;
+	delete cued;
+	delete first;
+	return numErrors;
+}
+
+/** Write a bank of test patterns to a temporary file and open it, checking that every
+	pattern comes back just as it went in. Returns 0 (having said why) if it didn't.
+ */
+static PatternBank* openTestBank (const File& file, const HarnessOptions& options, Random& random)
+{
+	OwnedArray<SequencerPattern> written;
+	Array<const SequencerPattern*> patterns;
+
+	for (int i = 0; i < options.bankSize; i++)
+	{
+		SequencerPattern* const p = new SequencerPattern();
+		fillTestPattern (*p, options, random);
+		written.add (p);
+		patterns.add (p);
+	}
+
+	if (! PatternBank::writeFile (file, patterns))
+	{
+		print ("FAIL: the bank couldn't be written");
+		return 0;
+	}
+
+	const int64 startTime = SequencerClock::getNanoseconds();
+	PatternBank* const bank = PatternBank::openFile (file);
+	const int64 openTime = SequencerClock::getNanoseconds() - startTime;
+
+	if (bank == 0 || bank->getNumPatterns() != options.bankSize)
+	{
+		print ("FAIL: the bank couldn't be opened");
+		delete bank;
+		return 0;
+	}
+
+	for (int i = 0; i < options.bankSize; i++)
+	{
+		const SequencerPattern& a = *written.getUnchecked (i);
+		const SequencerPattern& b = bank->getPattern (i);
+
+		if (a.numTracks != b.numTracks
+			 || memcmp (a.tracks, b.tracks, sizeof (a.tracks)) != 0
+			 || memcmp (a.stepNotes, b.stepNotes, sizeof (a.stepNotes)) != 0
+			 || memcmp (a.stepDelays, b.stepDelays, sizeof (a.stepDelays)) != 0
+			 || memcmp (a.stepRatchets, b.stepRatchets, sizeof (a.stepRatchets)) != 0
+			 || memcmp (a.stepChances, b.stepChances, sizeof (a.stepChances)) != 0
+			 || memcmp (a.stepNudges, b.stepNudges, sizeof (a.stepNudges)) != 0
+			 || a.randomSeed != b.randomSeed)
+		{
+			print (String ("FAIL: pattern ") << (i + 1) << " of the bank didn't come back the same");
+			delete bank;
+			return 0;
+		}
+	}
+
+	print (String ("Opened a bank of ") << options.bankSize << " patterns (" << (int) (file.getSize() / 1024)
+			<< "KB) in " << (int) (openTime / 1000) << "us");
+
+	return bank;
+}
+
+//==============================================================================
+/** A destination that takes far too long over every message, like a device that's stuck.
+ */
+class StalledMidiDestination : public MidiDestination
+	{
+	public:
+		StalledMidiDestination()
+			:	numReceived (0)
+		{
+		}
+
+		void sendMessageNow (const MidiMessage&, const int64)
+		{
+			Thread::sleep (50);
+			numReceived++;
+		}
+
+		volatile int numReceived;
+	};
+
+//==============================================================================
+/** Plays a drum roll into a MidiRecorder, a note every millisecond, like someone hammering a pad.
+ */
+class DrumRollThread : public Thread
+	{
+	public:
+		DrumRollThread (MidiRecorder& recorder_)
+			:	Thread (T("Drum Roll")),
+				numSent (0),
+				recorder (recorder_)
+		{
+		}
+
+		void run()
+		{
+			const MidiMessage note (MidiMessage::noteOn (10, 38, 0.9f));
+
+			while (! threadShouldExit())
+			{
+				recorder.handleIncomingMidiMessage (0, note);
+				numSent++;
+				sleep (1);
+			}
+		}
+
+		volatile int numSent;
+
+	private:
+		MidiRecorder& recorder;
+
+		const DrumRollThread& operator= (const DrumRollThread&);
+	};
+
+//==============================================================================
+/** Just keeps a CPU busy, at an ordinary priority, like a heavy plug-in or a compile in the background.
+ */
+class LoadThread : public Thread
+	{
+	public:
+		LoadThread()
+			:	Thread (T("Load"))
+		{
+		}
+
+		void run()
+		{
+			volatile double x = 1.0;
+
+			while (! threadShouldExit())
+				for (int i = 0; i < 100000; i++)
+					x = x * 1.0000001 + 0.0000001;
+		}
+
+	private:
+		LoadThread (const LoadThread&);
+		const LoadThread& operator= (const LoadThread&);
+	};
+
+struct RecordingResults
+{
+	int numRecorded, numUnplaced, numBadlyQuantised;
+};
+
+/** Put the notes the recorder has into the first track of the pattern, quantised to the
+	nearest step, returning true if there were any.
+ */
+static bool recordNotes (MidiRecorder& recorder, SequencerPattern& pattern, RecordingResults& results)
+{
+	MidiRecorder::RecordedNote note;
+	bool hasRecorded = false;
+
+	while (recorder.popNote (note))
+	{
+		double position;
+
+		// (the ones that came in before the first step can't be placed)
+		if (! recorder.getStepPosition (note.time, pattern.getStepLengthNanoseconds(), position))
+		{
+			results.numUnplaced++;
+			continue;
+		}
+
+		const double quantised = MidiRecorder::quantise (position, 1.0);
+
+		if (quantised != floor (quantised) || fabs (quantised - position) > 0.5)
+			results.numBadlyQuantised++;
+
+		SequencerTrack& track = pattern.tracks[0];
+		track.setStepOn ((int) ((int64) quantised % track.length), true);
+		results.numRecorded++;
+		hasRecorded = true;
+	}
+
+	return hasRecorded;
+}
+
+//==============================================================================
+class HarnessChecker
+	{
+	public:
+		HarnessChecker()
+			:	numErrors (0),
+				numNoteOns (0),
+				numNoteOffs (0),
+				maxLateness (0)
+		{
+			zeromem (notesPlaying, sizeof (notesPlaying));
+		}
+
+		void check (const LoopbackMidiDestination& loopback, const HarnessOptions& options)
+		{
+			if (loopback.getNumReceived() > loopback.getNumMessages())
+				error (String (loopback.getNumReceived() - loopback.getNumMessages()) + T(" messages weren't kept, so weren't checked"));
+
+			for (int i = 0; i < loopback.getNumMessages(); i++)
+			{
+				const LoopbackMidiDestination::ReceivedMessage& m = loopback.getMessage (i);
+
+				// order..
+				if (i > 0)
+				{
+					const LoopbackMidiDestination::ReceivedMessage& previous = loopback.getMessage (i - 1);
+
+					if (m.dueTime < previous.dueTime)
+						error (T("message ") + String (i) + T(" was due before the one before it"));
+
+					if (m.receivedTime < previous.receivedTime)
+						error (T("message ") + String (i) + T(" arrived before the one before it"));
+				}
+
+				// timing..
+				const int lateness = (int) ((m.receivedTime - m.dueTime) / 1000);
+
+				if (lateness < 0)
+					error (T("message ") + String (i) + T(" arrived ") + String (-lateness) + T("us early"));
+				else if (lateness > options.maxLatenessMicroseconds)
+					error (T("message ") + String (i) + T(" arrived ") + String (lateness) + T("us late"));
+
+				maxLateness = jmax (maxLateness, lateness);
+
+				// and the notes
+				const MidiMessage message (m.data, m.size);
+				const int channel = message.getChannel() - 1;
+				const int note = message.getNoteNumber();
+
+				if (message.isNoteOn())
+				{
+					if (notesPlaying [channel][note])
+						error (T("note ") + String (note) + T(" on channel ") + String (channel + 1) + T(" was turned on twice"));
+
+					notesPlaying [channel][note] = true;
+					numNoteOns++;
+				}
+				else if (message.isNoteOff())
+				{
+					if (! notesPlaying [channel][note])
+						error (T("note ") + String (note) + T(" on channel ") + String (channel + 1) + T(" was turned off but wasn't on"));
+
+					notesPlaying [channel][note] = false;
+					numNoteOffs++;
+				}
+			}
+
+			// when it stops, it turns off whatever it left playing
+			const int numStillPlaying = numNoteOns - numNoteOffs;
+
+			if (numStillPlaying != 0)
+				error (String (numStillPlaying) + T(" notes were left playing"));
+
+			if (numNoteOns == 0)
+				error (T("nothing was played"));
+		}
+
+		/** Check that the clock started with a Start, ended with a Stop, and had
+			the right number of ticks for the steps in between.
+		 */
+		void checkClock (const LoopbackMidiDestination& loopback)
+		{
+			int numTicks = 0, numStarts = 0, numStops = 0;
+			int64 firstTickTime = 0, lastTickTime = 0;
+
+			for (int i = 0; i < loopback.getNumMessages(); i++)
+			{
+				const LoopbackMidiDestination::ReceivedMessage& m = loopback.getMessage (i);
+
+				if (m.data[0] == 0xfa)
+				{
+					if (numTicks > 0)
+						error (T("the Start came after a clock tick"));
+
+					numStarts++;
+				}
+				else if (m.data[0] == 0xfc)
+				{
+					if (i != loopback.getNumMessages() - 1)
+						error (T("the Stop wasn't the last message"));
+
+					numStops++;
+				}
+				else if (m.data[0] == 0xf8)
+				{
+					if (numTicks++ == 0)
+						firstTickTime = m.dueTime;
+
+					lastTickTime = m.dueTime;
+				}
+			}
+
+			if (numStarts != 1 || numStops != 1)
+				error (String ("there were ") << numStarts << " Starts and " << numStops << " Stops, rather than one of each");
+
+			if (numTicks == 0)
+				error (T("no clock was sent"));
+
+			print (String ("Sent ") << numTicks << " clock ticks over " << (int) ((lastTickTime - firstTickTime) / 1000000) << "ms");
+		}
+
+		int numErrors, numNoteOns, numNoteOffs, maxLateness;
+
+	private:
+		enum { maxErrorsToPrint = 20 };
+		bool notesPlaying [16][128];
+
+		void error (const String& message)
+		{
+			if (++numErrors <= maxErrorsToPrint)
+				print (T("FAIL: ") + message);
+		}
+	};
+
+//==============================================================================
+/** Feed a MidiClockFollower a clock with jittery arrival times, and see how
+	closely it predicts when the ticks are really due.
+ */
+static int runClockTest (const StringArray& args)
+{
+	const int seconds = jmax (4, getOption (args, T("seconds"), 60));
+	const double tempo = jlimit (20, 1000, getOption (args, T("tempo"), 120));
+	const int jitterMicroseconds = jmax (0, getOption (args, T("jitter"), 1000));
+	const int maxErrorMicroseconds = getOption (args, T("maxerror"), 500);
+
+	print (String ("MIDI clock test: ") << seconds << " seconds at " << tempo << " bpm, with up to "
+			<< jitterMicroseconds << "us of jitter");
+
+	// the ticks are really due every tickLength, but arrive anywhere up to the jitter either side
+	const double tickLength = 60.0e9 / (tempo * 24.0);
+	const int numTicks = (int) (seconds * 1.0e9 / tickLength);
+	const int64 firstTick = 1000000000;
+	Random random (1);
+
+	// the sequencer looks ahead from the latest tick, so that's what's measured; the first
+	// couple of seconds (or 4 beats, if that's longer) are for it to settle
+	const int lookaheadTicks = (int) (SEQUENCER_LOOKAHEAD_MS * 1.0e6 / tickLength) + 1;
+	const int settleTicks = jmax (96, (int) (2.0e9 / tickLength));
+
+	MidiClockFollower* const follower = new MidiClockFollower();
+	follower->handleMessage (MidiMessage (0xfa), firstTick - (int64) (tickLength / 2));
+
+	int lockedAfter = -1, numErrors = 0;
+	double maxError = 0.0, sumOfSquares = 0.0, maxTempoError = 0.0;
+
+	for (int tick = 0; tick < numTicks; tick++)
+	{
+		const int64 jitter = (int64) (random.nextInt (2 * jitterMicroseconds + 1) - jitterMicroseconds) * 1000;
+		follower->handleMessage (MidiMessage (0xf8), firstTick + (int64) (tick * tickLength) + jitter);
+
+		const MidiClockFollower::State& state = follower->getState();
+
+		if (! state.isLocked)
+			continue;
+
+		if (lockedAfter < 0)
+			lockedAfter = tick;
+
+		if (tick < settleTicks)
+			continue;
+
+		const int64 due = firstTick + (int64) ((tick + lookaheadTicks) * tickLength);
+		const double error = fabs ((double) (state.getTimeOfTick (tick + lookaheadTicks) - due)) / 1000.0;
+
+		if (error > maxErrorMicroseconds && ++numErrors <= 20)
+			print (String ("FAIL: tick ") << (tick + lookaheadTicks) << " was predicted " << (int) error << "us out");
+
+		maxError = jmax (maxError, error);
+		sumOfSquares += error * error;
+		maxTempoError = jmax (maxTempoError, fabs (state.getTempo() - tempo));
+	}
+
+	if (lockedAfter < 0 || lockedAfter >= settleTicks)
+	{
+		print (T("FAIL: it didn't lock on in time"));
+		numErrors++;
+	}
+
+	// then stop (with the clock still going), and continue without saying where from,
+	// which should carry on from the step it stopped in
+	const int64 stopTime = firstTick + (int64) (numTicks * tickLength);
+	const int stoppedStep = numTicks / MidiClockFollower::ticksPerStep;
+	follower->handleMessage (MidiMessage (0xfc), stopTime - (int64) (tickLength / 2));
+
+	for (int tick = 0; tick < 2 * MidiClockFollower::ticksPerStep; tick++)
+		follower->handleMessage (MidiMessage (0xf8), stopTime + (int64) (tick * tickLength));
+
+	follower->handleMessage (MidiMessage (0xfb), stopTime + (int64) ((2 * MidiClockFollower::ticksPerStep - 0.5) * tickLength));
+	follower->handleMessage (MidiMessage (0xf8), stopTime + (int64) (2 * MidiClockFollower::ticksPerStep * tickLength));
+
+	const MidiClockFollower::State& continued = follower->getState();
+
+	if (! continued.isRunning || continued.startStep != stoppedStep
+		 || continued.tick != stoppedStep * (int64) MidiClockFollower::ticksPerStep)
+	{
+		print (String ("FAIL: after stopping in step ") << stoppedStep << ", Continue carried on from step "
+				<< continued.startStep << " (tick " << (int) continued.tick << ")");
+		numErrors++;
+	}
+
+	const int numMeasured = jmax (1, numTicks - settleTicks);
+
+	print (String ("Locked after ") << lockedAfter << " ticks; predicting " << lookaheadTicks << " ticks ahead, the error was "
+			<< (int) sqrt (sumOfSquares / numMeasured) << "us rms, " << (int) maxError << "us at worst, and the tempo was within "
+			<< String (maxTempoError, 4) << " bpm");
+
+	print (numErrors == 0 ? String ("PASSED")
+						  : String ("FAILED with ") << numErrors << " errors");
+
+	delete follower;
+	return numErrors == 0 ? 0 : 1;
+}
+
+//==============================================================================
+int SequencerHarness::run (const String& commandLine)
+{
+	StringArray args;
+	args.addTokens (commandLine, T(" "), T("\""));
+
+	if (args.contains (T("clocktest")))
+		return runClockTest (args);
+
+	HarnessOptions options;
+	options.seconds = jmax (1, getOption (args, T("seconds"), 10));
+	options.tempo = jlimit (20, 1000, getOption (args, T("tempo"), 180));
+	options.numTracks = jlimit (1, (int) SequencerPattern::maxTracks, getOption (args, T("tracks"), 16));
+	options.maxLatenessMicroseconds = getOption (args, T("maxlate"), 5000);
+	options.stress = false;
+	options.songBars = jmax (0, getOption (args, T("song"), 0));
+	options.sendClock = args.contains (T("clock"));
+	options.stall = args.contains (T("stall"));
+	options.record = args.contains (T("record"));
+	options.bankSize = jlimit (0, (int) PatternBank::maxPatterns, getOption (args, T("bank"), 0));
+	options.realtime = args.contains (T("realtime"));
+	options.cpu = getOption (args, T("cpu"), -1);
+	options.numLoadThreads = jlimit (0, 64, getOption (args, T("load"), 0));
+	options.ratchets = args.contains (T("ratchets"));
+	options.numOutputs = jlimit (options.stall ? 2 : 1, (int) SequencerPattern::maxOutputs,
+								 jmin (options.numTracks, getOption (args, T("outputs"), 1)));
+
+	for (int i = 0; i < args.size(); i++)
+		if (args[i] == T("stress"))
+			options.stress = true;
+
+	print (String ("Sequencer test: ") << options.seconds << " seconds at " << options.tempo
+			<< " bpm, " << options.numTracks << " tracks"
+			<< (options.songBars > 0 ? String (", a song of ") << options.songBars << " bars" : String::empty)
+			<< (options.stress ? ", changing the pattern" : "")
+			<< (options.sendClock ? ", sending MIDI clock" : "")
+			<< (options.numOutputs > 1 ? String (", ") << options.numOutputs << " outputs" : String::empty)
+			<< (options.stall ? String (" (the last one stalled)") : String::empty)
+			<< (options.record ? ", recording a drum roll" : "")
+			<< (options.bankSize > 0 ? String (", switching between ") << options.bankSize << " patterns from a bank" : String::empty)
+			<< (options.numLoadThreads > 0 ? String (", ") << options.numLoadThreads << " threads of CPU load" : String::empty)
+			<< (options.realtime ? ", real-time" : "")
+			<< (options.ratchets ? ", with ratchets, chances and nudges" : ""));
+
+	// every track can play a note-on and note-off on each step (or each ratchet), with some to
+	// spare (and there are 6 clock ticks a step, and the song's ramps go up to half as fast again)
+	const double stepsPerSecond = options.tempo / 15.0 * (options.songBars > 0 ? 1.5 : 1.0);
+	const int notesPerStep = options.ratchets ? SequencerPattern::maxRatchets : 1;
+	const int maxMessages = (int) (stepsPerSecond * (options.seconds + 1)
+									* (options.numTracks * 2 * notesPerStep + (options.sendClock ? 6 : 0))) + 1024;
+
+	// the tracks are shared out between the outputs, each of which has its own loopback
+	// (apart from a stalled one, which isn't checked)
+	OwnedArray<LoopbackMidiDestination> loopbacks;
+	StalledMidiDestination stalled;
+	const int numCheckedOutputs = options.stall ? options.numOutputs - 1 : options.numOutputs;
+
+	Sequencer* const sequencer = new Sequencer();
+	SequencerPattern* const pattern = new SequencerPattern();
+	Random random (1);
+
+	for (int i = 0; i < numCheckedOutputs; i++)
+	{
+		loopbacks.add (new LoopbackMidiDestination (maxMessages));
+		sequencer->setDestination (i, loopbacks.getUnchecked (i));
+	}
+
+	if (options.stall)
+		sequencer->setDestination (options.numOutputs - 1, &stalled);
+
+	fillTestPattern (*pattern, options, random);
+	sequencer->setPattern (*pattern);
+	sequencer->setSendsClock (options.sendClock);
+
+	// (the engine's placing of the ratchets and nudges is checked exactly, and a pattern with a nudged
+	// downbeat is cued at a bar line, before they're played)
+	const int numExtraErrors = options.ratchets ? checkStepExtras (*pattern) + checkCueAtBarLine() : 0;
+
+	// for a song, a few different patterns are chained together in bits of 1 to 4 bars
+	SequencerSong* song = 0;
+	SongCompiler* songCompiler = 0;
+
+	if (options.songBars > 0)
+	{
+		song = new SequencerSong();
+		songCompiler = new SongCompiler (*sequencer);
+
+		for (int i = 0; i < 4; i++)
+		{
+			fillTestPattern (*pattern, options, random);
+			song->setPattern (i, *pattern);
+		}
+
+		for (int bar = 0; bar < options.songBars;)
+		{
+			const int numBars = jmin (1 + random.nextInt (4), options.songBars - bar);
+			song->addEntry (random.nextInt (4), numBars);
+			bar += numBars;
+		}
+
+		// and the tempo speeds up by half over the first quarter, and back down (exponentially) over the second
+		song->setTempo (options.tempo);
+		song->addTempoChange (options.songBars / 4, options.tempo * 1.5, TempoMap::linearRamp);
+		song->addTempoChange (options.songBars / 2, options.tempo, TempoMap::exponentialRamp);
+
+		songCompiler->songChanged (*song);
+		sequencer->setSongMode (true);
+	}
+
+	// with a bank, a different one of its patterns is cued every time round (and plays
+	// straight from the file, from the next bar)
+	const File bankFile (File::getSpecialLocation (File::tempDirectory).getChildFile (T("SequencerHarness.seqbank")));
+	PatternBank* bank = 0;
+	int numCues = 0, numBankErrors = 0;
+
+	if (options.bankSize > 0)
+	{
+		bank = openTestBank (bankFile, options, random);
+
+		if (bank == 0)
+			numBankErrors++;
+	}
+
+	// the load's started first, so it's already competing for the CPUs when the sequencer starts
+	OwnedArray<LoadThread> loadThreads;
+
+	for (int i = 0; i < options.numLoadThreads; i++)
+	{
+		loadThreads.add (new LoadThread());
+		loadThreads.getUnchecked (i)->startThread (5);
+	}
+
+	sequencer->setRealtime (options.realtime, options.cpu);
+	sequencer->start();
+
+	// (the threads change their own scheduling as they start, so give them a moment)
+	Thread::sleep (10);
+	print (String ("Scheduling: ") << sequencer->getSchedulingDescription());
+
+	// a test that asked for real-time scheduling and didn't get it isn't testing what it says it is
+	const int numRefused = options.realtime && sequencer->getSchedulingMode() == RealtimeScheduling::normal ? 1 : 0;
+
+	if (numRefused > 0)
+		print ("FAIL: real-time scheduling was asked for, but the OS refused it");
+
+	// only the outputs with somewhere to send should have a thread going
+	int numIdleSenders = 0;
+
+	for (int i = options.numOutputs; i < SequencerPattern::maxOutputs; i++)
+		if (sequencer->getSender (i).isThreadRunning())
+			numIdleSenders++;
+
+	if (numIdleSenders > 0)
+		print (String ("FAIL: ") << numIdleSenders << " outputs with nowhere to send were started");
+
+	// for recording, the drum roll goes into the first track as it plays
+	MidiRecorder recorder;
+	DrumRollThread drumRoll (recorder);
+	RecordingResults recording;
+	zeromem (&recording, sizeof (recording));
+
+	if (options.record)
+	{
+		recorder.setRecording (true);
+		// (as high as a MIDI input's thread would be)
+		drumRoll.startThread (9);
+	}
+
+	// this thread stands in for the message thread: it collects the timing
+	// figures, for the stress test keeps changing the pattern, and does the recording
+	const int64 endTime = SequencerClock::getNanoseconds() + options.seconds * (int64) 1000000000;
+
+	while (SequencerClock::getNanoseconds() < endTime)
+	{
+		if (options.stress)
+		{
+			SequencerTrack& track = pattern->tracks [random.nextInt (pattern->numTracks)];
+			const int step = random.nextInt (track.length);
+
+			track.setStepOn (step, ! track.isStepOn (step));
+			sequencer->setPattern (*pattern);
+
+			// (in a song, that pattern is one of the ones in the chain)
+			if (song != 0 && song->setPattern (random.nextInt (4), *pattern))
+				songCompiler->songChanged (*song);
+		}
+
+		if (bank != 0)
+		{
+			sequencer->cuePattern (&bank->getPattern (random.nextInt (bank->getNumPatterns())));
+			numCues++;
+		}
+
+		if (options.record)
+		{
+			int64 step;
+			sequencer->getPlayhead (SequencerClock::getNanoseconds(), step, &recorder);
+
+			if (recordNotes (recorder, *pattern, recording))
+				sequencer->setPattern (*pattern);
+		}
+
+		for (int i = 0; i < numCheckedOutputs; i++)
+		{
+			TimingMonitor& timing = sequencer->getTimingMonitor (i);
+
+			if (timing.update())
+				print ((options.numOutputs > 1 ? String ("Output ") << (i + 1) << ": " : String::empty) + timing.getSummary());
+		}
+
+		Thread::sleep (options.stress ? 2 : 20);
+	}
+
+	if (options.record)
+	{
+		drumRoll.stopThread (1000);
+
+		int64 step;
+		sequencer->getPlayhead (SequencerClock::getNanoseconds(), step, &recorder);
+		recordNotes (recorder, *pattern, recording);
+	}
+
+	// (the stalled output's queue is looked at before stopping, which empties it)
+	const int numStalledQueued = options.stall ? sequencer->getSender (options.numOutputs - 1).getNumQueued() : 0;
+
+	int numSecondsShown [SequencerPattern::maxOutputs];
+
+	for (int i = 0; i < numCheckedOutputs; i++)
+		numSecondsShown[i] = sequencer->getTimingMonitor (i).getNumSeconds();
+
+	sequencer->stop();
+
+	// stopping finishes the second that was playing, however much of it there was
+	for (int i = 0; i < numCheckedOutputs; i++)
+	{
+		const TimingMonitor& timing = sequencer->getTimingMonitor (i);
+
+		if (timing.getNumSeconds() > numSecondsShown[i])
+			print ((options.numOutputs > 1 ? String ("Output ") << (i + 1) << ": " : String::empty)
+					+ timing.getSummary() + " (to the stop)");
+	}
+
+	for (int i = 0; i < loadThreads.size(); i++)
+		loadThreads.getUnchecked (i)->signalThreadShouldExit();
+
+	for (int i = 0; i < loadThreads.size(); i++)
+		loadThreads.getUnchecked (i)->stopThread (1000);
+
+	int numErrors = 0;
+
+	for (int i = 0; i < numCheckedOutputs; i++)
+	{
+		const LoopbackMidiDestination& loopback = *loopbacks.getUnchecked (i);
+		HarnessChecker checker;
+		checker.check (loopback, options);
+
+		if (options.sendClock)
+			checker.checkClock (loopback);
+
+		if (sequencer->getSender (i).getNumDropped() > 0)
+			print (String ("FAIL: ") << sequencer->getSender (i).getNumDropped() << " messages were dropped");
+
+		print ((options.numOutputs > 1 ? String ("Output ") << (i + 1) << ": received " : String ("Received "))
+				<< loopback.getNumReceived() << " messages (" << checker.numNoteOns << " note-ons, "
+				<< checker.numNoteOffs << " note-offs), latest " << checker.maxLateness << "us");
+
+		numErrors += checker.numErrors + sequencer->getSender (i).getNumDropped();
+	}
+
+	// every note of the drum roll should have been recorded, on its nearest step
+	if (options.record)
+	{
+		const int numLost = drumRoll.numSent - recording.numRecorded - recording.numUnplaced - recorder.getNumDropped();
+
+		print (String ("Recorded ") << recording.numRecorded << " of " << drumRoll.numSent << " notes ("
+				<< recording.numUnplaced << " before the first step, " << recorder.getNumDropped() << " dropped)");
+
+		if (recorder.getNumDropped() > 0 || numLost != 0)
+			print (String ("FAIL: ") << (recorder.getNumDropped() + abs (numLost)) << " notes weren't recorded");
+
+		if (recording.numBadlyQuantised > 0)
+			print (String ("FAIL: ") << recording.numBadlyQuantised << " notes weren't quantised to their nearest step");
+
+		numErrors += recorder.getNumDropped() + abs (numLost) + recording.numBadlyQuantised;
+	}
+
+	if (bank != 0)
+		print (String ("Cued ") << numCues << " patterns from the bank");
+
+	numErrors += numBankErrors + numExtraErrors + numIdleSenders + numRefused;
+
+	// the other outputs should have carried on regardless of the stalled one
+	if (options.stall)
+		print (String ("Output ") << options.numOutputs << " (stalled): sent " << stalled.numReceived
+				<< " messages, with " << numStalledQueued << " still queued and "
+				<< sequencer->getSender (options.numOutputs - 1).getNumDropped() << " dropped");
+
+	print (numErrors == 0 ? String ("PASSED")
+						  : String ("FAILED with ") << numErrors << " errors");
+
+	delete songCompiler;
+	delete song;
+	delete sequencer;
+	delete pattern;
+
+	// (the sequencer's finished with the bank's patterns now)
+	delete bank;
+	bankFile.deleteFile();
+
+	return numErrors == 0 ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+/*
+ *  SequencerHarness.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _SEQUENCERHARNESS_H_
+#define _SEQUENCERHARNESS_H_
+
+#include <juce/juce.h>
+
+/**
+ Runs the sequencer with no GUI or MIDI hardware, and checks what comes out.
+
+ This is started by running the app with --headless-test on the command line,
+ e.g.
+
+ @code
+ JuceMIDIApp --headless-test seconds=30 tempo=180 tracks=32 maxlate=2000 song=5000 stress
+ @endcode
+
+ A Sequencer plays a test pattern into a LoopbackMidiDestination for the given
+ number of seconds, and then the messages it received are checked:
+
+ - that they arrived in order, and none were due before the one before them
+ - that none arrived early, and none more than maxlate microseconds late (5ms
+   by default, which allows for the odd hiccup on a busy machine with no
+   real-time scheduling)
+ - that every note-off matches a note-on, no note was turned on twice, and
+   nothing was left playing once it stopped
+ - that nothing was lost
+
+ With song=bars it plays a song of that many bars, chaining a few test patterns
+ together through a SongCompiler (with some tempo ramps), instead of just the
+ one pattern. With 'stress'
+ the pattern (or the song's patterns) is also changed every few milliseconds
+ while it plays.
+ With 'clock' it sends MIDI clock too, and checks that it starts and stops
+ properly. With outputs=n the tracks are shared out between n of the
+ sequencer's outputs, each with its own loopback, which are checked
+ separately; adding 'stall' makes the last output's destination take 50ms over
+ every message (like a device that's stuck), and the others must still pass.
+ With 'record' a drum roll (a note every millisecond) is played into a
+ MidiRecorder and recorded into the pattern as it plays; none of the notes may
+ be lost, and each must be quantised to its nearest step. With bank=n a bank
+ of n test patterns is written to a temporary file and memory-mapped (each one
+ must read back just as it was written), and a different one is cued every time
+ round, to play straight from the file from the next bar.
+
+ With 'ratchets' the test patterns' steps have ratchets, chances and nudges
+ (see SequencerPattern); a few bars are rendered first to check that every
+ note lands exactly where it should, a pattern with its downbeat nudged early
+ is cued at a bar line to check that it takes over cleanly there, and then
+ they're played with the same timing checks as plain steps.
+
+ With load=n, n threads keep the CPUs busy at an ordinary priority while it
+ plays, and with 'realtime' the sequencer asks for real-time scheduling (see
+ Sequencer::setRealtime()), kept on one CPU with cpu=n (and its outputs on the
+ CPUs after it); the report says what it got, and the test fails if the OS
+ refused. Comparing the two shows how much lateness real-time scheduling saves
+ on a loaded machine, e.g.
+
+ @code
+ JuceMIDIApp --headless-test seconds=30 load=4 maxlate=1000
+ JuceMIDIApp --headless-test seconds=30 load=4 maxlate=1000 realtime cpu=0
+ @endcode
+
+ With 'clocktest' it tests following a clock instead: a MidiClockFollower is
+ given a clock whose ticks arrive up to jitter microseconds (1000 by default)
+ either side of when they're due, e.g.
+
+ @code
+ JuceMIDIApp --headless-test clocktest seconds=60 tempo=120 jitter=1000 maxerror=500
+ @endcode
+
+ and once it's settled, every tick it predicts a lookahead ahead must be within
+ maxerror microseconds of when it's really due. Then it's stopped and continued
+ (with no Song Position Pointer), and must carry on from where it stopped.
+
+ A report is printed to stdout, and the result is the app's return value (0 if
+ everything passed), so it can be run on a build machine.
+ */
+class SequencerHarness
+	{
+	public:
+		/** Run the test described by the command line, returning 0 if it passed.
+		 */
+		static int run (const String& commandLine);
+
+	private:
+		SequencerHarness();
+		SequencerHarness (const SequencerHarness&);
+	};
+
+#endif//_SEQUENCERHARNESS_H_
@@ -0,0 +1,187 @@
+/*
+ *  SequencerPattern.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _SEQUENCERPATTERN_H_
+#define _SEQUENCERPATTERN_H_
+
+#include <juce/juce.h>
+
+// the size of the biggest pattern, which sets the size of a SequencerPattern
+// (the tracks that hit on a step are worked out as a 64-bit mask, so 64 is the most tracks there can be)
+#define SEQUENCER_MAX_TRACKS 64
+#define SEQUENCER_MAX_STEPS 128
+
+// how many MIDI outputs the tracks can be sent to
+#define SEQUENCER_MAX_OUTPUTS 8
+
+/**
+ One row of the pattern.
+
+ Each track plays one note on one channel, but has its own length so tracks can
+ run against each other (polymeter), and its own swing and gate length. The
+ steps are stored as a bitset.
+ */
+struct SequencerTrack
+{
+	enum { numStepWords = SEQUENCER_MAX_STEPS / 64 };
+
+	uint64 steps [numStepWords];	// one bit per step
+	int length;						// in steps, 1 to SEQUENCER_MAX_STEPS
+	uint8 note;
+	uint8 channel;					// 1 to 16
+	uint8 output;					// which of the sequencer's outputs it plays on, 0 to SEQUENCER_MAX_OUTPUTS - 1
+	float velocity;					// 0 to 1
+	float swing;					// how far the off-beat (odd) steps are pushed back, as a proportion
+									// of a step: 0 is straight, 1/3 is triplets, up to maxSwingPercent
+	float gate;						// how long each note lasts, in steps: less than 1 leaves a gap before the
+									// next step, 1 runs into it (legato), and more ties the note over the
+									// steps after, up to maxGateSteps (a note played again is cut short)
+	bool enabled;
+
+	enum { maxSwingPercent = 75, maxGateSteps = 16 };
+
+	bool isStepOn (const int step) const throw()
+	{
+		return (steps [step >> 6] & ((uint64) 1 << (step & 63))) != 0;
+	}
+
+	void setStepOn (const int step, const bool shouldBeOn) throw()
+	{
+		if (shouldBeOn)
+			steps [step >> 6] |= (uint64) 1 << (step & 63);
+		else
+			steps [step >> 6] &= ~((uint64) 1 << (step & 63));
+	}
+};
+
+/**
+ Everything the sequencer thread needs to know to play the pattern.
+
+ The GUI builds one of these whenever a button or slider changes and publishes
+ it through a LockFreeSnapshot, so the sequencer thread never has to touch a
+ component. It's a plain fixed-size value so that copying it about never
+ allocates. A PatternEngine turns it into something quicker to play.
+ */
+struct SequencerPattern
+{
+	enum { maxTracks = SEQUENCER_MAX_TRACKS, maxSteps = SEQUENCER_MAX_STEPS, maxOutputs = SEQUENCER_MAX_OUTPUTS,
+		   maxRatchets = 8, maxNudge = 127, useTrackNote = 0xff };
+
+	SequencerTrack tracks [maxTracks];
+	int numTracks;
+
+	// a note for each step of each track, for melodies; useTrackNote means use the track's note
+	// (so that any note, even 0, can be set for a step)
+	uint8 stepNotes [maxTracks][maxSteps];
+
+	// how long after each step of each track its note goes, in 256ths of a step, on top of
+	// any swing (e.g. for a recorded note that was only partly quantised)
+	uint8 stepDelays [maxTracks][maxSteps];
+
+	// how many times each step of each track plays its note, evenly spaced across the step
+	// (for rolls), up to maxRatchets; 0 or 1 means just once
+	uint8 stepRatchets [maxTracks][maxSteps];
+
+	// the chance of each step of each track playing, in percent; 0 means it always does
+	uint8 stepChances [maxTracks][maxSteps];
+
+	// how far each step of each track is nudged off the grid, in 256ths of a step, up to
+	// maxNudge either way; unlike the delay, this can take a note before its step
+	int8 stepNudges [maxTracks][maxSteps];
+
+	double tempo;						// in bpm
+	uint32 version;						// changed every time the pattern is published
+	uint32 randomSeed;					// decides which steps play when they're left to chance
+
+	SequencerPattern()
+	{
+		clear();
+	}
+
+	/** Go back to an empty pattern, as it was when it was made.
+	 */
+	void clear() throw()
+	{
+		numTracks = 0;
+		tempo = 120.0;
+		version = 0;
+		randomSeed = 0;
+
+		zeromem (tracks, sizeof (tracks));
+		memset (stepNotes, useTrackNote, sizeof (stepNotes));
+		zeromem (stepDelays, sizeof (stepDelays));
+		zeromem (stepRatchets, sizeof (stepRatchets));
+		zeromem (stepChances, sizeof (stepChances));
+		zeromem (stepNudges, sizeof (stepNudges));
+	}
+
+	/** Add a new empty track, returning its index or -1 if the pattern is full.
+	 */
+	int addTrack (const int length, const int note, const int channel, const float velocity = 1.0f) throw()
+	{
+		if (numTracks >= maxTracks)
+			return -1;
+
+		SequencerTrack& t = tracks [numTracks];
+		zeromem (&t, sizeof (t));
+		t.length = jlimit (1, (int) maxSteps, length);
+		t.note = (uint8) jlimit (0, 127, note);
+		t.channel = (uint8) jlimit (1, 16, channel);
+		t.velocity = velocity;
+		t.gate = 1.0f;
+		t.enabled = true;
+
+		return numTracks++;
+	}
+
+	/** The note a track plays on a step.
+	 */
+	int getNote (const int track, const int step) const throw()
+	{
+		const int n = stepNotes [track][step];
+		return n != useTrackNote ? n : tracks [track].note;
+	}
+
+	/** How long after a step a track's note goes, as a proportion of the step.
+	 */
+	float getStepDelay (const int track, const int step) const throw()
+	{
+		return stepDelays [track][step] / 256.0f;
+	}
+
+	/** How many times a track plays its note on a step, from 1 to maxRatchets.
+	 */
+	int getRatchets (const int track, const int step) const throw()
+	{
+		return jlimit (1, (int) maxRatchets, (int) stepRatchets [track][step]);
+	}
+
+	/** The chance of a track playing on a step, in percent (100 if it always does).
+	 */
+	int getChance (const int track, const int step) const throw()
+	{
+		const int chance = stepChances [track][step];
+		return (chance == 0 || chance > 100) ? 100 : chance;
+	}
+
+	/** How far a track's note is nudged off a step, as a proportion of the step (negative for earlier).
+	 */
+	float getStepNudge (const int track, const int step) const throw()
+	{
+		return jlimit (-(int) maxNudge, (int) maxNudge, (int) stepNudges [track][step]) / 256.0f;
+	}
+
+	/** The time between 16th note steps.
+	 */
+	double getStepLengthNanoseconds() const throw()
+	{
+		return (15.0 / tempo) * 1000000000.0;
+	}
+};
+
+#endif//_SEQUENCERPATTERN_H_
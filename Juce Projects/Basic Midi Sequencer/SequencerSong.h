@@ -0,0 +1,271 @@
+/*
+ *  SequencerSong.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _SEQUENCERSONG_H_
+#define _SEQUENCERSONG_H_
+
+#include <juce/juce.h>
+#include "SequencerPattern.h"
+#include "TempoMap.h"
+
+/**
+ An arrangement: a set of numbered patterns, and the order they're played in.
+
+ The song is a chain of entries, each playing one of the patterns for a number
+ of bars, starting from the pattern's first step. It's edited on the message
+ thread and handed to a SongCompiler, which turns it into an EventTimeline for
+ the sequencer thread.
+
+ Each pattern has a change count which goes up whenever its notes change (but not
+ its tempo, which the song doesn't use), so the compiler can tell which parts of
+ the song need working out again and which it already has.
+
+ The song has its own tempo, which can change (suddenly, or with a ramp) at the
+ start of any entry; see getTempoMap().
+ */
+class SequencerSong
+	{
+	public:
+		enum { maxPatterns = 16, stepsPerBar = 16 };
+
+		/** One link in the chain.
+		 */
+		struct Entry
+		{
+			int pattern;		// 0 to maxPatterns - 1
+			int numBars;		// at least 1
+		};
+
+		/** A change of tempo at the start of a bar.
+		 */
+		struct TempoChange
+		{
+			int bar;
+			double tempo;				// in bpm
+			TempoMap::CurveType ramp;	// how the tempo gets here from the one before
+		};
+
+		//==============================================================================
+		SequencerSong()
+			:	tempo (120.0)
+		{
+			for (int i = 0; i < maxPatterns; i++)
+			{
+				patterns.add (new SequencerPattern());
+				changeCounts[i] = 0;
+			}
+		}
+
+		~SequencerSong()
+		{
+		}
+
+		//==============================================================================
+		/** Change one of the patterns, returning true if its notes are any different.
+		 */
+		bool setPattern (const int index, const SequencerPattern& newPattern)
+		{
+			jassert (index >= 0 && index < maxPatterns);
+			SequencerPattern& p = *patterns [index];
+
+			if (p.numTracks == newPattern.numTracks
+				 && memcmp (p.tracks, newPattern.tracks, sizeof (p.tracks)) == 0
+				 && memcmp (p.stepNotes, newPattern.stepNotes, sizeof (p.stepNotes)) == 0
+				 && memcmp (p.stepDelays, newPattern.stepDelays, sizeof (p.stepDelays)) == 0
+				 && memcmp (p.stepRatchets, newPattern.stepRatchets, sizeof (p.stepRatchets)) == 0
+				 && memcmp (p.stepChances, newPattern.stepChances, sizeof (p.stepChances)) == 0
+				 && memcmp (p.stepNudges, newPattern.stepNudges, sizeof (p.stepNudges)) == 0
+				 && p.randomSeed == newPattern.randomSeed)
+			{
+				return false;
+			}
+
+			p = newPattern;
+			++changeCounts [index];
+			return true;
+		}
+
+		const SequencerPattern& getPattern (const int index) const throw()		{ return *patterns [index]; }
+
+		/** Goes up every time a pattern's notes change.
+		 */
+		uint32 getChangeCount (const int index) const throw()					{ return changeCounts [index]; }
+
+		//==============================================================================
+		int getNumEntries() const throw()										{ return entries.size(); }
+		const Entry getEntry (const int index) const throw()					{ return entries [index]; }
+
+		/** Add a link to the end of the chain.
+		 */
+		void addEntry (const int pattern, const int numBars)
+		{
+			Entry e;
+			e.pattern = jlimit (0, maxPatterns - 1, pattern);
+			e.numBars = jmax (1, numBars);
+			entries.add (e);
+		}
+
+		void setEntry (const int index, const int pattern, const int numBars)
+		{
+			Entry e;
+			e.pattern = jlimit (0, maxPatterns - 1, pattern);
+			e.numBars = jmax (1, numBars);
+			entries.set (index, e);
+		}
+
+		void removeEntry (const int index)						{ entries.remove (index); }
+		void clearEntries()										{ entries.clear(); }
+
+		/** Replace the chain and the tempo changes with ones written out as text,
+			returning false if it couldn't be read.
+
+		 The text is a list of pattern numbers (counting from 1), each optionally
+		 followed by 'x' and a number of bars, e.g. "1x4 2x4 1 3x2". A tempo can go
+		 between them: "@140" jumps to 140 bpm there, "/140" ramps up (or down) to
+		 it linearly from the last change, and "*140" ramps exponentially, e.g.
+		 "1x4 /160 2x4 @120 1x4". If it can't be read nothing's changed.
+		 */
+		bool setEntriesFromText (const String& text)
+		{
+			StringArray tokens;
+			tokens.addTokens (text, T(" ,"), T("\""));
+
+			Array<Entry> newEntries;
+			Array<TempoChange> newTempoChanges;
+			int bar = 0;
+
+			for (int i = 0; i < tokens.size(); i++)
+			{
+				const String token (tokens[i].toLowerCase());
+
+				if (token.isEmpty())
+					continue;
+
+				if (token.startsWith (T("@")) || token.startsWith (T("/")) || token.startsWith (T("*")))
+				{
+					TempoChange change;
+					change.bar = bar;
+					change.tempo = token.substring (1).getDoubleValue();
+					change.ramp = token.startsWith (T("@")) ? TempoMap::constant
+								: (token.startsWith (T("/")) ? TempoMap::linearRamp : TempoMap::exponentialRamp);
+
+					if (change.tempo < 1.0)
+						return false;
+
+					newTempoChanges.add (change);
+					continue;
+				}
+
+				const int pattern = token.upToFirstOccurrenceOf (T("x"), false, false).getIntValue();
+				const int numBars = token.contains (T("x")) ? token.fromFirstOccurrenceOf (T("x"), false, false).getIntValue() : 1;
+
+				if (pattern < 1 || pattern > maxPatterns || numBars < 1)
+					return false;
+
+				Entry e;
+				e.pattern = pattern - 1;
+				e.numBars = numBars;
+				newEntries.add (e);
+				bar += numBars;
+			}
+
+			entries = newEntries;
+			tempoChanges = newTempoChanges;
+			return true;
+		}
+
+		//==============================================================================
+		/** The tempo the song starts with, unless there's a change at bar 0.
+		 */
+		void setTempo (const double newTempo)					{ tempo = newTempo; }
+		double getTempo() const throw()							{ return tempo; }
+
+		/** Add a change of tempo after the others (they must be in bar order).
+		 */
+		void addTempoChange (const int bar, const double newTempo, const TempoMap::CurveType ramp)
+		{
+			TempoChange change;
+			change.bar = jmax (0, bar);
+			change.tempo = newTempo;
+			change.ramp = ramp;
+			tempoChanges.add (change);
+		}
+
+		void clearTempoChanges()								{ tempoChanges.clear(); }
+
+		/** Work out the tempo all the way through the song.
+		 */
+		const TempoMap getTempoMap() const
+		{
+			TempoMap map (tempo);
+
+			// a ramp is described from the end that it gets to, but a TempoMap segment
+			// ramps from its start, so each change sets the curve of the one before
+			int lastStep = 0;
+			double lastTempo = tempo;
+
+			for (int i = 0; i < tempoChanges.size(); i++)
+			{
+				const TempoChange change (tempoChanges.getUnchecked (i));
+				const int step = change.bar * SequencerSong::stepsPerBar;
+
+				if (step > lastStep && change.ramp != TempoMap::constant)
+					map.addSegment (lastStep, lastTempo, change.ramp);
+
+				map.addSegment (step, change.tempo, TempoMap::constant);
+				lastStep = step;
+				lastTempo = change.tempo;
+			}
+
+			return map;
+		}
+
+		/** The length of the whole chain.
+		 */
+		int getNumBars() const throw()
+		{
+			int numBars = 0;
+
+			for (int i = 0; i < entries.size(); i++)
+				numBars += entries.getUnchecked (i).numBars;
+
+			return numBars;
+		}
+
+		//==============================================================================
+		/** Make this a copy of another song, copying only the patterns that have changed.
+		 */
+		void copyFrom (const SequencerSong& other)
+		{
+			for (int i = 0; i < maxPatterns; i++)
+			{
+				if (changeCounts[i] != other.changeCounts[i])
+				{
+					*patterns[i] = *other.patterns[i];
+					changeCounts[i] = other.changeCounts[i];
+				}
+			}
+
+			entries = other.entries;
+			tempo = other.tempo;
+			tempoChanges = other.tempoChanges;
+		}
+
+	private:
+		// (the patterns are rather big, so they're kept on the heap)
+		OwnedArray<SequencerPattern> patterns;
+		uint32 changeCounts [maxPatterns];
+		Array<Entry> entries;
+		double tempo;
+		Array<TempoChange> tempoChanges;
+
+		SequencerSong (const SequencerSong&);
+		const SequencerSong& operator= (const SequencerSong&);
+	};
+
+#endif//_SEQUENCERSONG_H_
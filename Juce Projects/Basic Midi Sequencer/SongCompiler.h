@@ -0,0 +1,319 @@
+/*
+ *  SongCompiler.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _SONGCOMPILER_H_
+#define _SONGCOMPILER_H_
+
+#include <juce/juce.h>
+#include "SequencerSong.h"
+#include "EventTimeline.h"
+#include "PatternEngine.h"
+#include "Sequencer.h"
+
+/**
+ A background thread which turns a SequencerSong into an EventTimeline for a Sequencer.
+
+ Whenever the song is edited, songChanged() takes a copy of it (just the
+ patterns that have changed, and the chain) and wakes this thread, which builds
+ a new timeline and hands it to the sequencer. The sequencer swaps it in at its
+ next bar line, so nothing it does ever waits for this.
+
+ Building is incremental: each entry of the chain is worked out as a block of
+ events, and the blocks are kept, so after an edit only the entries using the
+ pattern that changed are worked out again. The rest of the timeline is just the
+ old blocks copied end to end, which is quick even for thousands of bars.
+
+ The same goes for the table of step times: it's kept, and only worked out
+ again from the first step where the tempo map has changed.
+ */
+class SongCompiler : public Thread
+	{
+	public:
+		SongCompiler (Sequencer& sequencer_)
+			:	Thread (T("Song Compiler")),
+				sequencer (sequencer_),
+				hasChanged (false),
+				stepTimes (0),
+				numStepTimes (0),
+				numStepTimesAllocated (0)
+		{
+			startThread (3);
+		}
+
+		~SongCompiler()
+		{
+			stopThread (3000);
+			delete[] stepTimes;
+		}
+
+		//==============================================================================
+		/** Build a new timeline for the song in the background (message thread only).
+
+		 If it's called again before the last one's been built, only the latest
+		 version gets built.
+		 */
+		void songChanged (const SequencerSong& song)
+		{
+			{
+				const ScopedLock sl (lock);
+				pendingSong.copyFrom (song);
+				hasChanged = true;
+			}
+
+			notify();
+		}
+
+		//==============================================================================
+		void run()
+		{
+			while (! threadShouldExit())
+			{
+				// (this also tidies up after the sequencer every so often)
+				wait (500);
+				sequencer.deleteRetiredTimelines();
+
+				{
+					const ScopedLock sl (lock);
+
+					if (! hasChanged)
+						continue;
+
+					song.copyFrom (pendingSong);
+					hasChanged = false;
+				}
+
+				sequencer.setTimeline (build());
+			}
+		}
+
+	private:
+		//==============================================================================
+		/** The events for one entry of the chain, which is all that's needed to play it.
+		 */
+		struct Block
+		{
+			int pattern;
+			uint32 changeCount;
+			int numBars;
+			Array<TimelineEvent> events;		// with the steps counted from the start of the block
+			bool isUsed;
+		};
+
+		/** A PatternEngine note sink which adds the notes to a Block.
+		 */
+		class BlockNoteSink
+			{
+			public:
+				BlockNoteSink (Block& block_, const int step_)
+					:	block (block_),
+						step (step_),
+						output (0),
+						delay (0)
+				{
+				}
+
+				void setDelay (const float proportionOfStep)
+				{
+					delay = (uint16) jlimit (0, 65535, roundFloatToInt (proportionOfStep * 65536.0f));
+				}
+
+				void setOutput (const int newOutput)
+				{
+					output = (uint8) jlimit (0, (int) SequencerPattern::maxOutputs - 1, newOutput);
+				}
+
+				void noteOn (const int channel, const int note, const float velocity)
+				{
+					add (MidiMessage::noteOn (channel, note, velocity));
+				}
+
+				void noteOff (const int channel, const int note)
+				{
+					add (MidiMessage::noteOff (channel, note));
+				}
+
+			private:
+				Block& block;
+				const int step;
+				uint8 output;
+				uint16 delay;
+
+				void add (const MidiMessage& message)
+				{
+					TimelineEvent e;
+					e.step = step;
+					e.delay = delay;
+					e.output = output;
+					e.size = (uint8) jmin (3, message.getRawDataSize());
+					memcpy (e.data, message.getRawData(), e.size);
+					block.events.add (e);
+				}
+
+				const BlockNoteSink& operator= (const BlockNoteSink&);
+			};
+
+		Sequencer& sequencer;
+
+		// songChanged() leaves its copy here, and the thread takes it under the lock
+		CriticalSection lock;
+		SequencerSong pendingSong;
+		bool hasChanged;
+
+		// the thread's own copy, and the blocks it's worked out so far
+		SequencerSong song;
+		OwnedArray<Block> blocks;
+		PatternEngine engine;
+
+		// the step times from last time, which are good up to numStepTimes, and the map they came from
+		TempoMap tempoMap;
+		int64* stepTimes;
+		int numStepTimes, numStepTimesAllocated;
+
+		//==============================================================================
+		EventTimeline* build()
+		{
+			const int numEntries = song.getNumEntries();
+			Array<Block*> entryBlocks;
+			int numEvents = 0;
+
+			for (int i = 0; i < blocks.size(); i++)
+				blocks.getUnchecked (i)->isUsed = false;
+
+			for (int i = 0; i < numEntries; i++)
+			{
+				Block* const block = getBlock (song.getEntry (i));
+				block->isUsed = true;
+				entryBlocks.add (block);
+				numEvents += block->events.size();
+			}
+
+			// forget any blocks that aren't in the song any more
+			for (int i = blocks.size(); --i >= 0;)
+				if (! blocks.getUnchecked (i)->isUsed)
+					blocks.remove (i);
+
+			// and copy the blocks end to end
+			EventTimeline* const timeline = new EventTimeline (song.getNumBars(), numEvents);
+			TimelineEvent* dest = timeline->getEventsForWriting();
+			int bar = 0, eventIndex = 0;
+
+			for (int i = 0; i < numEntries; i++)
+			{
+				const Block& block = *entryBlocks.getUnchecked (i);
+				const int firstStep = bar * EventTimeline::stepsPerBar;
+				int n = 0;
+
+				for (int blockBar = 0; blockBar < block.numBars; blockBar++)
+				{
+					// (the events are in step order, so each bar starts where the last one stopped)
+					while (n < block.events.size() && block.events.getUnchecked (n).step < blockBar * EventTimeline::stepsPerBar)
+						n++;
+
+					timeline->setBarStart (bar + blockBar, eventIndex + n);
+				}
+
+				for (int j = 0; j < block.events.size(); j++)
+				{
+					*dest = block.events.getUnchecked (j);
+					dest->step += firstStep;
+					++dest;
+				}
+
+				eventIndex += block.events.size();
+				bar += block.numBars;
+			}
+
+			timeline->setBarStart (bar, eventIndex);
+
+			// and the times of the steps
+			updateStepTimes (song.getTempoMap(), timeline->getNumSteps());
+			memcpy (timeline->getStepTimesForWriting(), stepTimes, (timeline->getNumSteps() + 1) * sizeof (int64));
+
+			return timeline;
+		}
+
+		/** Bring the step times up to date, for a song of a number of steps.
+		 */
+		void updateStepTimes (const TempoMap& newTempoMap, const int numSteps)
+		{
+			// only the times after the first change need working out again
+			const int firstChange = newTempoMap.findFirstDifference (tempoMap);
+			int firstToUpdate = numStepTimes;
+
+			if (firstChange >= 0)
+				firstToUpdate = jmin (firstToUpdate, firstChange);
+
+			if (numSteps + 1 > numStepTimesAllocated)
+			{
+				numStepTimesAllocated = (numSteps + 1) * 3 / 2;
+				int64* const newStepTimes = new int64 [numStepTimesAllocated];
+
+				if (stepTimes != 0)
+					memcpy (newStepTimes, stepTimes, jmin (numStepTimes, firstToUpdate) * sizeof (int64));
+
+				delete[] stepTimes;
+				stepTimes = newStepTimes;
+			}
+
+			// (each one's worked out from the start, rather than by adding on to the last one,
+			// so a long ramp doesn't build up any rounding errors)
+			for (int step = firstToUpdate; step <= numSteps; step++)
+				stepTimes [step] = newTempoMap.getTimeOfStep (step);
+
+			numStepTimes = numSteps + 1;
+			tempoMap = newTempoMap;
+		}
+
+		/** Find the block for an entry, working it out if it's not been done already.
+		 */
+		Block* getBlock (const SequencerSong::Entry& entry)
+		{
+			const uint32 changeCount = song.getChangeCount (entry.pattern);
+
+			for (int i = 0; i < blocks.size(); i++)
+			{
+				Block* const b = blocks.getUnchecked (i);
+
+				if (b->pattern == entry.pattern && b->changeCount == changeCount && b->numBars == entry.numBars)
+					return b;
+			}
+
+			Block* const b = new Block();
+			b->pattern = entry.pattern;
+			b->changeCount = changeCount;
+			b->numBars = entry.numBars;
+			blocks.add (b);
+
+			// each entry plays its pattern from the start, with its notes turned off at the end
+			const SequencerPattern& pattern = song.getPattern (entry.pattern);
+			const int numSteps = entry.numBars * EventTimeline::stepsPerBar;
+
+			engine.invalidate();
+			engine.compile (pattern);
+			engine.resetNotes();
+
+			// (nothing's nudged early into this block from the next one, which may be something else)
+			engine.setEndStep (numSteps);
+
+			for (int step = 0; step < numSteps; step++)
+			{
+				BlockNoteSink sink (*b, step);
+				engine.renderStep (pattern, step, sink);
+			}
+
+			BlockNoteSink sink (*b, numSteps);
+			engine.renderNotesOff (sink);
+
+			return b;
+		}
+
+		SongCompiler (const SongCompiler&);
+		const SongCompiler& operator= (const SongCompiler&);
+	};
+
+#endif//_SONGCOMPILER_H_
@@ -0,0 +1,313 @@
+/*
+ *  StepGridComponent.cpp
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#include "StepGridComponent.h"
+
+StepGridComponent::StepGridComponent (const int numRows_, const int numColumns_)
+	:	numRows (0),
+		numColumns (0),
+		playheadColumn (-1),
+		cellWidth (1),
+		cellHeight (1),
+		gap (0),
+		offColour (Colours::lightblue),
+		onColour (Colour (0xff4a6ed8)),
+		playheadColour (Colours::white),
+		dragTurnsOn (true),
+		lastDragRow (-1),
+		lastDragColumn (-1)
+{
+	zeromem (cells, sizeof (cells));
+	zeromem (divisions, sizeof (divisions));
+
+	for (int i = 0; i < numCellImages; i++)
+		cellImages[i] = 0;
+
+	setGridSize (numRows_, numColumns_);
+}
+
+StepGridComponent::~StepGridComponent()
+{
+	deleteCellImages();
+}
+
+//==============================================================================
+void StepGridComponent::setGridSize (const int newNumRows, const int newNumColumns)
+{
+	const int oldNumColumns = numColumns;
+	numRows = jlimit (1, (int) maxRows, newNumRows);
+	numColumns = jlimit (1, (int) maxColumns, newNumColumns);
+
+	// (the cells past the end of a shorter row are cleared, so they don't come back if it grows again)
+	for (int row = 0; row < maxRows; row++)
+	{
+		for (int column = numColumns; column < jmax (oldNumColumns, numColumns); column++)
+		{
+			cells [row][column >> 6] &= ~((uint64) 1 << (column & 63));
+			divisions [row][column] = 0;
+		}
+	}
+
+	for (int row = numRows; row < maxRows; row++)
+	{
+		for (int word = 0; word < wordsPerRow; word++)
+			cells [row][word] = 0;
+
+		zeromem (divisions [row], sizeof (divisions [row]));
+	}
+
+	if (playheadColumn >= numColumns)
+		playheadColumn = -1;
+
+	resized();
+}
+
+void StepGridComponent::setCellOn (const int row, const int column, const bool shouldBeOn)
+{
+	if (row < 0 || row >= numRows || column < 0 || column >= numColumns || isCellOn (row, column) == shouldBeOn)
+		return;
+
+	if (shouldBeOn)
+		cells [row][column >> 6] |= (uint64) 1 << (column & 63);
+	else
+		cells [row][column >> 6] &= ~((uint64) 1 << (column & 63));
+
+	repaintCell (row, column);
+}
+
+void StepGridComponent::clear()
+{
+	zeromem (cells, sizeof (cells));
+	zeromem (divisions, sizeof (divisions));
+	repaint();
+}
+
+void StepGridComponent::setCellDivisions (const int row, const int column, const int numDivisions)
+{
+	const int newDivisions = jlimit (1, (int) maxDivisions, numDivisions);
+
+	if (row < 0 || row >= numRows || column < 0 || column >= numColumns || getCellDivisions (row, column) == newDivisions)
+		return;
+
+	divisions [row][column] = (uint8) newDivisions;
+	repaintCell (row, column);
+}
+
+//==============================================================================
+void StepGridComponent::setPlayheadColumn (const int column)
+{
+	const int newColumn = (column >= 0 && column < numColumns) ? column : -1;
+
+	if (newColumn == playheadColumn)
+		return;
+
+	repaintColumn (playheadColumn);
+	playheadColumn = newColumn;
+	repaintColumn (playheadColumn);
+}
+
+void StepGridComponent::setCellColours (const Colour& off, const Colour& on, const Colour& playhead)
+{
+	offColour = off;
+	onColour = on;
+	playheadColour = playhead;
+
+	updateCellImages();
+	repaint();
+}
+
+//==============================================================================
+void StepGridComponent::addListener (StepGridListener* const listener)
+{
+	jassert (listener != 0);
+
+	if (listener != 0 && ! listeners.contains (listener))
+		listeners.add (listener);
+}
+
+void StepGridComponent::removeListener (StepGridListener* const listener)
+{
+	listeners.removeValue (listener);
+}
+
+//==============================================================================
+int StepGridComponent::getRowAt (const int y) const throw()
+{
+	const int row = y / cellHeight;
+	return (y >= 0 && row < numRows) ? row : -1;
+}
+
+int StepGridComponent::getColumnAt (const int x) const throw()
+{
+	const int column = x / cellWidth;
+	return (x >= 0 && column < numColumns) ? column : -1;
+}
+
+//==============================================================================
+void StepGridComponent::paint (Graphics& g)
+{
+	// only the cells inside the area that needs painting are drawn
+	const Rectangle clip (g.getClipBounds());
+
+	const int firstRow = jmax (0, clip.getY() / cellHeight);
+	const int lastRow = jmin (numRows - 1, (clip.getY() + clip.getHeight() - 1) / cellHeight);
+	const int firstColumn = jmax (0, clip.getX() / cellWidth);
+	const int lastColumn = jmin (numColumns - 1, (clip.getX() + clip.getWidth() - 1) / cellWidth);
+
+	for (int row = firstRow; row <= lastRow; row++)
+	{
+		for (int column = firstColumn; column <= lastColumn; column++)
+		{
+			const int imageIndex = (isCellOn (row, column) ? 1 : 0) + (column == playheadColumn ? 2 : 0);
+			g.drawImageAt (cellImages [imageIndex], column * cellWidth, row * cellHeight);
+
+			// (a divided cell has lines across it, in the same colour as its border)
+			const int numDivisions = getCellDivisions (row, column);
+
+			if (numDivisions > 1)
+			{
+				const Colour colour (isCellOn (row, column) ? onColour : offColour);
+				g.setColour (colour.darker (0.5f));
+
+				const int width = jmax (1, cellWidth - gap);
+				const float top = (float) (row * cellHeight);
+
+				for (int i = 1; i < numDivisions; i++)
+					g.drawVerticalLine (column * cellWidth + (width * i) / numDivisions, top, top + jmax (1, cellHeight - gap));
+			}
+		}
+	}
+}
+
+void StepGridComponent::resized()
+{
+	cellWidth = jmax (1, getWidth() / numColumns);
+	cellHeight = jmax (1, getHeight() / numRows);
+
+	// (tiny cells go right up against each other)
+	gap = jmin (2, cellWidth / 6, cellHeight / 6);
+
+	updateCellImages();
+	repaint();
+}
+
+//==============================================================================
+void StepGridComponent::mouseDown (const MouseEvent& e)
+{
+	const int row = getRowAt (e.y);
+	const int column = getColumnAt (e.x);
+
+	lastDragRow = row;
+	lastDragColumn = column;
+
+	if (row < 0 || column < 0)
+		return;
+
+	// (a right-click doesn't change anything, or start a drag)
+	if (e.mods.isPopupMenu())
+	{
+		lastDragRow = lastDragColumn = -1;
+
+		for (int i = listeners.size(); --i >= 0;)
+		{
+			listeners.getUnchecked (i)->stepGridCellMenuRequested (this, row, column);
+			i = jmin (i, listeners.size());
+		}
+
+		return;
+	}
+
+	// the first cell toggles, and the rest of the drag goes the same way
+	dragTurnsOn = ! isCellOn (row, column);
+	changeCellFromMouse (row, column);
+}
+
+void StepGridComponent::mouseDrag (const MouseEvent& e)
+{
+	if (lastDragRow < 0 || lastDragColumn < 0)
+		return;
+
+	// (going off the edge carries on along it)
+	const int row = jlimit (0, numRows - 1, e.y / cellHeight);
+	const int column = jlimit (0, numColumns - 1, e.x / cellWidth);
+
+	// the mouse can jump several cells between events, so the ones in between are filled in too
+	const int rowDistance = row - lastDragRow;
+	const int columnDistance = column - lastDragColumn;
+	const int numSteps = jmax (abs (rowDistance), abs (columnDistance));
+
+	for (int i = 1; i <= numSteps; i++)
+		changeCellFromMouse (lastDragRow + roundFloatToInt (rowDistance * i / (float) numSteps),
+							 lastDragColumn + roundFloatToInt (columnDistance * i / (float) numSteps));
+
+	lastDragRow = row;
+	lastDragColumn = column;
+}
+
+//==============================================================================
+void StepGridComponent::updateCellImages()
+{
+	deleteCellImages();
+
+	const int width = jmax (1, cellWidth - gap);
+	const int height = jmax (1, cellHeight - gap);
+
+	for (int i = 0; i < numCellImages; i++)
+	{
+		const bool isOn = (i & 1) != 0;
+		const bool isPlayhead = (i & 2) != 0;
+
+		// under the playhead, an off cell is the playhead's colour and an on one is lit up
+		Colour colour (isOn ? onColour : offColour);
+
+		if (isPlayhead)
+			colour = isOn ? onColour.brighter (0.6f) : playheadColour;
+
+		cellImages[i] = new Image (Image::RGB, width, height, true);
+		Graphics g (*cellImages[i]);
+
+		g.fillAll (colour);
+
+		if (width > 3 && height > 3)
+		{
+			g.setColour (colour.darker (0.5f));
+			g.drawRect (0, 0, width, height);
+		}
+	}
+}
+
+void StepGridComponent::deleteCellImages()
+{
+	for (int i = 0; i < numCellImages; i++)
+		deleteAndZero (cellImages[i]);
+}
+
+void StepGridComponent::repaintCell (const int row, const int column)
+{
+	repaint (column * cellWidth, row * cellHeight, cellWidth, cellHeight);
+}
+
+void StepGridComponent::repaintColumn (const int column)
+{
+	if (column >= 0)
+		repaint (column * cellWidth, 0, cellWidth, numRows * cellHeight);
+}
+
+void StepGridComponent::changeCellFromMouse (const int row, const int column)
+{
+	if (isCellOn (row, column) == dragTurnsOn)
+		return;
+
+	setCellOn (row, column, dragTurnsOn);
+
+	for (int i = listeners.size(); --i >= 0;)
+	{
+		listeners.getUnchecked (i)->stepGridCellChanged (this, row, column);
+		i = jmin (i, listeners.size());
+	}
+}
@@ -0,0 +1,149 @@
+/*
+ *  StepGridComponent.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _STEPGRIDCOMPONENT_H_
+#define _STEPGRIDCOMPONENT_H_
+
+#include <juce/juce.h>
+
+class StepGridComponent;
+
+/**
+ Receives a callback when the cells of a StepGridComponent are clicked on.
+ */
+class StepGridListener
+	{
+	public:
+		virtual ~StepGridListener() {}
+
+		/** Called when the mouse turns a cell on or off (but not when setCellOn() does).
+		 */
+		virtual void stepGridCellChanged (StepGridComponent* grid, int row, int column) = 0;
+
+		/** Called when a cell's right-clicked (or ctrl-clicked on the Mac), e.g. to show a menu
+			of its settings. This doesn't change the cell.
+		 */
+		virtual void stepGridCellMenuRequested (StepGridComponent*, int, int)	{}
+	};
+
+//==============================================================================
+/**
+ A grid of steps that can be turned on and off, drawn as a single component.
+
+ A row of TextButtons costs a whole component (and a listener) for every step,
+ which soon adds up for a big pattern. This keeps the cells in a bitset instead,
+ one bit each, and paints them all itself: each of the four ways a cell can look
+ (on or off, under the playhead or not) is drawn once into an image whenever the
+ size or colours change, and painting is just copying those images into the
+ cells that need it, so it's quick even for the biggest pattern.
+
+ The mouse is mapped to a cell by dividing by the cell size, rather than by
+ searching. Clicking a cell toggles it, and dragging from there sets every cell
+ the mouse goes over the same way (filling in any it skips over when it moves
+ quickly). Right-clicking one just tells the listeners, so they can show a menu.
+
+ A cell can also be drawn divided into a few parts (e.g. for a step that's
+ ratcheted); those are drawn over its image.
+
+ Moving the playhead only repaints the two columns it's moved between, and
+ changing a cell only repaints that cell.
+ */
+class StepGridComponent : public Component
+	{
+	public:
+		enum { maxRows = 128, maxColumns = 128, maxDivisions = 16 };
+
+		//==============================================================================
+		StepGridComponent (const int numRows, const int numColumns);
+		~StepGridComponent();
+
+		//==============================================================================
+		/** Change the number of rows and columns, keeping the cells that are still in the grid.
+		 */
+		void setGridSize (const int newNumRows, const int newNumColumns);
+
+		int getNumRows() const throw()										{ return numRows; }
+		int getNumColumns() const throw()									{ return numColumns; }
+
+		bool isCellOn (const int row, const int column) const throw()
+		{
+			return (cells [row][column >> 6] & ((uint64) 1 << (column & 63))) != 0;
+		}
+
+		/** Turn a cell on or off, without telling the listeners.
+		 */
+		void setCellOn (const int row, const int column, const bool shouldBeOn);
+
+		/** Turn all the cells off and take away their divisions, without telling the listeners.
+		 */
+		void clear();
+
+		/** Draw a cell divided into a number of parts across (1 for a plain cell, up to maxDivisions).
+		 */
+		void setCellDivisions (const int row, const int column, const int numDivisions);
+
+		int getCellDivisions (const int row, const int column) const throw()	{ return jmax (1, (int) divisions [row][column]); }
+
+		//==============================================================================
+		/** Highlight a column as the one that's playing, or -1 for none.
+		 */
+		void setPlayheadColumn (const int column);
+		int getPlayheadColumn() const throw()								{ return playheadColumn; }
+
+		/** Change the colours of the cells that are off and on, and of the playhead's column.
+		 */
+		void setCellColours (const Colour& off, const Colour& on, const Colour& playhead);
+
+		//==============================================================================
+		void addListener (StepGridListener* const listener);
+		void removeListener (StepGridListener* const listener);
+
+		//==============================================================================
+		/** The row or column at a position in the component, or -1 if there isn't one there.
+		 */
+		int getRowAt (const int y) const throw();
+		int getColumnAt (const int x) const throw();
+
+		//==============================================================================
+		void paint (Graphics& g);
+		void resized();
+		void mouseDown (const MouseEvent& e);
+		void mouseDrag (const MouseEvent& e);
+
+	private:
+		//==============================================================================
+		enum { wordsPerRow = maxColumns / 64, numCellImages = 4 };
+
+		int numRows, numColumns;
+		uint64 cells [maxRows][wordsPerRow];
+		uint8 divisions [maxRows][maxColumns];
+		int playheadColumn;
+
+		// the size of a cell including the gap around it, and the images they're painted with:
+		// off, on, then off and on under the playhead
+		int cellWidth, cellHeight, gap;
+		Colour offColour, onColour, playheadColour;
+		Image* cellImages [numCellImages];
+
+		Array<StepGridListener*> listeners;
+
+		// while dragging, whether the cells are being turned on or off, and the last one done
+		bool dragTurnsOn;
+		int lastDragRow, lastDragColumn;
+
+		void updateCellImages();
+		void deleteCellImages();
+		void repaintCell (const int row, const int column);
+		void repaintColumn (const int column);
+		void changeCellFromMouse (const int row, const int column);
+
+		StepGridComponent (const StepGridComponent&);
+		const StepGridComponent& operator= (const StepGridComponent&);
+	};
+
+#endif//_STEPGRIDCOMPONENT_H_
@@ -0,0 +1,227 @@
+/*
+ *  TempoMap.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _TEMPOMAP_H_
+#define _TEMPOMAP_H_
+
+#include <juce/juce.h>
+
+/**
+ How the tempo changes through a song.
+
+ The map is a list of segments, each starting on a step with a tempo. Over a
+ segment the tempo either stays the same, or ramps (linearly or exponentially,
+ against the position in the song) to the tempo the next segment starts with;
+ the last segment always stays the same.
+
+ getTimeOfStep() works out when a step happens by integrating the tempo over
+ the segments, which is done exactly rather than by adding up step lengths, so
+ a long ramp comes out just as accurately as a constant tempo. Every change
+ lands exactly on a step.
+ */
+class TempoMap
+	{
+	public:
+		enum CurveType
+		{
+			constant,
+			linearRamp,
+			exponentialRamp
+		};
+
+		struct Segment
+		{
+			int startStep;
+			double tempo;			// in bpm, at the start of the segment
+			CurveType curve;		// how it gets from there to the next segment's tempo
+		};
+
+		//==============================================================================
+		TempoMap (const double initialTempo = 120.0)
+		{
+			setConstantTempo (initialTempo);
+		}
+
+		~TempoMap()
+		{
+		}
+
+		//==============================================================================
+		/** Get rid of all the changes, leaving one tempo for the whole song.
+		 */
+		void setConstantTempo (const double tempo)
+		{
+			segments.clear();
+			addSegment (0, tempo, constant);
+		}
+
+		/** Add a change of tempo at a step, replacing any that's already there.
+
+		 The curve says what happens between this and the next change.
+		 */
+		void addSegment (const int startStep, const double tempo, const CurveType curve)
+		{
+			Segment s;
+			s.startStep = jmax (0, startStep);
+			s.tempo = jlimit (1.0, 10000.0, tempo);
+			s.curve = curve;
+
+			int i = 0;
+			while (i < segments.size() && segments.getUnchecked (i).startStep < s.startStep)
+				i++;
+
+			if (i < segments.size() && segments.getUnchecked (i).startStep == s.startStep)
+				segments.set (i, s);
+			else
+				segments.insert (i, s);
+
+			// (there must always be a segment at the start)
+			if (segments.getUnchecked (0).startStep != 0)
+			{
+				Segment first (segments.getUnchecked (0));
+				first.startStep = 0;
+				first.curve = constant;
+				segments.insert (0, first);
+			}
+
+			updateStartTimes();
+		}
+
+		int getNumSegments() const throw()							{ return segments.size(); }
+		const Segment getSegment (const int index) const throw()		{ return segments [index]; }
+
+		//==============================================================================
+		/** The time a step happens, in nanoseconds from the start of step 0.
+		 */
+		int64 getTimeOfStep (const int step) const throw()
+		{
+			const int i = findSegment (step);
+			return (int64) ((startTimes.getUnchecked (i) + getTimeIntoSegment (i, step - segments.getUnchecked (i).startStep)) * 1.0e9 + 0.5);
+		}
+
+		/** The tempo at a point in the song, in steps.
+		 */
+		double getTempoAt (const double step) const throw()
+		{
+			const int i = findSegment ((int) step);
+			const Segment& s = segments.getUnchecked (i);
+			const double length = getSegmentLength (i);
+
+			if (s.curve == constant || length <= 0)
+				return s.tempo;
+
+			const double endTempo = segments.getUnchecked (i + 1).tempo;
+			const double proportion = (step - s.startStep) / length;
+
+			if (s.curve == linearRamp)
+				return s.tempo + (endTempo - s.tempo) * proportion;
+
+			return s.tempo * pow (endTempo / s.tempo, proportion);
+		}
+
+		/** The first step whose time is different in the other map, or -1 if they're the same.
+		 */
+		int findFirstDifference (const TempoMap& other) const throw()
+		{
+			const int num = jmin (segments.size(), other.segments.size());
+			int i = 0;
+
+			while (i < num && isSameSegment (segments.getUnchecked (i), other.segments.getUnchecked (i)))
+				i++;
+
+			if (i == num && segments.size() == other.segments.size())
+				return -1;
+
+			// a ramp depends on the segment after it, so if that's changed the ramp has too
+			if (i > 0 && segments.getUnchecked (i - 1).curve != constant)
+				return segments.getUnchecked (i - 1).startStep;
+
+			if (i < num)
+				return jmin (segments.getUnchecked (i).startStep, other.segments.getUnchecked (i).startStep);
+
+			return segments.size() > num ? segments.getUnchecked (num).startStep
+										 : other.segments.getUnchecked (num).startStep;
+		}
+
+	private:
+		//==============================================================================
+		Array<Segment> segments;
+		Array<double> startTimes;		// in seconds, for each segment
+
+		static bool isSameSegment (const Segment& a, const Segment& b) throw()
+		{
+			return a.startStep == b.startStep && a.tempo == b.tempo && a.curve == b.curve;
+		}
+
+		int findSegment (const int step) const throw()
+		{
+			// (a binary search, as a long song can have a lot of changes)
+			int start = 0, end = segments.size();
+
+			while (end - start > 1)
+			{
+				const int middle = (start + end) / 2;
+
+				if (segments.getUnchecked (middle).startStep <= step)
+					start = middle;
+				else
+					end = middle;
+			}
+
+			return start;
+		}
+
+		/** The length of a segment in steps, or 0 for the last one (which goes on for ever).
+		 */
+		int getSegmentLength (const int i) const throw()
+		{
+			return i + 1 < segments.size() ? segments.getUnchecked (i + 1).startStep - segments.getUnchecked (i).startStep : 0;
+		}
+
+		/** The time from the start of a segment to a number of steps into it, in seconds.
+		 */
+		double getTimeIntoSegment (const int i, const double steps) const throw()
+		{
+			// a step is a 16th note, so at tempo T it lasts 15 / T seconds
+			const Segment& s = segments.getUnchecked (i);
+			const double length = getSegmentLength (i);
+
+			if (s.curve == constant || length <= 0)
+				return steps * 15.0 / s.tempo;
+
+			const double endTempo = segments.getUnchecked (i + 1).tempo;
+
+			if (fabs (endTempo - s.tempo) < 1.0e-9)
+				return steps * 15.0 / s.tempo;
+
+			if (s.curve == linearRamp)
+			{
+				// T(x) = T0 + (T1 - T0) x / L, and the integral of 15 / T(x) is a log
+				const double slope = (endTempo - s.tempo) / length;
+				return 15.0 / slope * log ((s.tempo + slope * steps) / s.tempo);
+			}
+
+			// T(x) = T0 e^(kx), where k = ln (T1 / T0) / L, and the integral of 15 / T(x) is an exponential
+			const double k = log (endTempo / s.tempo) / length;
+			return 15.0 / s.tempo * (1.0 - exp (-k * steps)) / k;
+		}
+
+		void updateStartTimes()
+		{
+			startTimes.clear();
+			double time = 0.0;
+
+			for (int i = 0; i < segments.size(); i++)
+			{
+				startTimes.add (time);
+				time += getTimeIntoSegment (i, getSegmentLength (i));
+			}
+		}
+	};
+
+#endif//_TEMPOMAP_H_
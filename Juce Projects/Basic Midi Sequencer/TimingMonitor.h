@@ -0,0 +1,256 @@
+/*
+ *  TimingMonitor.h
+ *  JuceMIDIApp
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _TIMINGMONITOR_H_
+#define _TIMINGMONITOR_H_
+
+#include <juce/juce.h>
+#include "LockFreeFifo.h"
+
+/**
+ Measures how late (or early) the sequencer's MIDI messages go out.
+
+ The thread that sends the messages calls addEvent() with the time each one was
+ meant to go and the time it actually went, and these are passed through a
+ LockFreeFifo so that measuring doesn't hold that thread up. The message thread
+ calls update() every so often to collect them into a histogram for each second
+ of playing, from which it works out the median, 99th percentile and worst
+ lateness, the earliest, and the drift (how far the median has moved since the
+ first second). Early messages count as negative lateness, so they pull the
+ median down rather than passing as on time.
+
+ When playing stops, finish() collects whatever's left, including the part of
+ a second that was playing when it stopped.
+
+ The results can be shown with getSummary() or saved with exportToCsv().
+ */
+class TimingMonitor
+	{
+	public:
+		/** The results for one second.
+		 */
+		struct SecondStats
+		{
+			int second;				// since playing started
+			int numEvents;
+			int medianMicroseconds;
+			int p99Microseconds;
+			int maxMicroseconds;
+			int minMicroseconds;	// (negative if anything went early)
+			int driftMicroseconds;
+		};
+
+		TimingMonitor()
+			:	events (16384)
+		{
+			reset();
+		}
+
+		//==============================================================================
+		/** Start again from nothing.
+
+		 Only call this when nothing is calling addEvent().
+		 */
+		void reset()
+		{
+			events.reset();
+			seconds.clear();
+			clearHistogram();
+			startTime = -1;
+			currentSecond = 0;
+			firstSecondMedian = -1;
+		}
+
+		/** Record one message being sent (the sending thread only).
+
+		 Both times are SequencerClock times, and the actual time should be taken
+		 once the message has been handed to the device, so that what the device
+		 call itself takes is counted too.
+		 */
+		void addEvent (const int64 intendedTime, const int64 actualTime) throw()
+		{
+			Event e;
+			e.intendedTime = intendedTime;
+			e.actualTime = actualTime;
+
+			// (if the message thread has got behind we just lose some measurements)
+			events.push (e);
+		}
+
+		/** Collect any new measurements (the message thread only).
+
+		 Returns true if a second has been finished since the last call.
+		 */
+		bool update()
+		{
+			const int numSecondsBefore = seconds.size();
+			Event e;
+
+			while (events.pop (e))
+			{
+				if (startTime < 0)
+					startTime = e.intendedTime;
+
+				const int second = (int) ((e.intendedTime - startTime) / 1000000000);
+
+				if (second != currentSecond && numEvents > 0)
+					finishSecond();
+
+				currentSecond = second;
+				addToHistogram ((int) ((e.actualTime - e.intendedTime) / 1000));
+			}
+
+			return seconds.size() != numSecondsBefore;
+		}
+
+		/** Collect the last measurements once the sending thread has stopped, finishing
+			the second that was in progress even if it's only part of one (the message
+			thread only).
+
+		 Returns true if any second was finished.
+		 */
+		bool finish()
+		{
+			const int numSecondsBefore = seconds.size();
+			update();
+
+			if (numEvents > 0)
+				finishSecond();
+
+			return seconds.size() != numSecondsBefore;
+		}
+
+		int getNumSeconds() const throw()						{ return seconds.size(); }
+		const SecondStats getSecond (const int index) const	{ return seconds [index]; }
+
+		/** A short description of the last complete second, for showing on screen.
+		 */
+		const String getSummary() const
+		{
+			if (seconds.size() == 0)
+				return String::empty;
+
+			const SecondStats s (seconds.getLast());
+
+			return String ("p50 ") << s.medianMicroseconds
+					<< " p99 " << s.p99Microseconds
+					<< " max " << s.maxMicroseconds
+					<< " min " << s.minMicroseconds
+					<< " drift " << s.driftMicroseconds << "us";
+		}
+
+		/** Write all the seconds measured so far to a CSV file, returning false if it couldn't be written.
+		 */
+		bool exportToCsv (const File& file) const
+		{
+			String csv ("second,events,p50_us,p99_us,max_us,min_us,drift_us\n");
+
+			for (int i = 0; i < seconds.size(); i++)
+			{
+				const SecondStats s (seconds[i]);
+
+				csv << s.second << "," << s.numEvents << ","
+					<< s.medianMicroseconds << "," << s.p99Microseconds << ","
+					<< s.maxMicroseconds << "," << s.minMicroseconds << "," << s.driftMicroseconds << "\n";
+			}
+
+			return file.replaceWithText (csv);
+		}
+
+	private:
+		//==============================================================================
+		// the histogram has 10us buckets from 2ms early to 10ms late, with anything
+		// outside that in the first or last one
+		enum { bucketMicroseconds = 10, earliestBucketMicroseconds = -2000, numBuckets = 1200 };
+
+		struct Event
+		{
+			int64 intendedTime;
+			int64 actualTime;
+		};
+
+		LockFreeFifo<Event> events;
+		Array<SecondStats> seconds;
+
+		int histogram [numBuckets];
+		int numEvents, maxLateness, minLateness;
+		int64 startTime;
+		int currentSecond;
+		int firstSecondMedian;
+
+		void clearHistogram() throw()
+		{
+			zeromem (histogram, sizeof (histogram));
+			numEvents = 0;
+			maxLateness = 0;
+			minLateness = 0;
+		}
+
+		void addToHistogram (const int latenessMicroseconds) throw()
+		{
+			// (rounded down, so that the buckets are the same size either side of 0)
+			const int offset = latenessMicroseconds - earliestBucketMicroseconds;
+			const int bucket = (offset >= 0 ? offset : offset - (bucketMicroseconds - 1)) / bucketMicroseconds;
+
+			histogram [jlimit (0, (int) numBuckets - 1, bucket)]++;
+
+			if (numEvents == 0)
+			{
+				maxLateness = minLateness = latenessMicroseconds;
+			}
+			else
+			{
+				maxLateness = jmax (maxLateness, latenessMicroseconds);
+				minLateness = jmin (minLateness, latenessMicroseconds);
+			}
+
+			numEvents++;
+		}
+
+		/** The lateness that the given fraction of events were no later than (negative if early).
+		 */
+		int getPercentile (const double fraction) const throw()
+		{
+			const int target = jmax (1, (int) ceil (numEvents * fraction));
+			int count = 0;
+
+			for (int i = 0; i < numBuckets; i++)
+			{
+				count += histogram[i];
+
+				if (count >= target)
+					return jlimit (minLateness, maxLateness, earliestBucketMicroseconds + (i + 1) * bucketMicroseconds);
+			}
+
+			return maxLateness;
+		}
+
+		void finishSecond()
+		{
+			SecondStats s;
+			s.second = currentSecond;
+			s.numEvents = numEvents;
+			s.medianMicroseconds = getPercentile (0.5);
+			s.p99Microseconds = getPercentile (0.99);
+			s.maxMicroseconds = maxLateness;
+			s.minMicroseconds = minLateness;
+
+			if (firstSecondMedian < 0)
+				firstSecondMedian = s.medianMicroseconds;
+
+			s.driftMicroseconds = s.medianMicroseconds - firstSecondMedian;
+
+			seconds.add (s);
+			clearHistogram();
+		}
+
+		TimingMonitor (const TimingMonitor&);
+		const TimingMonitor& operator= (const TimingMonitor&);
+	};
+
+#endif//_TIMINGMONITOR_H_
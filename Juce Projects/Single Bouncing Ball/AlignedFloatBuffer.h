@@ -0,0 +1,55 @@
+/*
+ *  AlignedFloatBuffer.h
+ *  BouncingBallAudio
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _ALIGNEDFLOATBUFFER_H_
+#define _ALIGNEDFLOATBUFFER_H_
+
+#include <juce/juce.h>
+
+// SSE is used for the heavy DSP loops wherever the compiler supports it
+#if (defined (__SSE__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 1)) && ! defined (BOUNCINGBALL_NO_SSE)
+ #include <xmmintrin.h>
+ #define BOUNCINGBALL_USE_SSE 1
+#endif
+
+/**
+ A block of floats aligned to 16 bytes, for use with SSE.
+
+ The memory is allocated once, in the constructor, and is cleared to zero.
+ */
+class AlignedFloatBuffer
+	{
+	public:
+		AlignedFloatBuffer (const int numFloats)
+			:	size (numFloats)
+		{
+			raw = new char [numFloats * sizeof (float) + 16];
+			data = (float*) (((size_t) raw + 15) & ~(size_t) 15);
+			clear();
+		}
+
+		~AlignedFloatBuffer()
+		{
+			delete[] raw;
+		}
+
+		void clear() throw()					{ zeromem (data, size * sizeof (float)); }
+
+		float* getData() const throw()			{ return data; }
+		int getSize() const throw()				{ return size; }
+
+	private:
+		char* raw;
+		float* data;
+		const int size;
+
+		AlignedFloatBuffer (const AlignedFloatBuffer&);
+		const AlignedFloatBuffer& operator= (const AlignedFloatBuffer&);
+	};
+
+#endif//_ALIGNEDFLOATBUFFER_H_
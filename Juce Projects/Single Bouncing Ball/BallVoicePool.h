@@ -0,0 +1,235 @@
+/*
+ *  BallVoicePool.h
+ *  BouncingBallAudio
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _BALLVOICEPOOL_H_
+#define _BALLVOICEPOOL_H_
+
+#include <juce/juce.h>
+#include "LockFreeFifo.h"
+
+/**
+ Plays the bounce sounds from a fixed set of voices.
+
+ All the sound files are read into memory up front, and any number of balls can
+ share them. Triggers are passed to the audio thread through a LockFreeFifo and
+ picked up at the start of the next block; if all the voices are busy the oldest
+ one is stolen. Nothing here allocates or locks once the sounds are loaded, so
+ balls can come and go as fast as they like.
+ */
+class BallVoicePool : public AudioSource
+	{
+	public:
+
+		/** Construct a pool with a fixed number of voices.
+		 */
+		BallVoicePool (const int maxVoices_)
+			:	maxVoices (maxVoices_),
+				triggers (1024),
+				outputSampleRate (44100.0),
+				voiceCounter (0),
+				currentSampleTime (0),
+				lastMeasuredLatency (-1)
+		{
+			voices = new Voice [maxVoices];
+
+			for (int i = 0; i < maxVoices; i++)
+				voices[i].sound = -1;
+		}
+
+		~BallVoicePool()
+		{
+			delete[] voices;
+		}
+
+		/** Load a sound file into memory, returning its index or -1 if it couldn't be read.
+
+		 This must be done before the pool starts playing.
+		 */
+		int addSound (const File& file)
+		{
+			AudioFormatManager formatManager;
+			formatManager.registerBasicFormats();
+
+			AudioFormatReader* reader = formatManager.createReaderFor (file);
+
+			if (reader == 0)
+				return -1;
+
+			const int numSamples = (int) reader->lengthInSamples;
+			AudioSampleBuffer* buffer = new AudioSampleBuffer (2, numSamples);
+			buffer->readFromAudioReader (reader, 0, numSamples, 0, true, true);
+
+			sounds.add (buffer);
+			soundSampleRates.add (reader->sampleRate);
+
+			delete reader;
+
+			return sounds.size() - 1;
+		}
+
+		int getNumSounds() const throw()		{ return sounds.size(); }
+
+		/** Ask for a sound to be played at the start of the next audio block.
+
+		 This should only be called from one thread (the message thread). If more
+		 triggers arrive than can be played in one block, the extra ones are dropped.
+
+		 If the trigger was caused by something in the audio input, pass the input
+		 sample time of that event and the delay until the sound actually starts
+		 will be measured (see getLastMeasuredLatency()).
+		 */
+		void trigger (const int soundIndex, const float gain, const int64 inputSampleTime = -1)
+		{
+			if (soundIndex < 0 || soundIndex >= sounds.size())
+				return;
+
+			TriggerMessage t;
+			t.sound = soundIndex;
+			t.gain = gain;
+			t.inputSampleTime = inputSampleTime;
+
+			triggers.push (t);
+		}
+
+		/** Tell the pool the device sample time of the block it's about to render.
+
+		 Call this from the audio callback, on the same clock as the input sample
+		 times passed to trigger().
+		 */
+		void setCurrentSampleTime (const int64 sampleTime) throw()		{ currentSampleTime = sampleTime; }
+
+		/** The number of samples between the last input event passed to trigger() and
+		 the start of the block its sound started in, or -1 if there hasn't been one.
+
+		 This doesn't include the device's own input and output latency.
+		 */
+		int getLastMeasuredLatency() const throw()						{ return lastMeasuredLatency; }
+
+		//==============================================================================
+		void prepareToPlay (int samplesPerBlockExpected, double sampleRate)
+		{
+			outputSampleRate = sampleRate;
+		}
+
+		void releaseResources()
+		{
+			for (int i = 0; i < maxVoices; i++)
+				voices[i].sound = -1;
+		}
+
+		void getNextAudioBlock (const AudioSourceChannelInfo& info)
+		{
+			info.clearActiveBufferRegion();
+
+			TriggerMessage t;
+
+			while (triggers.pop (t))
+				startVoice (t);
+
+			const int numChannels = jmin (2, info.buffer->getNumChannels());
+
+			for (int v = 0; v < maxVoices; v++)
+			{
+				if (voices[v].sound >= 0)
+					renderVoice (voices[v], *info.buffer, numChannels, info.startSample, info.numSamples);
+			}
+		}
+
+	private:
+		//==============================================================================
+		struct TriggerMessage
+		{
+			int sound;
+			float gain;
+			int64 inputSampleTime;
+		};
+
+		struct Voice
+		{
+			int sound;			// -1 when the voice is free
+			double position;
+			double increment;
+			float gain;
+			int startedAt;
+		};
+
+		const int maxVoices;
+		Voice* voices;
+		LockFreeFifo<TriggerMessage> triggers;
+		OwnedArray<AudioSampleBuffer> sounds;
+		Array<double> soundSampleRates;
+		double outputSampleRate;
+		int voiceCounter;
+		int64 currentSampleTime;
+		volatile int lastMeasuredLatency;
+
+		void startVoice (const TriggerMessage& t)
+		{
+			// use a free voice, or steal the one that's been playing longest
+			int best = 0;
+
+			for (int i = 0; i < maxVoices; i++)
+			{
+				if (voices[i].sound < 0)
+				{
+					best = i;
+					break;
+				}
+
+				if (voices[i].startedAt - voices[best].startedAt < 0)
+					best = i;
+			}
+
+			Voice& v = voices[best];
+			v.sound = t.sound;
+			v.position = 0.0;
+			v.increment = soundSampleRates.getUnchecked (t.sound) / outputSampleRate;
+			v.gain = t.gain;
+			v.startedAt = voiceCounter++;
+
+			if (t.inputSampleTime >= 0)
+				lastMeasuredLatency = (int) (currentSampleTime - t.inputSampleTime);
+		}
+
+		void renderVoice (Voice& v, AudioSampleBuffer& output, const int numChannels,
+						  const int startSample, const int numSamples)
+		{
+			const AudioSampleBuffer& sound = *sounds.getUnchecked (v.sound);
+			const int soundLength = sound.getNumSamples();
+
+			for (int chan = 0; chan < numChannels; chan++)
+			{
+				const float* const src = sound.getSampleData (chan);
+				float* const dest = output.getSampleData (chan, startSample);
+				double pos = v.position;
+
+				for (int i = 0; i < numSamples; i++)
+				{
+					const int index = (int) pos;
+
+					if (index >= soundLength - 1)
+						break;
+
+					// linear interpolation to cope with differing sample rates
+					const float alpha = (float) (pos - index);
+					dest[i] += v.gain * (src[index] + alpha * (src[index + 1] - src[index]));
+					pos += v.increment;
+				}
+			}
+
+			v.position += v.increment * numSamples;
+
+			if (v.position >= soundLength - 1)
+				v.sound = -1;
+		}
+
+		BallVoicePool (const BallVoicePool&);
+		const BallVoicePool& operator= (const BallVoicePool&);
+	};
+
+#endif//_BALLVOICEPOOL_H_
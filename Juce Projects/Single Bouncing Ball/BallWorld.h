@@ -0,0 +1,515 @@
+/*
+ *  BallWorld.h
+ *  BouncingBallAudio
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _BALLWORLD_H_
+#define _BALLWORLD_H_
+
+#include <juce/juce.h>
+#include "BouncingBallComponent.h"
+#include "SpatialGrid.h"
+
+// balls are between 10 and 39 pixels across (see BouncingBallComponent)
+#define MAX_BALL_SIZE 40.0f
+
+// the interval between physics steps, speeds are in pixels per step
+#define PHYSICS_INTERVAL_MS 40
+
+//==============================================================================
+/**
+ Moves all the balls in one place so they can bump into each other and be
+ picked up with the mouse.
+
+ Ball state is kept in flat preallocated arrays indexed by a ball id, and the
+ BouncingBallComponents are just views onto it. Every step each ball is moved
+ into its new grid cell (usually a no-op), then neighbouring balls are tested
+ against each other using that same grid, so both the collision broadphase and
+ mouse hit-testing stay O(1) per ball no matter how many balls there are.
+ */
+class BallWorld : public Timer
+{
+	struct BallState
+	{
+		float x, y;		// top-left, to match the component position
+		float dx, dy;
+		float size;
+		int zOrder;		// higher is drawn on top (see bringToFront())
+		bool held;
+	};
+
+	const int maxBalls;
+	int numBalls;
+	int nextZOrder;
+	BallState* balls;
+	BouncingBallComponent** views;
+	bool* bounced;
+	SpatialGrid grid;
+	float width, height;
+	double lastStepTime;
+
+	// the ball being dragged with the mouse
+	int heldBall;
+	float grabOffsetX, grabOffsetY;
+	float lastDragX, lastDragY;
+	double lastDragTime;
+	float throwDx, throwDy;
+
+public:
+	//==============================================================================
+	BallWorld (const int maxBalls_)
+		:	maxBalls (maxBalls_),
+			numBalls (0),
+			nextZOrder (0),
+			grid (maxBalls_),
+			width (300.0f),
+			height (300.0f),
+			lastStepTime (0.0),
+			heldBall (-1)
+	{
+		balls = new BallState [maxBalls];
+		views = new BouncingBallComponent* [maxBalls];
+		bounced = new bool [maxBalls];
+
+		grid.setSize (width, height, MAX_BALL_SIZE);
+
+		startTimer (PHYSICS_INTERVAL_MS);
+	}
+
+	~BallWorld()
+	{
+		stopTimer();
+
+		delete[] balls;
+		delete[] views;
+		delete[] bounced;
+	}
+
+	//==============================================================================
+	/** Start simulating a ball somewhere near the top-left, returning its id or -1
+	 if the world is full.
+
+	 The component is positioned by the world from now on, but is still owned
+	 by whoever created it.
+	 */
+	int addBall (BouncingBallComponent* const ball)
+	{
+		// Initial positions on screen
+		return addBallAt (ball,
+						  Random::getSystemRandom().nextFloat() * 100.0f,
+						  Random::getSystemRandom().nextFloat() * 100.0f);
+	}
+
+	/** Start simulating a ball with its top-left at (x, y), returning its id or -1
+	 if the world is full.
+	 */
+	int addBallAt (BouncingBallComponent* const ball, const float x, const float y)
+	{
+		if (ball == 0 || numBalls >= maxBalls)
+			return -1;
+
+		const int id = numBalls++;
+		BallState& b = balls[id];
+
+		b.x = x;
+		b.y = y;
+
+		// Speeds
+		b.dx = Random::getSystemRandom().nextFloat() * 4.0f - 2.0f;
+		b.dy = Random::getSystemRandom().nextFloat() * 4.0f - 2.0f;
+
+		b.size = (float) ball->getWidth();
+		b.held = false;
+
+		views[id] = ball;
+		bounced[id] = false;
+
+		grid.update (id, b.x + b.size * 0.5f, b.y + b.size * 0.5f);
+		ball->setBallPosition (b.x, b.y);
+
+		// (a pooled component could be anywhere in the child list, so a new ball goes on top)
+		bringToFront (id);
+
+		return id;
+	}
+
+	/** Stop simulating a ball, returning its component so it can be reused.
+
+	 To keep the arrays packed, the last ball takes over the removed ball's id.
+	 */
+	BouncingBallComponent* removeBall (const int id)
+	{
+		if (id < 0 || id >= numBalls)
+			return 0;
+
+		BouncingBallComponent* const removed = views[id];
+		const int last = --numBalls;
+
+		if (heldBall == id)
+			heldBall = -1;
+
+		grid.remove (id);
+
+		if (id != last)
+		{
+			grid.remove (last);
+
+			balls[id] = balls[last];
+			views[id] = views[last];
+			bounced[id] = bounced[last];
+
+			grid.update (id, balls[id].x + balls[id].size * 0.5f, balls[id].y + balls[id].size * 0.5f);
+
+			if (heldBall == last)
+				heldBall = id;
+		}
+
+		return removed;
+	}
+
+	int getNumBalls() const throw()		{ return numBalls; }
+
+	/** The component for a ball id.
+	 */
+	BouncingBallComponent* getBall (const int id) const throw()
+	{
+		return (id >= 0 && id < numBalls) ? views[id] : 0;
+	}
+	int getMaxBalls() const throw()		{ return maxBalls; }
+
+	/** Tell the world how big the window is.
+	 */
+	void setBounds (const int newWidth, const int newHeight)
+	{
+		width = (float) newWidth;
+		height = (float) newHeight;
+
+		grid.setSize (width, height, MAX_BALL_SIZE);
+
+		for (int i = 0; i < numBalls; i++)
+			grid.update (i, balls[i].x + balls[i].size * 0.5f, balls[i].y + balls[i].size * 0.5f);
+	}
+
+	//==============================================================================
+	/** Return the id of the top-most ball under a point, or -1 if there isn't one.
+	 */
+	int findBallAt (const float px, const float py) const
+	{
+		HitVisitor visitor (*this, px, py);
+		grid.visitNeighbours (px, py, visitor);
+
+		return visitor.found;
+	}
+
+	/** Pick up a ball so it follows the mouse and ignores the physics.
+	 */
+	void grabBall (const int id, const float px, const float py)
+	{
+		if (id < 0 || id >= numBalls)
+			return;
+
+		releaseBall();
+
+		heldBall = id;
+		balls[id].held = true;
+		balls[id].dx = balls[id].dy = 0.0f;
+
+		grabOffsetX = px - balls[id].x;
+		grabOffsetY = py - balls[id].y;
+
+		lastDragX = px;
+		lastDragY = py;
+		lastDragTime = Time::getMillisecondCounterHiRes();
+		throwDx = throwDy = 0.0f;
+
+		// draw it on top of the others while it's being dragged
+		bringToFront (id);
+	}
+
+	/** Move the held ball, keeping track of how fast it's going so that it can be thrown.
+	 */
+	void dragBall (const float px, const float py)
+	{
+		if (heldBall < 0)
+			return;
+
+		BallState& b = balls[heldBall];
+		b.x = px - grabOffsetX;
+		b.y = py - grabOffsetY;
+
+		grid.update (heldBall, b.x + b.size * 0.5f, b.y + b.size * 0.5f);
+		views[heldBall]->setBallPosition (b.x, b.y);
+
+		const double now = Time::getMillisecondCounterHiRes();
+		const double elapsed = now - lastDragTime;
+
+		if (elapsed > 0.5)
+		{
+			// convert to pixels per step and smooth out the jumpiness of mouse events
+			const float scale = (float) (PHYSICS_INTERVAL_MS / elapsed);
+			throwDx = 0.5f * throwDx + 0.5f * (px - lastDragX) * scale;
+			throwDy = 0.5f * throwDy + 0.5f * (py - lastDragY) * scale;
+
+			lastDragX = px;
+			lastDragY = py;
+			lastDragTime = now;
+		}
+	}
+
+	/** Let go of the held ball, throwing it with the speed it was being dragged at.
+	 */
+	void releaseBall()
+	{
+		if (heldBall < 0)
+			return;
+
+		BallState& b = balls[heldBall];
+		b.held = false;
+
+		// if the mouse stopped before letting go, the ball should just drop
+		if (Time::getMillisecondCounterHiRes() - lastDragTime > 100.0)
+			throwDx = throwDy = 0.0f;
+
+		const float maxSpeed = MAX_BALL_SIZE * 0.5f;
+		b.dx = jlimit (-maxSpeed, maxSpeed, throwDx);
+		b.dy = jlimit (-maxSpeed, maxSpeed, throwDy);
+
+		heldBall = -1;
+	}
+
+	bool isHoldingBall() const throw()		{ return heldBall >= 0; }
+
+	/** Give a ball a new speed as of a given time (on the Time::getMillisecondCounterHiRes() clock).
+
+	 The next step moves the ball a whole interval at its new speed, so if the kick
+	 happened part way through the interval the ball is moved back to where it would
+	 have been had it kept its old speed until then. That way the time of the kick
+	 carries through to the simulation exactly, not just to the nearest step.
+	 */
+	void kickBall (const int id, const float newDx, const float newDy, const double kickTimeMs)
+	{
+		if (id < 0 || id >= numBalls || balls[id].held)
+			return;
+
+		BallState& b = balls[id];
+		const float elapsed = jlimit (0.0f, 1.0f, (float) ((kickTimeMs - lastStepTime) / PHYSICS_INTERVAL_MS));
+
+		b.x += (b.dx - newDx) * elapsed;
+		b.y += (b.dy - newDy) * elapsed;
+		b.dx = newDx;
+		b.dy = newDy;
+	}
+
+	//==============================================================================
+	void timerCallback()
+	{
+		step();
+	}
+
+	/** Advance all the balls by one step and tell the ones that bounced.
+	 */
+	void step()
+	{
+		int i;
+		lastStepTime = Time::getMillisecondCounterHiRes();
+
+		for (i = 0; i < numBalls; i++)
+		{
+			BallState& b = balls[i];
+			bounced[i] = false;
+
+			if (b.held)
+				continue;
+
+			// Set new co-ordinates
+			b.x += b.dx;
+			b.y += b.dy;
+
+			// Ball hits left or right side of window
+			if (b.x < 0)
+			{
+				b.dx = fabsf (b.dx);
+				bounced[i] = true;
+			}
+			else if (b.x > width - b.size)
+			{
+				b.dx = -fabsf (b.dx);
+				bounced[i] = true;
+			}
+
+			// Ball hits top or bottom of window
+			if (b.y < 0)
+			{
+				b.dy = fabsf (b.dy);
+				bounced[i] = true;
+			}
+			else if (b.y > height - b.size)
+			{
+				b.dy = -fabsf (b.dy);
+				bounced[i] = true;
+			}
+
+			grid.update (i, b.x + b.size * 0.5f, b.y + b.size * 0.5f);
+		}
+
+		// broadphase: only balls in neighbouring cells can be touching
+		for (i = 0; i < numBalls; i++)
+		{
+			CollisionVisitor visitor (*this, i);
+			grid.visitNeighbours (balls[i].x + balls[i].size * 0.5f,
+								  balls[i].y + balls[i].size * 0.5f,
+								  visitor);
+		}
+
+		for (i = 0; i < numBalls; i++)
+		{
+			if (bounced[i])
+			{
+				// collisions may have nudged it into another cell
+				grid.update (i, balls[i].x + balls[i].size * 0.5f, balls[i].y + balls[i].size * 0.5f);
+			}
+
+			if (! balls[i].held)
+				views[i]->setBallPosition (balls[i].x, balls[i].y);
+
+			if (bounced[i])
+				views[i]->sendCollisionMessage();
+		}
+	}
+
+private:
+	//==============================================================================
+	struct HitVisitor
+	{
+		HitVisitor (const BallWorld& world_, const float x_, const float y_)
+			: world (world_), x (x_), y (y_), found (-1), foundOrder (-1)
+		{
+		}
+
+		bool visit (const int id)
+		{
+			const BallState& b = world.balls[id];
+			const float r = b.size * 0.5f;
+			const float ox = x - (b.x + r);
+			const float oy = y - (b.y + r);
+
+			if (ox * ox + oy * oy <= r * r)
+			{
+				// (the ids don't say which is drawn on top, as removing a ball moves the last one's id)
+				if (found < 0 || b.zOrder > foundOrder)
+				{
+					found = id;
+					foundOrder = b.zOrder;
+				}
+			}
+
+			return true;
+		}
+
+		const BallWorld& world;
+		const float x, y;
+		int found, foundOrder;
+	};
+
+	struct CollisionVisitor
+	{
+		CollisionVisitor (BallWorld& world_, const int id_)
+			: world (world_), id (id_)
+		{
+		}
+
+		bool visit (const int other)
+		{
+			// each pair only needs testing once
+			if (other > id)
+				world.collide (id, other);
+
+			return true;
+		}
+
+		BallWorld& world;
+		const int id;
+	};
+
+	friend struct HitVisitor;
+	friend struct CollisionVisitor;
+
+	/** Draw a ball on top of the others, and remember that it is, so hit-testing
+	 never has to look through the components.
+	 */
+	void bringToFront (const int id)
+	{
+		balls[id].zOrder = nextZOrder++;
+		views[id]->toFront (false);
+	}
+
+	void collide (const int i, const int j)
+	{
+		BallState& a = balls[i];
+		BallState& b = balls[j];
+
+		if (a.held && b.held)
+			return;
+
+		const float ra = a.size * 0.5f;
+		const float rb = b.size * 0.5f;
+		const float nx = (b.x + rb) - (a.x + ra);
+		const float ny = (b.y + rb) - (a.y + ra);
+		const float distSquared = nx * nx + ny * ny;
+		const float minDist = ra + rb;
+
+		if (distSquared >= minDist * minDist || distSquared <= 0.0f)
+			return;
+
+		const float dist = sqrtf (distSquared);
+		const float ux = nx / dist;
+		const float uy = ny / dist;
+
+		// push them apart so they don't stick together, a held ball doesn't move
+		const float overlap = minDist - dist;
+		const float pushA = b.held ? overlap : (a.held ? 0.0f : overlap * 0.5f);
+		const float pushB = overlap - pushA;
+
+		a.x -= ux * pushA;
+		a.y -= uy * pushA;
+		b.x += ux * pushB;
+		b.y += uy * pushB;
+
+		// only bounce if they're moving towards each other
+		const float closingSpeed = (a.dx - b.dx) * ux + (a.dy - b.dy) * uy;
+
+		if (closingSpeed <= 0.0f)
+			return;
+
+		// equal masses swap their velocities along the line between them,
+		// a held ball acts like a wall
+		if (a.held)
+		{
+			b.dx += 2.0f * closingSpeed * ux;
+			b.dy += 2.0f * closingSpeed * uy;
+		}
+		else if (b.held)
+		{
+			a.dx -= 2.0f * closingSpeed * ux;
+			a.dy -= 2.0f * closingSpeed * uy;
+		}
+		else
+		{
+			a.dx -= closingSpeed * ux;
+			a.dy -= closingSpeed * uy;
+			b.dx += closingSpeed * ux;
+			b.dy += closingSpeed * uy;
+		}
+
+		bounced[i] = true;
+		bounced[j] = true;
+	}
+
+	BallWorld (const BallWorld&);
+	const BallWorld& operator= (const BallWorld&);
+};
+
+#endif//_BALLWORLD_H_
@@ -7,9 +7,12 @@
  *
  */
 
+#ifndef _BOUNCINGBALLCOMPONENT_H_
+#define _BOUNCINGBALLCOMPONENT_H_
+
 #include <juce/juce.h>
 
-/** This listens for the balls hitting the edge of the window.
+/** This listens for the balls hitting the edge of the window or each other.
  */
 class BouncingBallListener
 	{
@@ -20,25 +23,36 @@ class BouncingBallListener
 
 //==============================================================================
 
-class BouncingBallComponent :	public Component,
-								public Timer
+/** Draws a ball.
+
+ The ball doesn't move itself, its position is set by the BallWorld which does
+ the physics for all the balls together.
+ */
+class BouncingBallComponent :	public Component
 {
     Colour colour;
-    float x, y, dx, dy;
+    float x, y;
+	int soundIndex;
 	SortedSet <void*> ballListeners;
 	
 public:
 	
     BouncingBallComponent()
+		: x (0.0f),
+		  y (0.0f),
+		  soundIndex (0)
     {		
-        // Initial positions on screen
-		x = Random::getSystemRandom().nextFloat() * 100.0f;
-        y = Random::getSystemRandom().nextFloat() * 100.0f;
-		
-		// Speeds
-        dx = Random::getSystemRandom().nextFloat() * 4.0f - 2.0f;
-        dy = Random::getSystemRandom().nextFloat() * 4.0f - 2.0f;
-		
+		reset();
+    }
+	
+    ~BouncingBallComponent()
+    {
+    }
+	
+	/** Give the ball a new random colour and size, so it can be reused for a new ball.
+	 */
+	void reset()
+	{
 		// Colour and size
         colour = Colour (Random::getSystemRandom().nextInt())
 		.withAlpha (0.5f)
@@ -46,13 +60,12 @@ public:
 		
         int size = 10 + Random::getSystemRandom().nextInt (30);
         setSize (size, size);
-		
-        startTimer (40);
-    }
+	}
 	
-    ~BouncingBallComponent()
-    {
-    }
+	/** The sound this ball makes when it bounces.
+	 */
+	void setSoundIndex (const int newIndex) throw()		{ soundIndex = newIndex; }
+	int getSoundIndex() const throw()					{ return soundIndex; }
 	
     void paint (Graphics& g)
     {
@@ -60,56 +73,21 @@ public:
         g.fillEllipse (x - getX(), y - getY(), getWidth() - 2.0f, getHeight() - 2.0f);
     }
 	
-    void timerCallback()
-    {				
-        bool bounced = false;
-		
-		// Set new co-ordinates
-		x += dx;
-        y += dy;
-		
-		// Ball hits left side of window
-        if (x < 0)
-		{
-			// Make x movement positive
-            dx = fabsf (dx);
-			bounced = true;
-		}
-		
-		// Ball hits right side of window
-        if (x > (getParentWidth()-getWidth()) )
-		{
-            // Make x movement negative
-			dx = -fabsf (dx);
-			bounced = true;
-		}
-		
-		// Ball hits top of window
-        if (y < 0)
-		{
-            // Make y movement positive
-			dy = fabsf (dy);
-			bounced = true;
-		}
-		
-		// Ball hits bottom of window
-        if (y > (getParentHeight()-getHeight()) )
-		{
-            // Make y movement negative
-			dy = -fabsf (dy);
-			bounced = true;
-		}
+	/** Move the ball to new (sub-pixel) co-ordinates.
+	 */
+	void setBallPosition (const float newX, const float newY)
+	{
+		x = newX;
+		y = newY;
 		
 		// Move ball to new co-ordinates
         setTopLeftPosition ((int) x, (int) y);
-		
-		// If the ball has hit a side:
-		if (bounced) 
-			sendCollisionMessage();
-    }
+	}
 	
     bool hitTest (int x, int y)
     {
+		// mouse clicks fall through to the parent, which finds the ball
+		// using the BallWorld's grid rather than asking every component
         return false;
     }
 	
@@ -137,3 +115,5 @@ public:
         }
 	}
 };
+
+#endif//_BOUNCINGBALLCOMPONENT_H_
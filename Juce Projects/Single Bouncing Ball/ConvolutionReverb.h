@@ -0,0 +1,663 @@
+/*
+ *  ConvolutionReverb.h
+ *  BouncingBallAudio
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _CONVOLUTIONREVERB_H_
+#define _CONVOLUTIONREVERB_H_
+
+#include <juce/juce.h>
+#include "SimpleFFT.h"
+#include "LockFreeFifo.h"
+
+// the longest impulse response we'll load, in seconds
+#define MAX_IMPULSE_SECONDS 10.0
+
+//==============================================================================
+/**
+ Convolves a stereo signal with a mono impulse response, using a uniformly
+ partitioned overlap-save algorithm.
+
+ The impulse response is cut into partitions of blockSize samples, each of which
+ is transformed once when the engine is built. Every block of input is then
+ transformed and kept in a frequency-domain delay line, and the output block is
+ the inverse transform of the sum of (delayed input spectrum * partition
+ spectrum) over all the partitions. The latency is one block.
+
+ Only the first partition needs the newest input, so the rest of that sum (which
+ is most of the work for a long impulse response) is done a bit at a time as the
+ next block's input arrives, in proportion to how many samples have come in.
+ So when the device's blocks are smaller than a partition, each callback does
+ about the same amount of work, rather than every few callbacks doing all of it.
+
+ The left and right channels are packed into the real and imaginary parts of a
+ single complex FFT (which works because the impulse response is real), so a
+ stereo block costs one forward and one inverse transform.
+
+ Everything is allocated in the constructor, which can be slow for long impulse
+ responses, so build engines on a background thread.
+ */
+class ConvolutionEngine
+	{
+	public:
+		/** Prepare to convolve with an impulse response.
+
+		 blockSize must be a power of 2.
+		 */
+		ConvolutionEngine (const float* const impulse, const int impulseLength,
+						   const int blockSize_, const double sampleRate_)
+			:	blockSize (blockSize_),
+				fftSize (blockSize_ * 2),
+				numPartitions (jmax (1, (impulseLength + blockSize_ - 1) / blockSize_)),
+				sampleRate (sampleRate_),
+				fft (blockSize_ * 2),
+				partitions (numPartitions * blockSize_ * 4),
+				delayLine (numPartitions * blockSize_ * 4),
+				workRe (blockSize_ * 2),
+				workIm (blockSize_ * 2),
+				accRe (blockSize_ * 2),
+				accIm (blockSize_ * 2),
+				delayLineIndex (0),
+				nextPartition (1),
+				inputLeft (blockSize_),
+				inputRight (blockSize_),
+				outputLeft (blockSize_),
+				outputRight (blockSize_),
+				bufferPosition (0)
+		{
+			inputHistoryLeft = new float [blockSize];
+			inputHistoryRight = new float [blockSize];
+			zeromem (inputHistoryLeft, blockSize * sizeof (float));
+			zeromem (inputHistoryRight, blockSize * sizeof (float));
+
+			// the forward transform of each partition, with the 1/N scaling of the
+			// inverse transform folded in
+			const float scale = 1.0f / fftSize;
+
+			for (int p = 0; p < numPartitions; p++)
+			{
+				float* const re = getPartitionRe (p);
+				float* const im = getPartitionIm (p);
+
+				for (int i = 0; i < blockSize; i++)
+				{
+					const int index = p * blockSize + i;
+					re[i] = index < impulseLength ? impulse[index] * scale : 0.0f;
+				}
+
+				fft.perform (re, im, false);
+			}
+		}
+
+		~ConvolutionEngine()
+		{
+			delete[] inputHistoryLeft;
+			delete[] inputHistoryRight;
+		}
+
+		int getBlockSize() const throw()				{ return blockSize; }
+		int getNumPartitions() const throw()			{ return numPartitions; }
+		double getSampleRate() const throw()			{ return sampleRate; }
+
+		/** The wet signal lags the input by this many samples.
+		 */
+		int getLatencySamples() const throw()			{ return blockSize; }
+
+		/** Convolve any number of samples, replacing the input with the wet signal.
+
+		 Pass 0 for right when there's only one channel.
+		 */
+		void process (float* left, float* right, int numSamples) throw()
+		{
+			while (numSamples > 0)
+			{
+				const int num = jmin (numSamples, blockSize - bufferPosition);
+
+				memcpy (inputLeft.getData() + bufferPosition, left, num * sizeof (float));
+				memcpy (left, outputLeft.getData() + bufferPosition, num * sizeof (float));
+				left += num;
+
+				if (right != 0)
+				{
+					memcpy (inputRight.getData() + bufferPosition, right, num * sizeof (float));
+					memcpy (right, outputRight.getData() + bufferPosition, num * sizeof (float));
+					right += num;
+				}
+
+				bufferPosition += num;
+				numSamples -= num;
+
+				if (bufferPosition == blockSize)
+				{
+					processBlock();
+					bufferPosition = 0;
+				}
+				else
+				{
+					// keep up with this block's share of the older partitions
+					accumulatePartitions (1 + (numPartitions - 1) * bufferPosition / blockSize);
+				}
+			}
+		}
+
+		/** Convolve one complete block from inputLeft/Right into outputLeft/Right.
+		 */
+		void processBlock() throw()
+		{
+			float* const re = workRe.getData();
+			float* const im = workIm.getData();
+
+			// whatever's left of the older partitions' part of the sum
+			accumulatePartitions (numPartitions);
+
+			// overlap-save: the previous block followed by the new one
+			memcpy (re, inputHistoryLeft, blockSize * sizeof (float));
+			memcpy (re + blockSize, inputLeft.getData(), blockSize * sizeof (float));
+			memcpy (im, inputHistoryRight, blockSize * sizeof (float));
+			memcpy (im + blockSize, inputRight.getData(), blockSize * sizeof (float));
+			memcpy (inputHistoryLeft, inputLeft.getData(), blockSize * sizeof (float));
+			memcpy (inputHistoryRight, inputRight.getData(), blockSize * sizeof (float));
+
+			fft.perform (re, im, false);
+
+			// store this spectrum as the newest entry in the delay line
+			delayLineIndex = (delayLineIndex == 0 ? numPartitions : delayLineIndex) - 1;
+			memcpy (getDelayLineRe (delayLineIndex), re, fftSize * sizeof (float));
+			memcpy (getDelayLineIm (delayLineIndex), im, fftSize * sizeof (float));
+
+			multiplyAccumulate (getDelayLineRe (delayLineIndex), getDelayLineIm (delayLineIndex),
+								getPartitionRe (0), getPartitionIm (0),
+								accRe.getData(), accIm.getData(), fftSize);
+
+			fft.perform (accRe.getData(), accIm.getData(), true);
+
+			// the first half is wrapped-around garbage, the second half is our output
+			memcpy (outputLeft.getData(), accRe.getData() + blockSize, blockSize * sizeof (float));
+			memcpy (outputRight.getData(), accIm.getData() + blockSize, blockSize * sizeof (float));
+
+			// start on the next block's sum
+			accRe.clear();
+			accIm.clear();
+			nextPartition = 1;
+		}
+
+		/** Add the older partitions, up to (but not including) partition end, into the
+			sum for the block that's being filled.
+
+		 Partition p is paired with the input from p blocks before that one, which is
+		 already in the delay line for every p above 0.
+		 */
+		void accumulatePartitions (const int end) throw()
+		{
+			for (; nextPartition < end; nextPartition++)
+			{
+				int d = delayLineIndex + nextPartition - 1;
+				if (d >= numPartitions)
+					d -= numPartitions;
+
+				multiplyAccumulate (getDelayLineRe (d), getDelayLineIm (d),
+									getPartitionRe (nextPartition), getPartitionIm (nextPartition),
+									accRe.getData(), accIm.getData(), fftSize);
+			}
+		}
+
+		/** acc += x * h, for complex numbers stored as separate real and imaginary arrays.
+		 */
+		static void multiplyAccumulate (const float* const xRe, const float* const xIm,
+										const float* const hRe, const float* const hIm,
+										float* const accRe, float* const accIm,
+										const int num) throw()
+		{
+			int i = 0;
+
+#if BOUNCINGBALL_USE_SSE
+			// all the buffers are 16-byte aligned and num is a multiple of 4
+			for (; i < num - 3; i += 4)
+			{
+				const __m128 xr = _mm_load_ps (xRe + i);
+				const __m128 xi = _mm_load_ps (xIm + i);
+				const __m128 hr = _mm_load_ps (hRe + i);
+				const __m128 hi = _mm_load_ps (hIm + i);
+
+				_mm_store_ps (accRe + i, _mm_add_ps (_mm_load_ps (accRe + i),
+													 _mm_sub_ps (_mm_mul_ps (xr, hr), _mm_mul_ps (xi, hi))));
+				_mm_store_ps (accIm + i, _mm_add_ps (_mm_load_ps (accIm + i),
+													 _mm_add_ps (_mm_mul_ps (xr, hi), _mm_mul_ps (xi, hr))));
+			}
+#endif
+
+			for (; i < num; i++)
+			{
+				accRe[i] += xRe[i] * hRe[i] - xIm[i] * hIm[i];
+				accIm[i] += xRe[i] * hIm[i] + xIm[i] * hRe[i];
+			}
+		}
+
+	private:
+		const int blockSize, fftSize, numPartitions;
+		const double sampleRate;
+		SimpleFFT fft;
+
+		// each partition or delay line entry is fftSize reals followed by fftSize imaginaries
+		AlignedFloatBuffer partitions, delayLine;
+		AlignedFloatBuffer workRe, workIm, accRe, accIm;
+		int delayLineIndex, nextPartition;
+
+		AlignedFloatBuffer inputLeft, inputRight, outputLeft, outputRight;
+		float* inputHistoryLeft;
+		float* inputHistoryRight;
+		int bufferPosition;
+
+		float* getPartitionRe (const int p) const throw()		{ return partitions.getData() + p * fftSize * 2; }
+		float* getPartitionIm (const int p) const throw()		{ return getPartitionRe (p) + fftSize; }
+		float* getDelayLineRe (const int d) const throw()		{ return delayLine.getData() + d * fftSize * 2; }
+		float* getDelayLineIm (const int d) const throw()		{ return getDelayLineRe (d) + fftSize; }
+
+		ConvolutionEngine (const ConvolutionEngine&);
+		const ConvolutionEngine& operator= (const ConvolutionEngine&);
+	};
+
+
+//==============================================================================
+/**
+ A convolution reverb for the master bus.
+
+ This wraps another AudioSource and adds the reverberated signal to it. Impulse
+ responses are loaded and prepared on a background thread; the finished
+ ConvolutionEngine is passed to the audio thread through a LockFreeFifo and the
+ one it replaces is passed back the same way to be deleted, so the audio thread
+ never waits, allocates or frees anything.
+
+ The dry signal isn't delayed, so the reverb adds no latency to the output (the
+ one-block lag of the wet signal just acts as a short pre-delay).
+ */
+class ConvolutionReverb : public AudioSource,
+						  private Thread
+	{
+	public:
+		/** Create a reverb which processes the output of another source.
+		 */
+		ConvolutionReverb (AudioSource* const input_, const bool deleteInputWhenDeleted_)
+			:	Thread (T("Reverb loader")),
+				input (input_),
+				deleteInputWhenDeleted (deleteInputWhenDeleted_),
+				engine (0),
+				newEngines (4),
+				oldEngines (4),
+				wetLevel (0.3f),
+				blockSize (256),
+				sampleRate (44100.0),
+				impulseChanged (true),
+				useSyntheticImpulse (true),
+				syntheticDecaySeconds (2.0)
+		{
+			startThread (3);
+		}
+
+		~ConvolutionReverb()
+		{
+			stopThread (5000);
+
+			ConvolutionEngine* e;
+			while (newEngines.pop (e))
+				delete e;
+			while (oldEngines.pop (e))
+				delete e;
+
+			delete engine;
+
+			if (deleteInputWhenDeleted)
+				delete input;
+		}
+
+		//==============================================================================
+		/** Load an impulse response from an audio file, in the background.
+		 */
+		void loadImpulseResponse (const File& file)
+		{
+			const ScopedLock sl (settingsLock);
+			impulseFile = file;
+			useSyntheticImpulse = false;
+			impulseChanged = true;
+			notify();
+		}
+
+		/** Use a generated impulse response of decaying noise, in the background.
+		 */
+		void loadSyntheticImpulse (const double decaySeconds)
+		{
+			const ScopedLock sl (settingsLock);
+			syntheticDecaySeconds = decaySeconds;
+			useSyntheticImpulse = true;
+			impulseChanged = true;
+			notify();
+		}
+
+		/** Change the partition size, which is also the latency of the wet signal.
+
+		 The impulse response will be prepared again in the background.
+		 */
+		void setBlockSize (const int newBlockSize)
+		{
+			const ScopedLock sl (settingsLock);
+
+			int size = 32;
+			while (size < newBlockSize)
+				size <<= 1;
+
+			blockSize = size;
+			impulseChanged = true;
+			notify();
+		}
+
+		void setWetLevel (const float newLevel) throw()		{ wetLevel = newLevel; }
+		float getWetLevel() const throw()					{ return wetLevel; }
+
+		//==============================================================================
+		void prepareToPlay (int samplesPerBlockExpected, double newSampleRate)
+		{
+			if (input != 0)
+				input->prepareToPlay (samplesPerBlockExpected, newSampleRate);
+
+			const ScopedLock sl (settingsLock);
+
+			if (newSampleRate != sampleRate)
+			{
+				// the impulse response will need resampling
+				sampleRate = newSampleRate;
+				impulseChanged = true;
+				notify();
+			}
+		}
+
+		void releaseResources()
+		{
+			if (input != 0)
+				input->releaseResources();
+		}
+
+		void getNextAudioBlock (const AudioSourceChannelInfo& info)
+		{
+			if (input != 0)
+				input->getNextAudioBlock (info);
+			else
+				info.clearActiveBufferRegion();
+
+			// pick up a freshly built engine if there is one, as long as there's
+			// room to hand the old one back (the loader deletes them regularly)
+			ConvolutionEngine* newEngine;
+
+			if (oldEngines.getNumReady() < 2 && newEngines.pop (newEngine))
+			{
+				if (engine != 0)
+					oldEngines.push (engine);
+
+				engine = newEngine;
+			}
+
+			const float wet = wetLevel;
+
+			if (engine == 0 || wet <= 0.0f || info.buffer->getNumChannels() == 0)
+				return;
+
+			const int numSamples = info.numSamples;
+			const int numChannels = jmin (2, info.buffer->getNumChannels());
+
+			float* const left = info.buffer->getSampleData (0, info.startSample);
+			float* const right = numChannels > 1 ? info.buffer->getSampleData (1, info.startSample) : 0;
+
+			// convolve in chunks through a scratch buffer so we can mix the wet signal back in
+			int done = 0;
+
+			while (done < numSamples)
+			{
+				const int num = jmin (numSamples - done, (int) scratchSize);
+
+				memcpy (scratchLeft, left + done, num * sizeof (float));
+
+				if (right != 0)
+					memcpy (scratchRight, right + done, num * sizeof (float));
+
+				engine->process (scratchLeft, right != 0 ? scratchRight : 0, num);
+
+				for (int i = 0; i < num; i++)
+					left[done + i] += wet * scratchLeft[i];
+
+				if (right != 0)
+					for (int i = 0; i < num; i++)
+						right[done + i] += wet * scratchRight[i];
+
+				done += num;
+			}
+		}
+
+		//==============================================================================
+		/** Time the engine for a range of impulse lengths and block sizes, returning a
+		 table of the CPU time taken per second of audio per channel.
+		 */
+		static const String runBenchmark()
+		{
+			const double benchSampleRate = 44100.0;
+			const int numChannels = 2;
+			const double audioSeconds = 10.0;
+			const double impulseSeconds[] = { 0.5, 2.0, 5.0 };
+			const int blockSizes[] = { 64, 128, 256, 512, 1024 };
+
+			String report ("Convolution reverb benchmark (");
+#if BOUNCINGBALL_USE_SSE
+			report << "SSE";
+#else
+			report << "scalar";
+#endif
+			report << ", " << (int) benchSampleRate << "Hz, stereo)\n"
+				   << "impulse(s)  block  partitions  ms CPU per channel-second  % of one core\n";
+
+			const int numSamples = (int) (audioSeconds * benchSampleRate);
+			AudioSampleBuffer signal (numChannels, numSamples);
+			Random random (1234);
+
+			for (int chan = 0; chan < numChannels; chan++)
+			{
+				float* const data = signal.getSampleData (chan);
+
+				for (int i = 0; i < numSamples; i++)
+					data[i] = random.nextFloat() * 2.0f - 1.0f;
+			}
+
+			for (int i = 0; i < (int) (sizeof (impulseSeconds) / sizeof (impulseSeconds[0])); i++)
+			{
+				const int impulseLength = (int) (impulseSeconds[i] * benchSampleRate);
+				float* const impulse = new float [impulseLength];
+				makeSyntheticImpulse (impulse, impulseLength, benchSampleRate, impulseSeconds[i]);
+
+				for (int j = 0; j < (int) (sizeof (blockSizes) / sizeof (blockSizes[0])); j++)
+				{
+					ConvolutionEngine benchEngine (impulse, impulseLength, blockSizes[j], benchSampleRate);
+
+					const int64 start = Time::getHighResolutionTicks();
+
+					for (int pos = 0; pos < numSamples; pos += blockSizes[j])
+					{
+						const int num = jmin (blockSizes[j], numSamples - pos);
+						benchEngine.process (signal.getSampleData (0, pos), signal.getSampleData (1, pos), num);
+					}
+
+					const double cpuSeconds = (Time::getHighResolutionTicks() - start)
+												/ (double) Time::getHighResolutionTicksPerSecond();
+					const double msPerChannelSecond = 1000.0 * cpuSeconds / (audioSeconds * numChannels);
+
+					report << String (impulseSeconds[i], 1) << "         "
+						   << blockSizes[j] << "    "
+						   << benchEngine.getNumPartitions() << "         "
+						   << String (msPerChannelSecond, 3) << "                     "
+						   << String (100.0 * cpuSeconds / audioSeconds, 2) << "\n";
+				}
+
+				delete[] impulse;
+			}
+
+			return report;
+		}
+
+	private:
+		//==============================================================================
+		AudioSource* const input;
+		const bool deleteInputWhenDeleted;
+
+		// only touched by the audio thread
+		ConvolutionEngine* engine;
+		enum { scratchSize = 512 };
+		float scratchLeft [scratchSize];
+		float scratchRight [scratchSize];
+
+		LockFreeFifo<ConvolutionEngine*> newEngines, oldEngines;
+		volatile float wetLevel;
+
+		// settings for the loader thread
+		CriticalSection settingsLock;
+		int blockSize;
+		double sampleRate;
+		bool impulseChanged;
+		bool useSyntheticImpulse;
+		double syntheticDecaySeconds;
+		File impulseFile;
+
+		//==============================================================================
+		void run()
+		{
+			while (! threadShouldExit())
+			{
+				// free anything the audio thread has finished with
+				ConvolutionEngine* e;
+				while (oldEngines.pop (e))
+					delete e;
+
+				bool needsLoading;
+				bool synthetic;
+				double decaySeconds, rate;
+				int size;
+				File file;
+
+				{
+					const ScopedLock sl (settingsLock);
+					needsLoading = impulseChanged;
+					impulseChanged = false;
+					synthetic = useSyntheticImpulse;
+					decaySeconds = syntheticDecaySeconds;
+					rate = sampleRate;
+					size = blockSize;
+					file = impulseFile;
+				}
+
+				// wait until the audio thread has taken the last one before making another
+				if (needsLoading && newEngines.getNumReady() == 0)
+				{
+					ConvolutionEngine* const newEngine = synthetic ? createSyntheticEngine (decaySeconds, rate, size)
+																   : createEngineFromFile (file, rate, size);
+
+					if (newEngine != 0 && ! newEngines.push (newEngine))
+						delete newEngine;
+				}
+				else if (needsLoading)
+				{
+					const ScopedLock sl (settingsLock);
+					impulseChanged = true;
+				}
+
+				wait (100);
+			}
+		}
+
+		static ConvolutionEngine* createSyntheticEngine (const double decaySeconds, const double rate, const int size)
+		{
+			const int length = (int) (jmin (decaySeconds, MAX_IMPULSE_SECONDS) * rate);
+			float* const impulse = new float [jmax (1, length)];
+
+			makeSyntheticImpulse (impulse, length, rate, decaySeconds);
+			ConvolutionEngine* const newEngine = new ConvolutionEngine (impulse, length, size, rate);
+
+			delete[] impulse;
+			return newEngine;
+		}
+
+		static ConvolutionEngine* createEngineFromFile (const File& file, const double rate, const int size)
+		{
+			AudioFormatManager formatManager;
+			formatManager.registerBasicFormats();
+
+			AudioFormatReader* const reader = formatManager.createReaderFor (file);
+
+			if (reader == 0)
+				return 0;
+
+			const int fileLength = (int) jmin (reader->lengthInSamples, (int64) (MAX_IMPULSE_SECONDS * reader->sampleRate));
+			AudioSampleBuffer fileData (1, jmax (1, fileLength));
+			fileData.readFromAudioReader (reader, 0, fileLength, 0, true, false);
+
+			// resample to the device rate (linear interpolation is fine for a reverb tail)
+			const double ratio = reader->sampleRate / rate;
+			const int length = (int) (fileLength / ratio);
+			float* const impulse = new float [jmax (1, length)];
+			const float* const src = fileData.getSampleData (0);
+
+			for (int i = 0; i < length; i++)
+			{
+				const double pos = i * ratio;
+				const int index = (int) pos;
+				const float alpha = (float) (pos - index);
+				const float next = index + 1 < fileLength ? src [index + 1] : 0.0f;
+
+				impulse[i] = src[index] + alpha * (next - src[index]);
+			}
+
+			normalise (impulse, length);
+			ConvolutionEngine* const newEngine = new ConvolutionEngine (impulse, length, size, rate);
+
+			delete[] impulse;
+			delete reader;
+			return newEngine;
+		}
+
+		static void makeSyntheticImpulse (float* const impulse, const int length, const double rate, const double decaySeconds)
+		{
+			Random random (4321);
+
+			// noise falling by 60dB over the decay time
+			const double decayPerSample = exp (-6.908 / (decaySeconds * rate));
+			double envelope = 1.0;
+
+			for (int i = 0; i < length; i++)
+			{
+				impulse[i] = (float) (envelope * (random.nextFloat() * 2.0f - 1.0f));
+				envelope *= decayPerSample;
+			}
+
+			normalise (impulse, length);
+		}
+
+		/** Scale the impulse to unit energy so the wet level is roughly the same for any impulse.
+		 */
+		static void normalise (float* const impulse, const int length)
+		{
+			double energy = 0.0;
+
+			for (int i = 0; i < length; i++)
+				energy += impulse[i] * impulse[i];
+
+			if (energy > 0.0)
+			{
+				const float scale = (float) (1.0 / sqrt (energy));
+
+				for (int i = 0; i < length; i++)
+					impulse[i] *= scale;
+			}
+		}
+
+		ConvolutionReverb (const ConvolutionReverb&);
+		const ConvolutionReverb& operator= (const ConvolutionReverb&);
+	};
+
+#endif//_CONVOLUTIONREVERB_H_
@@ -0,0 +1,107 @@
+/*
+ *  LockFreeFifo.h
+ *  BouncingBallAudio
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _LOCKFREEFIFO_H_
+#define _LOCKFREEFIFO_H_
+
+#include <juce/juce.h>
+
+#if JUCE_WIN32
+ #include <intrin.h>
+ #pragma intrinsic (_ReadWriteBarrier)
+ #define lockFreeMemoryBarrier()	_ReadWriteBarrier()
+#else
+ #define lockFreeMemoryBarrier()	__sync_synchronize()
+#endif
+
+/**
+ A fixed-size queue for passing small messages from one thread to another
+ without locking, e.g. from the message thread to the audio callback.
+
+ There must only be one thread pushing and one thread popping. All the storage
+ is allocated up front, so neither end ever blocks or touches the heap; if the
+ queue is full, push() just fails.
+ */
+template <class ElementType>
+class LockFreeFifo
+	{
+	public:
+		/** Create a queue that holds up to (capacity - 1) elements.
+
+		 The capacity is rounded up to a power of 2.
+		 */
+		LockFreeFifo (const int capacity)
+			:	readPos (0),
+				writePos (0)
+		{
+			size = 2;
+			while (size < capacity)
+				size <<= 1;
+
+			mask = size - 1;
+			elements = new ElementType [size];
+		}
+
+		~LockFreeFifo()
+		{
+			delete[] elements;
+		}
+
+		/** Add an element, returning false if there's no room (producer thread only).
+		 */
+		bool push (const ElementType& element) throw()
+		{
+			const int w = writePos;
+
+			if (((w + 1) & mask) == readPos)
+				return false;
+
+			elements [w & mask] = element;
+
+			// make sure the element is written before the reader can see it
+			lockFreeMemoryBarrier();
+			writePos = (w + 1) & mask;
+
+			return true;
+		}
+
+		/** Take the oldest element, returning false if there isn't one (consumer thread only).
+		 */
+		bool pop (ElementType& element) throw()
+		{
+			const int r = readPos;
+
+			if (r == writePos)
+				return false;
+
+			lockFreeMemoryBarrier();
+			element = elements [r];
+
+			lockFreeMemoryBarrier();
+			readPos = (r + 1) & mask;
+
+			return true;
+		}
+
+		/** The number of elements waiting, which may be out of date by the time it returns.
+		 */
+		int getNumReady() const throw()
+		{
+			return (writePos - readPos) & mask;
+		}
+
+	private:
+		ElementType* elements;
+		int size, mask;
+		volatile int readPos, writePos;
+
+		LockFreeFifo (const LockFreeFifo&);
+		const LockFreeFifo& operator= (const LockFreeFifo&);
+	};
+
+#endif//_LOCKFREEFIFO_H_
@@ -9,12 +9,20 @@
 */
 
 #include <juce/juce.h>
-#include "AudioFilePlayer.h"
 #include "BouncingBallComponent.h"
+#include "BallWorld.h"
+#include "BallVoicePool.h"
+#include "ConvolutionReverb.h"
+#include "PeakLimiter.h"
+#include "OnsetDetector.h"
 
 // some defines
 #define APPLICATION_NAME "Bouncing Ball"
 #define SOUNDS_DIRECTORY "../../../sounds/"
+#define IMPULSES_DIRECTORY "impulses"
+#define MAX_BALLS 16384
+#define MAX_VOICES 64
+#define BOUNCE_GAIN 0.5f
 
 
 
@@ -23,12 +31,17 @@
 //==============================================================================
 class AudioDemo  :  public Component,
 					public ButtonListener,
-					public ChangeListener,
+					public SliderListener,
 					public BouncingBallListener,
-					public AudioIODeviceCallback
+					public AudioIODeviceCallback,
+					public Timer
 {
     //==============================================================================
     TextButton* audioSettingsButton;
+	Slider* ballCountSlider;
+	Slider* reverbSlider;
+	Label* latencyLabel;
+	ToggleButton* listenButton;
 	
     //==============================================================================
     // this wraps the actual audio device
@@ -41,20 +54,47 @@ class AudioDemo  :  public Component,
     // and wave player source
     MixerAudioSource mixerSource;
 	
+	// the master bus reverb, which processes the output of the mixer
+	ConvolutionReverb reverb;
+	
+	// ..and the limiter after that, to stop lots of bounces at once from clipping
+	PeakLimiter limiter;
+	
 	// the above objects are needed to manage the playback of audio
 	// ...
-	// we need one of each of the following objects to play a sound file
-	
-	//AudioFilePlayer file1, file2;
+	// the sound files are all loaded into the voice pool, which plays them
+	// whenever a ball bounces
 	OwnedArray<File> audioFiles;
-	OwnedArray<AudioFilePlayer> filePlayers;
-	Array<BouncingBallComponent*> balls;
+	BallVoicePool voicePool;
+	
+	// moves the balls around and finds them under the mouse
+	BallWorld world;
+	
+	// ball components that aren't in use, they're all created up front and hidden
+	// here so that adding and removing balls never creates or deletes anything
+	BouncingBallComponent** freeBalls;
+	int numFreeBalls;
+	int numSpawned;
+	
+	// this listens to the audio input for claps and hits which kick the balls
+	OnsetDetector onsetDetector;
+	int numKicks;
+	int timerTicks;
 		
 public:
 	//==============================================================================
 	AudioDemo()
+		: reverb (&mixerSource, false),
+		  limiter (&reverb, false),
+		  voicePool (MAX_VOICES),
+		  world (MAX_BALLS),
+		  numFreeBalls (0),
+		  numSpawned (0),
+		  numKicks (0),
+		  timerTicks (0)
     {
 		setName (T(APPLICATION_NAME));
+		setWantsKeyboardFocus (true);
 	
 		//==============================================================================
 		
@@ -62,6 +102,37 @@ public:
 																 T("click here to change the audio device settings")));
 		audioSettingsButton->addButtonListener (this);
 		
+		addAndMakeVisible (ballCountSlider = new Slider (T("Number of balls")));
+		ballCountSlider->setRange (0, MAX_BALLS, 1);
+		ballCountSlider->setTextBoxStyle (Slider::TextBoxLeft, false, 50, 20);
+		ballCountSlider->addListener (this);
+		
+		addAndMakeVisible (reverbSlider = new Slider (T("Reverb level")));
+		reverbSlider->setRange (0, 1, 0.01);
+		reverbSlider->setTextBoxStyle (Slider::TextBoxLeft, false, 50, 20);
+		reverbSlider->setValue (reverb.getWetLevel(), false);
+		reverbSlider->addListener (this);
+		
+		addAndMakeVisible (latencyLabel = new Label (T("Latency"), String::empty));
+		
+		addAndMakeVisible (listenButton = new ToggleButton (T("kick the balls with the audio input")));
+		listenButton->addButtonListener (this);
+		
+		//==============================================================================
+		// make all the ball components we'll ever need (as hidden children)
+		freeBalls = new BouncingBallComponent* [MAX_BALLS];
+		
+		for (int i = 0; i < MAX_BALLS; i++)
+		{
+			BouncingBallComponent *ball;
+			addChildComponent (ball = new BouncingBallComponent());
+			
+			// listen for ball bouncing messages
+			ball->addListener(this);
+			
+			freeBalls[numFreeBalls++] = ball;
+		}
+		
 		//==============================================================================
 		// and initialise the device manager with no settings so that it picks a
 		// default device to use.
@@ -78,12 +149,6 @@ public:
 		}
 		else
 		{
-			// ..and connect the mixer to our source player.
-			audioSourcePlayer.setSource (&mixerSource);
-			
-			// start the IO device pulling its data from our callback..
-			audioDeviceManager.setAudioCallback (this);
-			
 			// find some directories
 			File appDirectory = File::getSpecialLocation(File::currentApplicationFile).getParentDirectory();
 			File soundsDirectory = appDirectory.getChildFile(T(SOUNDS_DIRECTORY));
@@ -98,50 +163,202 @@ public:
 			soundsDirectory.findChildFiles(audioFiles, File::findFiles, false, T("*.aif"));
 			soundsDirectory.findChildFiles(audioFiles, File::findFiles, false, T("*.wav"));
 			
-			// iterate through our files, making a ball and a player for each
+			// load them all into memory before the audio starts
 			for (int i = 0; i < audioFiles.size(); i++ )
 			{
-				String soundFilePath = audioFiles[i]->getFullPathName();
-				DBG_PRINTF(( soundFilePath ));
-				
-				// a new instance of one of our player objects
-				// initialised with the path of this sound file
-				filePlayers.add (new AudioFilePlayer(soundFilePath));
-				
-				// listen for start/stop messages of the transport of each file
-				filePlayers[i]->addChangeListener (this);
-				
-				// plug it in to our mixer
-				mixerSource.addInputSource (filePlayers[i], false);
-				
-				BouncingBallComponent *ball;
-				addAndMakeVisible (ball = new BouncingBallComponent());
-				
-				// listen for ball bouncing messages
-				ball->addListener(this);
-				
-				// keep an array of the balls, in case we decide to add/remove them dynamically
-				// not REQUIRED since the Component will delete them cleanly anyway when the app exits
-				balls.add(ball);
+				DBG_PRINTF(( audioFiles[i]->getFullPathName() ));
+				voicePool.addSound (*audioFiles[i]);
 			}
+			
+			// use the first impulse response we can find, otherwise the reverb
+			// makes up its own
+			OwnedArray<File> impulseFiles;
+			File impulsesDirectory = soundsDirectory.getChildFile(T(IMPULSES_DIRECTORY));
+			impulsesDirectory.findChildFiles(impulseFiles, File::findFiles, false, T("*.aif"));
+			impulsesDirectory.findChildFiles(impulseFiles, File::findFiles, false, T("*.wav"));
+			
+			if (impulseFiles.size() > 0)
+				reverb.loadImpulseResponse (*impulseFiles[0]);
+			
+			// plug the voices in to our mixer..
+			mixerSource.addInputSource (&voicePool, false);
+			
+			// ..and connect the mixer (through the reverb and limiter) to our source player.
+			audioSourcePlayer.setSource (&limiter);
+			
+			// start the IO device pulling its data from our callback..
+			audioDeviceManager.setAudioCallback (this);
 		}
+		
+		// start off with one ball for each sound
+		setTargetBallCount (voicePool.getNumSounds());
+		
+		// check for onsets from the input, and keep the latency display up to date
+		startTimer (10);
 	}
 	
 	~AudioDemo()
 	{
+		stopTimer();
+		world.stopTimer();
 		audioDeviceManager.setAudioCallback (0);
 		
-		// reset all transportSources before they get deleted	
-		for (int i = 0; i < audioFiles.size(); i++ )
+		audioSourcePlayer.setSource (0);
+		mixerSource.removeAllInputs();
+		
+		// (NB the ball components are all our children, so they're deleted along with the others)
+		deleteAllChildren();
+		delete[] freeBalls;
+	}
+	
+	//==============================================================================
+	/** Add a new ball centred on (x, y), returning false if we've run out.
+	 */
+	bool spawnBall (const float x, const float y)
+	{
+		if (numFreeBalls == 0)
+			return false;
+		
+		BouncingBallComponent* const ball = freeBalls[--numFreeBalls];
+		ball->reset();
+		
+		// share the sounds out between the balls
+		if (voicePool.getNumSounds() > 0)
+			ball->setSoundIndex (numSpawned % voicePool.getNumSounds());
+		
+		numSpawned++;
+		
+		world.addBallAt (ball, x - ball->getWidth() * 0.5f, y - ball->getHeight() * 0.5f);
+		ball->setVisible (true);
+		
+		return true;
+	}
+	
+	/** Remove one of the world's balls, putting its component back in the pool.
+	 */
+	void despawnBall (const int id)
+	{
+		BouncingBallComponent* const ball = world.removeBall (id);
+		
+		if (ball != 0)
+		{
+			ball->setVisible (false);
+			freeBalls[numFreeBalls++] = ball;
+		}
+	}
+	
+	/** Add or remove balls until there are the given number.
+	 */
+	void setTargetBallCount (const int targetCount)
+	{
+		const int target = jlimit (0, MAX_BALLS, targetCount);
+		
+		while (world.getNumBalls() < target
+				&& spawnBall (MAX_BALL_SIZE * 0.5f + Random::getSystemRandom().nextFloat() * 100.0f,
+							  MAX_BALL_SIZE * 0.5f + Random::getSystemRandom().nextFloat() * 100.0f))
 		{
-			filePlayers[i]->removeChangeListener (this);
 		}
 		
-		// (NB  "filePlayers" is an OwnedArray so it and its elements are deleted for us )
+		// take the newest ones first
+		while (world.getNumBalls() > target)
+			despawnBall (world.getNumBalls() - 1);
 		
-		audioSourcePlayer.setSource (0);
+		updateBallCountSlider();
+	}
+	
+	void clearBalls()
+	{
+		setTargetBallCount (0);
+	}
+	
+	//==============================================================================
+	/** The delay between the mixer and the speakers: the device's own output latency
+		plus the limiter's lookahead.
+	 */
+	int getOutputLatencySamples()
+	{
+		AudioIODevice* const device = audioDeviceManager.getCurrentAudioDevice();
 		
-		deleteAllChildren();
+		return (device != 0 ? device->getOutputLatencyInSamples() : 0)
+				+ limiter.getLatencySamples();
+	}
+	
+	/** The delay from a sound arriving at the input to the sound it triggers coming
+		out, for the last onset: the device's input latency, the time taken to detect
+		and react to it (measured by the voice pool), and the output latency.
+		Returns -1 if nothing has been triggered from the input yet.
+	 */
+	int getInputToSoundLatencySamples()
+	{
+		AudioIODevice* const device = audioDeviceManager.getCurrentAudioDevice();
+		const int measured = voicePool.getLastMeasuredLatency();
+		
+		if (device == 0 || measured < 0)
+			return -1;
+		
+		return device->getInputLatencyInSamples() + measured + getOutputLatencySamples();
+	}
+	
+	void timerCallback()
+	{
+		OnsetDetector::Onset onset;
+		
+		while (onsetDetector.getNextOnset (onset))
+			kickFromOnset (onset);
+		
+		// the display only needs updating twice a second
+		if (++timerTicks < 50)
+			return;
+		
+		timerTicks = 0;
+		AudioIODevice* const device = audioDeviceManager.getCurrentAudioDevice();
+		
+		if (device == 0 || device->getCurrentSampleRate() <= 0)
+		{
+			latencyLabel->setText (T("No audio device"), false);
+			return;
+		}
+		
+		const double msPerSample = 1000.0 / device->getCurrentSampleRate();
+		
+		String text ("Output latency: ");
+		text << String (getOutputLatencySamples() * msPerSample, 1) << "ms (device "
+			 << device->getOutputLatencyInSamples() << " + limiter "
+			 << limiter.getLatencySamples() << " samples)";
+		
+		const int inputToSound = getInputToSoundLatencySamples();
+		
+		if (inputToSound >= 0)
+			text << ", input to sound: " << String (inputToSound * msPerSample, 1) << "ms";
+		
+		latencyLabel->setText (text, false);
+	}
+	
+	/** Kick one of the balls (or add one, if there aren't any) when the input has a hit in it.
+	 */
+	void kickFromOnset (const OnsetDetector::Onset& onset)
+	{
+		if (world.getNumBalls() == 0)
+		{
+			spawnBall (MAX_BALL_SIZE * 0.5f + Random::getSystemRandom().nextFloat() * 100.0f,
+					   MAX_BALL_SIZE * 0.5f + Random::getSystemRandom().nextFloat() * 100.0f);
+			updateBallCountSlider();
+		}
+		
+		const int id = numKicks++ % jmax (1, world.getNumBalls());
+		BouncingBallComponent* const ball = world.getBall (id);
+		
+		if (ball == 0)
+			return;
+		
+		// harder hits kick harder, in a random direction
+		const float speed = jmin (MAX_BALL_SIZE * 0.5f, 2.0f + 3.0f * onset.strength);
+		const float angle = Random::getSystemRandom().nextFloat() * 2.0f * float_Pi;
+		
+		world.kickBall (id, speed * cosf (angle), speed * sinf (angle), onset.timeMs);
+		
+		// pass the input time along so the voice pool can measure how long this took
+		voicePool.trigger (ball->getSoundIndex(), BOUNCE_GAIN, onset.sampleTime);
 	}
 	
 	
@@ -152,12 +369,25 @@ public:
 								int totalNumOutputChannels,
 								int numSamples)
 	{		
+		// look for hits in the input, counting time in samples from the first callback
+		// (the input and output share this clock, which lets the voice pool measure
+		// how long it takes for an input hit to make a sound)
+		const int64 blockStartTime = onsetDetector.getTotalSamples();
+		
+		onsetDetector.processBlock (totalNumInputChannels > 0 ? inputChannelData[0] : 0,
+									numSamples,
+									Time::getMillisecondCounterHiRes());
+		
+		voicePool.setCurrentSampleTime (blockStartTime);
+		
 		// pass the audio callback on to our player source
 		audioSourcePlayer.audioDeviceIOCallback (inputChannelData, totalNumInputChannels, outputChannelData, totalNumOutputChannels, numSamples);
 	}
 	
 	void audioDeviceAboutToStart (AudioIODevice* device)
 	{
+		onsetDetector.setSampleRate (device->getCurrentSampleRate());
+		
 		audioSourcePlayer.audioDeviceAboutToStart (device);
 	}
 	
@@ -176,9 +406,68 @@ public:
 	{		
 		audioSettingsButton->setBounds (10, 10, 200, 24);
 		audioSettingsButton->changeWidthToFitText();
+		
+		ballCountSlider->setBounds (10, 40, 200, 20);
+		reverbSlider->setBounds (10, 64, 200, 20);
+		latencyLabel->setBounds (10, 88, 300, 20);
+		listenButton->setBounds (10, 112, 250, 20);
+		
+		world.setBounds (getWidth(), getHeight());
 	}
 	
+	//==============================================================================
+	// the balls don't take mouse clicks themselves (see BouncingBallComponent::hitTest)
+	// so we look them up in the world's grid instead
+	void mouseDown (const MouseEvent& e)
+	{
+		grabKeyboardFocus();
+		
+		const int id = world.findBallAt ((float) e.x, (float) e.y);
+		
+		if (e.mods.isPopupMenu())
+		{
+			// right-click removes a ball..
+			despawnBall (id);
+		}
+		else if (id >= 0)
+		{
+			// ..left-click picks one up..
+			world.grabBall (id, (float) e.x, (float) e.y);
+		}
+		else
+		{
+			// ..or drops a new one in if there isn't one there
+			spawnBall ((float) e.x, (float) e.y);
+		}
+		
+		updateBallCountSlider();
+	}
+	
+	void mouseDrag (const MouseEvent& e)
+	{
+		world.dragBall ((float) e.x, (float) e.y);
+	}
+	
+	void mouseUp (const MouseEvent& e)
+	{
+		world.releaseBall();
+	}
+	
+	bool keyPressed (const KeyPress& key)
+	{
+		// 'c', delete or backspace gets rid of all the balls
+		if (key.getTextCharacter() == 'c'
+			 || key.isKeyCode (KeyPress::deleteKey)
+			 || key.isKeyCode (KeyPress::backspaceKey))
+		{
+			clearBalls();
+			return true;
+		}
+		
+		return false;
+	}
 	
+	//==============================================================================
 	void buttonClicked (Button* button)
 	{
 		if (button == audioSettingsButton)
@@ -201,24 +490,32 @@ public:
 										   Colours::azure,
 										   true);
 		}
+		else if (button == listenButton)
+		{
+			// (this is off to start with, or the balls could set themselves off through the speakers)
+			onsetDetector.setEnabled (listenButton->getToggleState());
+		}
 	}
-		
-	void changeListenerCallback (void* pointer)
+	
+	void sliderValueChanged (Slider* slider)
 	{
-		// callback from the transport source to tell us that play has
-		// started or stopped
-				
+		if (slider == ballCountSlider)
+			setTargetBallCount ((int) ballCountSlider->getValue());
+		else if (slider == reverbSlider)
+			reverb.setWetLevel ((float) reverbSlider->getValue());
 	}
 	
 	void ballCollision (BouncingBallComponent* ball)
 	{
-		DBG_PRINTF(( T("ball %p bounced"), ball ));
-		
-		int i = balls.indexOf(ball);
-//		filePlayers[i]->startFromZero();
+		voicePool.trigger (ball->getSoundIndex(), BOUNCE_GAIN);
 	}
 	
-	
+private:
+	void updateBallCountSlider()
+	{
+		// (no change message, or we'd end up back in setTargetBallCount)
+		ballCountSlider->setValue (world.getNumBalls(), false);
+	}
 };
 
 
@@ -299,6 +596,14 @@ public:
     //==============================================================================
     void initialise (const String& commandLine)
     {
+        // "--benchmark-reverb" prints the reverb's CPU use and quits without opening a window
+        if (commandLine.containsIgnoreCase (T("--benchmark-reverb")))
+        {
+            printf ("%s", (const char*) ConvolutionReverb::runBenchmark());
+            JUCEApplication::quit();
+            return;
+        }
+        
         // just create the main window...
         helloWorldWindow = new HelloWorldWindow();
 
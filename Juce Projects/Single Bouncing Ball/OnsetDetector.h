@@ -0,0 +1,284 @@
+/*
+ *  OnsetDetector.h
+ *  BouncingBallAudio
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _ONSETDETECTOR_H_
+#define _ONSETDETECTOR_H_
+
+#include <juce/juce.h>
+#include "SimpleFFT.h"
+#include "LockFreeFifo.h"
+
+//==============================================================================
+/**
+ Finds the start of claps, drum hits and other percussive sounds in a live input.
+
+ This is meant to run directly in the audio callback. Every 'hop' samples the
+ last 'frameSize' samples are windowed and transformed, and the spectral flux
+ (the total increase in magnitude across all the bins since the last frame) is
+ compared with a running average of recent flux. A frame that is a local peak
+ and well above the average is an onset. The exact sample is then found by
+ looking for the point where the signal jumps up in the last couple of hops.
+
+ Onsets are timestamped in samples since the detector started and are posted to
+ a LockFreeFifo for another thread to pick up. All the buffers are allocated in
+ the constructor.
+ */
+class OnsetDetector
+	{
+	public:
+		struct Onset
+		{
+			int64 sampleTime;		// in input samples since the detector started
+			double timeMs;			// the same time on the Time::getMillisecondCounterHiRes() clock
+			float strength;			// roughly how far over the threshold it was (> 1)
+		};
+
+		/** Create a detector. frameSize must be a power of 2 and a multiple of hopSize.
+		 */
+		OnsetDetector (const int frameSize_ = 512, const int hopSize_ = 128)
+			:	frameSize (frameSize_),
+				hopSize (hopSize_),
+				numBins (frameSize_ / 2 + 1),
+				fft (frameSize_),
+				re (frameSize_),
+				im (frameSize_),
+				onsets (64),
+				sampleRate (44100.0),
+				sensitivity (1.5f),
+				minimumFlux (1.0f),
+				enabled (false)
+		{
+			history = new float [frameSize];
+			window = new float [frameSize];
+			previousMagnitudes = new float [numBins];
+			recentFlux = new float [numRecentFlux];
+
+			for (int i = 0; i < frameSize; i++)
+				window[i] = (float) (0.5 - 0.5 * cos (2.0 * double_Pi * i / frameSize));
+
+			reset();
+		}
+
+		~OnsetDetector()
+		{
+			delete[] history;
+			delete[] window;
+			delete[] previousMagnitudes;
+			delete[] recentFlux;
+		}
+
+		//==============================================================================
+		/** Forget everything and start counting samples from 0 again.
+
+		 Only call this when the audio isn't running.
+		 */
+		void reset()
+		{
+			zeromem (history, frameSize * sizeof (float));
+			zeromem (previousMagnitudes, numBins * sizeof (float));
+			zeromem (recentFlux, numRecentFlux * sizeof (float));
+
+			samplesSinceHop = 0;
+			totalSamples = 0;
+			recentFluxIndex = 0;
+			recentFluxSum = 0.0f;
+			lastFlux = previousFlux = 0.0f;
+			lastOnsetTime = -1000000;
+			blockEndSample = 0;
+			blockEndMs = 0.0;
+		}
+
+		void setSampleRate (const double newSampleRate) throw()		{ sampleRate = newSampleRate; }
+
+		/** Turn detection on or off (the input is ignored when it's off).
+		 */
+		void setEnabled (const bool shouldBeEnabled) throw()		{ enabled = shouldBeEnabled; }
+		bool isEnabled() const throw()								{ return enabled; }
+
+		/** How far above the recent average the flux must go, e.g. 1.5 = 50% above.
+		 */
+		void setSensitivity (const float newSensitivity) throw()	{ sensitivity = newSensitivity; }
+
+		/** The latency of detection in samples: an onset can only be reported one hop
+		 after the frame it peaks in, which itself ends up to a hop after the sound.
+		 */
+		int getLatencySamples() const throw()						{ return hopSize * 2; }
+
+		//==============================================================================
+		/** Feed in a block of input from the audio callback.
+
+		 blockEndTimeMs is Time::getMillisecondCounterHiRes() at the time the last
+		 sample of the block arrived (near enough, the start of the callback), which
+		 is used to put the onsets on the same clock as the rest of the app.
+		 */
+		void processBlock (const float* input, int numSamples, const double blockEndTimeMs) throw()
+		{
+			blockEndSample = totalSamples + numSamples;
+			blockEndMs = blockEndTimeMs;
+
+			if (input == 0 || ! enabled)
+			{
+				totalSamples += numSamples;
+				return;
+			}
+
+			while (numSamples > 0)
+			{
+				const int num = jmin (numSamples, hopSize - samplesSinceHop);
+
+				// slide the new samples in at the end of the frame
+				memmove (history, history + num, (frameSize - num) * sizeof (float));
+				memcpy (history + frameSize - num, input, num * sizeof (float));
+
+				input += num;
+				numSamples -= num;
+				samplesSinceHop += num;
+				totalSamples += num;
+
+				if (samplesSinceHop == hopSize)
+				{
+					samplesSinceHop = 0;
+					analyseFrame();
+				}
+			}
+		}
+
+		/** Take the next detected onset, returning false if there isn't one.
+
+		 Only one thread should call this.
+		 */
+		bool getNextOnset (Onset& onset) throw()
+		{
+			return onsets.pop (onset);
+		}
+
+		/** The number of input samples seen so far.
+		 */
+		int64 getTotalSamples() const throw()						{ return totalSamples; }
+
+	private:
+		//==============================================================================
+		enum { numRecentFlux = 32 };
+
+		const int frameSize, hopSize, numBins;
+		SimpleFFT fft;
+		AlignedFloatBuffer re, im;
+		LockFreeFifo<Onset> onsets;
+
+		float* history;
+		float* window;
+		float* previousMagnitudes;
+		float* recentFlux;
+		int recentFluxIndex;
+		float recentFluxSum;
+		float lastFlux, previousFlux;
+
+		int samplesSinceHop;
+		int64 totalSamples;
+		int64 blockEndSample;
+		double blockEndMs;
+		int64 lastOnsetTime;
+
+		double sampleRate;
+		volatile float sensitivity;
+		float minimumFlux;
+		volatile bool enabled;
+
+		void analyseFrame() throw()
+		{
+			float* const r = re.getData();
+			float* const i = im.getData();
+
+			for (int n = 0; n < frameSize; n++)
+			{
+				r[n] = history[n] * window[n];
+				i[n] = 0.0f;
+			}
+
+			fft.perform (r, i, false);
+
+			// half-wave rectified difference of log magnitudes
+			float flux = 0.0f;
+
+			for (int bin = 0; bin < numBins; bin++)
+			{
+				const float magnitude = logf (1.0f + 100.0f * sqrtf (r[bin] * r[bin] + i[bin] * i[bin]));
+				const float increase = magnitude - previousMagnitudes [bin];
+
+				if (increase > 0.0f)
+					flux += increase;
+
+				previousMagnitudes [bin] = magnitude;
+			}
+
+			// the frame before this one is an onset if it's a local peak above the threshold
+			const float average = recentFluxSum / numRecentFlux;
+			const float threshold = jmax (minimumFlux, average * sensitivity);
+
+			if (lastFlux > threshold && lastFlux >= previousFlux && lastFlux > flux)
+			{
+				const int64 onsetTime = findOnsetSample();
+
+				// ignore anything within 50ms of the last one
+				if (onsetTime - lastOnsetTime > (int64) (sampleRate * 0.05))
+				{
+					Onset onset;
+					onset.sampleTime = onsetTime;
+					onset.timeMs = blockEndMs - (blockEndSample - onsetTime) * 1000.0 / sampleRate;
+					onset.strength = lastFlux / threshold;
+
+					onsets.push (onset);
+					lastOnsetTime = onsetTime;
+				}
+			}
+
+			previousFlux = lastFlux;
+			lastFlux = flux;
+
+			recentFluxSum += flux - recentFlux [recentFluxIndex];
+			recentFlux [recentFluxIndex] = flux;
+			recentFluxIndex = (recentFluxIndex + 1) % numRecentFlux;
+		}
+
+		/** Find the sample where the sound started within the last frame's newest two hops.
+		 */
+		int64 findOnsetSample() const throw()
+		{
+			// the last frame ended one hop before the end of the history
+			const int end = frameSize - hopSize;
+			const int start = jmax (hopSize, end - hopSize * 2);
+
+			float before = 0.0f;
+			for (int n = start - hopSize; n < start; n++)
+				before = jmax (before, fabsf (history[n]));
+
+			float peak = 0.0f;
+			for (int n = start; n < end; n++)
+				peak = jmax (peak, fabsf (history[n]));
+
+			// the first sample that gets halfway from the old level to the new peak
+			const float level = before + 0.5f * (peak - before);
+			int onsetIndex = start;
+
+			for (int n = start; n < end; n++)
+			{
+				if (fabsf (history[n]) >= level)
+				{
+					onsetIndex = n;
+					break;
+				}
+			}
+
+			return totalSamples - frameSize + onsetIndex;
+		}
+
+		OnsetDetector (const OnsetDetector&);
+		const OnsetDetector& operator= (const OnsetDetector&);
+	};
+
+#endif//_ONSETDETECTOR_H_
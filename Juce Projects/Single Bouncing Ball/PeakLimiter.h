@@ -0,0 +1,370 @@
+/*
+ *  PeakLimiter.h
+ *  BouncingBallAudio
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _PEAKLIMITER_H_
+#define _PEAKLIMITER_H_
+
+#include <juce/juce.h>
+#include "AlignedFloatBuffer.h"
+
+// the longest lookahead allowed, which sets the size of the buffers
+#define MAX_LIMITER_LOOKAHEAD_MS 20.0
+
+//==============================================================================
+/**
+ A lookahead brickwall limiter for the master bus.
+
+ This wraps another AudioSource. The output is delayed by (lookahead - 1)
+ samples so the gain can start coming down before a peak arrives:
+
+ - the peak over the next 'lookahead' samples comes from a van Herk/Gil-Werman
+   sliding maximum, which costs the same few operations per sample whatever the
+   signal is doing;
+ - the gain needed for that peak falls instantly and recovers at the release rate;
+ - a moving average over the lookahead window smooths the gain, and because
+   every value in the window is at or below the gain needed for the peak at the
+   end of it, the smoothed gain is too, so nothing gets past the ceiling.
+
+ The channels are linked so the stereo image doesn't move. Finding the peaks and
+ applying the gain are done with SSE. All the work happens in fixed-size chunks,
+ so the CPU cost of a block only depends on its length.
+ */
+class PeakLimiter : public AudioSource
+	{
+	public:
+		/** Create a limiter which processes the output of another source.
+		 */
+		PeakLimiter (AudioSource* const input_, const bool deleteInputWhenDeleted_)
+			:	input (input_),
+				deleteInputWhenDeleted (deleteInputWhenDeleted_),
+				lookaheadMs (2.0),
+				releaseMs (80.0),
+				ceiling (0.966f),	// -0.3dB
+				sampleRate (44100.0),
+				maxWindowSize (0),
+				windowSize (0),
+				requestedWindowSize (1),
+				releaseCoeff (0.0f),
+				currentGain (1.0f),
+				peakInput (chunkSize),
+				gains (chunkSize),
+				currentSegment (0),
+				suffixMax (0),
+				gainHistory (0),
+				delayLeft (0),
+				delayRight (0)
+		{
+		}
+
+		~PeakLimiter()
+		{
+			deleteBuffers();
+
+			if (deleteInputWhenDeleted)
+				delete input;
+		}
+
+		//==============================================================================
+		/** Change how far ahead the limiter looks, which is also (roughly) its latency.
+
+		 This can be called while playing, but the limiter will be reset with a
+		 short glitch.
+		 */
+		void setLookaheadMs (const double newLookaheadMs)
+		{
+			lookaheadMs = jlimit (0.1, MAX_LIMITER_LOOKAHEAD_MS, newLookaheadMs);
+			requestedWindowSize = calculateWindowSize (sampleRate);
+		}
+
+		double getLookaheadMs() const throw()			{ return lookaheadMs; }
+
+		/** Set the time taken for the gain to recover after a peak.
+		 */
+		void setReleaseMs (const double newReleaseMs)
+		{
+			releaseMs = jmax (1.0, newReleaseMs);
+			releaseCoeff = (float) (1.0 - exp (-1.0 / (releaseMs * 0.001 * sampleRate)));
+		}
+
+		/** Set the level the output will never go over (as a linear gain).
+		 */
+		void setCeiling (const float newCeiling) throw()	{ ceiling = jlimit (0.001f, 1.0f, newCeiling); }
+
+		/** The number of samples by which the output lags the input.
+		 */
+		int getLatencySamples() const throw()			{ return jmax (0, requestedWindowSize - 1); }
+
+		/** The gain currently being applied, for metering.
+		 */
+		float getCurrentGain() const throw()			{ return currentGain; }
+
+		//==============================================================================
+		void prepareToPlay (int samplesPerBlockExpected, double newSampleRate)
+		{
+			if (input != 0)
+				input->prepareToPlay (samplesPerBlockExpected, newSampleRate);
+
+			sampleRate = newSampleRate;
+
+			// allocate for the longest lookahead so it can be changed without allocating later
+			deleteBuffers();
+			maxWindowSize = (int) (MAX_LIMITER_LOOKAHEAD_MS * 0.001 * sampleRate) + 1;
+
+			currentSegment = new float [maxWindowSize];
+			suffixMax = new float [maxWindowSize + 1];
+			gainHistory = new float [maxWindowSize];
+			delayLeft = new AlignedFloatBuffer (maxWindowSize + chunkSize);
+			delayRight = new AlignedFloatBuffer (maxWindowSize + chunkSize);
+
+			setReleaseMs (releaseMs);
+			requestedWindowSize = calculateWindowSize (sampleRate);
+			reset (requestedWindowSize);
+		}
+
+		void releaseResources()
+		{
+			if (input != 0)
+				input->releaseResources();
+		}
+
+		void getNextAudioBlock (const AudioSourceChannelInfo& info)
+		{
+			if (input != 0)
+				input->getNextAudioBlock (info);
+			else
+				info.clearActiveBufferRegion();
+
+			const int numChannels = jmin (2, info.buffer->getNumChannels());
+
+			if (numChannels == 0 || maxWindowSize == 0)
+				return;
+
+			if (requestedWindowSize != windowSize)
+				reset (requestedWindowSize);
+
+			float* const left = info.buffer->getSampleData (0, info.startSample);
+			float* const right = numChannels > 1 ? info.buffer->getSampleData (1, info.startSample) : 0;
+
+			for (int done = 0; done < info.numSamples; done += chunkSize)
+				processChunk (left + done,
+							  right != 0 ? right + done : 0,
+							  jmin ((int) chunkSize, info.numSamples - done));
+		}
+
+	private:
+		//==============================================================================
+		enum { chunkSize = 256 };
+
+		AudioSource* const input;
+		const bool deleteInputWhenDeleted;
+
+		double lookaheadMs, releaseMs;
+		volatile float ceiling;
+		double sampleRate;
+		int maxWindowSize, windowSize;
+		volatile int requestedWindowSize;
+		float releaseCoeff;
+		volatile float currentGain;
+
+		// per-chunk scratch space
+		AlignedFloatBuffer peakInput, gains;
+
+		// sliding maximum state
+		float* currentSegment;
+		float* suffixMax;
+		int segmentPosition;
+		float prefixMax;
+
+		// release and smoothing state
+		float releasedGain;
+		float* gainHistory;
+		int gainHistoryPosition;
+		double gainSum;
+
+		// the delay line, which holds (windowSize - 1) samples of history followed by the current chunk
+		AlignedFloatBuffer* delayLeft;
+		AlignedFloatBuffer* delayRight;
+
+		//==============================================================================
+		int calculateWindowSize (const double rate) const throw()
+		{
+			const int size = jmax (1, (int) (lookaheadMs * 0.001 * rate));
+			return maxWindowSize > 0 ? jmin (size, maxWindowSize) : size;
+		}
+
+		void reset (const int newWindowSize)
+		{
+			windowSize = newWindowSize;
+
+			for (int i = 0; i < windowSize; i++)
+			{
+				currentSegment[i] = 0.0f;
+				suffixMax[i] = 0.0f;
+				gainHistory[i] = 1.0f;
+			}
+
+			suffixMax [windowSize] = 0.0f;
+			segmentPosition = 0;
+			prefixMax = 0.0f;
+
+			releasedGain = 1.0f;
+			gainHistoryPosition = 0;
+			gainSum = windowSize;
+			currentGain = 1.0f;
+
+			delayLeft->clear();
+			delayRight->clear();
+		}
+
+		void deleteBuffers()
+		{
+			delete[] currentSegment;
+			delete[] suffixMax;
+			delete[] gainHistory;
+			deleteAndZero (delayLeft);
+			deleteAndZero (delayRight);
+
+			currentSegment = 0;
+			suffixMax = 0;
+			gainHistory = 0;
+			maxWindowSize = 0;
+		}
+
+		void processChunk (float* const left, float* const right, const int numSamples)
+		{
+			findPeaks (left, right, numSamples);
+			calculateGains (numSamples);
+
+			applyGain (*delayLeft, left, numSamples);
+
+			if (right != 0)
+				applyGain (*delayRight, right, numSamples);
+		}
+
+		/** peakInput[i] = max (|left[i]|, |right[i]|)
+		 */
+		void findPeaks (const float* const left, const float* const right, const int numSamples) throw()
+		{
+			float* const peaks = peakInput.getData();
+			int i = 0;
+
+#if BOUNCINGBALL_USE_SSE
+			const __m128 signMask = _mm_set1_ps (-0.0f);
+
+			for (; i < numSamples - 3; i += 4)
+			{
+				__m128 p = _mm_andnot_ps (signMask, _mm_loadu_ps (left + i));
+
+				if (right != 0)
+					p = _mm_max_ps (p, _mm_andnot_ps (signMask, _mm_loadu_ps (right + i)));
+
+				_mm_store_ps (peaks + i, p);
+			}
+#endif
+
+			for (; i < numSamples; i++)
+				peaks[i] = right != 0 ? jmax (fabsf (left[i]), fabsf (right[i])) : fabsf (left[i]);
+		}
+
+		/** Turn the chunk's peaks into the gains to apply to the delayed signal.
+		 */
+		void calculateGains (const int numSamples) throw()
+		{
+			const float* const peaks = peakInput.getData();
+			float* const g = gains.getData();
+			const float limit = ceiling;
+			const float windowScale = 1.0f / windowSize;
+
+			for (int i = 0; i < numSamples; i++)
+			{
+				// sliding maximum: the tail of the last segment plus the start of this one
+				const float v = peaks[i];
+				prefixMax = segmentPosition == 0 ? v : jmax (prefixMax, v);
+				currentSegment [segmentPosition] = v;
+
+				const float peak = jmax (prefixMax, suffixMax [segmentPosition + 1]);
+
+				if (++segmentPosition == windowSize)
+				{
+					// this segment becomes the previous one
+					float m = 0.0f;
+
+					for (int j = windowSize; --j >= 0;)
+					{
+						m = jmax (m, currentSegment[j]);
+						suffixMax[j] = m;
+					}
+
+					segmentPosition = 0;
+				}
+
+				// the gain we need for that peak, dropping instantly and recovering slowly
+				const float target = peak > limit ? limit / peak : 1.0f;
+
+				if (target < releasedGain)
+					releasedGain = target;
+				else
+					releasedGain += (target - releasedGain) * releaseCoeff;
+
+				// moving average over the window
+				gainSum += releasedGain - gainHistory [gainHistoryPosition];
+				gainHistory [gainHistoryPosition] = releasedGain;
+
+				if (++gainHistoryPosition == windowSize)
+				{
+					gainHistoryPosition = 0;
+
+					// stop rounding errors in the running sum building up
+					gainSum = 0.0;
+
+					for (int j = 0; j < windowSize; j++)
+						gainSum += gainHistory[j];
+				}
+
+				g[i] = (float) gainSum * windowScale;
+			}
+
+			currentGain = g [numSamples - 1];
+		}
+
+		/** Push a chunk through the delay line, replacing it with the delayed and limited signal.
+		 */
+		void applyGain (AlignedFloatBuffer& delay, float* const samples, const int numSamples) throw()
+		{
+			float* const d = delay.getData();
+			const float* const g = gains.getData();
+			const int delaySamples = windowSize - 1;
+			const float limit = ceiling;
+
+			memcpy (d + delaySamples, samples, numSamples * sizeof (float));
+
+			int i = 0;
+
+#if BOUNCINGBALL_USE_SSE
+			const __m128 upper = _mm_set1_ps (limit);
+			const __m128 lower = _mm_set1_ps (-limit);
+
+			for (; i < numSamples - 3; i += 4)
+			{
+				// (the final clamp only catches rounding errors in the smoothed gain)
+				const __m128 out = _mm_mul_ps (_mm_loadu_ps (d + i), _mm_load_ps (g + i));
+				_mm_storeu_ps (samples + i, _mm_max_ps (lower, _mm_min_ps (upper, out)));
+			}
+#endif
+
+			for (; i < numSamples; i++)
+				samples[i] = jlimit (-limit, limit, d[i] * g[i]);
+
+			memmove (d, d + numSamples, delaySamples * sizeof (float));
+		}
+
+		PeakLimiter (const PeakLimiter&);
+		const PeakLimiter& operator= (const PeakLimiter&);
+	};
+
+#endif//_PEAKLIMITER_H_
@@ -0,0 +1,126 @@
+/*
+ *  SimpleFFT.h
+ *  BouncingBallAudio
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _SIMPLEFFT_H_
+#define _SIMPLEFFT_H_
+
+#include <juce/juce.h>
+#include "AlignedFloatBuffer.h"
+
+/**
+ A basic radix-2 complex FFT.
+
+ The real and imaginary parts are kept in separate arrays, which is the layout
+ that makes multiplying spectra together easy to vectorise. The tables are
+ built in the constructor, so perform() never allocates.
+ */
+class SimpleFFT
+	{
+	public:
+		/** Create an FFT for the given size, which must be a power of 2.
+		 */
+		SimpleFFT (const int size_)
+			:	size (size_)
+		{
+			jassert (size >= 2 && (size & (size - 1)) == 0);
+
+			bitReversed = new int [size];
+			cosTable = new float [size / 2];
+			sinTable = new float [size / 2];
+
+			int numBits = 0;
+			while ((1 << numBits) < size)
+				numBits++;
+
+			for (int i = 0; i < size; i++)
+			{
+				int r = 0;
+
+				for (int b = 0; b < numBits; b++)
+					if (i & (1 << b))
+						r |= 1 << (numBits - 1 - b);
+
+				bitReversed[i] = r;
+			}
+
+			for (int i = 0; i < size / 2; i++)
+			{
+				const double angle = -2.0 * double_Pi * i / size;
+				cosTable[i] = (float) cos (angle);
+				sinTable[i] = (float) sin (angle);
+			}
+		}
+
+		~SimpleFFT()
+		{
+			delete[] bitReversed;
+			delete[] cosTable;
+			delete[] sinTable;
+		}
+
+		int getSize() const throw()				{ return size; }
+
+		/** Transform the data in place.
+
+		 The inverse transform is not scaled, so a forward and inverse transform
+		 will leave the data multiplied by getSize().
+		 */
+		void perform (float* const re, float* const im, const bool inverse) const throw()
+		{
+			int i;
+
+			for (i = 0; i < size; i++)
+			{
+				const int j = bitReversed[i];
+
+				if (j > i)
+				{
+					const float tr = re[i];	re[i] = re[j];	re[j] = tr;
+					const float ti = im[i];	im[i] = im[j];	im[j] = ti;
+				}
+			}
+
+			const float sign = inverse ? -1.0f : 1.0f;
+
+			for (int half = 1; half < size; half <<= 1)
+			{
+				const int tableStep = size / (half << 1);
+
+				for (int start = 0; start < size; start += half << 1)
+				{
+					for (int k = 0; k < half; k++)
+					{
+						const float wr = cosTable [k * tableStep];
+						const float wi = sign * sinTable [k * tableStep];
+
+						const int a = start + k;
+						const int b = a + half;
+
+						const float tr = re[b] * wr - im[b] * wi;
+						const float ti = re[b] * wi + im[b] * wr;
+
+						re[b] = re[a] - tr;
+						im[b] = im[a] - ti;
+						re[a] += tr;
+						im[a] += ti;
+					}
+				}
+			}
+		}
+
+	private:
+		const int size;
+		int* bitReversed;
+		float* cosTable;
+		float* sinTable;
+
+		SimpleFFT (const SimpleFFT&);
+		const SimpleFFT& operator= (const SimpleFFT&);
+	};
+
+#endif//_SIMPLEFFT_H_
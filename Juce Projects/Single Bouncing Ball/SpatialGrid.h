@@ -0,0 +1,176 @@
+/*
+ *  SpatialGrid.h
+ *  BouncingBallAudio
+ *
+ *  Copyright 2008 UWE. All rights reserved.
+ *
+ */
+
+#ifndef _SPATIALGRID_H_
+#define _SPATIALGRID_H_
+
+#include <juce/juce.h>
+
+/**
+ A uniform grid of buckets used to find balls by position.
+
+ Each item lives in exactly one cell (the one containing its centre) and the
+ cells are intrusive doubly linked lists threaded through preallocated arrays,
+ so inserting, removing or moving an item is O(1) and never allocates. As long
+ as the cell size is at least the largest item diameter, anything touching a
+ point can only be in that point's cell or one of its 8 neighbours, which makes
+ point queries O(1) regardless of how many items there are.
+
+ The same grid is used for mouse hit-testing and for the collision broadphase.
+ */
+class SpatialGrid
+	{
+	public:
+
+		/** Create a grid that can hold item ids from 0 to (maxItems - 1).
+		 */
+		SpatialGrid (const int maxItems_)
+			:	maxItems (maxItems_),
+				cellSize (1.0f),
+				numCellsX (0),
+				numCellsY (0),
+				cellHeads (0)
+		{
+			next = new int [maxItems];
+			prev = new int [maxItems];
+			itemCell = new int [maxItems];
+
+			for (int i = 0; i < maxItems; i++)
+				itemCell[i] = -1;
+		}
+
+		~SpatialGrid()
+		{
+			delete[] next;
+			delete[] prev;
+			delete[] itemCell;
+			delete[] cellHeads;
+		}
+
+		/** Change the area covered by the grid.
+
+		 This drops all the items, so the caller needs to insert them again.
+		 */
+		void setSize (const float width, const float height, const float newCellSize)
+		{
+			cellSize = jmax (1.0f, newCellSize);
+			numCellsX = jmax (1, (int) (width / cellSize) + 1);
+			numCellsY = jmax (1, (int) (height / cellSize) + 1);
+
+			delete[] cellHeads;
+			cellHeads = new int [numCellsX * numCellsY];
+
+			for (int i = numCellsX * numCellsY; --i >= 0;)
+				cellHeads[i] = -1;
+
+			for (int i = 0; i < maxItems; i++)
+				itemCell[i] = -1;
+		}
+
+		float getCellSize() const throw()		{ return cellSize; }
+
+		/** Add an item or move it to the cell containing (x, y).
+
+		 This does nothing if the item is already in the right cell, which is the
+		 usual case from one physics step to the next.
+		 */
+		void update (const int item, const float x, const float y) throw()
+		{
+			jassert (item >= 0 && item < maxItems);
+
+			const int cell = getCellIndex (x, y);
+
+			if (cell == itemCell[item])
+				return;
+
+			unlink (item);
+
+			prev[item] = -1;
+			next[item] = cellHeads[cell];
+
+			if (next[item] >= 0)
+				prev[next[item]] = item;
+
+			cellHeads[cell] = item;
+			itemCell[item] = cell;
+		}
+
+		/** Take an item out of the grid.
+		 */
+		void remove (const int item) throw()
+		{
+			jassert (item >= 0 && item < maxItems);
+			unlink (item);
+		}
+
+		/** Call back visitor.visit (item) for every item in the 3x3 block of cells
+		 around (x, y), stopping early if visit() returns false.
+
+		 Anything whose centre is within one cell size of the point is guaranteed
+		 to be visited.
+		 */
+		template <class VisitorType>
+		void visitNeighbours (const float x, const float y, VisitorType& visitor) const
+		{
+			const int cx = jlimit (0, numCellsX - 1, (int) (x / cellSize));
+			const int cy = jlimit (0, numCellsY - 1, (int) (y / cellSize));
+
+			for (int j = jmax (0, cy - 1); j <= jmin (numCellsY - 1, cy + 1); j++)
+			{
+				for (int i = jmax (0, cx - 1); i <= jmin (numCellsX - 1, cx + 1); i++)
+				{
+					for (int item = cellHeads[j * numCellsX + i]; item >= 0; item = next[item])
+					{
+						if (! visitor.visit (item))
+							return;
+					}
+				}
+			}
+		}
+
+	private:
+		const int maxItems;
+		float cellSize;
+		int numCellsX, numCellsY;
+		int* cellHeads;
+		int* next;
+		int* prev;
+		int* itemCell;
+
+		int getCellIndex (const float x, const float y) const throw()
+		{
+			// items that stray outside the window are kept in the edge cells
+			const int cx = jlimit (0, numCellsX - 1, (int) (x / cellSize));
+			const int cy = jlimit (0, numCellsY - 1, (int) (y / cellSize));
+
+			return cy * numCellsX + cx;
+		}
+
+		void unlink (const int item) throw()
+		{
+			const int cell = itemCell[item];
+
+			if (cell < 0)
+				return;
+
+			if (prev[item] >= 0)
+				next[prev[item]] = next[item];
+			else
+				cellHeads[cell] = next[item];
+
+			if (next[item] >= 0)
+				prev[next[item]] = prev[item];
+
+			itemCell[item] = -1;
+		}
+
+		SpatialGrid (const SpatialGrid&);
+		const SpatialGrid& operator= (const SpatialGrid&);
+	};
+
+#endif//_SPATIALGRID_H_